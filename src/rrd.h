@@ -116,6 +116,7 @@ extern    "C" {
         int       mm_prot;
         int       mm_flags;
 #endif
+        struct rrd_member_t *member;    /* set for members of a container */
     } rrd_simple_file_t;
 
 /* rrd info interface */
@@ -146,6 +147,29 @@ extern    "C" {
         struct rrd_info_t *next;
     } rrd_info_t;
 
+/* read-only view on the rows of a fetch, see rrd_fetch_view_r() */
+    typedef struct rrd_fetch_view_t {
+        unsigned long ds_cnt;   /* number of data sources */
+        char    **ds_namv;  /* names of the data sources */
+        unsigned long pad_before;   /* unknown rows in front of seg[0] */
+        const rrd_value_t *seg[2];  /* DS d of row r is at seg[k][r *
+                                     * row_stride + d * ds_stride], seg[1]
+                                     * continues seg[0] */
+        unsigned long seg_rows[2];  /* number of rows in each segment */
+        unsigned long row_stride;   /* distance between rows and */
+        unsigned long ds_stride;    /* data sources in the segments */
+        unsigned long pad_after;    /* unknown rows behind seg[1] */
+        void      (*release) (struct rrd_fetch_view_t *view);
+        void     *pvt;
+    } rrd_fetch_view_t;
+
+/* rows of a fetch handed out a chunk at a time, see rrd_fetch_cursor_r() */
+    typedef struct rrd_fetch_cursor_t rrd_fetch_cursor_t;
+
+/* fonts and text measurements kept from graph to graph, see
+ * rrd_graph_context_use() */
+    typedef struct rrd_graph_context_t rrd_graph_context_t;
+
     typedef size_t (
     *rrd_output_callback_t) (
     const void *,
@@ -192,6 +216,29 @@ extern    "C" {
     rrd_info_t *rrd_graph_v(
     int,
     const char **);
+    int       rrd_graph_cache_set(
+    unsigned long);
+    rrd_info_t *rrd_graph_cache_info(
+    void);
+    rrd_graph_context_t *rrd_graph_context_new(
+    void);
+    void      rrd_graph_context_free(
+    rrd_graph_context_t *ctx);
+    rrd_graph_context_t *rrd_graph_context_use(
+    rrd_graph_context_t *ctx);
+/* one graph for rrd_graph_many(), argv as for rrd_graph_v */
+    typedef struct rrd_graph_job_t {
+        int       argc;
+        const char **argv;
+        rrd_info_t *info;   /* what rrd_graph_v would have returned */
+        char     *error;    /* its error message if info is NULL, else
+                             * NULL; free it with rrd_freemem() */
+    } rrd_graph_job_t;
+
+    int       rrd_graph_many(
+    rrd_graph_job_t *jobs,
+    unsigned long job_cnt,
+    int threads);
 
     int       rrd_fetch(
     int,
@@ -202,6 +249,14 @@ extern    "C" {
     unsigned long *,
     char ***,
     rrd_value_t **);
+    rrd_fetch_cursor_t *rrd_fetch_cursor(
+    int,
+    const char **,
+    time_t *,
+    time_t *,
+    unsigned long *,
+    unsigned long *,
+    char ***);
     int       rrd_restore(
     int,
     const char **);
@@ -223,6 +278,9 @@ extern    "C" {
     int       rrd_resize(
     int,
     const char **);
+    int       rrd_convert(
+    int,
+    const char **);
     char     *rrd_strversion(
     void);
     double    rrd_version(
@@ -261,6 +319,22 @@ extern    "C" {
     const char *_template,
     int argc,
     const char **argv);
+/* data area layouts for rrd_create_r3 */
+#define RRD_LAYOUT_ROW    0 /* one row holds all DS, the classic format */
+#define RRD_LAYOUT_COLUMN 1 /* one ring per DS and RRA */
+#define RRD_LAYOUT_COMPRESSED 2 /* rings cut into compressed blocks */
+/* or'ed into the layout: leave the data area unwritten, as a sparse file */
+#define RRD_CREATE_SPARSE 0x100
+    int       rrd_create_r3(
+    const char *filename,
+    unsigned long pdp_step,
+    time_t last_up,
+    int no_overwrite,
+    int layout,
+    const char **sources,
+    const char *_template,
+    int argc,
+    const char **argv);
     rrd_info_t *rrd_info_r(
     const char *);
 /* NOTE: rrd_update_r and rrd_update_v_r are only thread-safe if no at-style
@@ -308,6 +382,35 @@ extern    "C" {
     int argc,
     const char **argv,
     rrd_info_t *pcdp_summary);
+    int       rrd_update_bulk_r(
+    const char *filename,
+    const char *_template,
+    int extra_flags,
+    unsigned long sample_cnt,
+    const time_t *stamps,
+    const rrd_value_t *const *values);
+/* one file to update, see rrd_update_many() */
+    typedef struct rrd_update_job_t {
+        const char *filename;
+        const char *tmplt;  /* as for rrd_update_r, may be NULL */
+        int       argc;
+        const char **argv;  /* time:value:value:... */
+    } rrd_update_job_t;
+
+/* what became of a job given to rrd_update_many() */
+    typedef struct rrd_update_status_t {
+        int       rc;       /* what rrd_updatex_r returned */
+        char     *error;    /* its error message if rc != 0, else NULL;
+                             * free it with rrd_freemem() */
+    } rrd_update_status_t;
+
+    int       rrd_update_many(
+    const rrd_update_job_t *jobs,
+    unsigned long job_cnt,
+    int threads,
+    int io_concurrency,
+    int extra_flags,
+    rrd_update_status_t *status);
     int       rrd_fetch_r(
     const char *filename,
     const char *cf,
@@ -317,6 +420,74 @@ extern    "C" {
     unsigned long *ds_cnt,
     char ***ds_namv,
     rrd_value_t **data);
+/* how rrd_fetch_select_r brings a fetch down to max_rows rows */
+#define RRD_REDUCE_CF     0 /* consolidate with the CF of the fetch */
+#define RRD_REDUCE_MINMAX 1 /* keep the min and max of every bucket */
+#define RRD_REDUCE_LTTB   2 /* largest triangle three buckets */
+    int       rrd_fetch_select_r(
+    const char *filename,
+    const char *cf,
+    time_t *start,
+    time_t *end,
+    unsigned long *step,
+    unsigned long want_cnt,
+    const char *const *want,
+    unsigned long max_rows,
+    int reduce,
+    unsigned long *ds_cnt,
+    char ***ds_namv,
+    rrd_value_t **data);
+/* one fetch for rrd_fetch_many(), the fields up to reduce are what
+ * rrd_fetch_select_r is passed, start, end and step are changed like
+ * there; leave want_cnt and max_rows 0 to fetch like rrd_fetch_r */
+    typedef struct rrd_fetch_job_t {
+        const char *filename;
+        const char *cf;
+        time_t    start;
+        time_t    end;
+        unsigned long step;
+        unsigned long want_cnt;
+        const char *const *want;
+        unsigned long max_rows;
+        int       reduce;
+        unsigned long ds_cnt;   /* results as from rrd_fetch_r */
+        char    **ds_namv;
+        rrd_value_t *data;
+        int       rc;       /* what the fetch returned */
+        char     *error;    /* its error message if rc != 0, else NULL;
+                             * free it with rrd_freemem() */
+    } rrd_fetch_job_t;
+
+    int       rrd_fetch_many(
+    rrd_fetch_job_t *jobs,
+    unsigned long job_cnt,
+    int threads,
+    int io_concurrency);
+    int       rrd_fetch_view_r(
+    const char *filename,
+    const char *cf,
+    time_t *start,
+    time_t *end,
+    unsigned long *step,
+    rrd_fetch_view_t *view);
+/* flags of rrd_fetch_cursor_r() */
+#define RRD_FETCH_REVERSE 1 /* hand out the newest rows first */
+    rrd_fetch_cursor_t *rrd_fetch_cursor_r(
+    const char *filename,
+    const char *cf,
+    time_t *start,
+    time_t *end,
+    unsigned long *step,
+    int flags,
+    unsigned long *ds_cnt,
+    char ***ds_namv);
+    long      rrd_fetch_cursor_next(
+    rrd_fetch_cursor_t *cursor,
+    unsigned long max_rows,
+    time_t *first,
+    rrd_value_t *data);
+    void      rrd_fetch_cursor_close(
+    rrd_fetch_cursor_t *cursor);
     int       rrd_tune_r(
     const char *filename,
     int argc,
@@ -339,6 +510,9 @@ extern    "C" {
     time_t    rrd_first_r(
     const char *filename,
     const int rraindex);
+    int       rrd_convert_r(
+    const char *filename,
+    const char *target);
 
     int       rrd_dump_cb_r(
     const char *filename,
@@ -370,6 +544,7 @@ extern    "C" {
     typedef struct rrd_context {
         char      lib_errstr[256];
         char      rrd_error[4096];
+        rrd_graph_context_t *graph_ctx; /* used by the graphs of the thread */
     } rrd_context_t;
 
 /* returns the current per-thread rrd_context */
@@ -469,6 +469,9 @@ int main(
         }
     }
 
+    /* the graphs of a page share their fonts */
+    rrd_graph_context_use(rrd_graph_context_new());
+
     if (!filter) {
         rrdcgiDebug(0, 0);
         rrdcgiArg = rrdcgiInit();
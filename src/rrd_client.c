@@ -89,6 +89,9 @@ static rrd_client_t default_client = { -1, NULL, {0}, NULL, 0 };
 
 static mutex_t lock = MUTEX_INITIALIZER;
 
+/* FETCH commands rrd_client_fetch_many sends before it reads the answers */
+#define FETCH_PIPELINE 16
+
 static int reconnect(
     rrd_client_t *client);
 
@@ -1812,49 +1815,31 @@ int rrdc_create_r2(
     return status;
 }                       /* }}} int rrdc_create_r2 */
 
-int rrd_client_fetch(
+/* Put the FETCH command for the arguments of rrd_client_fetch_select into
+ * buffer, which has room for RRD_CMD_MAX bytes. A start or end of 0 is not
+ * sent. */
+static int fetch_request(
     rrd_client_t *client,
     const char *filename,   /* {{{ */
     const char *cf,
-    time_t *ret_start,
-    time_t *ret_end,
-    unsigned long *ret_step,
-    unsigned long *ret_ds_num,
-    char ***ret_ds_names,
-    rrd_value_t **ret_data)
+    time_t start,
+    time_t end,
+    unsigned long want_cnt,
+    const char *const *want,
+    unsigned long max_rows,
+    int reduce,
+    char *buffer,
+    size_t *ret_buffer_size)
 {
-    char      buffer[RRD_CMD_MAX];
     char     *buffer_ptr;
     size_t    buffer_free;
     size_t    buffer_size;
-    rrdc_response_t *res;
     char     *file_path;
-
-    char     *str_tmp;
-    unsigned long flush_version;
-
-    time_t    start;
-    time_t    end;
-    unsigned long step;
-    unsigned long ds_num;
-    char    **ds_names;
-
-    rrd_value_t *data;
-    size_t    data_size;
-    size_t    data_fill;
-
     int       status;
-    size_t    current_line;
-    time_t    t;
-
-    if ((client == NULL) || (filename == NULL) || (cf == NULL))
-        return (-1);
 
-    /* Send request {{{ */
-
-    memset(buffer, 0, sizeof(buffer));
+    memset(buffer, 0, RRD_CMD_MAX);
     buffer_ptr = &buffer[0];
-    buffer_free = sizeof(buffer);
+    buffer_free = RRD_CMD_MAX;
     status = buffer_add_string("FETCH", &buffer_ptr, &buffer_free);
     if (status != 0) {
         return (ENOBUFS);
@@ -1878,18 +1863,18 @@ int rrd_client_fetch(
         return (ENOBUFS);
     }
 
-    if ((ret_start != NULL) && (*ret_start > 0)) {
+    if (start > 0) {
         char      tmp[64];
 
-        snprintf(tmp, sizeof(tmp), "%lu", (unsigned long) *ret_start);
+        snprintf(tmp, sizeof(tmp), "%lu", (unsigned long) start);
         tmp[sizeof(tmp) - 1] = 0;
         status = buffer_add_string(tmp, &buffer_ptr, &buffer_free);
         if (status != 0) {
             return (ENOBUFS);
         }
 
-        if ((ret_end != NULL) && (*ret_end > 0)) {
-            snprintf(tmp, sizeof(tmp), "%lu", (unsigned long) *ret_end);
+        if (end > 0) {
+            snprintf(tmp, sizeof(tmp), "%lu", (unsigned long) end);
             tmp[sizeof(tmp) - 1] = 0;
             status = buffer_add_string(tmp, &buffer_ptr, &buffer_free);
             if (status != 0) {
@@ -1898,29 +1883,76 @@ int rrd_client_fetch(
         }
     }
 
-    assert(buffer_free < sizeof(buffer));
-    buffer_size = sizeof(buffer) - buffer_free;
+    /* the columns and options follow start and end, so those are sent
+     * with the defaults of the daemon if need be */
+    if (want_cnt > 0 || max_rows > 0) {
+        static const char *reductions[] = { "cf", "minmax", "lttb" };
+        char      tmp[64];
+        unsigned long i;
+
+        if (start <= 0)
+            status = buffer_add_string("-86400", &buffer_ptr, &buffer_free);
+        if ((status == 0) && ((start <= 0) || (end <= 0)))
+            status = buffer_add_string("0", &buffer_ptr, &buffer_free);
+        for (i = 0; (status == 0) && (i < want_cnt); i++)
+            status = buffer_add_string(want[i], &buffer_ptr, &buffer_free);
+        if ((status == 0) && (max_rows > 0)) {
+            if ((reduce < RRD_REDUCE_CF) || (reduce > RRD_REDUCE_LTTB)) {
+                rrd_set_error("unknown reduction %d", reduce);
+                return (-1);
+            }
+            snprintf(tmp, sizeof(tmp), "maxrows=%lu", max_rows);
+            status = buffer_add_string(tmp, &buffer_ptr, &buffer_free);
+            if (status == 0) {
+                snprintf(tmp, sizeof(tmp), "reduce=%s", reductions[reduce]);
+                status = buffer_add_string(tmp, &buffer_ptr, &buffer_free);
+            }
+        }
+        if (status != 0) {
+            return (ENOBUFS);
+        }
+    }
+
+    assert(buffer_free < RRD_CMD_MAX);
+    buffer_size = RRD_CMD_MAX - buffer_free;
     assert(buffer[buffer_size - 1] == ' ');
     buffer[buffer_size - 1] = '\n';
+    *ret_buffer_size = buffer_size;
+    return (0);
+}                       /* }}} int fetch_request */
 
-    res = NULL;
-    status = request(client, buffer, buffer_size, &res);
-    if (status != 0) {
-        return (status);
-    }
-    status = res->status;
-    if (status < 0) {
-        response_free(res);
-        return (status);
-    }
+/* Turn the answer to a FETCH into what rrd_fetch_r returns. res is freed
+ * either way. */
+static int fetch_response(
+    rrdc_response_t *res,   /* {{{ */
+    time_t *ret_start,
+    time_t *ret_end,
+    unsigned long *ret_step,
+    unsigned long *ret_ds_num,
+    char ***ret_ds_names,
+    rrd_value_t **ret_data)
+{
+    char     *str_tmp;
+    unsigned long flush_version;
+
+    time_t    start;
+    time_t    end;
+    unsigned long step;
+    unsigned long ds_num;
+    char    **ds_names;
+
+    rrd_value_t *data;
+    size_t    data_size;
+    size_t    data_fill;
 
-    /* }}} Send request */
+    int       status;
+    size_t    current_line;
+    time_t    t;
 
     ds_names = NULL;
     ds_num = 0;
     data = NULL;
     current_line = 0;
-
     /* Macros to make error handling a little easier (i. e. less to type and
      * read. `BAIL_OUT' sets the error message, frees all dynamically allocated
      * variables and returns the provided status code. */
@@ -2038,7 +2070,216 @@ int rrd_client_fetch(
     return (0);
 #undef READ_NUMERIC_FIELD
 #undef BAIL_OUT
-}                       /* }}} int_rrd_client_fetch */
+}                       /* }}} int fetch_response */
+
+/* FETCH with a list of data sources and a row limit, see
+ * rrd_fetch_select_r. A daemon that does not know the row limit is asked
+ * again without it, so the answer may hold more than max_rows rows. */
+int rrd_client_fetch_select(
+    rrd_client_t *client,
+    const char *filename,   /* {{{ */
+    const char *cf,
+    time_t *ret_start,
+    time_t *ret_end,
+    unsigned long *ret_step,
+    unsigned long want_cnt,
+    const char *const *want,
+    unsigned long max_rows,
+    int reduce,
+    unsigned long *ret_ds_num,
+    char ***ret_ds_names,
+    rrd_value_t **ret_data)
+{
+    char      buffer[RRD_CMD_MAX];
+    size_t    buffer_size;
+    rrdc_response_t *res;
+    int       status;
+
+    if ((client == NULL) || (filename == NULL) || (cf == NULL))
+        return (-1);
+
+    status = fetch_request(client, filename, cf,
+                           ret_start != NULL ? *ret_start : 0,
+                           ret_end != NULL ? *ret_end : 0,
+                           want_cnt, want, max_rows, reduce,
+                           buffer, &buffer_size);
+    if (status != 0) {
+        return (status);
+    }
+
+    res = NULL;
+    status = request(client, buffer, buffer_size, &res);
+    if (status != 0) {
+        return (status);
+    }
+    status = res->status;
+    if (status < 0) {
+        response_free(res);
+        if (max_rows > 0)
+            return (rrd_client_fetch_select(client, filename, cf, ret_start,
+                                            ret_end, ret_step, want_cnt,
+                                            want, 0, reduce, ret_ds_num,
+                                            ret_ds_names, ret_data));
+        return (status);
+    }
+
+    return (fetch_response(res, ret_start, ret_end, ret_step, ret_ds_num,
+                           ret_ds_names, ret_data));
+}                       /* }}} int rrd_client_fetch_select */
+
+static void fetch_job_failed(
+    rrd_fetch_job_t *job,   /* {{{ */
+    int status)
+{
+    job->rc = (status != 0) ? status : -1;
+    job->error = strdup(rrd_test_error()? rrd_get_error() : "fetch failed");
+    rrd_clear_error();
+}                       /* }}} void fetch_job_failed */
+
+/* Run the fetches of rrd_fetch_many through the daemon. The FETCH commands
+ * go out FETCH_PIPELINE at a time and only then are the answers read, which
+ * come back in the same order, so a bunch of fetches costs one round trip
+ * instead of one each. */
+int rrd_client_fetch_many(
+    rrd_client_t *client,
+    rrd_fetch_job_t *jobs,  /* {{{ */
+    unsigned long job_cnt)
+{
+    char     *buffer;
+    size_t    buffer_size;
+    size_t    size;
+    rrdc_response_t *res;
+    rrd_fetch_job_t *job;
+    int       sent[FETCH_PIPELINE];
+    unsigned long first, cnt, i, failed = 0;
+    int       connected;
+    int       status;
+
+    for (i = 0; i < job_cnt; i++) {
+        jobs[i].ds_cnt = 0;
+        jobs[i].ds_namv = NULL;
+        jobs[i].data = NULL;
+        jobs[i].rc = -1;
+        jobs[i].error = NULL;
+    }
+    if ((client == NULL) || (job_cnt == 0))
+        return (client == NULL) ? -1 : 0;
+
+    buffer = (char *) malloc(FETCH_PIPELINE * RRD_CMD_MAX);
+    if (buffer == NULL) {
+        rrd_set_error("rrdc_fetch_many: Out of memory");
+        return (-1);
+    }
+
+    for (first = 0; first < job_cnt; first += cnt) {
+        cnt = job_cnt - first;
+        if (cnt > FETCH_PIPELINE)
+            cnt = FETCH_PIPELINE;
+
+        buffer_size = 0;
+        for (i = 0; i < cnt; i++) {
+            job = jobs + first + i;
+            sent[i] = 0;
+            rrd_clear_error();
+            if ((job->filename == NULL) || (job->cf == NULL))
+                status = -1;
+            else
+                status = fetch_request(client, job->filename, job->cf,
+                                       job->start, job->end, job->want_cnt,
+                                       job->want, job->max_rows, job->reduce,
+                                       buffer + buffer_size, &size);
+            if (status != 0) {
+                fetch_job_failed(job, status);
+                continue;
+            }
+            buffer_size += size;
+            sent[i] = 1;
+        }
+        if (buffer_size == 0)
+            continue;
+
+        connected = (client->sd != -1)
+            && (sendall(client, buffer, buffer_size, 1) != -1);
+        if (!connected) {
+            close_connection(client);
+            rrd_set_error("request: socket error while talking to rrdcached");
+        }
+
+        for (i = 0; i < cnt; i++) {
+            if (!sent[i])
+                continue;
+            job = jobs + first + i;
+            res = NULL;
+            if (connected && (response_read(client, &res) != 0)) {
+                connected = 0;
+                rrd_set_error
+                    ("request: internal error while talking to rrdcached");
+            }
+            if (!connected) {
+                fetch_job_failed(job, -1);
+                continue;
+            }
+            status = res->status;
+            if (status < 0) {
+                response_free(res);
+                if (job->max_rows > 0) {
+                    /* asked again without maxrows below */
+                    rrd_clear_error();
+                    sent[i] = 2;
+                } else
+                    fetch_job_failed(job, status);
+                continue;
+            }
+            job->rc = fetch_response(res, &job->start, &job->end, &job->step,
+                                     &job->ds_cnt, &job->ds_namv,
+                                     &job->data);
+            if (job->rc != 0)
+                fetch_job_failed(job, job->rc);
+        }
+
+        /* only now that all answers are in can the connection be used for
+         * the fetches a daemon without maxrows turned down */
+        for (i = 0; i < cnt; i++) {
+            if (sent[i] != 2)
+                continue;
+            job = jobs + first + i;
+            job->rc = rrd_client_fetch_select(client, job->filename, job->cf,
+                                              &job->start, &job->end,
+                                              &job->step, job->want_cnt,
+                                              job->want, 0, job->reduce,
+                                              &job->ds_cnt, &job->ds_namv,
+                                              &job->data);
+            if (job->rc != 0)
+                fetch_job_failed(job, job->rc);
+        }
+    }
+    free(buffer);
+
+    for (i = 0; i < job_cnt; i++)
+        if (jobs[i].rc != 0)
+            failed++;
+    if (failed > 0) {
+        rrd_set_error("%lu of %lu fetches failed", failed, job_cnt);
+        return (-1);
+    }
+    return (0);
+}                       /* }}} int rrd_client_fetch_many */
+
+int rrd_client_fetch(
+    rrd_client_t *client,
+    const char *filename,   /* {{{ */
+    const char *cf,
+    time_t *ret_start,
+    time_t *ret_end,
+    unsigned long *ret_step,
+    unsigned long *ret_ds_num,
+    char ***ret_ds_names,
+    rrd_value_t **ret_data)
+{
+    return (rrd_client_fetch_select(client, filename, cf, ret_start, ret_end,
+                                    ret_step, 0, NULL, 0, RRD_REDUCE_CF,
+                                    ret_ds_num, ret_ds_names, ret_data));
+}                       /* }}} int rrd_client_fetch */
 
 int rrdc_fetch(
     const char *filename,   /* {{{ */
@@ -2060,6 +2301,43 @@ int rrdc_fetch(
     return status;
 }                       /* }}} int rrdc_fetch */
 
+int rrdc_fetch_select(
+    const char *filename,   /* {{{ */
+    const char *cf,
+    time_t *ret_start,
+    time_t *ret_end,
+    unsigned long *ret_step,
+    unsigned long want_cnt,
+    const char *const *want,
+    unsigned long max_rows,
+    int reduce,
+    unsigned long *ret_ds_num,
+    char ***ret_ds_names,
+    rrd_value_t **ret_data)
+{
+    int       status;
+
+    mutex_lock(&lock);
+    status =
+        rrd_client_fetch_select(&default_client, filename, cf, ret_start,
+                                ret_end, ret_step, want_cnt, want, max_rows,
+                                reduce, ret_ds_num, ret_ds_names, ret_data);
+    mutex_unlock(&lock);
+    return status;
+}                       /* }}} int rrdc_fetch_select */
+
+int rrdc_fetch_many(
+    rrd_fetch_job_t *jobs,  /* {{{ */
+    unsigned long job_cnt)
+{
+    int       status;
+
+    mutex_lock(&lock);
+    status = rrd_client_fetch_many(&default_client, jobs, job_cnt);
+    mutex_unlock(&lock);
+    return status;
+}                       /* }}} int rrdc_fetch_many */
+
 int rrd_client_dump(
     rrd_client_t *client,
     const char *filename,   /* {{{ */
@@ -102,6 +102,19 @@ int rrd_client_fetch(rrd_client_t *client, const char *filename,
     unsigned long *ret_ds_num,
     char ***ret_ds_names,
     rrd_value_t **ret_data);
+int rrd_client_fetch_select(rrd_client_t *client, const char *filename,
+    const char *cf,
+    time_t *ret_start, time_t *ret_end,
+    unsigned long *ret_step,
+    unsigned long want_cnt,
+    const char *const *want,
+    unsigned long max_rows,
+    int reduce,
+    unsigned long *ret_ds_num,
+    char ***ret_ds_names,
+    rrd_value_t **ret_data);
+int rrd_client_fetch_many(rrd_client_t *client, rrd_fetch_job_t *jobs,
+    unsigned long job_cnt);
 
 int rrd_client_tune(rrd_client_t *client, const char *filename,
     int argc,
@@ -165,6 +178,18 @@ int rrdc_fetch (const char *filename,
     unsigned long *ret_ds_num,
     char ***ret_ds_names,
     rrd_value_t **ret_data);
+int rrdc_fetch_select (const char *filename,
+    const char *cf,
+    time_t *ret_start, time_t *ret_end,
+    unsigned long *ret_step,
+    unsigned long want_cnt,
+    const char *const *want,
+    unsigned long max_rows,
+    int reduce,
+    unsigned long *ret_ds_num,
+    char ***ret_ds_names,
+    rrd_value_t **ret_data);
+int rrdc_fetch_many (rrd_fetch_job_t *jobs, unsigned long job_cnt);
 
 int rrdc_stats_get (rrdc_stats_t **ret_stats);
 void rrdc_stats_free (rrdc_stats_t *ret_stats);
@@ -0,0 +1,361 @@
+/*****************************************************************************
+ * rrd_compress.c  Blocks of RRD_LAYOUT_COMPRESSED files
+ *****************************************************************************
+ * A sealed block keeps the values of one data source after the other. Each
+ * value is XORed with the one before it (the first one of a data source
+ * with DNAN) and the result goes into a bit stream, most significant bit
+ * first:
+ *
+ *   0                        same value as before
+ *   10 <bits>                the set bits of the XOR lie within the
+ *                            window of the last 110 code, only the window
+ *                            is stored
+ *   110 <6 bits lz> <6 bits len-1> <len bits>
+ *                            new window of len bits after lz leading zeros
+ *   111 <7 bits n-2>         n times the same value as before, 2 <= n <= 129
+ *
+ * Consolidated values tend to change slowly and unknown values come in
+ * runs, so most values shrink to a few bits. The encoding is lossless,
+ * even for the payload of NaNs.
+ *****************************************************************************/
+
+#include <stdint.h>
+#include <string.h>
+
+#include "rrd_tool.h"
+#include "rrd_compress.h"
+
+/* runs shorter than this are cheaper as a series of 0 codes */
+#define RUN_MIN 11
+#define RUN_MAX 129
+
+typedef struct bit_writer_t {
+    unsigned char *out;
+    size_t    cap;
+    size_t    pos;
+    uint64_t  acc;      /* bits not yet written out, from the top down */
+    int       bits;
+    int       full;     /* ran out of room in out */
+} bit_writer_t;
+
+typedef struct bit_reader_t {
+    const unsigned char *in;
+    size_t    len;
+    size_t    pos;
+    uint64_t  acc;      /* bits not yet handed out, from the top down */
+    int       bits;
+    int       missing;  /* bits in acc beyond the end of in */
+} bit_reader_t;
+
+static uint64_t value_bits(
+    rrd_value_t value)
+{
+    uint64_t  bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static rrd_value_t bits_value(
+    uint64_t bits)
+{
+    rrd_value_t value;
+
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static int leading_zeros(
+    uint64_t x)
+{
+#if defined(__GNUC__)
+    return __builtin_clzll(x);
+#else
+    int       n = 0;
+
+    while (!(x & ((uint64_t) 1 << 63))) {
+        x <<= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+static int trailing_zeros(
+    uint64_t x)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(x);
+#else
+    int       n = 0;
+
+    while (!(x & 1)) {
+        x >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+/* append the cnt low bits of value, cnt <= 32 */
+static void put_bits(
+    bit_writer_t *w,
+    uint64_t value,
+    int cnt)
+{
+    if (cnt == 0)
+        return;
+    w->acc |= (value & (((uint64_t) 1 << cnt) - 1)) << (64 - w->bits - cnt);
+    w->bits += cnt;
+    while (w->bits >= 8) {
+        if (w->pos == w->cap) {
+            w->full = 1;
+            w->bits = 0;
+            return;
+        }
+        w->out[w->pos++] = (unsigned char) (w->acc >> 56);
+        w->acc <<= 8;
+        w->bits -= 8;
+    }
+}
+
+static void put_long(
+    bit_writer_t *w,
+    uint64_t value,
+    int cnt)
+{
+    if (cnt > 32) {
+        put_bits(w, value >> 32, cnt - 32);
+        cnt = 32;
+    }
+    put_bits(w, value, cnt);
+}
+
+/* make sure there are at least 57 bits in acc */
+static void refill(
+    bit_reader_t *r)
+{
+    if (r->bits <= 56 && r->pos + 8 <= r->len) {
+        const unsigned char *p = r->in + r->pos;
+        uint64_t  next = (uint64_t) p[0] << 56 | (uint64_t) p[1] << 48
+            | (uint64_t) p[2] << 40 | (uint64_t) p[3] << 32
+            | (uint64_t) p[4] << 24 | (uint64_t) p[5] << 16
+            | (uint64_t) p[6] << 8 | (uint64_t) p[7];
+        int       bytes = (63 - r->bits) >> 3;
+
+        r->acc |= next >> r->bits;
+        r->pos += bytes;
+        r->bits += bytes * 8;
+        return;
+    }
+    while (r->bits <= 56) {
+        if (r->pos < r->len)
+            r->acc |= (uint64_t) r->in[r->pos++] << (56 - r->bits);
+        else
+            r->missing += 8;
+        r->bits += 8;
+    }
+}
+
+/* the next cnt bits, 1 <= cnt <= 32 */
+static uint64_t get_bits(
+    bit_reader_t *r,
+    int cnt)
+{
+    uint64_t  value;
+
+    refill(r);
+    value = r->acc >> (64 - cnt);
+    r->acc <<= cnt;
+    r->bits -= cnt;
+    return value;
+}
+
+static uint64_t get_long(
+    bit_reader_t *r,
+    int cnt)
+{
+    uint64_t  value = 0;
+
+    if (cnt > 32) {
+        value = get_bits(r, cnt - 32) << 32;
+        cnt = 32;
+    }
+    return value | get_bits(r, cnt);
+}
+
+static void put_repeats(
+    bit_writer_t *w,
+    unsigned long cnt)
+{
+    while (cnt >= RUN_MIN) {
+        unsigned long run = cnt > RUN_MAX ? RUN_MAX : cnt;
+
+        put_bits(w, (7 << 7) | (run - 2), 10);
+        cnt -= run;
+    }
+    put_bits(w, 0, (int) cnt);
+}
+
+/* Returns the length of the encoded values or 0 if they do not fit into
+ * cap bytes. */
+static size_t block_encode(
+    const rrd_value_t *values,
+    unsigned long row_cnt,
+    unsigned long ds_cnt,
+    unsigned char *out,
+    size_t cap)
+{
+    bit_writer_t w = { out, cap, 0, 0, 0, 0 };
+    unsigned long ds_idx, row, repeats;
+    uint64_t  prev, x;
+    int       lz, tz, win_lz, win_len;
+
+    for (ds_idx = 0; ds_idx < ds_cnt && !w.full; ds_idx++) {
+        prev = value_bits(DNAN);
+        win_lz = 0;
+        win_len = 0;
+        repeats = 0;
+        for (row = 0; row < row_cnt && !w.full; row++) {
+            uint64_t  cur = value_bits(values[row * ds_cnt + ds_idx]);
+
+            x = cur ^ prev;
+            if (x == 0) {
+                repeats++;
+                continue;
+            }
+            put_repeats(&w, repeats);
+            repeats = 0;
+            lz = leading_zeros(x);
+            tz = trailing_zeros(x);
+            if (win_len > 0 && lz >= win_lz
+                && tz >= 64 - win_lz - win_len) {
+                put_bits(&w, 2, 2);
+                put_long(&w, x >> (64 - win_lz - win_len), win_len);
+            } else {
+                win_lz = lz;
+                win_len = 64 - lz - tz;
+                put_bits(&w, (6 << 12) | (win_lz << 6) | (win_len - 1), 15);
+                put_long(&w, x >> tz, win_len);
+            }
+            prev = cur;
+        }
+        put_repeats(&w, repeats);
+    }
+    if (w.bits > 0)
+        put_bits(&w, 0, 8 - w.bits);
+    if (w.full || w.pos >= cap)
+        return 0;
+    return w.pos;
+}
+
+static int block_decode(
+    const unsigned char *in,
+    size_t len,
+    unsigned long row_cnt,
+    unsigned long ds_cnt,
+    rrd_value_t *values)
+{
+    bit_reader_t r = { in, len, 0, 0, 0, 0 };
+    unsigned long ds_idx, row, run;
+    uint64_t  prev, code;
+    int       win_lz, win_len;
+
+    for (ds_idx = 0; ds_idx < ds_cnt; ds_idx++) {
+        prev = value_bits(DNAN);
+        win_lz = 0;
+        win_len = 0;
+        for (row = 0; row < row_cnt;) {
+            refill(&r);
+            code = r.acc >> 61;
+            if (code < 4) {     /* 0 */
+                r.acc <<= 1;
+                r.bits -= 1;
+            } else if (code < 6) {  /* 10 */
+                r.acc <<= 2;
+                r.bits -= 2;
+                if (win_len == 0)
+                    return -1;
+                prev ^= get_long(&r, win_len) << (64 - win_lz - win_len);
+            } else if (code == 6) { /* 110 */
+                code = get_bits(&r, 15);
+                win_lz = (int) (code >> 6) & 63;
+                win_len = (int) (code & 63) + 1;
+                if (win_lz + win_len > 64)
+                    return -1;
+                prev ^= get_long(&r, win_len) << (64 - win_lz - win_len);
+            } else {            /* 111 */
+                run = (unsigned long) get_bits(&r, 10) - (7 << 7) + 2;
+                if (run > row_cnt - row)
+                    return -1;
+                while (--run > 0)
+                    values[row++ * ds_cnt + ds_idx] = bits_value(prev);
+            }
+            values[row++ * ds_cnt + ds_idx] = bits_value(prev);
+        }
+        if (r.missing > r.bits)
+            return -1;
+    }
+    return 0;
+}
+
+void rrd_block_pack(
+    const rrd_value_t *values,
+    unsigned long row_cnt,
+    unsigned long ds_cnt,
+    int raw,
+    block_head_t *head,
+    unsigned char *data)
+{
+    size_t    size = row_cnt * ds_cnt * sizeof(rrd_value_t);
+    uint64_t  unknown = value_bits(DNAN);
+    unsigned long i;
+
+    if (!raw) {
+        for (i = 0; i < row_cnt * ds_cnt; i++)
+            if (value_bits(values[i]) != unknown)
+                break;
+        if (i == row_cnt * ds_cnt) {
+            head->kind = BLOCK_EMPTY;
+            head->len = 0;
+            return;
+        }
+        head->len = (unsigned int) block_encode(values, row_cnt, ds_cnt,
+                                                data, size);
+        if (head->len > 0) {
+            head->kind = BLOCK_XOR;
+            return;
+        }
+    }
+    head->kind = BLOCK_RAW;
+    head->len = (unsigned int) size;
+    memcpy(data, values, size);
+}
+
+int rrd_block_unpack(
+    const block_head_t *head,
+    const unsigned char *data,
+    unsigned long row_cnt,
+    unsigned long ds_cnt,
+    rrd_value_t *values)
+{
+    size_t    size = row_cnt * ds_cnt * sizeof(rrd_value_t);
+    unsigned long i;
+
+    switch (head->kind) {
+    case BLOCK_EMPTY:
+        for (i = 0; i < row_cnt * ds_cnt; i++)
+            values[i] = DNAN;
+        return 0;
+    case BLOCK_RAW:
+        if (head->len != size)
+            return -1;
+        memcpy(values, data, size);
+        return 0;
+    case BLOCK_XOR:
+        if (head->len >= size)
+            return -1;
+        return block_decode(data, head->len, row_cnt, ds_cnt, values);
+    }
+    return -1;
+}
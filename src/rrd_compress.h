@@ -0,0 +1,31 @@
+/*****************************************************************************
+ * rrd_compress.h  Blocks of RRD_LAYOUT_COMPRESSED files
+ *****************************************************************************/
+
+#ifndef RRD_COMPRESS_H
+#define RRD_COMPRESS_H
+
+#include "rrd.h"
+#include "rrd_format.h"
+
+/* Turn row_cnt rows of ds_cnt values into the head and the data of a
+ * block. Unless raw is set the values get encoded if that saves space.
+ * data must have room for row_cnt * ds_cnt values. */
+void      rrd_block_pack(
+    const rrd_value_t *values,
+    unsigned long row_cnt,
+    unsigned long ds_cnt,
+    int raw,
+    block_head_t *head,
+    unsigned char *data);
+
+/* The counterpart of rrd_block_pack. Returns 0 on success and -1 if the
+ * block is damaged. */
+int       rrd_block_unpack(
+    const block_head_t *head,
+    const unsigned char *data,
+    unsigned long row_cnt,
+    unsigned long ds_cnt,
+    rrd_value_t *values);
+
+#endif
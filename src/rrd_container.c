@@ -0,0 +1,825 @@
+/*****************************************************************************
+ * rrd_container.c  Many RRDs in one container file
+ *****************************************************************************
+ * A container holds any number of RRD files, its members, which are named
+ * container.rrdc#member. It starts with a head page and goes on with
+ * index chunks and members, each of which begins on a page boundary:
+ *
+ *   head    cookie, page size, end of the space handed out so far and the
+ *           offset of the first index chunk
+ *   chunk   offset of the next chunk, number of slots and of slots in use,
+ *           followed by a hash table of entries; a chunk gets twice the
+ *           slots of the one before it once that one is three quarters full
+ *   entry   member name, offset and length of the member
+ *
+ * A member is looked up by probing one chunk after the other. Members are
+ * added with a write lock on the first byte of the container, lookups hold
+ * a read lock there. Every member gets locked on its own byte range, so
+ * updates of different members do not wait for each other.
+ *
+ * A member that outgrows its space moves to the first hole between the
+ * chunks and the other members that is big enough, or to the end. The
+ * space it leaves is such a hole for the members written after it, so a
+ * container does not keep growing as its members do.
+ *
+ * A process keeps the containers it has used open and mapped as a whole,
+ * opening a member costs neither an open nor an mmap of its own.
+ *****************************************************************************/
+
+#include "rrd_tool.h"
+#include "rrd_container.h"
+
+#ifdef HAVE_RRD_CONTAINER
+
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "rrd_create.h"
+#include "compat-cloexec.h"
+#include "mutex.h"
+
+#define RRDC_COOKIE   "RRDC"
+#define RRDC_VERSION  "0001"
+#define RRDC_SUFFIX   ".rrdc#"
+#define RRDC_MIN_PAGE 4096
+#define RRDC_NAME_LEN 112
+#define RRDC_SLOTS    1024  /* slots of the first index chunk */
+
+typedef struct rrdc_head_t {
+    char      cookie[4];
+    char      version[4];
+    uint64_t  page;     /* members and chunks start on multiples of it */
+    uint64_t  end;      /* space handed out so far */
+    uint64_t  chunk;    /* offset of the first index chunk */
+} rrdc_head_t;
+
+typedef struct rrdc_chunk_t {
+    uint64_t  next;     /* offset of the next chunk, 0 for the last one */
+    uint64_t  slots;
+    uint64_t  used;
+} rrdc_chunk_t;
+
+typedef struct rrdc_entry_t {
+    char      name[RRDC_NAME_LEN];  /* empty for a free slot */
+    uint64_t  offset;
+    uint64_t  len;
+} rrdc_entry_t;
+
+typedef struct rrd_container_map_t {
+    char     *start;
+    size_t    len;
+    int       refs;     /* members using this mapping */
+    struct rrd_container_map_t *next;   /* older mappings still in use */
+} rrd_container_map_t;
+
+typedef struct rrd_container_t {
+    char     *path;
+    dev_t     dev;
+    ino_t     ino;
+    int       fd;
+    int       writable;
+    int       refs;     /* open members */
+    rrd_container_map_t *map;   /* the latest mapping, NULL until needed */
+    struct rrd_container_t *next;
+} rrd_container_t;
+
+/* the containers of this process, guarded by container_mutex */
+static rrd_container_t *containers = NULL;
+static mutex_t container_mutex = MUTEX_INITIALIZER;
+
+#define HEAD(c) ((rrdc_head_t *) (c)->map->start)
+#define AT(c, ofs) ((void *) ((c)->map->start + (ofs)))
+
+static uint64_t round_page(
+    rrd_container_t *c,
+    uint64_t len)
+{
+    uint64_t  page = HEAD(c)->page;
+
+    return (len + page - 1) / page * page;
+}
+
+static uint64_t chunk_len(
+    uint64_t slots)
+{
+    return sizeof(rrdc_chunk_t) + slots * sizeof(rrdc_entry_t);
+}
+
+/* FNV-1a */
+static uint64_t name_hash(
+    const char *name)
+{
+    uint64_t  h = 14695981039346656037ULL;
+
+    while (*name)
+        h = (h ^ (unsigned char) *name++) * 1099511628211ULL;
+    return h;
+}
+
+/* Split file_name into the path of the container, which has to be freed,
+ * and the name of the member. */
+static char *split_name(
+    const char *file_name,
+    const char **name)
+{
+    const char *hash = strstr(file_name, RRDC_SUFFIX);
+    size_t    len;
+    char     *path;
+
+    len = hash - file_name + strlen(RRDC_SUFFIX) - 1;
+    *name = file_name + len + 1;
+    if (**name == '\0' || strlen(*name) >= RRDC_NAME_LEN) {
+        rrd_set_error("invalid member name in '%s'", file_name);
+        return NULL;
+    }
+    if ((path = (char *) malloc(len + 1)) == NULL) {
+        rrd_set_error("allocating container name");
+        return NULL;
+    }
+    memcpy(path, file_name, len);
+    path[len] = '\0';
+    return path;
+}
+
+static int range_lock(
+    int fd,
+    int type,
+    off_t start,
+    off_t len)
+{
+    struct flock lock;
+
+    lock.l_type = type;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = start;
+    lock.l_len = len;
+    return fcntl(fd, type == F_UNLCK ? F_SETLK : F_SETLKW, &lock);
+}
+
+static void drop_container(
+    rrd_container_t *c)
+{
+    rrd_container_t **p;
+    rrd_container_map_t *map, *next;
+
+    for (p = &containers; *p != c; p = &(*p)->next);
+    *p = c->next;
+    for (map = c->map; map != NULL; map = next) {
+        next = map->next;
+        munmap(map->start, map->len);
+        free(map);
+    }
+    close(c->fd);
+    free(c->path);
+    free(c);
+}
+
+/* The container at path, out of the open ones if it is among them. It gets
+ * created if it does not exist and create is set. */
+static rrd_container_t *get_container(
+    const char *path,
+    int create)
+{
+    rrd_container_t *c, *next;
+    struct stat st;
+    int       fd, writable = 1;
+
+    if (stat(path, &st) == 0) {
+        for (c = containers; c != NULL; c = next) {
+            next = c->next;
+            if (c->dev == st.st_dev && c->ino == st.st_ino)
+                return c;
+            /* the file got replaced */
+            if (c->refs == 0 && strcmp(c->path, path) == 0)
+                drop_container(c);
+        }
+    }
+
+    fd = open(path, O_RDWR | O_CLOEXEC | (create ? O_CREAT : 0), 0666);
+    if (fd < 0 && !create && (errno == EACCES || errno == EROFS)) {
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        writable = 0;
+    }
+    if (fd < 0) {
+        rrd_set_error("opening '%s': %s", path, rrd_strerror(errno));
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0) {
+        rrd_set_error("fstat '%s': %s", path, rrd_strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    if ((c = (rrd_container_t *) calloc(1, sizeof(rrd_container_t))) == NULL
+        || (c->path = strdup(path)) == NULL) {
+        rrd_set_error("allocating container '%s'", path);
+        free(c);
+        close(fd);
+        return NULL;
+    }
+    c->dev = st.st_dev;
+    c->ino = st.st_ino;
+    c->fd = fd;
+    c->writable = writable;
+    c->next = containers;
+    containers = c;
+    return c;
+}
+
+/* Map all of the container again if it grew beyond the mapping. Returns 1
+ * if it did, 0 if it did not and -1 on error. */
+static int remap(
+    rrd_container_t *c)
+{
+    rrd_container_map_t *map;
+    struct stat st;
+
+    if (fstat(c->fd, &st) != 0) {
+        rrd_set_error("fstat '%s': %s", c->path, rrd_strerror(errno));
+        return -1;
+    }
+    if (c->map != NULL && (size_t) st.st_size <= c->map->len)
+        return 0;
+    if (st.st_size < (off_t) sizeof(rrdc_head_t)) {
+        rrd_set_error("'%s' is not an RRD container", c->path);
+        return -1;
+    }
+    if ((map = (rrd_container_map_t *) malloc(sizeof(*map))) == NULL) {
+        rrd_set_error("allocating container mapping");
+        return -1;
+    }
+    map->len = st.st_size;
+    map->refs = 0;
+    map->start = (char *) mmap(NULL, map->len,
+                               PROT_READ | (c->writable ? PROT_WRITE : 0),
+                               MAP_SHARED, c->fd, 0);
+    if (map->start == MAP_FAILED) {
+        rrd_set_error("mmaping container '%s': %s", c->path,
+                      rrd_strerror(errno));
+        free(map);
+        return -1;
+    }
+    map->next = c->map;
+    if (c->map != NULL && c->map->refs == 0) {
+        map->next = c->map->next;
+        munmap(c->map->start, c->map->len);
+        free(c->map);
+    }
+    c->map = map;
+    return 1;
+}
+
+/* Make sure the mapping reaches up to end. Returns 1 if it had to be
+ * renewed, which moves everything in it, 0 if not and -1 on error. */
+static int reach(
+    rrd_container_t *c,
+    uint64_t end)
+{
+    int       ret;
+
+    if (end <= c->map->len)
+        return 0;
+    if ((ret = remap(c)) == -1)
+        return -1;
+    if (ret == 0 || end > c->map->len) {
+        rrd_set_error("container '%s' is damaged", c->path);
+        return -1;
+    }
+    return 1;
+}
+
+/* Make room for len bytes from ofs. */
+static int grow(
+    rrd_container_t *c,
+    uint64_t ofs,
+    uint64_t len)
+{
+    struct stat st;
+
+#ifdef HAVE_POSIX_FALLOCATE
+    int       fret = posix_fallocate(c->fd, ofs, len);
+
+    if (fret == 0)
+        return 0;
+    if (fret != EINVAL) {
+        rrd_set_error("posix_fallocate '%s': %s", c->path,
+                      rrd_strerror(fret));
+        return -1;
+    }
+#endif
+    if (fstat(c->fd, &st) != 0) {
+        rrd_set_error("fstat '%s': %s", c->path, rrd_strerror(errno));
+        return -1;
+    }
+    if ((uint64_t) st.st_size < ofs + len
+        && ftruncate(c->fd, ofs + len) != 0) {
+        rrd_set_error("resizing '%s': %s", c->path, rrd_strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/* Hand out len bytes at the end of the container. Returns their offset or
+ * 0 on error. */
+static uint64_t allot(
+    rrd_container_t *c,
+    uint64_t len)
+{
+    uint64_t  ofs = HEAD(c)->end;
+
+    len = round_page(c, len);
+    if (grow(c, ofs, len) == -1 || remap(c) == -1)
+        return 0;
+    HEAD(c)->end = ofs + len;
+    return ofs;
+}
+
+typedef struct rrdc_extent_t {
+    uint64_t  offset;
+    uint64_t  len;
+} rrdc_extent_t;
+
+static int extent_cmp(
+    const void *a,
+    const void *b)
+{
+    uint64_t  x = ((const rrdc_extent_t *) a)->offset;
+    uint64_t  y = ((const rrdc_extent_t *) b)->offset;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Find room for len bytes between the head, the chunks and the members
+ * other than name, whose space is about to be replaced. Sets *ofs and
+ * returns 1 if there is a hole that big, returns 0 if the room has to be
+ * alloted at the end and -1 on error. Space at the end that no one uses
+ * any longer is given back so that allot() starts there. The index must
+ * be write locked. */
+static int find_hole(
+    rrd_container_t *c,
+    const char *name,
+    uint64_t len,
+    uint64_t *ofs)
+{
+    rrdc_extent_t *ext = NULL, *more;
+    rrdc_chunk_t *chunk;
+    rrdc_entry_t *e;
+    uint64_t  chunk_ofs, cnt, room = 0, pos, i;
+    int       ret;
+
+    len = round_page(c, len);
+  again:
+    cnt = 0;
+    for (chunk_ofs = HEAD(c)->chunk; chunk_ofs != 0;
+         chunk_ofs = chunk->next) {
+        if ((ret = reach(c, chunk_ofs + sizeof(rrdc_chunk_t))) == 0) {
+            chunk = (rrdc_chunk_t *) AT(c, chunk_ofs);
+            ret = reach(c, chunk_ofs + chunk_len(chunk->slots));
+        }
+        if (ret == 1)
+            goto again;
+        if (ret == -1)
+            goto err;
+        chunk = (rrdc_chunk_t *) AT(c, chunk_ofs);
+        /* the head, the chunk and its members */
+        if (cnt + 2 + chunk->used > room) {
+            room = 2 * (cnt + 2 + chunk->used);
+            if ((more = (rrdc_extent_t *)
+                 realloc(ext, room * sizeof(*ext))) == NULL) {
+                rrd_set_error("allocating container extents");
+                goto err;
+            }
+            ext = more;
+        }
+        if (cnt == 0) {
+            ext[cnt].offset = 0;
+            ext[cnt++].len = HEAD(c)->page;
+        }
+        ext[cnt].offset = chunk_ofs;
+        ext[cnt++].len = round_page(c, chunk_len(chunk->slots));
+        e = (rrdc_entry_t *) (chunk + 1);
+        for (i = 0; i < chunk->slots; i++) {
+            if (e[i].name[0] == '\0'
+                || strncmp(e[i].name, name, RRDC_NAME_LEN) == 0)
+                continue;
+            if (cnt == room) {
+                rrd_set_error("container '%s' is damaged", c->path);
+                goto err;
+            }
+            ext[cnt].offset = e[i].offset;
+            ext[cnt++].len = round_page(c, e[i].len);
+        }
+    }
+    qsort(ext, cnt, sizeof(*ext), extent_cmp);
+
+    ret = 0;
+    for (i = 0, pos = 0; i < cnt; i++) {
+        if (ext[i].offset >= pos + len) {
+            *ofs = pos;
+            ret = 1;
+            break;
+        }
+        pos = max(pos, ext[i].offset + ext[i].len);
+    }
+    if (ret == 0 && pos < HEAD(c)->end)
+        HEAD(c)->end = pos;
+    free(ext);
+    return ret;
+
+  err:
+    free(ext);
+    return -1;
+}
+
+/* Map the container and check its head. An empty container gets a head
+ * and the first index chunk if init is set. The index must be locked. */
+static int check_head(
+    rrd_container_t *c,
+    int init)
+{
+    rrdc_head_t *head;
+    rrdc_chunk_t *chunk;
+    struct stat st;
+    uint64_t  page;
+
+    if (c->map == NULL && init) {
+        if (fstat(c->fd, &st) != 0) {
+            rrd_set_error("fstat '%s': %s", c->path, rrd_strerror(errno));
+            return -1;
+        }
+        if (st.st_size == 0) {
+            page = max(sysconf(_SC_PAGESIZE), RRDC_MIN_PAGE);
+            if (grow(c, 0, page + chunk_len(RRDC_SLOTS)) == -1
+                || remap(c) == -1)
+                return -1;
+            head = HEAD(c);
+            memcpy(head->cookie, RRDC_COOKIE, sizeof(head->cookie));
+            memcpy(head->version, RRDC_VERSION, sizeof(head->version));
+            head->page = page;
+            head->chunk = page;
+            head->end = round_page(c, page + chunk_len(RRDC_SLOTS));
+            chunk = (rrdc_chunk_t *) AT(c, page);
+            chunk->slots = RRDC_SLOTS;
+        }
+    }
+    /* later growth shows when something lies beyond the mapping */
+    if (c->map == NULL && remap(c) == -1)
+        return -1;
+    head = HEAD(c);
+    if (memcmp(head->cookie, RRDC_COOKIE, sizeof(head->cookie)) != 0) {
+        rrd_set_error("'%s' is not an RRD container", c->path);
+        return -1;
+    }
+    if (memcmp(head->version, RRDC_VERSION, sizeof(head->version)) != 0) {
+        rrd_set_error("can't handle RRD container version %.4s",
+                      head->version);
+        return -1;
+    }
+    if (head->page < RRDC_MIN_PAGE || (head->page & (head->page - 1))) {
+        rrd_set_error("container '%s' is damaged", c->path);
+        return -1;
+    }
+    return 0;
+}
+
+/* Set *entry to the entry of member name or NULL if there is none. The
+ * index must be locked. */
+static int lookup(
+    rrd_container_t *c,
+    const char *name,
+    rrdc_entry_t **entry)
+{
+    uint64_t  h = name_hash(name), ofs, i, probes;
+    rrdc_chunk_t *chunk;
+    rrdc_entry_t *e;
+    int       ret;
+
+  again:
+    *entry = NULL;
+    for (ofs = HEAD(c)->chunk; ofs != 0; ofs = chunk->next) {
+        if ((ret = reach(c, ofs + sizeof(rrdc_chunk_t))) != 0)
+            goto moved;
+        chunk = (rrdc_chunk_t *) AT(c, ofs);
+        if (chunk->slots == 0 || chunk->used >= chunk->slots) {
+            rrd_set_error("container '%s' is damaged", c->path);
+            return -1;
+        }
+        if ((ret = reach(c, ofs + chunk_len(chunk->slots))) != 0)
+            goto moved;
+        e = (rrdc_entry_t *) (chunk + 1);
+        for (i = h % chunk->slots, probes = 0;
+             e[i].name[0] != '\0' && probes < chunk->slots;
+             i = (i + 1) % chunk->slots, probes++) {
+            if (strncmp(e[i].name, name, RRDC_NAME_LEN) != 0)
+                continue;
+            if ((ret = reach(c, e[i].offset + e[i].len)) != 0)
+                goto moved;
+            *entry = &e[i];
+            return 0;
+        }
+    }
+    return 0;
+
+  moved:
+    if (ret == 1)
+        goto again;
+    return -1;
+}
+
+/* Add an entry for member name, which must not have one yet. The index
+ * must be write locked. */
+static rrdc_entry_t *insert(
+    rrd_container_t *c,
+    const char *name)
+{
+    uint64_t  ofs, next, slots, i;
+    rrdc_chunk_t *chunk;
+    rrdc_entry_t *e;
+
+    for (ofs = HEAD(c)->chunk;; ofs = chunk->next) {
+        chunk = (rrdc_chunk_t *) AT(c, ofs);
+        if (chunk->used < chunk->slots / 4 * 3) {
+            e = (rrdc_entry_t *) (chunk + 1);
+            for (i = name_hash(name) % chunk->slots; e[i].name[0] != '\0';
+                 i = (i + 1) % chunk->slots);
+            strcpy(e[i].name, name);    /* split_name checked the length */
+            chunk->used++;
+            return &e[i];
+        }
+        if (chunk->next == 0) {
+            slots = chunk->slots * 2;
+            if ((next = allot(c, chunk_len(slots))) == 0)
+                return NULL;
+            /* the mapping may have moved */
+            chunk = (rrdc_chunk_t *) AT(c, ofs);
+            memset(AT(c, next), 0, chunk_len(slots));
+            ((rrdc_chunk_t *) AT(c, next))->slots = slots;
+            chunk->next = next;
+        }
+    }
+}
+
+int rrd_container_name(
+    const char *file_name)
+{
+    return strstr(file_name, RRDC_SUFFIX) != NULL;
+}
+
+int rrd_member_open(
+    rrd_file_t *rrd_file,
+    const char *file_name,
+    int writable)
+{
+    rrd_simple_file_t *rrd_simple_file = (rrd_simple_file_t *) rrd_file->pvt;
+    rrd_container_t *c;
+    rrd_member_t *member;
+    rrdc_entry_t *e = NULL;
+    const char *name;
+    char     *path;
+    int       ret = -1;
+
+    if ((path = split_name(file_name, &name)) == NULL)
+        return -1;
+    if ((member = (rrd_member_t *) malloc(sizeof(rrd_member_t))) == NULL) {
+        rrd_set_error("allocating container member");
+        free(path);
+        return -1;
+    }
+
+    mutex_lock(&container_mutex);
+    if ((c = get_container(path, 0)) == NULL)
+        goto out;
+    if (writable && !c->writable) {
+        rrd_set_error("container '%s' is read-only", path);
+        goto out;
+    }
+    if (range_lock(c->fd, F_RDLCK, 0, 1) != 0) {
+        rrd_set_error("locking '%s': %s", path, rrd_strerror(errno));
+        goto out;
+    }
+    if (check_head(c, 0) == 0 && lookup(c, name, &e) == 0) {
+        if (e == NULL)
+            rrd_set_error("opening '%s': %s", file_name,
+                          rrd_strerror(ENOENT));
+        else {
+            member->container = c;
+            member->map = c->map;
+            member->base = e->offset;
+            c->refs++;
+            c->map->refs++;
+            rrd_simple_file->member = member;
+            rrd_simple_file->fd = c->fd;
+            rrd_simple_file->file_start = c->map->start + e->offset;
+            rrd_file->file_len = e->len;
+            ret = 0;
+        }
+    }
+    range_lock(c->fd, F_UNLCK, 0, 1);
+
+  out:
+    mutex_unlock(&container_mutex);
+    if (ret != 0)
+        free(member);
+    free(path);
+    return ret;
+}
+
+int rrd_member_close(
+    rrd_file_t *rrd_file)
+{
+    rrd_simple_file_t *rrd_simple_file = (rrd_simple_file_t *) rrd_file->pvt;
+    rrd_member_t *member = rrd_simple_file->member;
+    rrd_container_t *c = member->container;
+    rrd_container_map_t **p, *map;
+    int       ret = 0;
+
+    /* a plain file would lose its lock with the descriptor */
+    if (range_lock(c->fd, F_UNLCK, member->base, rrd_file->file_len) != 0) {
+        rrd_set_error("unlock '%s': %s", c->path, rrd_strerror(errno));
+        ret = -1;
+    }
+
+    mutex_lock(&container_mutex);
+    c->refs--;
+    if (--member->map->refs == 0 && member->map != c->map) {
+        for (p = &c->map->next; *p != member->map; p = &(*p)->next);
+        map = *p;
+        *p = map->next;
+        munmap(map->start, map->len);
+        free(map);
+    }
+    mutex_unlock(&container_mutex);
+
+    free(member);
+    rrd_simple_file->member = NULL;
+    rrd_simple_file->file_start = NULL;
+    rrd_simple_file->fd = -1;
+    return ret;
+}
+
+int rrd_member_exists(
+    const char *file_name)
+{
+    rrd_container_t *c;
+    rrdc_entry_t *e = NULL;
+    const char *name;
+    struct stat st;
+    char     *path;
+    int       ret = -1;
+
+    if ((path = split_name(file_name, &name)) == NULL)
+        return -1;
+    if (stat(path, &st) != 0) {
+        free(path);
+        return 0;
+    }
+
+    mutex_lock(&container_mutex);
+    if ((c = get_container(path, 0)) != NULL) {
+        if (range_lock(c->fd, F_RDLCK, 0, 1) != 0)
+            rrd_set_error("locking '%s': %s", path, rrd_strerror(errno));
+        else {
+            if (check_head(c, 0) == 0 && lookup(c, name, &e) == 0)
+                ret = e != NULL;
+            range_lock(c->fd, F_UNLCK, 0, 1);
+        }
+    }
+    mutex_unlock(&container_mutex);
+    free(path);
+    return ret;
+}
+
+int rrd_member_write(
+    const char *file_name,
+    rrd_t *rrd,
+    int excl)
+{
+    rrd_container_t *c;
+    rrdc_entry_t *e;
+    const char *name;
+    char     *path;
+    uint64_t  ofs, len;
+    unsigned long i;
+    FILE     *fh;
+    char     *buf = NULL;
+    size_t    buf_len = 0;
+    int       rc = -1, ret;
+
+    if ((path = split_name(file_name, &name)) == NULL)
+        return -1;
+    len = rrd_get_header_size(rrd);
+    for (i = 0; i < rrd->stat_head->rra_cnt; i++)
+        len += rrd_rra_data_size(rrd, i);
+
+    mutex_lock(&container_mutex);
+    if ((c = get_container(path, 1)) == NULL)
+        goto out;
+    if (!c->writable) {
+        rrd_set_error("container '%s' is read-only", path);
+        goto out;
+    }
+    if (range_lock(c->fd, F_WRLCK, 0, 1) != 0) {
+        rrd_set_error("locking '%s': %s", path, rrd_strerror(errno));
+        goto out;
+    }
+    if (check_head(c, 1) == -1 || lookup(c, name, &e) == -1)
+        goto out_unlock;
+    if (e != NULL && excl) {
+        rrd_set_error("creating '%s': File exists", file_name);
+        goto out_unlock;
+    }
+
+    /* a member that still fits gets overwritten, otherwise it moves to a
+     * hole, which may take in its old space, or to the end */
+    if (e != NULL && len <= round_page(c, e->len))
+        ofs = e->offset;
+    else if ((ret = find_hole(c, name, len, &ofs)) == -1)
+        goto out_unlock;
+    else if (ret == 0 && (ofs = allot(c, len)) == 0)
+        goto out_unlock;
+
+    /* wait for those still using the space */
+    if (range_lock(c->fd, F_WRLCK, ofs, round_page(c, len)) != 0) {
+        rrd_set_error("locking '%s': %s", file_name, rrd_strerror(errno));
+        goto out_unlock;
+    }
+    if ((fh = open_memstream(&buf, &buf_len)) == NULL) {
+        rrd_set_error("opening '%s': %s", file_name, rrd_strerror(errno));
+    } else {
+        rc = write_fh(fh, rrd);
+        if (fclose(fh) != 0 || buf_len != len)
+            rc = -1;
+        if (rc == 0)
+            memcpy(AT(c, ofs), buf, len);
+        else
+            rrd_set_error("writing '%s' failed", file_name);
+        free(buf);
+    }
+    if (rc == 0 && lookup(c, name, &e) == 0) {
+        if (e == NULL)
+            e = insert(c, name);
+        if (e != NULL) {
+            e->offset = ofs;
+            e->len = len;
+        } else
+            rc = -1;
+    }
+    range_lock(c->fd, F_UNLCK, ofs, round_page(c, len));
+
+  out_unlock:
+    range_lock(c->fd, F_UNLCK, 0, 1);
+  out:
+    mutex_unlock(&container_mutex);
+    free(path);
+    return rc;
+}
+
+#else                           /* HAVE_RRD_CONTAINER */
+
+int rrd_container_name(
+    const char *file_name)
+{
+    (void) file_name;
+    return 0;
+}
+
+int rrd_member_open(
+    rrd_file_t *rrd_file,
+    const char *file_name,
+    int writable)
+{
+    (void) rrd_file;
+    (void) writable;
+    rrd_set_error("opening '%s': RRD containers are not supported",
+                  file_name);
+    return -1;
+}
+
+int rrd_member_close(
+    rrd_file_t *rrd_file)
+{
+    (void) rrd_file;
+    return 0;
+}
+
+int rrd_member_exists(
+    const char *file_name)
+{
+    (void) file_name;
+    return 0;
+}
+
+int rrd_member_write(
+    const char *file_name,
+    rrd_t *rrd,
+    int excl)
+{
+    (void) rrd;
+    (void) excl;
+    rrd_set_error("creating '%s': RRD containers are not supported",
+                  file_name);
+    return -1;
+}
+
+#endif                          /* HAVE_RRD_CONTAINER */
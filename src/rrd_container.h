@@ -0,0 +1,50 @@
+/*****************************************************************************
+ * rrd_container.h  Many RRDs in one container file
+ *****************************************************************************/
+
+#ifndef RRD_CONTAINER_H
+#define RRD_CONTAINER_H
+
+#include "rrd_tool.h"
+
+/* members are mapped out of one shared mapping of the container and locked
+ * with byte range locks, both need a unix like system */
+#if defined(HAVE_MMAP) && !defined(_WIN32)
+#define HAVE_RRD_CONTAINER 1
+#endif
+
+/* what an rrd_file_t that is a container member refers to */
+typedef struct rrd_member_t {
+    struct rrd_container_t *container;
+    struct rrd_container_map_t *map;    /* the mapping file_start lies in */
+    off_t     base;     /* offset of the member in the container */
+} rrd_member_t;
+
+/* Returns 1 if file_name has the form container.rrdc#member. */
+int       rrd_container_name(
+    const char *file_name);
+
+/* Look up the member file_name and point rrd_file at it: file_start and
+ * file_len of its simple file describe the member, fd is the descriptor
+ * of the container, which must be left open. */
+int       rrd_member_open(
+    rrd_file_t *rrd_file,
+    const char *file_name,
+    int writable);
+
+/* Drop the locks rrd_file holds on its member and let go of it. */
+int       rrd_member_close(
+    rrd_file_t *rrd_file);
+
+/* Returns 1 if the member file_name exists, 0 if not and -1 on error. */
+int       rrd_member_exists(
+    const char *file_name);
+
+/* Store rrd as member file_name, creating the container if need be. An
+ * existing member is replaced unless excl is set. */
+int       rrd_member_write(
+    const char *file_name,
+    rrd_t *rrd,
+    int excl);
+
+#endif
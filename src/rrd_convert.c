@@ -0,0 +1,819 @@
+/*****************************************************************************
+ * rrd_convert.c  Move RRD files between architectures without XML
+ *****************************************************************************
+ * rrd_open maps the header straight from the file, so the byte order, the
+ * size of long and time_t and the alignment of doubles in it are those of
+ * the machine that created the file. The portable format is the layout a
+ * 64 bit little endian machine (amd64, arm64, ...) writes anyway: there
+ * portable files are native files and get mapped without any conversion.
+ *
+ * rrd_convert_r rewrites a file field by field from whatever layout it was
+ * created with into the native, the portable or any other layout. The
+ * layout of the source is told by where the float cookie sits, in which
+ * byte order it reads and which sizes of long and time_t make header and
+ * data add up to the size of the file.
+ *****************************************************************************/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <fcntl.h>
+
+#include "rrd_tool.h"
+#include "rrd_rpncalc.h"
+#include "rrd_container.h"
+
+typedef struct rrd_abi_t {
+    int       big_endian;
+    int       long_size;        /* 4 or 8 */
+    int       time_size;        /* 4 or 8 */
+    int       align8;           /* alignment of doubles and 8 byte integers */
+} rrd_abi_t;
+
+/* the LP64 little endian layout */
+static const rrd_abi_t portable_abi = { 0, 8, 8, 8 };
+
+/* how to carry over one unival */
+enum par_kind_en { PAR_VALUE = 0, PAR_COUNT, PAR_BYTES };
+
+typedef struct conv_t {
+    rrd_abi_t src_abi;
+    const unsigned char *src;
+    size_t    src_len;
+    size_t    src_pos;
+    rrd_abi_t dst_abi;
+    unsigned char *dst; /* NULL to find out how long the result gets */
+    size_t    dst_pos;
+    /* what the data area depends on */
+    int       version;
+    unsigned long ds_cnt;
+    unsigned long rra_cnt;
+    unsigned long layout;
+    unsigned long block_rows;
+    unsigned long *row_cnt;
+    enum cf_en *cf;
+} conv_t;
+
+struct align_probe {
+    char      c;
+    double    d;
+};
+
+static void native_abi(
+    rrd_abi_t *abi)
+{
+    uint16_t  probe = 1;
+
+    abi->big_endian = *(unsigned char *) &probe == 0;
+    abi->long_size = sizeof(long);
+    abi->time_size = sizeof(time_t);
+    abi->align8 = offsetof(struct align_probe, d);
+}
+
+static int same_abi(
+    const rrd_abi_t *a,
+    const rrd_abi_t *b)
+{
+    return a->big_endian == b->big_endian && a->long_size == b->long_size
+        && a->time_size == b->time_size && a->align8 == b->align8;
+}
+
+/* native, portable or [le|be][32|64], optionally followed by a4 or a8 for
+ * the alignment of doubles and t32 or t64 for the size of time_t */
+static int parse_abi(
+    const char *spec,
+    rrd_abi_t *abi)
+{
+    const char *p;
+
+    if (spec == NULL || strcmp(spec, "native") == 0) {
+        native_abi(abi);
+        return 0;
+    }
+    if (strcmp(spec, "portable") == 0) {
+        *abi = portable_abi;
+        return 0;
+    }
+    p = spec + 2;
+    if (strncmp(spec, "le", 2) == 0)
+        abi->big_endian = 0;
+    else if (strncmp(spec, "be", 2) == 0)
+        abi->big_endian = 1;
+    else
+        goto bad;
+    if (strncmp(p, "32", 2) == 0)
+        abi->long_size = 4;
+    else if (strncmp(p, "64", 2) == 0)
+        abi->long_size = 8;
+    else
+        goto bad;
+    p += 2;
+    abi->align8 = 8;
+    abi->time_size = abi->long_size;
+    if (strcmp(p, "a4") == 0 || strncmp(p, "a4t", 3) == 0) {
+        abi->align8 = 4;
+        p += 2;
+    } else if (strcmp(p, "a8") == 0 || strncmp(p, "a8t", 3) == 0)
+        p += 2;
+    if (strcmp(p, "t32") == 0) {
+        abi->time_size = 4;
+        p += 3;
+    } else if (strcmp(p, "t64") == 0) {
+        abi->time_size = 8;
+        p += 3;
+    }
+    if (*p == '\0')
+        return 0;
+  bad:
+    rrd_set_error("unknown target '%s', use native, portable or a layout "
+                  "like le64, be32 or le32a4t64", spec);
+    return -1;
+}
+
+static uint64_t get_uint(
+    const unsigned char *p,
+    int size,
+    int big_endian)
+{
+    uint64_t  value = 0;
+    int       i;
+
+    for (i = 0; i < size; i++)
+        value |= (uint64_t) p[big_endian ? size - 1 - i : i] << (8 * i);
+    return value;
+}
+
+static void put_uint(
+    unsigned char *p,
+    int size,
+    int big_endian,
+    uint64_t value)
+{
+    int       i;
+
+    for (i = 0; i < size; i++)
+        p[big_endian ? size - 1 - i : i] = (unsigned char) (value >> (8 * i));
+}
+
+/* copy size bytes, in reverse order if swap is set */
+static void swap_copy(
+    unsigned char *dst,
+    const unsigned char *src,
+    int size,
+    int swap)
+{
+    int       i;
+
+    for (i = 0; i < size; i++)
+        dst[i] = src[swap ? size - 1 - i : i];
+}
+
+static size_t round_up(
+    size_t pos,
+    int align)
+{
+    return (pos + align - 1) / align * align;
+}
+
+static int align_of(
+    const rrd_abi_t *abi,
+    int size)
+{
+    return size == 8 ? abi->align8 : size;
+}
+
+/* skip the padding in front of something aligned to src_align in the
+ * source and dst_align in the result */
+static int conv_pad(
+    conv_t *c,
+    int src_align,
+    int dst_align)
+{
+    c->src_pos = round_up(c->src_pos, src_align);
+    c->dst_pos = round_up(c->dst_pos, dst_align);
+    if (c->src_pos > c->src_len) {
+        rrd_set_error("RRD file is truncated");
+        return -1;
+    }
+    return 0;
+}
+
+static int conv_chars(
+    conv_t *c,
+    size_t cnt,
+    char *copy)
+{
+    if (c->src_len - c->src_pos < cnt) {
+        rrd_set_error("RRD file is truncated");
+        return -1;
+    }
+    if (c->dst != NULL)
+        memcpy(c->dst + c->dst_pos, c->src + c->src_pos, cnt);
+    if (copy != NULL) {
+        memcpy(copy, c->src + c->src_pos, cnt);
+        copy[cnt] = '\0';
+    }
+    c->src_pos += cnt;
+    c->dst_pos += cnt;
+    return 0;
+}
+
+/* an integer of src_size bytes that becomes one of dst_size bytes */
+static int conv_int(
+    conv_t *c,
+    int src_size,
+    int dst_size,
+    unsigned long *value)
+{
+    uint64_t  v;
+
+    if (conv_pad(c, align_of(&c->src_abi, src_size),
+                 align_of(&c->dst_abi, dst_size)) != 0)
+        return -1;
+    if (c->src_len - c->src_pos < (size_t) src_size) {
+        rrd_set_error("RRD file is truncated");
+        return -1;
+    }
+    v = get_uint(c->src + c->src_pos, src_size, c->src_abi.big_endian);
+    if (dst_size < 8 && v >> (8 * dst_size) != 0) {
+        rrd_set_error("%llu does not fit into %d bytes",
+                      (unsigned long long) v, dst_size);
+        return -1;
+    }
+    if (c->dst != NULL)
+        put_uint(c->dst + c->dst_pos, dst_size, c->dst_abi.big_endian, v);
+    if (value != NULL)
+        *value = (unsigned long) v;
+    c->src_pos += src_size;
+    c->dst_pos += dst_size;
+    return 0;
+}
+
+static int conv_long(
+    conv_t *c,
+    unsigned long *value)
+{
+    return conv_int(c, c->src_abi.long_size, c->dst_abi.long_size, value);
+}
+
+static int conv_double(
+    conv_t *c)
+{
+    if (conv_pad(c, c->src_abi.align8, c->dst_abi.align8) != 0)
+        return -1;
+    if (c->src_len - c->src_pos < 8) {
+        rrd_set_error("RRD file is truncated");
+        return -1;
+    }
+    if (c->dst != NULL)
+        swap_copy(c->dst + c->dst_pos, c->src + c->src_pos, 8,
+                  c->src_abi.big_endian != c->dst_abi.big_endian);
+    c->src_pos += 8;
+    c->dst_pos += 8;
+    return 0;
+}
+
+/* a union of an unsigned long and a double, see unival */
+static int conv_unival(
+    conv_t *c,
+    enum par_kind_en kind,
+    unsigned long *value)
+{
+    size_t    src_pos, dst_pos;
+
+    if (kind == PAR_VALUE)
+        return conv_double(c);
+    if (kind == PAR_BYTES)
+        return conv_pad(c, c->src_abi.align8, c->dst_abi.align8)
+            || conv_chars(c, 8, NULL);
+    if (conv_pad(c, c->src_abi.align8, c->dst_abi.align8) != 0)
+        return -1;
+    src_pos = c->src_pos;
+    dst_pos = c->dst_pos;
+    if (c->src_len - src_pos < 8) {
+        rrd_set_error("RRD file is truncated");
+        return -1;
+    }
+    if (conv_long(c, value) != 0)
+        return -1;
+    c->src_pos = src_pos + 8;
+    c->dst_pos = dst_pos + 8;
+    return 0;
+}
+
+/* the par array of a COMPUTE data source holds an rpn_cdefds_t program */
+static int conv_cdef(
+    conv_t *c)
+{
+    int       i;
+
+    if (conv_pad(c, c->src_abi.align8, c->dst_abi.align8) != 0)
+        return -1;
+    for (i = 0; i < DS_CDEF_MAX_RPN_NODES; i++) {
+        if (conv_chars(c, 1, NULL) != 0 || conv_int(c, 2, 2, NULL) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int is_hw(
+    enum cf_en cf)
+{
+    return cf == CF_HWPREDICT || cf == CF_MHWPREDICT || cf == CF_SEASONAL
+        || cf == CF_DEVSEASONAL || cf == CF_DEVPREDICT || cf == CF_FAILURES;
+}
+
+static enum par_kind_en rra_par_kind(
+    enum cf_en cf,
+    int idx)
+{
+    switch (idx) {
+    case RRA_dependent_rra_idx:
+        return is_hw(cf) ? PAR_COUNT : PAR_VALUE;
+    case RRA_seasonal_smooth_idx:  /* and RRA_window_len */
+        return cf == CF_SEASONAL || cf == CF_DEVSEASONAL
+            || cf == CF_FAILURES ? PAR_COUNT : PAR_VALUE;
+    case RRA_failure_threshold:
+        return cf == CF_FAILURES ? PAR_COUNT : PAR_VALUE;
+    }
+    return PAR_VALUE;
+}
+
+static enum par_kind_en cdp_par_kind(
+    enum cf_en cf,
+    int idx)
+{
+    switch (cf) {
+    case CF_FAILURES:
+        return PAR_BYTES;
+    case CF_HWPREDICT:
+    case CF_MHWPREDICT:
+        if (idx == CDP_last_null_count)
+            return PAR_COUNT;
+        /* fall through */
+    case CF_SEASONAL:
+    case CF_DEVSEASONAL:
+        if (idx == CDP_null_count)
+            return PAR_COUNT;
+        break;
+    default:
+        break;
+    }
+    return idx == CDP_unkn_pdp_cnt ? PAR_COUNT : PAR_VALUE;
+}
+
+/* end of a struct holding doubles */
+static int conv_end(
+    conv_t *c)
+{
+    return conv_pad(c, c->src_abi.align8, c->dst_abi.align8);
+}
+
+static int conv_header(
+    conv_t *c)
+{
+    char      text[DST_SIZE + 1];
+    unsigned long i, j;
+
+    if (conv_chars(c, 4, NULL) != 0 || conv_chars(c, 5, text) != 0
+        || conv_double(c) != 0 || conv_long(c, &c->ds_cnt) != 0
+        || conv_long(c, &c->rra_cnt) != 0 || conv_long(c, NULL) != 0)
+        return -1;
+    c->version = atoi(text);
+    c->layout = RRD_LAYOUT_ROW;
+    c->block_rows = 1;
+    for (i = 0; i < 10; i++) {
+        if (c->version >= 6 && i == SH_layout) {
+            if (conv_unival(c, PAR_COUNT, &c->layout) != 0)
+                return -1;
+        } else if (c->version >= 6 && i == SH_block_rows) {
+            if (conv_unival(c, PAR_COUNT, &c->block_rows) != 0)
+                return -1;
+        } else if (c->version >= 6 && i == SH_sparse_since) {
+            if (conv_unival(c, PAR_COUNT, NULL) != 0)
+                return -1;
+        } else if (conv_unival(c, PAR_VALUE, NULL) != 0)
+            return -1;
+    }
+    if (conv_end(c) != 0)
+        return -1;
+    if (c->layout != RRD_LAYOUT_ROW && c->layout != RRD_LAYOUT_COLUMN
+        && c->layout != RRD_LAYOUT_COMPRESSED) {
+        rrd_set_error("can't handle data layout %lu", c->layout);
+        return -1;
+    }
+    /* only compressed files use block_rows, the others leave it 0 */
+    if (c->layout != RRD_LAYOUT_COMPRESSED)
+        c->block_rows = 1;
+    if (c->block_rows < 1
+        || c->ds_cnt > c->src_len || c->rra_cnt > c->src_len / 100) {
+        rrd_set_error("RRD file is damaged");
+        return -1;
+    }
+
+    for (i = 0; i < c->ds_cnt; i++) {
+        if (conv_chars(c, DS_NAM_SIZE, NULL) != 0
+            || conv_chars(c, DST_SIZE, text) != 0)
+            return -1;
+        if (strcmp(text, "COMPUTE") == 0) {
+            if (conv_cdef(c) != 0)
+                return -1;
+        } else {
+            for (j = 0; j < 10; j++)
+                if (conv_unival(c, j == DS_mrhb_cnt ? PAR_COUNT
+                                : PAR_VALUE, NULL) != 0)
+                    return -1;
+        }
+        if (conv_end(c) != 0)
+            return -1;
+    }
+
+    c->row_cnt = (unsigned long *) calloc(c->rra_cnt + 1,
+                                          sizeof(unsigned long));
+    c->cf = (enum cf_en *) calloc(c->rra_cnt + 1, sizeof(enum cf_en));
+    if (c->row_cnt == NULL || c->cf == NULL) {
+        rrd_set_error("out of memory");
+        return -1;
+    }
+    for (i = 0; i < c->rra_cnt; i++) {
+        if (conv_chars(c, CF_NAM_SIZE, text) != 0)
+            return -1;
+        c->cf[i] = rrd_cf_conv(text);
+        if ((int) c->cf[i] == -1)
+            return -1;
+        if (conv_long(c, &c->row_cnt[i]) != 0 || conv_long(c, NULL) != 0)
+            return -1;
+        for (j = 0; j < MAX_RRA_PAR_EN; j++)
+            if (conv_unival(c, rra_par_kind(c->cf[i], j), NULL) != 0)
+                return -1;
+        if (conv_end(c) != 0)
+            return -1;
+    }
+
+    if (conv_int(c, c->src_abi.time_size, c->dst_abi.time_size, NULL) != 0)
+        return -1;
+    if (c->version >= 3) {
+        if (conv_long(c, NULL) != 0)
+            return -1;
+        if (conv_pad(c, max(align_of(&c->src_abi, c->src_abi.time_size),
+                            align_of(&c->src_abi, c->src_abi.long_size)),
+                     max(align_of(&c->dst_abi, c->dst_abi.time_size),
+                         align_of(&c->dst_abi, c->dst_abi.long_size))) != 0)
+            return -1;
+    }
+
+    for (i = 0; i < c->ds_cnt; i++) {
+        if (conv_chars(c, LAST_DS_LEN, NULL) != 0)
+            return -1;
+        for (j = 0; j < 10; j++)
+            if (conv_unival(c, j == PDP_unkn_sec_cnt ? PAR_COUNT
+                            : PAR_VALUE, NULL) != 0)
+                return -1;
+        if (conv_end(c) != 0)
+            return -1;
+    }
+
+    for (i = 0; i < c->rra_cnt * c->ds_cnt; i++) {
+        for (j = 0; j < MAX_CDP_PAR_EN; j++)
+            if (conv_unival(c, cdp_par_kind(c->cf[i / c->ds_cnt], j),
+                            NULL) != 0)
+                return -1;
+    }
+
+    for (i = 0; i < c->rra_cnt; i++)
+        if (conv_long(c, NULL) != 0)
+            return -1;
+    return 0;
+}
+
+/* Returns the size of the data area the header describes or 0 if it does
+ * not fit into the file. */
+static size_t data_size(
+    const conv_t *c)
+{
+    size_t    room = c->src_len - c->src_pos;
+    size_t    size = 0, rra_size;
+    unsigned long i;
+
+    for (i = 0; i < c->rra_cnt; i++) {
+        if (c->ds_cnt > 0 && c->row_cnt[i] > room / 8 / c->ds_cnt)
+            return 0;
+        rra_size = c->row_cnt[i] * c->ds_cnt * sizeof(rrd_value_t);
+        if (c->layout == RRD_LAYOUT_COMPRESSED)
+            rra_size += (c->row_cnt[i] + c->block_rows - 1) / c->block_rows
+                * sizeof(block_head_t);
+        if (rra_size > room - size)
+            return 0;
+        size += rra_size;
+    }
+    return size;
+}
+
+static int conv_data(
+    conv_t *c)
+{
+    const unsigned char *src = c->src + c->src_pos;
+    unsigned char *dst = c->dst + c->dst_pos;
+    int       swap = c->src_abi.big_endian != c->dst_abi.big_endian;
+    size_t    size = data_size(c), i, rows, slot;
+    unsigned long rra_idx, row;
+    uint64_t  kind, len;
+
+    if (!swap) {
+        memcpy(dst, src, size);
+        return 0;
+    }
+    if (c->layout != RRD_LAYOUT_COMPRESSED) {
+        for (i = 0; i < size; i += 8)
+            swap_copy(dst + i, src + i, 8, 1);
+        return 0;
+    }
+    /* only the heads and the raw blocks depend on the byte order, the bit
+     * streams of the others are the same everywhere */
+    for (rra_idx = 0; rra_idx < c->rra_cnt; rra_idx++) {
+        for (row = 0; row < c->row_cnt[rra_idx]; row += c->block_rows) {
+            rows = min(c->block_rows, c->row_cnt[rra_idx] - row);
+            slot = rows * c->ds_cnt * sizeof(rrd_value_t);
+            kind = get_uint(src, 4, c->src_abi.big_endian);
+            len = get_uint(src + 4, 4, c->src_abi.big_endian);
+            swap_copy(dst, src, 4, 1);
+            swap_copy(dst + 4, src + 4, 4, 1);
+            src += sizeof(block_head_t);
+            dst += sizeof(block_head_t);
+            if (kind == BLOCK_RAW) {
+                if (len != slot) {
+                    rrd_set_error("damaged block in RRA %lu", rra_idx);
+                    return -1;
+                }
+                for (i = 0; i < slot; i += 8)
+                    swap_copy(dst + i, src + i, 8, 1);
+            } else
+                memcpy(dst, src, slot);
+            src += slot;
+            dst += slot;
+        }
+    }
+    return 0;
+}
+
+/* Walk the header as if the file had been written on a machine with abi.
+ * Returns the length of the header or 0 if it does not match the file. */
+static size_t try_abi(
+    const unsigned char *buf,
+    size_t len,
+    const rrd_abi_t *abi)
+{
+    conv_t    c;
+    size_t    header_len = 0;
+
+    memset(&c, 0, sizeof(c));
+    c.src_abi = *abi;
+    c.src = buf;
+    c.src_len = len;
+    c.dst_abi = *abi;
+    if (conv_header(&c) == 0 && c.src_pos + data_size(&c) == len)
+        header_len = c.src_pos;
+    free(c.row_cnt);
+    free(c.cf);
+    return header_len;
+}
+
+static int detect_abi(
+    const unsigned char *buf,
+    size_t len,
+    rrd_abi_t *abi)
+{
+    double    cookie;
+    uint64_t  bits;
+    int       big_endian, align, long_size, i;
+
+    for (big_endian = 0; big_endian < 2; big_endian++) {
+        for (align = 8; align >= 4; align -= 4) {
+            /* the float cookie follows the 9 bytes of cookie and version */
+            if (len < (size_t) round_up(9, align) + 8)
+                continue;
+            bits = get_uint(buf + round_up(9, align), 8, big_endian);
+            memcpy(&cookie, &bits, sizeof(cookie));
+            if (cookie != FLOAT_COOKIE)
+                continue;
+            abi->big_endian = big_endian;
+            abi->align8 = align;
+            for (long_size = 8; long_size >= 4; long_size -= 4) {
+                /* time_t mostly is as wide as long, so try that first */
+                for (i = 0; i < 2; i++) {
+                    abi->long_size = long_size;
+                    abi->time_size = i == 0 ? long_size : 12 - long_size;
+                    if (try_abi(buf, len, abi) > 0) {
+                        /* forget why the candidates before failed */
+                        rrd_clear_error();
+                        return 0;
+                    }
+                }
+            }
+        }
+    }
+    rrd_set_error("can't tell which architecture the RRD was created on");
+    return -1;
+}
+
+static int read_file(
+    int fd,
+    unsigned char **buf,
+    size_t *len)
+{
+    struct stat st;
+    ssize_t   got;
+    size_t    done = 0;
+
+    if (fstat(fd, &st) != 0) {
+        rrd_set_error("fstat: %s", rrd_strerror(errno));
+        return -1;
+    }
+    *len = st.st_size;
+    *buf = (unsigned char *) malloc(*len + 1);
+    if (*buf == NULL) {
+        rrd_set_error("out of memory");
+        return -1;
+    }
+    while (done < *len) {
+        got = read(fd, *buf + done, *len - done);
+        if (got <= 0) {
+            rrd_set_error("read: %s",
+                          got < 0 ? rrd_strerror(errno) : "short read");
+            return -1;
+        }
+        done += got;
+    }
+    return 0;
+}
+
+static int write_file(
+    const char *filename,
+    int fd,
+    const unsigned char *buf,
+    size_t len)
+{
+    char     *tmpfilename;
+    struct stat st;
+    ssize_t   put;
+    size_t    done = 0;
+    int       tmpfd, rc = -1;
+
+    tmpfilename = (char *) malloc(strlen(filename) + 7);
+    if (tmpfilename == NULL) {
+        rrd_set_error("out of memory");
+        return -1;
+    }
+    strcpy(tmpfilename, filename);
+    strcat(tmpfilename, "XXXXXX");
+    tmpfd = mkstemp(tmpfilename);
+    if (tmpfd < 0) {
+        rrd_set_error("Cannot create temporary file");
+        free(tmpfilename);
+        return -1;
+    }
+    while (done < len) {
+        put = write(tmpfd, buf + done, len - done);
+        if (put < 0) {
+            rrd_set_error("write: %s", rrd_strerror(errno));
+            goto done;
+        }
+        done += put;
+    }
+    if (fstat(fd, &st) == 0 && fchmod(tmpfd, st.st_mode) != 0) {
+        rrd_set_error("Cannot chmod temporary file!");
+        goto done;
+    }
+    if (fsync(tmpfd) != 0) {
+        rrd_set_error("fsync: %s", rrd_strerror(errno));
+        goto done;
+    }
+    if (rename(tmpfilename, filename) != 0) {
+        rrd_set_error("Cannot rename temporary file to final file!");
+        goto done;
+    }
+    rc = 0;
+  done:
+    close(tmpfd);
+    if (rc != 0)
+        unlink(tmpfilename);
+    free(tmpfilename);
+    return rc;
+}
+
+int rrd_convert_r(
+    const char *filename,
+    const char *target)
+{
+    conv_t    c;
+    unsigned char *buf = NULL;
+    size_t    len, size;
+    int       fd, rc = -1;
+
+    memset(&c, 0, sizeof(c));
+    if (parse_abi(target, &c.dst_abi) != 0)
+        return -1;
+    if (rrd_container_name(filename)) {
+        /* members are always written by this machine */
+        rrd_set_error("'%s' is a container member, only plain RRD files "
+                      "can be converted", filename);
+        return -1;
+    }
+#if defined(_WIN32) && !defined(__CYGWIN__) && !defined(__CYGWIN32__)
+    fd = open(filename, O_RDWR | O_BINARY);
+#else
+    fd = open(filename, O_RDWR);
+#endif
+    if (fd < 0) {
+        rrd_set_error("opening '%s': %s", filename, rrd_strerror(errno));
+        return -1;
+    }
+#ifndef _WIN32
+    {
+        /* keep writers out until the converted file is in place */
+        struct flock lock;
+
+        lock.l_type = F_WRLCK;
+        lock.l_len = 0;
+        lock.l_start = 0;
+        lock.l_whence = SEEK_SET;
+        if (fcntl(fd, F_SETLK, &lock) != 0) {
+            rrd_set_error("could not lock RRD");
+            goto done;
+        }
+    }
+#endif
+    if (read_file(fd, &buf, &len) != 0)
+        goto done;
+    if (len < 4 || memcmp(buf, RRD_COOKIE, sizeof(RRD_COOKIE)) != 0) {
+        rrd_set_error("'%s' is not an RRD file", filename);
+        goto done;
+    }
+    if (detect_abi(buf, len, &c.src_abi) != 0)
+        goto done;
+    if (same_abi(&c.src_abi, &c.dst_abi)) {
+        rc = 0;
+        goto done;
+    }
+
+    c.src = buf;
+    c.src_len = len;
+    /* the first pass only measures the result */
+    if (conv_header(&c) != 0)
+        goto done;
+    size = c.dst_pos + data_size(&c);
+    c.dst = (unsigned char *) calloc(size, 1);
+    if (c.dst == NULL) {
+        rrd_set_error("out of memory");
+        goto done;
+    }
+    free(c.row_cnt);
+    free(c.cf);
+    c.row_cnt = NULL;
+    c.cf = NULL;
+    c.src_pos = 0;
+    c.dst_pos = 0;
+    if (conv_header(&c) != 0 || conv_data(&c) != 0)
+        goto done;
+    rc = write_file(filename, fd, c.dst, size);
+  done:
+    close(fd);
+    free(buf);
+    free(c.dst);
+    free(c.row_cnt);
+    free(c.cf);
+    return rc;
+}
+
+int rrd_convert(
+    int argc,
+    const char **argv)
+{
+    struct optparse_long longopts[] = {
+        {"target", 't', OPTPARSE_REQUIRED},
+        {0},
+    };
+    struct optparse options;
+    int       opt;
+    const char *target = NULL;
+
+    optparse_init(&options, argc, argv);
+    while ((opt = optparse_long(&options, longopts, NULL)) != -1) {
+        switch (opt) {
+        case 't':
+            target = options.optarg;
+            break;
+        case '?':
+            rrd_set_error("%s", options.errmsg);
+            return -1;
+        }
+    }
+    if (options.optind >= options.argc) {
+        rrd_set_error("usage rrdtool %s [--target|-t native|portable|layout] "
+                      "file.rrd [file.rrd ...]", options.argv[0]);
+        return -1;
+    }
+    for (; options.optind < options.argc; options.optind++)
+        if (rrd_convert_r(options.argv[options.optind], target) != 0)
+            return -1;
+    return 0;
+}
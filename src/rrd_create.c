@@ -37,6 +37,7 @@
 #include "rrd_config.h"
 #include "rrd_create.h"
 #include "rrd_update.h"
+#include "rrd_container.h"
 
 #include "rrd_is_thread_safe.h"
 #include "rrd_modify.h"
@@ -85,6 +86,8 @@ int rrd_create(
         {"source", 'r', OPTPARSE_REQUIRED},
         {"template", 't', OPTPARSE_REQUIRED},
         {"no-overwrite", 'O', OPTPARSE_NONE},
+        {"layout", 'L', OPTPARSE_REQUIRED},
+        {"sparse", 'S', OPTPARSE_NONE},
         {0},
     };
     struct optparse options;
@@ -96,6 +99,8 @@ int rrd_create(
     int       rc = -1;
     char     *opt_daemon = NULL;
     int       opt_no_overwrite = 0;
+    int       opt_layout = RRD_LAYOUT_ROW;
+    int       opt_sparse = 0;
     GList    *sources = NULL;
     const char **sources_array = NULL;
     char     *template = NULL;
@@ -153,6 +158,25 @@ int rrd_create(
             opt_no_overwrite = 1;
             break;
 
+        case 'L':
+            if (strcmp(options.optarg, "row") == 0)
+                opt_layout = RRD_LAYOUT_ROW;
+            else if (strcmp(options.optarg, "column") == 0)
+                opt_layout = RRD_LAYOUT_COLUMN;
+            else if (strcmp(options.optarg, "compressed") == 0)
+                opt_layout = RRD_LAYOUT_COMPRESSED;
+            else {
+                rrd_set_error("unknown layout '%s', use row, column or "
+                              "compressed", options.optarg);
+                rc = -1;
+                goto done;
+            }
+            break;
+
+        case 'S':
+            opt_sparse = RRD_CREATE_SPARSE;
+            break;
+
         case 'r':{
             struct stat st;
 
@@ -228,7 +252,13 @@ int rrd_create(
         sources_array[n] = NULL;
     }
     rrdc_connect(opt_daemon);
-    if (rrdc_is_connected(opt_daemon)) {
+    if (rrdc_is_connected(opt_daemon) && opt_layout != RRD_LAYOUT_ROW) {
+        rrd_set_error("--layout can not be passed on to rrdcached");
+        rc = -1;
+    } else if (rrdc_is_connected(opt_daemon) && opt_sparse) {
+        rrd_set_error("--sparse can not be passed on to rrdcached");
+        rc = -1;
+    } else if (rrdc_is_connected(opt_daemon)) {
         rc = rrdc_create_r2(options.argv[options.optind],
                             pdp_step, last_up, opt_no_overwrite,
                             sources_array, template,
@@ -236,8 +266,9 @@ int rrd_create(
                             (const char **) (options.argv + options.optind +
                                              1));
     } else {
-        rc = rrd_create_r2(options.argv[options.optind],
+        rc = rrd_create_r3(options.argv[options.optind],
                            pdp_step, last_up, opt_no_overwrite,
+                           opt_layout | opt_sparse,
                            sources_array, template,
                            options.argc - options.optind - 1,
                            (const char **) (options.argv + options.optind +
@@ -835,6 +866,21 @@ int rrd_create_r2(
     const char *template,
     int argc,
     const char **argv)
+{
+    return rrd_create_r3(filename, pdp_step, last_up, no_overwrite,
+                         RRD_LAYOUT_ROW, sources, template, argc, argv);
+}
+
+int rrd_create_r3(
+    const char *filename,
+    unsigned long pdp_step,
+    time_t last_up,
+    int no_overwrite,
+    int layout,
+    const char **sources,
+    const char *template,
+    int argc,
+    const char **argv)
 {
     rrd_t     rrd;
     long      i;
@@ -845,6 +891,7 @@ int rrd_create_r2(
     mapping_t *mappings = NULL;
     int       mappings_cnt = 0;
     const char *require_version = NULL;
+    int       sparse = layout & RRD_CREATE_SPARSE;
 
     rrd_thread_init();
     /* clear any previous errors */
@@ -853,7 +900,20 @@ int rrd_create_r2(
     /* init rrd clean */
     rrd_init(&rrd);
 
-    if (no_overwrite && (stat(filename, &stat_buf) == 0)) {
+    layout &= ~RRD_CREATE_SPARSE;
+    if (sparse && sources != NULL) {
+        rrd_set_error("a sparse RRD can not be prefilled from sources");
+        goto done;
+    }
+
+    if (no_overwrite && rrd_container_name(filename)) {
+        int       exists = rrd_member_exists(filename);
+
+        if (exists == 1)
+            rrd_set_error("creating '%s': File exists", filename);
+        if (exists != 0)
+            goto done;
+    } else if (no_overwrite && (stat(filename, &stat_buf) == 0)) {
         rrd_set_error("creating '%s': File exists", filename);
         goto done;
     }
@@ -1012,12 +1072,34 @@ int rrd_create_r2(
             goto done;
         }
     }
+    if (layout == RRD_LAYOUT_COLUMN || layout == RRD_LAYOUT_COMPRESSED
+        || sparse) {
+        /* the layout flags are only looked at from version 6 on */
+        if (require_version == NULL
+            || atoi(require_version) < atoi(RRD_VERSION4)) {
+            /* before version 4 the smoothing window was fixed, keep it
+             * for the SEASONAL RRAs HWPREDICT created on its own */
+            for (i = 0; i < rrd.stat_head->rra_cnt; i++) {
+                enum cf_en cf = rrd_cf_conv(rrd.rra_def[i].cf_nam);
+
+                if (cf == CF_SEASONAL || cf == CF_DEVSEASONAL)
+                    rrd.rra_def[i].par[RRA_seasonal_smoothing_window].
+                        u_val = 0.05;
+            }
+        }
+        require_version = RRD_VERSION6;
+    } else if (layout != RRD_LAYOUT_ROW) {
+        rrd_set_error("unknown data layout %d", layout);
+        goto done;
+    }
     // parsing went well. ONLY THEN are we allowed to produce
     // additional side effects.
     if (require_version != NULL) {
-        strncpy(rrd.stat_head->version, require_version, 4);
-        rrd.stat_head->version[4] = '\0';
+        strcpy(rrd.stat_head->version, require_version);
     }
+    rrd.stat_head->par[SH_layout].u_cnt = layout;
+    if (layout == RRD_LAYOUT_COMPRESSED)
+        rrd.stat_head->par[SH_block_rows].u_cnt = rrd_block_rows(&rrd);
 
     if (rrd.stat_head->rra_cnt < 1) {
         rrd_set_error("you must define at least one Round Robin Archive");
@@ -1034,6 +1116,8 @@ int rrd_create_r2(
     if (!last_up_set && template_latest_last_up > 0 && sources == NULL) {
         rrd.live_head->last_up = template_latest_last_up;
     }
+    if (sparse)
+        rrd.stat_head->par[SH_sparse_since].u_cnt = rrd.live_head->last_up;
 
     rc = rrd_init_data(&rrd);
     if (rc != 0)
@@ -1374,7 +1458,9 @@ static int rrd_init_data(
         }
     }
 
-    if (rrd->rrd_value == NULL) {
+    /* a sparse RRD is written without any values in memory */
+    if (rrd->rrd_value == NULL
+        && rrd->stat_head->par[SH_sparse_since].u_cnt == 0) {
         unsigned long total_rows = 0, total_values;
 
         for (i = 0; i < rrd->stat_head->rra_cnt; i++) {
@@ -1418,6 +1504,11 @@ int write_rrd(
     }
 #endif
 
+    if (rrd_container_name(outfilename)) {
+        rc = rrd_member_write(outfilename, out, 0);
+        goto done;
+    }
+
     FILE     *fh = NULL;
 
     if (strcmp(outfilename, "-") == 0) {
@@ -1536,12 +1627,128 @@ int write_rrd(
     return rc;
 }
 
+/* Move on by len bytes, leaving a hole that reads as zero bytes, or write
+ * the zero bytes where fh can not seek. */
+static int skip_zeros(
+    FILE * fh,
+    size_t len)
+{
+    static const char zeros[4096];
+    size_t    chunk;
+
+    while (len > 0) {
+        chunk = min(len, 1UL << 30);
+        if (fseek(fh, (long) chunk, SEEK_CUR) != 0)
+            break;
+        len -= chunk;
+    }
+    while (len > 0) {
+        chunk = min(len, sizeof(zeros));
+        if (fwrite(zeros, 1, chunk, fh) != chunk)
+            return -1;
+        len -= chunk;
+    }
+    return 0;
+}
+
+static int write_unknown(
+    FILE * fh,
+    unsigned long cnt)
+{
+    rrd_value_t unknown[512];
+    unsigned long i, chunk;
+
+    for (i = 0; i < 512; i++)
+        unknown[i] = DNAN;
+    while (cnt > 0) {
+        chunk = min(cnt, 512);
+        if (fwrite(unknown, sizeof(rrd_value_t), chunk, fh) != chunk)
+            return -1;
+        cnt -= chunk;
+    }
+    return 0;
+}
+
+/* Write RRA rra_idx of an RRD created sparse, whose values are all
+ * unknown, leaving out what reads as unknown anyway. *hole tells if the
+ * RRA ends in a hole. */
+static int write_sparse_rra(
+    FILE * fh,
+    rrd_t *rrd,
+    unsigned long rra_idx,
+    int *hole)
+{
+    unsigned long row_cnt = rrd->rra_def[rra_idx].row_cnt;
+    unsigned long ds_cnt = rrd->stat_head->ds_cnt;
+    unsigned long block_rows, hot, block_cnt;
+    size_t    size = rrd_rra_data_size(rrd, rra_idx), slot;
+    block_head_t head;
+
+    *hole = 0;
+    if (rrd_layout(rrd) == RRD_LAYOUT_COMPRESSED) {
+        /* all blocks but the raw one of the current row are empty, and
+         * empty blocks are zero bytes */
+        block_rows = rrd->stat_head->par[SH_block_rows].u_cnt;
+        hot = rrd->rra_ptr[rra_idx].cur_row / block_rows;
+        block_cnt = min(block_rows, row_cnt - hot * block_rows);
+        slot = sizeof(block_head_t) + block_rows * ds_cnt
+            * sizeof(rrd_value_t);
+        head.kind = BLOCK_RAW;
+        head.len = (unsigned int) (block_cnt * ds_cnt * sizeof(rrd_value_t));
+        if (skip_zeros(fh, hot * slot) != 0
+            || fwrite(&head, sizeof(head), 1, fh) != 1
+            || write_unknown(fh, block_cnt * ds_cnt) != 0)
+            return -1;
+        size -= hot * slot + sizeof(head) + head.len;
+        *hole = size > 0;
+        return skip_zeros(fh, size);
+    }
+    if (rrd_sparse_rra(rrd, rra_idx)) {
+        *hole = size > 0;
+        return skip_zeros(fh, size);
+    }
+    return write_unknown(fh, row_cnt * ds_cnt);
+}
+
+/* Allocate the data area of an RRD created sparse, from data_start to the
+ * end of fh, without writing it. Updates store into the shared mapping,
+ * where the first store into a hole raises SIGBUS once the file system is
+ * full; this way create fails instead. Allocated blocks that were never
+ * written read as zero bytes all the same. A file system that can not
+ * allocate (EINVAL, as on ZFS) keeps the holes. */
+static int allocate_sparse(
+    FILE * fh,
+    long data_start)
+{
+#ifdef HAVE_POSIX_FALLOCATE
+    struct stat st;
+    int       fd = fileno(fh), fret;
+
+    /* a stream in memory or a pipe has no holes */
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)
+        || st.st_size <= data_start)
+        return 0;
+    fret = posix_fallocate(fd, data_start, st.st_size - data_start);
+    if (fret != 0 && fret != EINVAL) {
+        rrd_set_error("posix_fallocate: %s", rrd_strerror(fret));
+        return -1;
+    }
+#else
+    (void) fh;
+    (void) data_start;
+#endif
+    return 0;
+}
+
 int write_fh(
     FILE * fh,
     rrd_t *rrd)
 {
     unsigned int i;
     unsigned int rra_offset;
+    void     *packed = NULL;
+    int       hole = 0;
+    long      data_start = -1;
 
     if (atoi(rrd->stat_head->version) < 3) {
         /* we output 3 or higher */
@@ -1550,8 +1757,10 @@ int write_fh(
 
 #define FWRITE_CHECK(ptr, size, nitems, fp)                    \
     do {                                                       \
-        if (fwrite((ptr), (size), (nitems), (fp)) != (nitems)) \
+        if (fwrite((ptr), (size), (nitems), (fp)) != (nitems)) { \
+            free(packed);                                      \
             return (-1);                                       \
+        }                                                      \
     } while (0)
 
     FWRITE_CHECK(rrd->stat_head, sizeof(stat_head_t), 1, fh);
@@ -1566,22 +1775,52 @@ int write_fh(
     FWRITE_CHECK(rrd->rra_ptr, sizeof(rra_ptr_t), rrd->stat_head->rra_cnt,
                  fh);
 
+    if (rrd->rrd_value == NULL)
+        data_start = ftell(fh);
+
     /* calculate the number of rrd_values to dump */
     rra_offset = 0;
     for (i = 0; i < rrd->stat_head->rra_cnt; i++) {
         unsigned long num_rows = rrd->rra_def[i].row_cnt;
         unsigned long ds_cnt = rrd->stat_head->ds_cnt;
 
-        if (num_rows > 0) {
+        if (rrd->rrd_value == NULL) {
+            if (write_sparse_rra(fh, rrd, i, &hole) != 0) {
+                rrd_set_error("writing rrd values");
+                return (-1);
+            }
+        } else if (num_rows > 0 && rrd_layout(rrd) != RRD_LAYOUT_ROW) {
+            /* the values are kept in rows in memory */
+            size_t    size = rrd_rra_data_size(rrd, i);
+            void     *tmp = realloc(packed, size);
+
+            if (tmp == NULL) {
+                rrd_set_error("allocating rrd values");
+                free(packed);
+                return (-1);
+            }
+            packed = tmp;
+            rrd_pack_rra(rrd, i, rrd->rrd_value + rra_offset * ds_cnt,
+                         packed);
+            FWRITE_CHECK(packed, 1, size, fh);
+
+            rra_offset += num_rows;
+        } else if (num_rows > 0) {
             FWRITE_CHECK(rrd->rrd_value + rra_offset * ds_cnt,
                          sizeof(rrd_value_t), num_rows * ds_cnt, fh);
 
             rra_offset += num_rows;
         }
     }
+    free(packed);
 
+    /* a hole at the end only counts once something follows it */
+    if (hole && (fseek(fh, -1, SEEK_CUR) != 0 || fputc(0, fh) == EOF))
+        return (-1);
     if (fflush(fh) != 0)
         return (-1);
+    if (data_start >= 0 && allocate_sparse(fh, data_start) != 0)
+        return (-1);
 
     return (0);
 
@@ -1970,7 +1970,7 @@ struct fetch_parsed {
     rrd_value_t *data;
 
     unsigned long field_cnt;
-    unsigned int *field_idx;
+    char    **field_namv;
 };
 
 static void free_fetch_parsed(
@@ -1983,7 +1983,7 @@ static void free_fetch_parsed(
         rrd_freemem(parsed->ds_namv[i]);
     rrd_freemem(parsed->ds_namv);
     rrd_freemem(parsed->data);
-    rrd_freemem(parsed->field_idx);
+    rrd_freemem(parsed->field_namv);
 }
 
 static int handle_request_fetch_parse(
@@ -1993,12 +1993,21 @@ static int handle_request_fetch_parse(
     char     *pbuffile;
     char     *start_str;
     char     *end_str;
+    char     *field;
+    unsigned long i;
+    unsigned long max_rows = 0;
+    int       reduce = RRD_REDUCE_CF;
 
     time_t    t;
     int       status;
 
     parsed->file = NULL;
     parsed->cf = NULL;
+    parsed->ds_cnt = 0;
+    parsed->ds_namv = NULL;
+    parsed->data = NULL;
+    parsed->field_cnt = 0;
+    parsed->field_namv = NULL;
     start_str = NULL;
     end_str = NULL;
 
@@ -2099,76 +2108,82 @@ static int handle_request_fetch_parse(
         parsed->end_tm = t;
     }
 
-    parsed->step = -1;
-    parsed->ds_cnt = 0;
-    parsed->ds_namv = NULL;
-    parsed->data = NULL;
-
-    status = rrd_fetch_r(parsed->file, parsed->cf,
-                         &parsed->start_tm, &parsed->end_tm, &parsed->step,
-                         &parsed->ds_cnt, &parsed->ds_namv, &parsed->data);
-    if (status != 0) {
-        send_response(sock, RESP_ERR,
-                      "rrd_fetch_r failed: %s\n", rrd_get_error());
-        return -1;
-    }
-
-    parsed->steps = (parsed->end_tm - parsed->start_tm) / parsed->step;
-
-    /* prepare field index */
-    {
-        unsigned int i;
-        char     *field;
-
-        parsed->field_cnt = 0;
-        parsed->field_idx =
-            malloc(sizeof(*parsed->field_idx) * parsed->ds_cnt);
+    /* the names of the wanted fields, and maxrows=<n> and
+     * reduce=cf|minmax|lttb, which no DS name can be mistaken for */
+    while (buffer_get_field(&buffer, &buffer_size, &field) == 0) {
+        /* if the field is empty, then next */
+        if (field[0] == 0)
+            continue;
+        if (strncmp(field, "maxrows=", 8) == 0) {
+            char     *endptr = NULL;
 
-        /* now parse the extra names */
-        while (buffer_get_field(&buffer, &buffer_size, &field) == 0) {
-            /* check boundaries */
-            if (parsed->field_cnt >= parsed->ds_cnt) {
+            errno = 0;
+            max_rows = strtoul(field + 8, &endptr, 10);
+            if (!isdigit((unsigned char) field[8])
+                || (*endptr != 0) || (errno != 0)) {
                 free_fetch_parsed(parsed);
                 send_response(sock, RESP_ERR,
-                              "too many fields given - duplicates!\n");
+                              "Cannot parse `%s'\n", field);
                 return -1;
             }
-            /* if the field is empty, then next */
-            if (field[0] == 0)
-                continue;
-            /* try to find the string */
-            unsigned int found = parsed->ds_cnt;
-
-            for (i = 0; i < parsed->ds_cnt; i++) {
-                if (strcmp(field, parsed->ds_namv[i]) == 0) {
-                    found = i;
-                    break;
-                }
-            }
-            if (found >= parsed->ds_cnt) {
+            continue;
+        }
+        if (strncmp(field, "reduce=", 7) == 0) {
+            if (strcmp(field + 7, "cf") == 0)
+                reduce = RRD_REDUCE_CF;
+            else if (strcmp(field + 7, "minmax") == 0)
+                reduce = RRD_REDUCE_MINMAX;
+            else if (strcmp(field + 7, "lttb") == 0)
+                reduce = RRD_REDUCE_LTTB;
+            else {
                 free_fetch_parsed(parsed);
                 send_response(sock, RESP_ERR,
-                              "field %s not found in %s\n",
-                              field, parsed->file);
+                              "unknown reduction `%s'\n", field + 7);
                 return -1;
             }
-            for (i = 0; i < parsed->field_cnt; i++) {
-                if (parsed->field_idx[i] == found) {
-                    free_fetch_parsed(parsed);
-                    send_response(sock, RESP_ERR,
-                                  "field %s already used\n", field);
-                    return -1;
-                }
+            continue;
+        }
+        for (i = 0; i < parsed->field_cnt; i++) {
+            if (strcmp(parsed->field_namv[i], field) == 0) {
+                free_fetch_parsed(parsed);
+                send_response(sock, RESP_ERR,
+                              "field %s already used\n", field);
+                return -1;
             }
-            parsed->field_idx[parsed->field_cnt++] = found;
         }
-        if (parsed->field_cnt == 0) {
-            parsed->field_cnt = parsed->ds_cnt;
-            for (i = 0; i < parsed->field_cnt; i++) {
-                parsed->field_idx[i] = i;
+        if ((parsed->field_cnt % 16) == 0) {
+            char    **namv = realloc(parsed->field_namv,
+                                     sizeof(char *) * (parsed->field_cnt +
+                                                       16));
+
+            if (namv == NULL) {
+                free_fetch_parsed(parsed);
+                send_response(sock, RESP_ERR, "%s\n", rrd_strerror(ENOMEM));
+                return -1;
             }
+            parsed->field_namv = namv;
         }
+        parsed->field_namv[parsed->field_cnt++] = field;
     }
+
+    parsed->step = -1;
+
+    /* only the wanted fields are fetched, in the order they were given */
+    status = rrd_fetch_select_r(parsed->file, parsed->cf,
+                                &parsed->start_tm, &parsed->end_tm,
+                                &parsed->step, parsed->field_cnt,
+                                (const char *const *) parsed->field_namv,
+                                max_rows, reduce, &parsed->ds_cnt,
+                                &parsed->ds_namv, &parsed->data);
+    if (status != 0) {
+        free_fetch_parsed(parsed);
+        send_response(sock, RESP_ERR,
+                      "rrd_fetch_r failed: %s\n", rrd_get_error());
+        return -1;
+    }
+
+    parsed->steps = (parsed->end_tm - parsed->start_tm) / parsed->step;
+    parsed->field_cnt = parsed->ds_cnt;
     return 0;
 }
 
@@ -2197,7 +2212,7 @@ static int handle_request_fetch(
     add_response_info(sock, "DSName: ");
     for (i = 0; i < parsed.field_cnt; i++) {
         add_response_info(sock, (i == 0 ? "%s" : " %s"),
-                          parsed.ds_namv[parsed.field_idx[i]]);
+                          parsed.ds_namv[i]);
     }
     add_response_info(sock, "\n");
 
@@ -2207,7 +2222,7 @@ static int handle_request_fetch(
          t <= parsed.end_tm; t += parsed.step, j++) {
         add_response_info(sock, "%10lu:", (unsigned long) t);
         for (i = 0; i < parsed.field_cnt; i++) {
-            unsigned int idx = j * parsed.ds_cnt + parsed.field_idx[i];
+            unsigned int idx = j * parsed.ds_cnt + i;
 
             add_response_info(sock, " %0.17e", parsed.data[idx]);
         }
@@ -2255,14 +2270,14 @@ static int handle_request_fetchbin(
     for (i = 0; i < parsed.field_cnt; i++) {
         for (t = parsed.start_tm + parsed.step, j = 0;
              t <= parsed.end_tm; t += parsed.step, j++) {
-            unsigned int idx = j * parsed.ds_cnt + parsed.field_idx[i];
+            unsigned int idx = j * parsed.ds_cnt + i;
 
             dbuffer[j] = parsed.data[idx];
         }
 
         add_binary_response_info(sock,
                                  "DSName-",
-                                 parsed.ds_namv[parsed.field_idx[i]],
+                                 parsed.ds_namv[i],
                                  dbuffer, parsed.steps, sizeof(double)
             );
     }
@@ -3080,14 +3095,18 @@ static command_t list_of_commands[] = { /* {{{ */
      "FETCH",
      handle_request_fetch,
      CMD_CONTEXT_CLIENT,
-     "FETCH <file> <CF> [<start> [<end>] [<column>...]]\n",
-     "The 'FETCH' can be used by the client to retrieve values from an RRD file.\n"},
+     "FETCH <file> <CF> [<start> [<end>] [<column>...] [maxrows=<n>]\n"
+     "    [reduce=cf|minmax|lttb]]\n",
+     "The 'FETCH' can be used by the client to retrieve values from an RRD file.\n"
+     "With maxrows, rows are combined until there are no more than <n>.\n"},
     {
      "FETCHBIN",
      handle_request_fetchbin,
      CMD_CONTEXT_CLIENT,
-     "FETCHBIN <file> <CF> [<start> [<end>] [<column>...]]\n",
-     "The 'FETCHBIN' can be used by the client to retrieve values from an RRD file.\n"},
+     "FETCHBIN <file> <CF> [<start> [<end>] [<column>...] [maxrows=<n>]\n"
+     "    [reduce=cf|minmax|lttb]]\n",
+     "The 'FETCHBIN' can be used by the client to retrieve values from an RRD file.\n"
+     "With maxrows, rows are combined until there are no more than <n>.\n"},
     {
      "INFO",
      handle_request_info,
@@ -7,9 +7,77 @@
  *****************************************************************************/
 
 #include <ctype.h>
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
 #include "rrd_tool.h"
 #include "rrd_strtod.h"
 
+/* Split a reading into sign and magnitude, skipping leading garbage and
+ * stopping at the first non digit exactly like the string code below.
+ * Returns 0 if there are no digits or the magnitude does not fit into
+ * 64 bits, in which case the caller has to fall back to string math. */
+static int diff_parse(
+    const char *s,
+    int *neg,
+    uint64_t *mag)
+{
+    unsigned  d, len = 0;
+
+    *neg = 0;
+    while (!(isdigit((int) *s) || *s == 0)) {
+        if (*s == '-')
+            *neg = 1;
+        s++;
+    }
+    if (!isdigit((int) *s))
+        return 0;
+    for (*mag = 0; isdigit((int) *s); s++) {
+        d = *s - '0';
+        if (*mag > (UINT64_MAX - d) / 10 || ++len > LAST_DS_LEN)
+            return 0;
+        *mag = *mag * 10 + d;
+    }
+    return 1;
+}
+
+/* Subtract two readings given as sign and magnitude. Returns 0 if the
+ * result does not fit into 64 bits. */
+static int diff_native(
+    int a_sign,
+    uint64_t a_mag,
+    int b_sign,
+    uint64_t b_mag,
+    double *result)
+{
+    if (a_sign == b_sign) {
+        *result = a_mag >= b_mag ? (double) (a_mag - b_mag)
+            : -(double) (b_mag - a_mag);
+    } else if (a_mag + b_mag >= a_mag) {
+        *result = (double) (a_mag + b_mag);
+    } else {
+        return 0;
+    }
+    if (a_sign)
+        *result = -*result;
+    return 1;
+}
+
+/* The increase of a counter from b to a, see rrd_diff_counter() */
+static double counter_native(
+    uint64_t a_mag,
+    uint64_t b_mag)
+{
+    uint64_t  drop;
+
+    if (a_mag >= b_mag)
+        return (double) (a_mag - b_mag);
+    drop = b_mag - a_mag;
+    if (drop <= UINT32_MAX)
+        return (double) (UINT32_MAX - drop);
+    return (double) (UINT64_MAX - drop);
+}
+
 double rrd_diff(
     char *a,
     char *b)
@@ -18,6 +86,13 @@ double rrd_diff(
     int       c, x, m;
     char      a_neg = 0, b_neg = 0;
     double    result;
+    int       a_sign, b_sign;
+    uint64_t  a_mag, b_mag;
+
+    /* readings fitting into 64 bits are the norm, diff them natively */
+    if (diff_parse(a, &a_sign, &a_mag) && diff_parse(b, &b_sign, &b_mag)
+        && diff_native(a_sign, a_mag, b_sign, b_mag, &result))
+        return result;
 
     while (!(isdigit((int) *a) || *a == 0)) {
         if (*a == '-')
@@ -100,3 +175,52 @@ double rrd_diff(
 
     return result;
 }
+
+/* Like rrd_diff() but for COUNTER readings: a decrease is taken as a
+ * wrap of a 32 bit counter, or of a 64 bit one if the drop is too large
+ * for 32 bits. This will fail terribly for non 32 or 64 bit counters
+ * ... are there any others in SNMP land? */
+double rrd_diff_counter(
+    char *a,
+    char *b)
+{
+    int       a_sign, b_sign;
+    uint64_t  a_mag, b_mag;
+    double    result;
+
+    if (diff_parse(a, &a_sign, &a_mag) && diff_parse(b, &b_sign, &b_mag)
+        && !a_sign && !b_sign)
+        return counter_native(a_mag, b_mag);
+    result = rrd_diff(a, b);
+    if (result < (double) 0.0)
+        result += (double) 4294967295.0;    /* 2^32-1 */
+    if (result < (double) 0.0)
+        result += (double) 18446744069414584320.0;  /* 2^64-2^32 */
+    return result;
+}
+
+/* rrd_diff() or, if counter is set, rrd_diff_counter() for readings that
+ * are already numbers. a and b must be integral. The result is the same
+ * as diffing their decimal representations, with b truncated the way it
+ * would be when stored in pdp_prep_t.last_ds. */
+double rrd_diff_values(
+    double a,
+    double b,
+    int counter)
+{
+    char      a_str[DBL_MAX_10_EXP + 3], b_str[LAST_DS_LEN];
+    double    result;
+
+    if (fabs(a) < 18446744073709551616.0 && fabs(b) < 18446744073709551616.0) {
+        if (!counter) {
+            if (diff_native(a < 0, (uint64_t) fabs(a), b < 0,
+                            (uint64_t) fabs(b), &result))
+                return result;
+        } else if (a >= 0 && b >= 0) {
+            return counter_native((uint64_t) a, (uint64_t) b);
+        }
+    }
+    snprintf(a_str, sizeof(a_str), "%.0f", a);
+    snprintf(b_str, sizeof(b_str), "%.0f", b);
+    return counter ? rrd_diff_counter(a_str, b_str) : rrd_diff(a_str, b_str);
+}
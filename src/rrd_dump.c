@@ -62,8 +62,7 @@ int rrd_dump_cb_r(
     unsigned int i, ii, ix, iii = 0;
     time_t    now;
     char      somestring[255];
-    rrd_value_t my_cdp;
-    off_t     rra_base, rra_start, rra_next;
+    rrd_value_t *my_cdp = NULL;
     rrd_file_t *rrd_file;
     rrd_t     rrd;
     rrd_value_t value;
@@ -121,6 +120,11 @@ int rrd_dump_cb_r(
     } else {
         CB_FMTS("\t<version>%s</version>\n", rrd.stat_head->version);
     }
+    if (rrd_layout(&rrd) == RRD_LAYOUT_COLUMN) {
+        CB_PUTS("\t<layout>column</layout>\n");
+    } else if (rrd_layout(&rrd) == RRD_LAYOUT_COMPRESSED) {
+        CB_PUTS("\t<layout>compressed</layout>\n");
+    }
     
     CB_FMTS("\t<step>%lu</step> <!-- Seconds -->\n",
         rrd.stat_head->pdp_step);
@@ -198,17 +202,21 @@ int rrd_dump_cb_r(
 
     CB_PUTS("\t<!-- Round Robin Archives -->\n");
 
-    rra_base = rrd_file->header_len;
-    rra_next = rra_base;
+    /* rows are read one by one so that the layout of the file does not
+     * matter here */
+    my_cdp = (rrd_value_t *) malloc(rrd.stat_head->ds_cnt
+                                    * sizeof(rrd_value_t));
+    if (my_cdp == NULL) {
+        rrd_set_error("allocating dump row buffer");
+        rrd_free(&rrd);
+        rrd_close(rrd_file);
+        return (-1);
+    }
 
     for (i = 0; i < rrd.stat_head->rra_cnt; i++) {
 
         long      timer = 0;
 
-        rra_start = rra_next;
-        rra_next += (rrd.stat_head->ds_cnt
-                     * rrd.rra_def[i].row_cnt * sizeof(rrd_value_t));
-
         CB_PUTS("\t<rra>\n");
 
         CB_FMTS("\t\t<cf>%s</cf>\n", rrd.rra_def[i].cf_nam);
@@ -407,15 +415,11 @@ int rrd_dump_cb_r(
         CB_PUTS("\t\t</cdp_prep>\n");
 
         CB_PUTS("\t\t<database>\n");
-        rrd_seek(rrd_file, (rra_start + (rrd.rra_ptr[i].cur_row + 1)
-                            * rrd.stat_head->ds_cnt
-                            * sizeof(rrd_value_t)), SEEK_SET);
         timer = -(long)(rrd.rra_def[i].row_cnt - 1);
         ii = rrd.rra_ptr[i].cur_row;
         for (ix = 0; ix < rrd.rra_def[i].row_cnt; ix++) {
             ii++;
             if (ii >= rrd.rra_def[i].row_cnt) {
-                rrd_seek(rrd_file, rra_start, SEEK_SET);
                 ii = 0; /* wrap if max row cnt is reached */
             }
             now = (rrd.live_head->last_up
@@ -431,12 +435,15 @@ int rrd_dump_cb_r(
 # error "Need strftime"
 #endif
             CB_FMTS("\t\t\t<!-- %s / %lld --> <row>",  somestring, (long long int) now);
+            if (rrd_read_rows(rrd_file, &rrd, i, ii, 1, my_cdp) != 0) {
+                rrd_set_error("reading rra %u of '%s'", i, filename);
+                goto err_free;
+            }
             for (iii = 0; iii < rrd.stat_head->ds_cnt; iii++) {
-                rrd_read(rrd_file, &my_cdp, sizeof(rrd_value_t) * 1);
-                if (isnan(my_cdp)) {
+                if (isnan(my_cdp[iii])) {
                     CB_PUTS("<v>NaN</v>");
                 } else {
-                    CB_FMTS("<v>%0.10e</v>", my_cdp);
+                    CB_FMTS("<v>%0.10e</v>", my_cdp[iii]);
                 }
             }
             CB_PUTS("</row>\n");
@@ -446,12 +453,15 @@ int rrd_dump_cb_r(
 
     CB_PUTS("</rrd>\n");
 
+    free(my_cdp);
     rrd_free(&rrd);
 
     return rrd_close(rrd_file);
 
 err_out:
     rrd_set_error("error writing output file: %s", rrd_strerror(errno));
+err_free:
+    free(my_cdp);
     rrd_free(&rrd);
     rrd_close(rrd_file);
     return (-1);
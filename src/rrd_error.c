@@ -129,6 +129,7 @@ rrd_context_t *rrd_new_context(
 
     rrd_ctx->rrd_error[0] = '\0';
     rrd_ctx->lib_errstr[0] = '\0';
+    rrd_ctx->graph_ctx = NULL;
     return rrd_ctx;
 }
 
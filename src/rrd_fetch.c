@@ -59,24 +59,44 @@
 
 /* #define DEBUG  */
 
-int rrd_fetch(
+/* what the command line of rrdtool fetch asks for */
+typedef struct fetch_args_t {
+    const char *filename;
+    const char *cf;
+    char     *daemon;
+    char     *columns;  /* the --columns argument, cut up into want */
+    const char **want;
+    unsigned long want_cnt;
+    unsigned long max_rows;
+    int       reduce;
+} fetch_args_t;
+
+static void fetch_free_args(
+    fetch_args_t *args)
+{
+    free(args->daemon);
+    free(args->columns);
+    free(args->want);
+}
+
+/*
+ * Parse the arguments of rrdtool fetch into args and the wish parameters.
+ * args has to be released with fetch_free_args whatever this returns.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int fetch_parse_args(
     int argc,
     const char **argv,
     time_t *start,
-    time_t *end,        /* which time frame do you want ?
-                         * will be changed to represent reality */
-    unsigned long *step,    /* which stepsize do you want? 
-                             * will be changed to represent reality */
-    unsigned long *ds_cnt,  /* number of data sources in file */
-    char ***ds_namv,    /* names of data sources */
-    rrd_value_t **data)
-{                       /* two dimensional array containing the data */
+    time_t *end,
+    unsigned long *step,
+    fetch_args_t *args)
+{
     unsigned long step_tmp = 1;
     time_t    start_tmp = 0, end_tmp = 0;
-    const char *cf;
-    char *opt_daemon = NULL;
     int align_start = 0;
-    int status;
+    char *col, *saveptr;
 
     rrd_time_value_t start_tv, end_tv;
     const char *parsetime_error = NULL;
@@ -86,11 +106,17 @@ int rrd_fetch(
         {"end", 'e', OPTPARSE_REQUIRED},
         {"align-start", 'a', OPTPARSE_NONE},
         {"daemon", 'd', OPTPARSE_REQUIRED},
+        {"columns", 'c', OPTPARSE_REQUIRED},
+        {"max-rows", 'm', OPTPARSE_REQUIRED},
+        {"reduce", 'R', OPTPARSE_REQUIRED},
         {0},
     };
     struct optparse options;
     int opt;
 
+    memset(args, 0, sizeof(*args));
+    args->reduce = RRD_REDUCE_CF;
+
     /* init start and end time */
     rrd_parsetime("end-24h", &start_tv);
     rrd_parsetime("now", &end_tv);
@@ -101,18 +127,12 @@ int rrd_fetch(
         case 's':
             if ((parsetime_error = rrd_parsetime(options.optarg, &start_tv))) {
                 rrd_set_error("start time: %s", parsetime_error);
-                if (opt_daemon != NULL) {
-                    free(opt_daemon);
-                }
                 return -1;
             }
             break;
         case 'e':
             if ((parsetime_error = rrd_parsetime(options.optarg, &end_tv))) {
                 rrd_set_error("end time: %s", parsetime_error);
-                if (opt_daemon != NULL) {
-                    free(opt_daemon);
-                }
                 return -1;
             }
             break;
@@ -122,48 +142,81 @@ int rrd_fetch(
         case 'r':
             if ((parsetime_error = rrd_scaled_duration(options.optarg, 1, &step_tmp))) {
                 rrd_set_error("resolution: %s", parsetime_error);
-                if (opt_daemon != NULL) {
-                    free(opt_daemon);
-                }
                 return -1;
             }
             break;
 
         case 'd':
-            if (opt_daemon != NULL) {
-                free (opt_daemon);
+            if (args->daemon != NULL) {
+                free (args->daemon);
             }
-            opt_daemon = strdup(options.optarg);
-            if (opt_daemon == NULL)
+            args->daemon = strdup(options.optarg);
+            if (args->daemon == NULL)
             {
                 rrd_set_error ("strdup failed.");
                 return -1;
             }
             break;
 
+        case 'c':
+            free(args->columns);
+            free(args->want);
+            args->want = NULL;
+            args->want_cnt = 0;
+            if ((args->columns = strdup(options.optarg)) == NULL
+                || (args->want = (const char **)
+                    malloc((strlen(args->columns) / 2 + 1)
+                           * sizeof(char *))) == NULL) {
+                rrd_set_error("strdup failed.");
+                return -1;
+            }
+            for (col = strtok_r(args->columns, ",", &saveptr); col != NULL;
+                 col = strtok_r(NULL, ",", &saveptr))
+                args->want[args->want_cnt++] = col;
+            break;
+
+        case 'm':{
+            char     *endptr = NULL;
+
+            /* strtoul takes "-1" for ULONG_MAX */
+            errno = 0;
+            args->max_rows = strtoul(options.optarg, &endptr, 10);
+            if (!isdigit((unsigned char) options.optarg[0])
+                || (*endptr != 0) || (errno != 0) || args->max_rows < 1) {
+                rrd_set_error("max-rows: '%s' is not a positive number",
+                              options.optarg);
+                return -1;
+            }
+            break;
+        }
+
+        case 'R':
+            if (strcmp(options.optarg, "cf") == 0)
+                args->reduce = RRD_REDUCE_CF;
+            else if (strcmp(options.optarg, "minmax") == 0)
+                args->reduce = RRD_REDUCE_MINMAX;
+            else if (strcmp(options.optarg, "lttb") == 0)
+                args->reduce = RRD_REDUCE_LTTB;
+            else {
+                rrd_set_error("unknown reduction '%s'", options.optarg);
+                return -1;
+            }
+            break;
+
         case '?':
             rrd_set_error("%s", options.errmsg);
-            if (opt_daemon != NULL) {
-            	free(opt_daemon);
-            }
             return -1;
         }
     }
 
 
     if (rrd_proc_start_end(&start_tv, &end_tv, &start_tmp, &end_tmp) == -1) {
-        if (opt_daemon != NULL) {
-            free(opt_daemon);
-        }
         return -1;
     }
 
     if (start_tmp < 3600 * 24 * 365 * 10) {
         rrd_set_error("the first entry to fetch should be after 1980");
-        if (opt_daemon != NULL) {
-            free(opt_daemon);
-        }
-        return (-1);
+        return -1;
     }
 
     if (align_start) {
@@ -175,10 +228,7 @@ int rrd_fetch(
     if (end_tmp < start_tmp) {
         rrd_set_error("start (%ld) should be less than end (%ld)", start_tmp,
                       end_tmp);
-        if (opt_daemon != NULL) {
-            free(opt_daemon);
-        }
-        return (-1);
+        return -1;
     }
 
     *start = start_tmp;
@@ -187,26 +237,54 @@ int rrd_fetch(
 
     if (options.optind + 1 >= options.argc) {
         rrd_set_error("Usage: rrdtool %s <file> <CF> [options]", options.argv[0]);
-        if (opt_daemon != NULL) {
-            free(opt_daemon);
-        }
         return -1;
     }
 
-    cf = options.argv[options.optind + 1];
+    args->filename = options.argv[options.optind];
+    args->cf = options.argv[options.optind + 1];
+    return 0;
+}
 
-    rrdc_connect (opt_daemon);
-    if (rrdc_is_connected (opt_daemon))
-	    status = rrdc_fetch (options.argv[options.optind],
-			    cf, start, end, step, ds_cnt, ds_namv, data);
+/* fetch what args ask for, through rrdcached if there is one */
+static int fetch_run_args(
+    const fetch_args_t *args,
+    time_t *start,
+    time_t *end,
+    unsigned long *step,
+    unsigned long *ds_cnt,
+    char ***ds_namv,
+    rrd_value_t **data)
+{
+    rrdc_connect (args->daemon);
+    if (rrdc_is_connected (args->daemon))
+	    return rrdc_fetch_select (args->filename, args->cf, start, end,
+			    step, args->want_cnt, args->want, args->max_rows,
+			    args->reduce, ds_cnt, ds_namv, data);
 
-    else
-	    status = rrd_fetch_r(options.argv[options.optind],
-			    cf, start, end, step, ds_cnt, ds_namv, data);
+    return rrd_fetch_select_r(args->filename, args->cf, start, end, step,
+			    args->want_cnt, args->want, args->max_rows,
+			    args->reduce, ds_cnt, ds_namv, data);
+}
 
-    if (opt_daemon != NULL) {
-    	free(opt_daemon);
-    }
+int rrd_fetch(
+    int argc,
+    const char **argv,
+    time_t *start,
+    time_t *end,        /* which time frame do you want ?
+                         * will be changed to represent reality */
+    unsigned long *step,    /* which stepsize do you want? 
+                             * will be changed to represent reality */
+    unsigned long *ds_cnt,  /* number of data sources in file */
+    char ***ds_namv,    /* names of data sources */
+    rrd_value_t **data)
+{                       /* two dimensional array containing the data */
+    fetch_args_t args;
+    int status = -1;
+
+    if (fetch_parse_args(argc, argv, start, end, step, &args) == 0)
+        status = fetch_run_args(&args, start, end, step, ds_cnt, ds_namv,
+                                data);
+    fetch_free_args(&args);
     if (status != 0)
         return (-1);
     return (0);
@@ -274,75 +352,42 @@ int rrd_fetch_empty(
     return (0);
 }
 
-int rrd_fetch_fn(
-    const char *filename,   /* name of the rrd */
-    enum cf_en cf_idx,  /* which consolidation function ? */
-    time_t *start,
-    time_t *end,        /* which time frame do you want ?
-                         * will be changed to represent reality */
-    unsigned long *step,    /* which stepsize do you want? 
-                             * will be changed to represent reality */
-    unsigned long *ds_cnt,  /* number of data sources in file */
-    char ***ds_namv,    /* names of data_sources */
-    rrd_value_t **data)
-{                       /* two dimensional array containing the data */
-    long      i, ii;
-    time_t    cal_start, cal_end, rra_start_time, rra_end_time;
-    long      best_full_rra = 0, best_part_rra = 0, chosen_rra =
-        0, rra_pointer = 0;
+/* where the rows of a fetch come from */
+typedef struct fetch_layout_t {
+    long      rra_idx;  /* the chosen RRA */
+    unsigned long pad_before;   /* unknown rows in front of the data */
+    unsigned long seg_row[2];   /* first RRA row of each segment */
+    unsigned long seg_rows[2];  /* rows in each segment, the second one
+                                 * starts at row 0 after the wrap */
+    unsigned long pad_after;    /* unknown rows behind the data */
+} fetch_layout_t;
+
+/* what a view on a file keeps alive until it is released */
+typedef struct fetch_view_pvt_t {
+    rrd_t     rrd;
+    rrd_file_t *rrd_file;
+    rrd_value_t *copy;  /* the rows, if they could not be mapped */
+} fetch_view_pvt_t;
+
+static long fetch_choose_rra(
+    rrd_t *rrd,
+    enum cf_en cf_idx,
+    time_t start,
+    time_t end,
+    unsigned long step)
+{
+    long      i;
+    time_t    cal_start, cal_end;
+    long      best_full_rra = 0, best_part_rra = 0;
     long      best_full_step_diff = 0, best_part_step_diff =
         0, tmp_step_diff = 0, tmp_match = 0, best_match = 0;
-    long      full_match, rra_base;
-    off_t     start_offset, end_offset;
+    long      full_match;
     int       first_full = 1;
     int       first_part = 1;
-    rrd_t     rrd;
-    rrd_file_t *rrd_file;
-    rrd_value_t *data_ptr;
-    unsigned long rows;
-
-#ifdef DEBUG
-    fprintf(stderr, "Entered rrd_fetch_fn() searching for the best match\n");
-    fprintf(stderr, "Looking for: start %10lu end %10lu step %5lu\n",
-            *start, *end, *step);
-#endif
-
-#ifdef HAVE_LIBDBI
-    /* handle libdbi datasources */
-    if (strncmp("sql//",filename,5)==0 || strncmp("sql||",filename,5)==0) {
-	return rrd_fetch_fn_libdbi(filename,cf_idx,start,end,step,ds_cnt,ds_namv,data);
-    }
-#endif
-    if (strncmp("cb//",filename,4)==0) {
-	return rrd_fetch_fn_cb(filename,cf_idx,start,end,step,ds_cnt,ds_namv,data);
-    }
-
-    rrd_init(&rrd);
-    rrd_file = rrd_open(filename, &rrd, RRD_READONLY | RRD_LOCK);
-    if (rrd_file == NULL)
-        goto err_free;
-
-    /* when was the really last update of this file ? */
-
-    if (((*ds_namv) =
-         (char **) malloc(rrd.stat_head->ds_cnt * sizeof(char *))) == NULL) {
-        rrd_set_error("malloc fetch ds_namv array");
-        goto err_close;
-    }
-
-    for (i = 0; (unsigned long) i < rrd.stat_head->ds_cnt; i++) {
-        if ((((*ds_namv)[i]) = (char*)malloc(sizeof(char) * DS_NAM_SIZE)) == NULL) {
-            rrd_set_error("malloc fetch ds_namv entry");
-            goto err_free_ds_namv;
-        }
-        strncpy((*ds_namv)[i], rrd.ds_def[i].ds_nam, DS_NAM_SIZE);
-        (*ds_namv)[i][DS_NAM_SIZE - 1] = '\0';
-
-    }
 
     /* find the rra which best matches the requirements */
-    for (i = 0; (unsigned) i < rrd.stat_head->rra_cnt; i++) {
-      enum cf_en rratype=rrd_cf_conv(rrd.rra_def[i].cf_nam);
+    for (i = 0; (unsigned) i < rrd->stat_head->rra_cnt; i++) {
+      enum cf_en rratype=rrd->__desc->cf[i];
       /* handle this RRA */
       if (
 	  /* if we found a direct match */
@@ -353,7 +398,7 @@ int rrd_fetch_fn(
 	  */
 	  ( 
 	      /* only if we are on interval 1 */
-	      (rrd.rra_def[i].pdp_cnt==1) 
+	      (rrd->rra_def[i].pdp_cnt==1) 
 	      && ( 
 		  /* and requested CF is MIN,MAX,AVERAGE,LAST */
 		  (cf_idx == CF_MINIMUM)
@@ -371,29 +416,29 @@ int rrd_fetch_fn(
 	      )
 	  ){
 
-            cal_end = (rrd.live_head->last_up - (rrd.live_head->last_up
-                                                 % (rrd.rra_def[i].pdp_cnt
+            cal_end = (rrd->live_head->last_up - (rrd->live_head->last_up
+                                                 % (rrd->rra_def[i].pdp_cnt
                                                     *
-                                                    rrd.stat_head->
+                                                    rrd->stat_head->
                                                     pdp_step)));
             cal_start =
                 (cal_end -
-                 (rrd.rra_def[i].pdp_cnt * rrd.rra_def[i].row_cnt *
-                  rrd.stat_head->pdp_step));
+                 (rrd->rra_def[i].pdp_cnt * rrd->rra_def[i].row_cnt *
+                  rrd->stat_head->pdp_step));
 
-            full_match = *end - *start;
+            full_match = end - start;
 #ifdef DEBUG
             fprintf(stderr, "Considering: start %10lu end %10lu step %5lu ",
                     cal_start, cal_end,
-                    rrd.stat_head->pdp_step * rrd.rra_def[i].pdp_cnt);
+                    rrd->stat_head->pdp_step * rrd->rra_def[i].pdp_cnt);
 #endif
             /* we need step difference in either full or partial case */
             tmp_step_diff =
-                labs((long) *step -
-                     ((long) rrd.stat_head->pdp_step *
-                      (long) rrd.rra_def[i].pdp_cnt));
+                labs((long) step -
+                     ((long) rrd->stat_head->pdp_step *
+                      (long) rrd->rra_def[i].pdp_cnt));
             /* best full match */
-            if (cal_start <= *start) {
+            if (cal_start <= start) {
                 if (first_full || (tmp_step_diff < best_full_step_diff)) {
                     first_full = 0;
                     best_full_step_diff = tmp_step_diff;
@@ -408,8 +453,8 @@ int rrd_fetch_fn(
             } else {
                 /* best partial match */
                 tmp_match = full_match;
-                if (cal_start > *start)
-                    tmp_match -= (cal_start - *start);
+                if (cal_start > start)
+                    tmp_match -= (cal_start - start);
                 if (first_part ||
                     (best_match < tmp_match) ||
                     (best_match == tmp_match &&
@@ -432,25 +477,45 @@ int rrd_fetch_fn(
 
     /* lets see how the matching went. */
     if (first_full == 0)
-        chosen_rra = best_full_rra;
-    else if (first_part == 0)
-        chosen_rra = best_part_rra;
-    else {
-        rrd_set_error
-            ("the RRD does not contain an RRA matching the chosen CF");
-        goto err_free_all_ds_namv;
-    }
+        return best_full_rra;
+    if (first_part == 0)
+        return best_part_rra;
+    rrd_set_error("the RRD does not contain an RRA matching the chosen CF");
+    return -1;
+}
+
+/*
+ * Choose the RRA for a fetch, set the wish parameters to their real
+ * values and work out which rows of the RRA make up the answer.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int fetch_plan(
+    rrd_t *rrd,
+    enum cf_en cf_idx,
+    time_t *start,
+    time_t *end,
+    unsigned long *step,
+    fetch_layout_t *layout)
+{
+    time_t    rra_start_time, rra_end_time;
+    long long start_offset, end_offset, first, last, rows;
+    unsigned long row_cnt;
+    long      rra_idx;
+
+    if ((rra_idx = fetch_choose_rra(rrd, cf_idx, *start, *end, *step)) < 0)
+        return -1;
+    row_cnt = rrd->rra_def[rra_idx].row_cnt;
 
     /* set the wish parameters to their real values */
-    *step = rrd.stat_head->pdp_step * rrd.rra_def[chosen_rra].pdp_cnt;
+    *step = rrd->__desc->rra_step[rra_idx];
     *start -= (*start % *step);
     *end += (*step - *end % *step);
-    rows = (*end - *start) / *step + 1;
 
 #ifdef DEBUG
     fprintf(stderr,
             "We found:    start %10lu end %10lu step %5lu rows  %lu\n",
-            *start, *end, *step, rows);
+            *start, *end, *step, (*end - *start) / *step + 1);
 #endif
 
 /* Start and end are now multiples of the step size.  The amount of
@@ -459,115 +524,194 @@ int rrd_fetch_fn(
 ** we need exactly ((t+s)-t)/s rows.  The row to collect from the
 ** database is the one with time stamp (t+s) which means t to t+s.
 */
-    *ds_cnt = rrd.stat_head->ds_cnt;
-    if (((*data) = (rrd_value_t*)malloc(*ds_cnt * rows * sizeof(rrd_value_t))) == NULL) {
-        rrd_set_error("malloc fetch data area");
-        goto err_free_all_ds_namv;
-    }
-
-    data_ptr = (*data);
-
-    /* find base address of rra */
-    rra_base = rrd_file->header_len;
-    for (i = 0; i < chosen_rra; i++)
-        rra_base += (*ds_cnt * rrd.rra_def[i].row_cnt * sizeof(rrd_value_t));
-
-    /* find start and end offset */
-    rra_end_time = (rrd.live_head->last_up
-                    - (rrd.live_head->last_up % *step));
-    rra_start_time = (rra_end_time
-                      - (*step * (rrd.rra_def[chosen_rra].row_cnt - 1)));
+    rra_end_time = (rrd->live_head->last_up
+                    - (rrd->live_head->last_up % *step));
+    rra_start_time = (rra_end_time - (*step * (row_cnt - 1)));
     /* here's an error by one if we don't be careful */
     start_offset = ((long long)*start + (long long)*step - (long long)rra_start_time) / (long long) *step;
     end_offset = ((long long)rra_end_time - (long long)*end) / (long long) *step;
 #ifdef DEBUG
     fprintf(stderr,
             "start %10lu step %10lu rra_start %lld, rra_end %lld, start_off %lld, end_off %lld\n",
-            *start, *step,(long long)rra_start_time, (long long)rra_end_time, (long long)start_offset, (long long)end_offset);
+            *start, *step,(long long)rra_start_time, (long long)rra_end_time, start_offset, end_offset);
 #endif
-    /* only seek if the start time is before the end time */
-    if (*start <= rra_end_time && *end >= rra_start_time - (off_t)*step ){
-        if (start_offset <= 0)
-            rra_pointer = rrd.rra_ptr[chosen_rra].cur_row + 1;
-        else
-            rra_pointer = rrd.rra_ptr[chosen_rra].cur_row + 1 + start_offset;
-
-        rra_pointer = rra_pointer % (signed) rrd.rra_def[chosen_rra].row_cnt;
-         
-        if (rrd_seek(rrd_file, (rra_base + (rra_pointer * (*ds_cnt)
-                                        * sizeof(rrd_value_t))),
-                 SEEK_SET) != 0) {
-            rrd_set_error("seek error in RRA");
-            goto err_free_data;
+
+    /* rows start_offset up to row_cnt - end_offset of the RRA are asked
+     * for, counting from the oldest one; those outside the RRA are unknown */
+    rows = (long long) row_cnt - end_offset - start_offset;
+    if (rows < 0)
+        rows = 0;
+    first = max(start_offset, 0);
+    last = min((long long) row_cnt - end_offset, (long long) row_cnt);
+
+    layout->rra_idx = rra_idx;
+    if (first < last) {
+        layout->pad_before = first - start_offset;
+        layout->seg_row[0] =
+            (rrd->rra_ptr[rra_idx].cur_row + 1 + first) % row_cnt;
+        layout->seg_rows[0] = min(last - first,
+                                  (long long) (row_cnt -
+                                               layout->seg_row[0]));
+        layout->seg_row[1] = 0;
+        layout->seg_rows[1] = last - first - layout->seg_rows[0];
+    } else {
+        layout->pad_before = rows;
+        layout->seg_row[0] = layout->seg_row[1] = 0;
+        layout->seg_rows[0] = layout->seg_rows[1] = 0;
+    }
+    layout->pad_after = rows - layout->pad_before
+        - layout->seg_rows[0] - layout->seg_rows[1];
+    return 0;
+}
+
+static void fetch_free_ds_namv(
+    char **ds_namv,
+    unsigned long ds_cnt)
+{
+    unsigned long i;
+
+    for (i = 0; i < ds_cnt; i++)
+        free(ds_namv[i]);
+    free(ds_namv);
+}
+
+/*
+ * Open the rrd for a fetch, fill in the DS names and plan the fetch.
+ *
+ * Returns the open file, or NULL with everything cleaned up but rrd
+ * on error.
+ */
+static rrd_file_t *fetch_open(
+    const char *filename,
+    rrd_t *rrd,
+    enum cf_en cf_idx,
+    time_t *start,
+    time_t *end,
+    unsigned long *step,
+    char ***ds_namv,
+    fetch_layout_t *layout)
+{
+    rrd_file_t *rrd_file;
+    unsigned long i;
+
+    rrd_file = rrd_open(filename, rrd, RRD_READONLY | RRD_LOCK);
+    if (rrd_file == NULL)
+        return NULL;
+
+    if (((*ds_namv) =
+         (char **) calloc(rrd->stat_head->ds_cnt, sizeof(char *))) == NULL) {
+        rrd_set_error("malloc fetch ds_namv array");
+        goto err_close;
+    }
+
+    for (i = 0; i < rrd->stat_head->ds_cnt; i++) {
+        if ((((*ds_namv)[i]) = (char*)malloc(sizeof(char) * DS_NAM_SIZE)) == NULL) {
+            rrd_set_error("malloc fetch ds_namv entry");
+            goto err_free_ds_namv;
         }
-#ifdef DEBUG
-        fprintf(stderr, "First Seek: rra_base %lu rra_pointer %lu\n",
-                rra_base, rra_pointer);
-#endif
+        strncpy((*ds_namv)[i], rrd->ds_def[i].ds_nam, DS_NAM_SIZE);
+        (*ds_namv)[i][DS_NAM_SIZE - 1] = '\0';
+
     }
-    
-    /* step trough the array */
 
-    for (i = start_offset;
-         i < (signed) rrd.rra_def[chosen_rra].row_cnt - end_offset; i++) {
-        /* no valid data yet */
-        if (i < 0) {
-#ifdef DEBUG
-            fprintf(stderr, "pre fetch %li -- ", i);
-#endif
-            for (ii = 0; (unsigned) ii < *ds_cnt; ii++) {
-                *(data_ptr++) = DNAN;
-#ifdef DEBUG
-                fprintf(stderr, "%10.2f ", *(data_ptr - 1));
-#endif
-            }
+    if (fetch_plan(rrd, cf_idx, start, end, step, layout) == -1)
+        goto err_free_ds_namv;
+    return rrd_file;
+
+  err_free_ds_namv:
+    fetch_free_ds_namv(*ds_namv, rrd->stat_head->ds_cnt);
+    *ds_namv = NULL;
+  err_close:
+    rrd_close(rrd_file);
+    return NULL;
+}
+
+/*
+ * Read the rows of both segments of a fetch into data.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int fetch_read_segments(
+    rrd_file_t *rrd_file,
+    rrd_t *rrd,
+    const fetch_layout_t *layout,
+    rrd_value_t *data)
+{
+    int       seg;
+
+    /* let the disk work on both segments at once */
+    for (seg = 0; seg < 2; seg++)
+        rrd_read_ahead(rrd_file, rrd, layout->rra_idx, layout->seg_row[seg],
+                       layout->seg_rows[seg]);
+    for (seg = 0; seg < 2; seg++) {
+        if (rrd_read_rows(rrd_file, rrd, layout->rra_idx,
+                          layout->seg_row[seg], layout->seg_rows[seg],
+                          data) == -1) {
+            rrd_set_error("fetching cdp from rra");
+            return -1;
         }
-        /* past the valid data area */
-        else if (i >= (signed) rrd.rra_def[chosen_rra].row_cnt) {
-#ifdef DEBUG
-            fprintf(stderr, "past fetch %li -- ", i);
-#endif
-            for (ii = 0; (unsigned) ii < *ds_cnt; ii++) {
-                *(data_ptr++) = DNAN;
-#ifdef DEBUG
-                fprintf(stderr, "%10.2f ", *(data_ptr - 1));
-#endif
-            }
-        } else {
-            /* OK we are inside the valid area but the pointer has to 
-             * be wrapped*/
-            if (rra_pointer >= (signed) rrd.rra_def[chosen_rra].row_cnt) {
-                rra_pointer -= rrd.rra_def[chosen_rra].row_cnt;
-                if (rrd_seek(rrd_file, (rra_base + rra_pointer * (*ds_cnt)
-                                        * sizeof(rrd_value_t)),
-                             SEEK_SET) != 0) {
-                    rrd_set_error("wrap seek in RRA did fail");
-                    goto err_free_data;
-                }
-#ifdef DEBUG
-                fprintf(stderr, "wrap seek ...\n");
-#endif
-            }
+        data += layout->seg_rows[seg] * rrd->stat_head->ds_cnt;
+    }
+    return 0;
+}
+
+int rrd_fetch_fn(
+    const char *filename,   /* name of the rrd */
+    enum cf_en cf_idx,  /* which consolidation function ? */
+    time_t *start,
+    time_t *end,        /* which time frame do you want ?
+                         * will be changed to represent reality */
+    unsigned long *step,    /* which stepsize do you want? 
+                             * will be changed to represent reality */
+    unsigned long *ds_cnt,  /* number of data sources in file */
+    char ***ds_namv,    /* names of data_sources */
+    rrd_value_t **data)
+{                       /* two dimensional array containing the data */
+    rrd_t     rrd;
+    rrd_file_t *rrd_file;
+    rrd_value_t *data_ptr;
+    fetch_layout_t layout;
+    unsigned long i, rows;
 
-            if (rrd_read(rrd_file, data_ptr, sizeof(rrd_value_t) * (*ds_cnt))
-                != (ssize_t) (sizeof(rrd_value_t) * (*ds_cnt))) {
-                rrd_set_error("fetching cdp from rra");
-                goto err_free_data;
-            }
 #ifdef DEBUG
-            fprintf(stderr, "post fetch %li -- ", i);
-            for (ii = 0; ii < *ds_cnt; ii++)
-                fprintf(stderr, "%10.2f ", *(data_ptr + ii));
+    fprintf(stderr, "Entered rrd_fetch_fn() searching for the best match\n");
+    fprintf(stderr, "Looking for: start %10lu end %10lu step %5lu\n",
+            *start, *end, *step);
 #endif
-            data_ptr += *ds_cnt;
-            rra_pointer++;
-        }
-#ifdef DEBUG
-        fprintf(stderr, "\n");
+
+#ifdef HAVE_LIBDBI
+    /* handle libdbi datasources */
+    if (strncmp("sql//",filename,5)==0 || strncmp("sql||",filename,5)==0) {
+	return rrd_fetch_fn_libdbi(filename,cf_idx,start,end,step,ds_cnt,ds_namv,data);
+    }
 #endif
+    if (strncmp("cb//",filename,4)==0) {
+	return rrd_fetch_fn_cb(filename,cf_idx,start,end,step,ds_cnt,ds_namv,data);
+    }
 
+    rrd_init(&rrd);
+    rrd_file = fetch_open(filename, &rrd, cf_idx, start, end, step,
+                          ds_namv, &layout);
+    if (rrd_file == NULL)
+        goto err_free;
+
+    rows = (*end - *start) / *step + 1;
+    *ds_cnt = rrd.stat_head->ds_cnt;
+    if (((*data) = (rrd_value_t*)malloc(*ds_cnt * rows * sizeof(rrd_value_t))) == NULL) {
+        rrd_set_error("malloc fetch data area");
+        goto err_free_all_ds_namv;
     }
 
+    /* no valid data yet, the rows of the RRA, past the valid data area */
+    data_ptr = (*data);
+    for (i = 0; i < layout.pad_before * *ds_cnt; i++)
+        *(data_ptr++) = DNAN;
+    if (fetch_read_segments(rrd_file, &rrd, &layout, data_ptr) == -1)
+        goto err_free_data;
+    data_ptr += (layout.seg_rows[0] + layout.seg_rows[1]) * *ds_cnt;
+    for (i = 0; i < layout.pad_after * *ds_cnt; i++)
+        *(data_ptr++) = DNAN;
+
     rrd_close(rrd_file);
     rrd_free(&rrd);
     return (0);
@@ -575,13 +719,860 @@ int rrd_fetch_fn(
     free(*data);
     *data = NULL;
   err_free_all_ds_namv:
-    for (i = 0; (unsigned long) i < rrd.stat_head->ds_cnt; ++i)
-        free((*ds_namv)[i]);
-  err_free_ds_namv:
-    free(*ds_namv);
-  err_close:
+    fetch_free_ds_namv(*ds_namv, rrd.stat_head->ds_cnt);
+    *ds_namv = NULL;
     rrd_close(rrd_file);
   err_free:
     rrd_free(&rrd);
     return (-1);
 }
+
+static void fetch_view_release_file(
+    rrd_fetch_view_t *view)
+{
+    fetch_view_pvt_t *pvt = (fetch_view_pvt_t *) view->pvt;
+
+    fetch_free_ds_namv(view->ds_namv, view->ds_cnt);
+    rrd_close(pvt->rrd_file);
+    rrd_free(&pvt->rrd);
+    free(pvt->copy);
+    free(pvt);
+    memset(view, 0, sizeof(*view));
+}
+
+static void fetch_view_release_data(
+    rrd_fetch_view_t *view)
+{
+    fetch_free_ds_namv(view->ds_namv, view->ds_cnt);
+    free(view->pvt);
+    memset(view, 0, sizeof(*view));
+}
+
+int rrd_fetch_view_r(
+    const char *filename,   /* name of the rrd */
+    const char *cf,     /* which consolidation function ? */
+    time_t *start,
+    time_t *end,        /* which time frame do you want ?
+                         * will be changed to represent reality */
+    unsigned long *step,    /* which stepsize do you want? 
+                             * will be changed to represent reality */
+    rrd_fetch_view_t *view)
+{
+    fetch_view_pvt_t *pvt;
+    fetch_layout_t layout;
+    enum cf_en cf_idx;
+    size_t    row_size;
+    const rrd_value_t *rows;
+
+    memset(view, 0, sizeof(*view));
+    if ((int) (cf_idx = rrd_cf_conv(cf)) == -1) {
+        return -1;
+    }
+
+    /* data that does not come from an rrd file is handed out as it is */
+    if (
+#ifdef HAVE_LIBDBI
+        strncmp("sql//", filename, 5) == 0
+        || strncmp("sql||", filename, 5) == 0 ||
+#endif
+        strncmp("cb//", filename, 4) == 0) {
+        rrd_value_t *data;
+
+        if (rrd_fetch_fn(filename, cf_idx, start, end, step,
+                         &view->ds_cnt, &view->ds_namv, &data) == -1)
+            return -1;
+        view->seg[0] = data;
+        view->seg_rows[0] = (*end - *start) / *step;
+        view->row_stride = view->ds_cnt;
+        view->ds_stride = 1;
+        view->release = fetch_view_release_data;
+        view->pvt = data;
+        return 0;
+    }
+
+    if ((pvt = (fetch_view_pvt_t *) calloc(1, sizeof(*pvt))) == NULL) {
+        rrd_set_error("allocating fetch view");
+        return -1;
+    }
+    rrd_init(&pvt->rrd);
+    pvt->rrd_file = fetch_open(filename, &pvt->rrd, cf_idx, start, end,
+                               step, &view->ds_namv, &layout);
+    if (pvt->rrd_file == NULL) {
+        rrd_free(&pvt->rrd);
+        free(pvt);
+        return -1;
+    }
+    view->ds_cnt = pvt->rrd.stat_head->ds_cnt;
+    view->pvt = pvt;
+    view->release = fetch_view_release_file;
+
+    /* point into the mapped RRA, or read both segments into a copy;
+     * sealed blocks have to be unpacked anyway and rows a sparse file has
+     * not written yet have to read as DNAN */
+    row_size = view->ds_cnt * sizeof(rrd_value_t);
+    rows = NULL;
+    if (pvt->rrd.__desc->layout != RRD_LAYOUT_COMPRESSED
+        && rrd_rows_written(&pvt->rrd, layout.rra_idx)
+        == pvt->rrd.rra_def[layout.rra_idx].row_cnt)
+        rows = (const rrd_value_t *)
+            rrd_mapped(pvt->rrd_file,
+                       pvt->rrd.__desc->rra_start[layout.rra_idx],
+                       pvt->rrd.rra_def[layout.rra_idx].row_cnt * row_size);
+    view->row_stride = view->ds_cnt;
+    view->ds_stride = 1;
+    if (rows != NULL && pvt->rrd.__desc->layout == RRD_LAYOUT_COLUMN) {
+        view->seg[0] = rows + layout.seg_row[0];
+        view->seg[1] = rows + layout.seg_row[1];
+        view->row_stride = 1;
+        view->ds_stride = pvt->rrd.rra_def[layout.rra_idx].row_cnt;
+    } else if (rows != NULL) {
+        view->seg[0] = rows + layout.seg_row[0] * view->ds_cnt;
+        view->seg[1] = rows + layout.seg_row[1] * view->ds_cnt;
+    } else if (layout.seg_rows[0] > 0) {
+        pvt->copy = (rrd_value_t *)
+            malloc((layout.seg_rows[0] + layout.seg_rows[1]) * row_size);
+        if (pvt->copy == NULL) {
+            rrd_set_error("malloc fetch data area");
+            goto err_release;
+        }
+        if (fetch_read_segments(pvt->rrd_file, &pvt->rrd, &layout,
+                                pvt->copy) == -1)
+            goto err_release;
+        view->seg[0] = pvt->copy;
+        view->seg[1] = pvt->copy + layout.seg_rows[0] * view->ds_cnt;
+    }
+    view->pad_before = layout.pad_before;
+    view->seg_rows[0] = layout.seg_rows[0];
+    view->seg_rows[1] = layout.seg_rows[1];
+    view->pad_after = layout.pad_after;
+    return 0;
+
+  err_release:
+    view->release(view);
+    return -1;
+}
+
+/* value of data source ds in row row of the answer held by a view */
+static rrd_value_t fetch_view_value(
+    const rrd_fetch_view_t *view,
+    unsigned long row,
+    unsigned long ds)
+{
+    int       seg;
+
+    if (row < view->pad_before)
+        return DNAN;
+    row -= view->pad_before;
+    for (seg = 0; seg < 2; seg++) {
+        if (row < view->seg_rows[seg])
+            return view->seg[seg][row * view->row_stride
+                                  + ds * view->ds_stride];
+        row -= view->seg_rows[seg];
+    }
+    return DNAN;
+}
+
+/* how the rows of a view are cut into buckets of k rows; buckets start
+ * at multiples of k * step, so row i is in bucket (i + off) / k */
+typedef struct fetch_buckets_t {
+    const rrd_fetch_view_t *view;
+    unsigned long rows;
+    unsigned long k;
+    unsigned long off;
+} fetch_buckets_t;
+
+/* the first row of bucket b, or -1 if the fetch does not cover all of
+ * it, like rrd_reduce_data it leaves partial buckets unknown */
+static long fetch_bucket_row(
+    const fetch_buckets_t *bk,
+    unsigned long b)
+{
+    if (b * bk->k < bk->off || b * bk->k - bk->off + bk->k > bk->rows)
+        return -1;
+    return (long) (b * bk->k - bk->off);
+}
+
+/* consolidate a bucket the way rrd_reduce_data does */
+static rrd_value_t fetch_reduce_cf(
+    const fetch_buckets_t *bk,
+    enum cf_en cf_idx,
+    unsigned long b,
+    unsigned long ds)
+{
+    rrd_value_t value = DNAN, v;
+    unsigned long i, valid = 0;
+    long      row;
+
+    if ((row = fetch_bucket_row(bk, b)) < 0)
+        return DNAN;
+    for (i = 0; i < bk->k; i++) {
+        v = fetch_view_value(bk->view, row + i, ds);
+        if (isnan(v))
+            continue;
+        if (valid++ == 0) {
+            value = v;
+            continue;
+        }
+        switch (cf_idx) {
+        case CF_MINIMUM:
+            value = min(value, v);
+            break;
+        case CF_FAILURES:
+        case CF_MAXIMUM:
+            value = max(value, v);
+            break;
+        case CF_LAST:
+            value = v;
+            break;
+        default:
+            value += v;
+            break;
+        }
+    }
+    switch (cf_idx) {
+    case CF_MINIMUM:
+    case CF_FAILURES:
+    case CF_MAXIMUM:
+    case CF_LAST:
+        break;
+    default:
+        if (valid > 0)
+            value /= valid;
+        break;
+    }
+    return value;
+}
+
+/* write the smaller and the larger value of bucket b to out[0] and
+ * out[stride] in the order they came in */
+static void fetch_reduce_minmax(
+    const fetch_buckets_t *bk,
+    unsigned long b,
+    unsigned long ds,
+    rrd_value_t *out,
+    unsigned long stride)
+{
+    rrd_value_t v;
+    unsigned long i, lo = 0, hi = 0;
+    int       found = 0;
+    long      row;
+
+    out[0] = out[stride] = DNAN;
+    if ((row = fetch_bucket_row(bk, b)) < 0)
+        return;
+    for (i = 0; i < bk->k; i++) {
+        v = fetch_view_value(bk->view, row + i, ds);
+        if (isnan(v))
+            continue;
+        if (!found || v < fetch_view_value(bk->view, row + lo, ds))
+            lo = i;
+        if (!found || v > fetch_view_value(bk->view, row + hi, ds))
+            hi = i;
+        found = 1;
+    }
+    if (!found)
+        return;
+    out[0] = fetch_view_value(bk->view, row + min(lo, hi), ds);
+    out[stride] = fetch_view_value(bk->view, row + max(lo, hi), ds);
+}
+
+/* mean position and value of the known rows of bucket b */
+static int fetch_bucket_mean(
+    const fetch_buckets_t *bk,
+    unsigned long b,
+    unsigned long ds,
+    double *t,
+    double *v)
+{
+    rrd_value_t x;
+    unsigned long i, valid = 0;
+    long      row;
+
+    *t = *v = 0;
+    if ((row = fetch_bucket_row(bk, b)) < 0)
+        return 0;
+    for (i = 0; i < bk->k; i++) {
+        x = fetch_view_value(bk->view, row + i, ds);
+        if (isnan(x))
+            continue;
+        *t += row + i;
+        *v += x;
+        valid++;
+    }
+    if (valid == 0)
+        return 0;
+    *t /= valid;
+    *v /= valid;
+    return 1;
+}
+
+/* Largest triangle three buckets: every bucket keeps the row that spans
+ * the largest triangle with the row kept from the bucket before and the
+ * mean of the bucket after. out[b * stride] receives bucket b. */
+static void fetch_reduce_lttb(
+    const fetch_buckets_t *bk,
+    unsigned long buckets,
+    unsigned long ds,
+    rrd_value_t *out,
+    unsigned long stride)
+{
+    double    ta = 0, va = 0, tc, vc, tn, vn, area, best_area;
+    rrd_value_t v;
+    unsigned long b, i, best;
+    long      row;
+    int       have_a = 0;
+
+    for (b = 0; b < buckets; b++) {
+        out[b * stride] = DNAN;
+        if ((row = fetch_bucket_row(bk, b)) < 0
+            || !fetch_bucket_mean(bk, b, ds, &tc, &vc)) {
+            have_a = 0;
+            continue;
+        }
+        /* without a next bucket the triangle closes on this one's mean */
+        if (b + 1 < buckets && fetch_bucket_mean(bk, b + 1, ds, &tn, &vn)) {
+            tc = tn;
+            vc = vn;
+        }
+        best = bk->k;
+        best_area = -1;
+        for (i = 0; i < bk->k; i++) {
+            v = fetch_view_value(bk->view, row + i, ds);
+            if (isnan(v))
+                continue;
+            if (!have_a) {
+                /* after a gap the first known row starts the line again */
+                best = i;
+                break;
+            }
+            area = fabs((ta - tc) * (v - va) - (ta - (row + i)) * (vc - va));
+            if (area > best_area) {
+                best_area = area;
+                best = i;
+            }
+        }
+        ta = row + best;
+        va = out[b * stride] = fetch_view_value(bk->view, row + best, ds);
+        have_a = 1;
+    }
+}
+
+/*
+ * Like rrd_fetch_r, but only return the data sources named in want, in
+ * that order, or all of them if want_cnt is 0. If the answer would have
+ * more than max_rows rows (no limit if max_rows is 0), neighbouring rows
+ * are combined as they are read: RRD_REDUCE_CF consolidates them with
+ * cf, RRD_REDUCE_MINMAX keeps the smallest and the largest value of every
+ * bucket as two rows in the order they came in, and RRD_REDUCE_LTTB picks
+ * the row of every bucket that best keeps the shape of the line. start,
+ * end and step are changed to describe the reduced rows.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int rrd_fetch_select_r(
+    const char *filename,
+    const char *cf,
+    time_t *start,
+    time_t *end,
+    unsigned long *step,
+    unsigned long want_cnt,
+    const char *const *want,
+    unsigned long max_rows,
+    int reduce,
+    unsigned long *ds_cnt,
+    char ***ds_namv,
+    rrd_value_t **data)
+{
+    rrd_fetch_view_t view;
+    fetch_buckets_t bk;
+    enum cf_en cf_idx;
+    unsigned long *idx = NULL;
+    unsigned long i, b, cnt, buckets, out_rows, per_bucket;
+    time_t    span;
+    rrd_value_t *out;
+
+    if (want_cnt == 0 && max_rows == 0)
+        return rrd_fetch_r(filename, cf, start, end, step, ds_cnt, ds_namv,
+                           data);
+    if (reduce < RRD_REDUCE_CF || reduce > RRD_REDUCE_LTTB) {
+        rrd_set_error("unknown reduction %d", reduce);
+        return -1;
+    }
+    if ((int) (cf_idx = rrd_cf_conv(cf)) == -1)
+        return -1;
+    if (rrd_fetch_view_r(filename, cf, start, end, step, &view) == -1)
+        return -1;
+    *ds_namv = NULL;
+    *data = NULL;
+
+    cnt = want_cnt > 0 ? want_cnt : view.ds_cnt;
+    if ((idx = (unsigned long *) malloc(cnt * sizeof(unsigned long))) == NULL) {
+        rrd_set_error("malloc fetch ds index");
+        goto err_release;
+    }
+    for (i = 0; i < cnt; i++) {
+        if (want_cnt == 0) {
+            idx[i] = i;
+            continue;
+        }
+        for (idx[i] = 0; idx[i] < view.ds_cnt; idx[i]++)
+            if (strcmp(view.ds_namv[idx[i]], want[i]) == 0)
+                break;
+        if (idx[i] == view.ds_cnt) {
+            rrd_set_error("No DS called '%s' in '%s'", want[i], filename);
+            goto err_release;
+        }
+    }
+
+    /* cut the rows into buckets of k rows, minmax makes two rows out of
+     * every bucket so its buckets hold an even number of rows */
+    bk.view = &view;
+    bk.rows = (*end - *start) / *step;
+    bk.k = 1;
+    per_bucket = reduce == RRD_REDUCE_MINMAX ? 2 : 1;
+    if (max_rows > 0 && bk.rows > max_rows) {
+        max_rows = max(max_rows, per_bucket);
+        bk.k = (bk.rows * per_bucket + max_rows - 1) / max_rows;
+        if (per_bucket == 2)
+            bk.k += bk.k % 2;
+    } else
+        per_bucket = 1;
+    span = (time_t) (bk.k * *step);
+    bk.off = (*start % span) / *step;
+    *start -= *start % span;
+    if (*end % span)
+        *end += span - *end % span;
+    buckets = (*end - *start) / span;
+    out_rows = buckets * per_bucket;
+
+    if ((*ds_namv = (char **) calloc(cnt, sizeof(char *))) == NULL) {
+        rrd_set_error("malloc fetch ds_namv array");
+        goto err_release;
+    }
+    for (i = 0; i < cnt; i++)
+        if (((*ds_namv)[i] = strdup(view.ds_namv[idx[i]])) == NULL) {
+            rrd_set_error("malloc fetch ds_namv entry");
+            goto err_release;
+        }
+    /* one spare row like rrd_fetch_fn */
+    if ((*data = (rrd_value_t *)
+         malloc((out_rows + 1) * cnt * sizeof(rrd_value_t))) == NULL) {
+        rrd_set_error("malloc fetch data area");
+        goto err_release;
+    }
+    out = *data;
+    for (i = 0; i < cnt; i++) {
+        if (bk.k == 1) {
+            for (b = 0; b < buckets; b++)
+                out[b * cnt + i] =
+                    fetch_view_value(&view, b - bk.off, idx[i]);
+        } else if (reduce == RRD_REDUCE_MINMAX) {
+            for (b = 0; b < buckets; b++)
+                fetch_reduce_minmax(&bk, b, idx[i], out + 2 * b * cnt + i,
+                                    cnt);
+        } else if (reduce == RRD_REDUCE_LTTB) {
+            fetch_reduce_lttb(&bk, buckets, idx[i], out + i, cnt);
+        } else {
+            for (b = 0; b < buckets; b++)
+                out[b * cnt + i] = fetch_reduce_cf(&bk, cf_idx, b, idx[i]);
+        }
+        out[out_rows * cnt + i] = DNAN;
+    }
+    *step = span / per_bucket;
+    *ds_cnt = cnt;
+    free(idx);
+    view.release(&view);
+    return 0;
+
+  err_release:
+    if (*ds_namv != NULL)
+        fetch_free_ds_namv(*ds_namv, cnt);
+    *ds_namv = NULL;
+    free(*data);
+    *data = NULL;
+    free(idx);
+    view.release(&view);
+    return -1;
+}
+
+typedef struct fetch_many_t {
+    rrd_fetch_job_t *jobs;
+    int       in_pool;
+} fetch_many_t;
+
+/* fetches that do not read an rrd file but call back into the
+ * application or go to a database, which need not be thread safe */
+static int fetch_many_local(
+    const char *filename)
+{
+    return strncmp(filename, "cb//", 4) == 0
+        || strncmp(filename, "sql//", 5) == 0
+        || strncmp(filename, "sql||", 5) == 0;
+}
+
+/*
+ * Work out what rrd_fetch_r would answer without reading any rows: start,
+ * end and step are changed like there and rra_idx tells the RRA the rows
+ * would come from. Fetches that do not read an rrd file have no plan.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int rrd_fetch_plan_r(
+    const char *filename,
+    const char *cf,
+    time_t *start,
+    time_t *end,
+    unsigned long *step,
+    long *rra_idx)
+{
+    rrd_t     rrd;
+    rrd_file_t *rrd_file;
+    fetch_layout_t layout;
+    enum cf_en cf_idx;
+    int       rc = -1;
+
+    if (fetch_many_local(filename)) {
+        rrd_set_error("'%s' is not an rrd file", filename);
+        return -1;
+    }
+    if ((int) (cf_idx = rrd_cf_conv(cf)) == -1)
+        return -1;
+    rrd_init(&rrd);
+    rrd_file = rrd_open(filename, &rrd, RRD_READONLY | RRD_LOCK);
+    if (rrd_file != NULL) {
+        if (fetch_plan(&rrd, cf_idx, start, end, step, &layout) == 0) {
+            *rra_idx = layout.rra_idx;
+            rc = 0;
+        }
+        rrd_close(rrd_file);
+    }
+    rrd_free(&rrd);
+    return rc;
+}
+
+static void fetch_many_job(
+    void *arg,
+    unsigned long idx)
+{
+    fetch_many_t *fm = (fetch_many_t *) arg;
+    rrd_fetch_job_t *job = fm->jobs + idx;
+
+    if (fm->in_pool && fetch_many_local(job->filename))
+        return;
+    rrd_clear_error();
+    job->rc = rrd_fetch_select_r(job->filename, job->cf, &job->start,
+                                 &job->end, &job->step, job->want_cnt,
+                                 job->want, job->max_rows, job->reduce,
+                                 &job->ds_cnt, &job->ds_namv, &job->data);
+    if (job->rc != 0) {
+        job->error = strdup(rrd_test_error()? rrd_get_error() :
+                            "fetch failed");
+        rrd_clear_error();
+    }
+}
+
+/*
+ * Run job_cnt fetches on a pool of up to threads threads, see
+ * rrd_run_jobs. Each job gets its results or its error the way
+ * rrd_fetch_r would have returned them. Fetches from callbacks and
+ * databases run one after the other in the calling thread.
+ *
+ * Returns 0 if all fetches went through and -1 if any failed.
+ */
+int rrd_fetch_many(
+    rrd_fetch_job_t *jobs,
+    unsigned long job_cnt,
+    int threads,
+    int io_concurrency)
+{
+    fetch_many_t fm;
+    const char **filenames;
+    unsigned long i, failed = 0;
+
+    if (job_cnt == 0)
+        return 0;
+    for (i = 0; i < job_cnt; i++) {
+        jobs[i].ds_cnt = 0;
+        jobs[i].ds_namv = NULL;
+        jobs[i].data = NULL;
+        jobs[i].rc = -1;
+        jobs[i].error = NULL;
+    }
+    if ((filenames = (const char **) malloc(job_cnt * sizeof(char *)))
+        == NULL) {
+        rrd_set_error("allocating fetch jobs");
+        return -1;
+    }
+    fm.jobs = jobs;
+    fm.in_pool = 0;
+    for (i = 0; i < job_cnt; i++) {
+        filenames[i] = jobs[i].filename;
+        if (fetch_many_local(jobs[i].filename))
+            fetch_many_job(&fm, i);
+    }
+    fm.in_pool = 1;
+    if (rrd_run_jobs(filenames, job_cnt, threads, io_concurrency,
+                     fetch_many_job, &fm) != 0) {
+        free(filenames);
+        return -1;
+    }
+    free(filenames);
+
+    for (i = 0; i < job_cnt; i++)
+        if (jobs[i].rc != 0)
+            failed++;
+    if (failed > 0) {
+        rrd_set_error("%lu of %lu fetches failed", failed, job_cnt);
+        return -1;
+    }
+    return 0;
+}
+
+/* a fetch handed out a chunk of rows at a time, see rrd_fetch_cursor_r() */
+struct rrd_fetch_cursor_t {
+    rrd_t     rrd;
+    rrd_file_t *rrd_file;   /* the file the rows are read from, or */
+    rrd_value_t *data;  /* all rows, for answers that are not in a file */
+    fetch_layout_t layout;
+    unsigned long ds_cnt;
+    time_t    start;
+    unsigned long step;
+    unsigned long rows; /* rows of the whole answer */
+    unsigned long done; /* rows handed out so far */
+    int       reverse;
+};
+
+static rrd_fetch_cursor_t *fetch_cursor_new(
+    int flags)
+{
+    rrd_fetch_cursor_t *cursor;
+
+    if ((cursor = (rrd_fetch_cursor_t *) calloc(1, sizeof(*cursor)))
+        == NULL) {
+        rrd_set_error("allocating fetch cursor");
+        return NULL;
+    }
+    rrd_init(&cursor->rrd);
+    cursor->reverse = (flags & RRD_FETCH_REVERSE) != 0;
+    return cursor;
+}
+
+/*
+ * Read rows row .. row + row_cnt - 1 of the answer into out. With out
+ * NULL only hint that they are about to be read.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int fetch_cursor_read(
+    rrd_fetch_cursor_t *cursor,
+    unsigned long row,
+    unsigned long row_cnt,
+    rrd_value_t *out)
+{
+    const fetch_layout_t *layout = &cursor->layout;
+    unsigned long ds_cnt = cursor->ds_cnt, seg_first, n, i;
+    int       seg;
+
+    if (cursor->data != NULL) {
+        if (out != NULL)
+            memcpy(out, cursor->data + row * ds_cnt,
+                   row_cnt * ds_cnt * sizeof(rrd_value_t));
+        return 0;
+    }
+
+    /* the rows in front of the data, the segments, the rows behind */
+    n = row < layout->pad_before ? min(row_cnt, layout->pad_before - row) : 0;
+    if (out != NULL) {
+        for (i = 0; i < n * ds_cnt; i++)
+            *(out++) = DNAN;
+    }
+    row += n;
+    row_cnt -= n;
+    seg_first = layout->pad_before;
+    for (seg = 0; seg < 2 && row_cnt > 0; seg++) {
+        if (row < seg_first + layout->seg_rows[seg]) {
+            n = min(row_cnt, seg_first + layout->seg_rows[seg] - row);
+            if (out == NULL)
+                rrd_read_ahead(cursor->rrd_file, &cursor->rrd,
+                               layout->rra_idx,
+                               layout->seg_row[seg] + row - seg_first, n);
+            else if (rrd_read_rows(cursor->rrd_file, &cursor->rrd,
+                                   layout->rra_idx,
+                                   layout->seg_row[seg] + row - seg_first,
+                                   n, out) == -1) {
+                rrd_set_error("fetching cdp from rra");
+                return -1;
+            } else
+                out += n * ds_cnt;
+            row += n;
+            row_cnt -= n;
+        }
+        seg_first += layout->seg_rows[seg];
+    }
+    if (out != NULL) {
+        for (i = 0; i < row_cnt * ds_cnt; i++)
+            *(out++) = DNAN;
+    }
+    return 0;
+}
+
+/*
+ * Start a fetch like rrd_fetch_r without reading any rows yet; they are
+ * read with rrd_fetch_cursor_next a chunk at a time, so the memory a
+ * fetch takes does not grow with the range. With RRD_FETCH_REVERSE in
+ * flags the newest rows come first. ds_namv is the caller's to free
+ * like the one of rrd_fetch_r, the cursor has to be closed with
+ * rrd_fetch_cursor_close.
+ *
+ * Returns the cursor, or NULL on error.
+ */
+rrd_fetch_cursor_t *rrd_fetch_cursor_r(
+    const char *filename,
+    const char *cf,
+    time_t *start,
+    time_t *end,
+    unsigned long *step,
+    int flags,
+    unsigned long *ds_cnt,
+    char ***ds_namv)
+{
+    rrd_fetch_cursor_t *cursor;
+    enum cf_en cf_idx;
+
+    if ((int) (cf_idx = rrd_cf_conv(cf)) == -1)
+        return NULL;
+    if ((cursor = fetch_cursor_new(flags)) == NULL)
+        return NULL;
+
+    /* data that does not come from an rrd file is fetched at once */
+    if (fetch_many_local(filename)) {
+        if (rrd_fetch_fn(filename, cf_idx, start, end, step, ds_cnt,
+                         ds_namv, &cursor->data) == -1)
+            goto err_free;
+    } else {
+        cursor->rrd_file = fetch_open(filename, &cursor->rrd, cf_idx, start,
+                                      end, step, ds_namv, &cursor->layout);
+        if (cursor->rrd_file == NULL)
+            goto err_free;
+        *ds_cnt = cursor->rrd.stat_head->ds_cnt;
+    }
+    cursor->ds_cnt = *ds_cnt;
+    cursor->start = *start;
+    cursor->step = *step;
+    cursor->rows = (*end - *start) / *step;
+    return cursor;
+
+  err_free:
+    rrd_free(&cursor->rrd);
+    free(cursor);
+    return NULL;
+}
+
+/*
+ * Copy the next up to max_rows rows of the fetch into data, ds_cnt values
+ * per row. *first is set to the time of the first of them; the rows
+ * after it follow step apart, going back in time with RRD_FETCH_REVERSE.
+ *
+ * Returns the number of rows, 0 once all have been handed out, or -1 on
+ * error.
+ */
+long rrd_fetch_cursor_next(
+    rrd_fetch_cursor_t *cursor,
+    unsigned long max_rows,
+    time_t *first,
+    rrd_value_t *data)
+{
+    unsigned long n = min(max_rows, cursor->rows - cursor->done);
+    unsigned long row, next, i, k;
+    rrd_value_t *a, *b, tmp;
+
+    if (n == 0)
+        return 0;
+    row = cursor->reverse ? cursor->rows - cursor->done - n : cursor->done;
+    if (fetch_cursor_read(cursor, row, n, data) == -1)
+        return -1;
+    cursor->done += n;
+
+    /* let the disk work on the next chunk while this one is used */
+    next = min(n, cursor->rows - cursor->done);
+    fetch_cursor_read(cursor, cursor->reverse ? row - next : row + n, next,
+                      NULL);
+
+    if (!cursor->reverse) {
+        *first = cursor->start + (row + 1) * cursor->step;
+        return n;
+    }
+    for (i = 0; i < n / 2; i++) {
+        a = data + i * cursor->ds_cnt;
+        b = data + (n - 1 - i) * cursor->ds_cnt;
+        for (k = 0; k < cursor->ds_cnt; k++) {
+            tmp = a[k];
+            a[k] = b[k];
+            b[k] = tmp;
+        }
+    }
+    *first = cursor->start + (row + n) * cursor->step;
+    return n;
+}
+
+void rrd_fetch_cursor_close(
+    rrd_fetch_cursor_t *cursor)
+{
+    if (cursor == NULL)
+        return;
+    if (cursor->rrd_file != NULL)
+        rrd_close(cursor->rrd_file);
+    rrd_free(&cursor->rrd);
+    free(cursor->data);
+    free(cursor);
+}
+
+/*
+ * Parse the arguments of rrdtool fetch and start a cursor on what they ask
+ * for. Only plain fetches from a local file are read a chunk at a time;
+ * fetches through rrdcached and with --columns or --max-rows are done at
+ * once and handed out from memory.
+ *
+ * Returns the cursor, or NULL on error.
+ */
+rrd_fetch_cursor_t *rrd_fetch_cursor(
+    int argc,
+    const char **argv,
+    time_t *start,
+    time_t *end,
+    unsigned long *step,
+    unsigned long *ds_cnt,
+    char ***ds_namv)
+{
+    fetch_args_t args;
+    rrd_fetch_cursor_t *cursor = NULL;
+    rrd_value_t *data;
+
+    if (fetch_parse_args(argc, argv, start, end, step, &args) == -1)
+        goto done;
+    rrdc_connect(args.daemon);
+    if (!rrdc_is_connected(args.daemon) && args.want_cnt == 0
+        && args.max_rows == 0) {
+        cursor = rrd_fetch_cursor_r(args.filename, args.cf, start, end, step,
+                                    0, ds_cnt, ds_namv);
+        goto done;
+    }
+
+    if (fetch_run_args(&args, start, end, step, ds_cnt, ds_namv, &data) != 0)
+        goto done;
+    if ((cursor = fetch_cursor_new(0)) == NULL) {
+        fetch_free_ds_namv(*ds_namv, *ds_cnt);
+        *ds_namv = NULL;
+        free(data);
+        goto done;
+    }
+    cursor->data = data;
+    cursor->ds_cnt = *ds_cnt;
+    cursor->start = *start;
+    cursor->step = *step;
+    cursor->rows = (*end - *start) / *step;
+
+  done:
+    fetch_free_args(&args);
+    return cursor;
+}
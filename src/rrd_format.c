@@ -4,6 +4,7 @@
  * rrd_format.c  RRD Database Format helper functions
  *****************************************************************************/
 #include "rrd_tool.h"
+#include "rrd_compress.h"
 #ifdef _WIN32
 #include "stdlib.h"
 #endif
@@ -12,7 +13,7 @@
    if (strcmp(#VV, string) == 0) return VVV;
 
 /* conversion functions to allow symbolic entry of enumerations */
-enum dst_en dst_conv(
+static enum dst_en dst_lookup(
     const char *string)
 {
     converter(COUNTER, DST_COUNTER)
@@ -22,15 +23,12 @@ enum dst_en dst_conv(
         converter(COMPUTE, DST_CDEF)
         converter(DCOUNTER, DST_DCOUNTER)
         converter(DDERIVE, DST_DDERIVE)
-        rrd_set_error("unknown data acquisition function '%s'", string);
-    return (enum dst_en)(-1);
+        return (enum dst_en)(-1);
 }
 
-
-enum cf_en rrd_cf_conv(
+static enum cf_en cf_lookup(
     const char *string)
 {
-
     converter(AVERAGE, CF_AVERAGE)
         converter(MIN, CF_MINIMUM)
         converter(MAX, CF_MAXIMUM)
@@ -41,8 +39,28 @@ enum cf_en rrd_cf_conv(
         converter(SEASONAL, CF_SEASONAL)
         converter(DEVSEASONAL, CF_DEVSEASONAL)
         converter(FAILURES, CF_FAILURES)
+        return (enum cf_en)(-1);
+}
+
+enum dst_en dst_conv(
+    const char *string)
+{
+    enum dst_en dst = dst_lookup(string);
+
+    if ((int) dst == -1)
+        rrd_set_error("unknown data acquisition function '%s'", string);
+    return dst;
+}
+
+
+enum cf_en rrd_cf_conv(
+    const char *string)
+{
+    enum cf_en cf = cf_lookup(string);
+
+    if ((int) cf == -1)
         rrd_set_error("unknown consolidation function '%s'", string);
-    return (enum cf_en)(-1);
+    return cf;
 }
 
 const char *cf_to_string (enum cf_en cf)
@@ -91,3 +109,278 @@ off_t rrd_get_header_size(
         sizeof(cdp_prep_t) * rrd->stat_head->ds_cnt * rrd->stat_head->rra_cnt + \
         sizeof(rra_ptr_t) * rrd->stat_head->rra_cnt;
 }
+
+/* Decode the header of an rrd into an rrd_desc_t. The descriptor is kept
+ * with the rrd and released by rrd_free(). rrd_open() builds it right after
+ * reading the header, so code that only ever sees opened rrds (update,
+ * fetch, the Holt-Winters helpers and the row I/O in rrd_open.c) reads
+ * rrd->__desc directly. Code that may get an rrd assembled in memory has
+ * to call this instead, which builds the descriptor on first use. Returns
+ * NULL if memory runs out. */
+const rrd_desc_t *rrd_get_desc(
+    rrd_t *rrd)
+{
+    rrd_desc_t *desc;
+    unsigned long ds_cnt = rrd->stat_head->ds_cnt;
+    unsigned long rra_cnt = rrd->stat_head->rra_cnt;
+    unsigned long i;
+    char     *mem;
+
+    if (rrd->__desc != NULL)
+        return rrd->__desc;
+
+    /* one block for the struct and all its arrays, widest members first */
+    mem = (char *) malloc(sizeof(rrd_desc_t)
+                          + sizeof(size_t) * (rra_cnt + 1)
+                          + sizeof(unsigned long) * (rra_cnt + ds_cnt)
+                          + sizeof(enum cf_en) * rra_cnt
+                          + sizeof(enum dst_en) * ds_cnt);
+    if (mem == NULL) {
+        rrd_set_error("allocating rrd header descriptor");
+        return NULL;
+    }
+    desc = (rrd_desc_t *) (void *) mem;
+    mem += sizeof(rrd_desc_t);
+    desc->rra_start = (size_t *) (void *) mem;
+    mem += sizeof(size_t) * (rra_cnt + 1);
+    desc->rra_step = (unsigned long *) (void *) mem;
+    mem += sizeof(unsigned long) * rra_cnt;
+    desc->ds_input = (unsigned long *) (void *) mem;
+    mem += sizeof(unsigned long) * ds_cnt;
+    desc->cf = (enum cf_en *) (void *) mem;
+    mem += sizeof(enum cf_en) * rra_cnt;
+    desc->dst = (enum dst_en *) (void *) mem;
+
+    /* unknown names decode to -1 silently; the code acting on them
+     * reports the problem, just as it did when converting on the fly */
+    desc->ds_input_cnt = 0;
+    for (i = 0; i < ds_cnt; i++) {
+        desc->dst[i] = dst_lookup(rrd->ds_def[i].dst);
+        if (desc->dst[i] != DST_CDEF)
+            desc->ds_input[desc->ds_input_cnt++] = i;
+    }
+
+    desc->rra_start[0] = rrd_get_header_size(rrd);
+    for (i = 0; i < rra_cnt; i++) {
+        desc->cf[i] = cf_lookup(rrd->rra_def[i].cf_nam);
+        desc->rra_step[i] =
+            rrd->stat_head->pdp_step * rrd->rra_def[i].pdp_cnt;
+        desc->rra_start[i + 1] = desc->rra_start[i]
+            + rrd_rra_data_size(rrd, i);
+    }
+
+    desc->layout = rrd_layout(rrd);
+    desc->block_rows = 0;
+    desc->block_size = 0;
+    if (desc->layout == RRD_LAYOUT_COMPRESSED) {
+        desc->block_rows = rrd->stat_head->par[SH_block_rows].u_cnt;
+        desc->block_size = sizeof(block_head_t)
+            + desc->block_rows * ds_cnt * sizeof(rrd_value_t);
+    }
+    desc->block_cache = NULL;
+    desc->cache_rra = rra_cnt;
+    desc->cache_block = 0;
+
+    rrd->__desc = desc;
+    return desc;
+}
+
+void rrd_desc_free(
+    rrd_t *rrd)
+{
+    if (rrd->__desc != NULL)
+        free(rrd->__desc->block_cache);
+    free(rrd->__desc);
+    rrd->__desc = NULL;
+}
+
+/* layout of the data area, the flags in stat_head par[] only count from
+ * version 6 on */
+int rrd_layout(
+    const rrd_t *rrd)
+{
+    if (atoi(rrd->stat_head->version) < atoi(RRD_VERSION6))
+        return RRD_LAYOUT_ROW;
+    return (int) rrd->stat_head->par[SH_layout].u_cnt;
+}
+
+/* rows per block for a new RRD_LAYOUT_COMPRESSED file */
+unsigned long rrd_block_rows(
+    const rrd_t *rrd)
+{
+    unsigned long row_size = rrd->stat_head->ds_cnt * sizeof(rrd_value_t);
+
+    return max(RRD_BLOCK_ROWS, (RRD_BLOCK_BYTES + row_size - 1) / row_size);
+}
+
+/* bytes taken up by RRA rra_idx in the data area */
+size_t rrd_rra_data_size(
+    const rrd_t *rrd,
+    unsigned long rra_idx)
+{
+    unsigned long row_cnt = rrd->rra_def[rra_idx].row_cnt;
+    unsigned long block_rows;
+    size_t    size = row_cnt * rrd->stat_head->ds_cnt * sizeof(rrd_value_t);
+
+    if (rrd_layout(rrd) == RRD_LAYOUT_COMPRESSED) {
+        /* the last block only has room for the rows it holds */
+        block_rows = rrd->stat_head->par[SH_block_rows].u_cnt;
+        size += (row_cnt + block_rows - 1) / block_rows
+            * sizeof(block_head_t);
+    }
+    return size;
+}
+
+/* Returns 1 if rows of RRA rra_idx may not have been written yet. */
+int rrd_sparse_rra(
+    const rrd_t *rrd,
+    unsigned long rra_idx)
+{
+    if (atoi(rrd->stat_head->version) < atoi(RRD_VERSION6)
+        || rrd->stat_head->par[SH_sparse_since].u_cnt == 0
+        || rrd_layout(rrd) == RRD_LAYOUT_COMPRESSED)
+        return 0;
+    switch (cf_lookup(rrd->rra_def[rra_idx].cf_nam)) {
+    case CF_HWPREDICT:
+    case CF_MHWPREDICT:
+    case CF_SEASONAL:
+    case CF_DEVSEASONAL:
+    case CF_DEVPREDICT:
+    case CF_FAILURES:
+        /* seasonal smoothing reads and writes the whole RRA */
+        return 0;
+    default:
+        return 1;
+    }
+}
+
+/* Number of rows up to and including the current one that RRA rra_idx
+ * has advanced by since a sparse file was created. These are the only ones
+ * that have been written, row_cnt if all of them have. */
+unsigned long rrd_rows_written(
+    const rrd_t *rrd,
+    unsigned long rra_idx)
+{
+    unsigned long row_cnt = rrd->rra_def[rra_idx].row_cnt;
+    unsigned long step, since, last_up, written;
+
+    if (!rrd_sparse_rra(rrd, rra_idx))
+        return row_cnt;
+    step = rrd->rra_def[rra_idx].pdp_cnt * rrd->stat_head->pdp_step;
+    since = rrd->stat_head->par[SH_sparse_since].u_cnt;
+    last_up = (unsigned long) rrd->live_head->last_up;
+    if (last_up <= since)
+        return 0;
+    written = (last_up - last_up % step - (since - since % step)) / step;
+    return min(written, row_cnt);
+}
+
+/* Turn the values read from rows row .. row + row_cnt - 1 of RRA rra_idx
+ * that have not been written yet into DNAN. */
+void rrd_mask_unwritten(
+    const rrd_t *rrd,
+    unsigned long rra_idx,
+    unsigned long row,
+    unsigned long row_cnt,
+    rrd_value_t *values)
+{
+    unsigned long rra_rows = rrd->rra_def[rra_idx].row_cnt;
+    unsigned long cur_row = rrd->rra_ptr[rra_idx].cur_row;
+    unsigned long ds_cnt = rrd->stat_head->ds_cnt;
+    unsigned long written = rrd_rows_written(rrd, rra_idx);
+    unsigned long i, ds_idx;
+
+    if (written == rra_rows)
+        return;
+    for (i = 0; i < row_cnt; i++) {
+        /* how far the row lies behind the current one */
+        if ((cur_row + rra_rows - row - i) % rra_rows < written)
+            continue;
+        for (ds_idx = 0; ds_idx < ds_cnt; ds_idx++)
+            values[i * ds_cnt + ds_idx] = DNAN;
+    }
+}
+
+/* file offset of the value of DS ds_idx in row of RRA rra_idx, for
+ * RRD_LAYOUT_COMPRESSED where it sits as long as its block is kept raw */
+size_t rrd_value_offset(
+    const rrd_t *rrd,
+    unsigned long rra_idx,
+    unsigned long row,
+    unsigned long ds_idx)
+{
+    const rrd_desc_t *desc = rrd->__desc;
+    size_t    cell, block;
+
+    switch (desc->layout) {
+    case RRD_LAYOUT_COLUMN:
+        cell = ds_idx * rrd->rra_def[rra_idx].row_cnt + row;
+        break;
+    case RRD_LAYOUT_COMPRESSED:
+        block = row / desc->block_rows;
+        cell = (row - block * desc->block_rows) * rrd->stat_head->ds_cnt
+            + ds_idx;
+        return desc->rra_start[rra_idx] + block * desc->block_size
+            + sizeof(block_head_t) + cell * sizeof(rrd_value_t);
+    default:
+        cell = row * rrd->stat_head->ds_cnt + ds_idx;
+    }
+    return desc->rra_start[rra_idx] + cell * sizeof(rrd_value_t);
+}
+
+/* Copy the row_cnt rows of ds_cnt values of one RRA from src to dst,
+ * turning them into one ring per DS if to_columns, and back otherwise. */
+void rrd_transpose_rra(
+    rrd_value_t *dst,
+    const rrd_value_t *src,
+    unsigned long row_cnt,
+    unsigned long ds_cnt,
+    int to_columns)
+{
+    unsigned long row, ds_idx;
+
+    for (row = 0; row < row_cnt; row++)
+        for (ds_idx = 0; ds_idx < ds_cnt; ds_idx++) {
+            if (to_columns)
+                dst[ds_idx * row_cnt + row] = src[row * ds_cnt + ds_idx];
+            else
+                dst[row * ds_cnt + ds_idx] = src[ds_idx * row_cnt + row];
+        }
+}
+
+/* Turn the rows of values of RRA rra_idx into the rrd_rra_data_size()
+ * bytes the RRA takes up in the file. With RRD_LAYOUT_COMPRESSED the block
+ * holding the current row stays raw, all others get sealed. */
+void rrd_pack_rra(
+    const rrd_t *rrd,
+    unsigned long rra_idx,
+    const rrd_value_t *values,
+    void *data)
+{
+    unsigned long row_cnt = rrd->rra_def[rra_idx].row_cnt;
+    unsigned long ds_cnt = rrd->stat_head->ds_cnt;
+    unsigned long block_rows, row, block_cnt;
+    unsigned char *pos = (unsigned char *) data;
+    block_head_t *head;
+
+    switch (rrd_layout(rrd)) {
+    case RRD_LAYOUT_COLUMN:
+        rrd_transpose_rra((rrd_value_t *) data, values, row_cnt, ds_cnt, 1);
+        return;
+    case RRD_LAYOUT_COMPRESSED:
+        block_rows = rrd->stat_head->par[SH_block_rows].u_cnt;
+        memset(data, 0, rrd_rra_data_size(rrd, rra_idx));
+        for (row = 0; row < row_cnt; row += block_rows) {
+            block_cnt = min(block_rows, row_cnt - row);
+            head = (block_head_t *) (void *) pos;
+            rrd_block_pack(values + row * ds_cnt, block_cnt, ds_cnt,
+                           rrd->rra_ptr[rra_idx].cur_row / block_rows
+                           == row / block_rows, head,
+                           pos + sizeof(block_head_t));
+            pos += sizeof(block_head_t)
+                + block_cnt * ds_cnt * sizeof(rrd_value_t);
+        }
+        return;
+    }
+    memcpy(data, values, row_cnt * ds_cnt * sizeof(rrd_value_t));
+}
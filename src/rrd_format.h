@@ -36,6 +36,8 @@
 #define RRD_VERSION3  "0003"
 #define RRD_VERSION4  "0004"
 #define RRD_VERSION5  "0005"
+/* stat_head par[] carries flags, see stat_head_par_en */
+#define RRD_VERSION6  "0006"
 #define FLOAT_COOKIE  ((double)8.642135E130)
 
 typedef union unival {
@@ -126,10 +128,27 @@ typedef struct stat_head_t {
                              * in the rrd */
     unsigned long pdp_step; /* pdp interval in seconds */
 
-    unival    par[10];  /* global parameters ... unused
-                           at the moment */
+    unival    par[10];  /* global parameters, see stat_head_par_en;
+                           unused before version 6 */
 } stat_head_t;
 
+enum stat_head_par_en { SH_layout = 0,  /* RRD_LAYOUT_ROW, _COLUMN or
+                                         * _COMPRESSED, see the
+                                         * DATA STORAGE AREA below */
+    SH_block_rows = 1,          /* rows per block with
+                                 * RRD_LAYOUT_COMPRESSED */
+    SH_sparse_since = 2         /* last_up when the file was created
+                                 * without writing its data area, 0 if it
+                                 * was written in full, see
+                                 * rrd_rows_written() */
+};
+
+/* new RRD_LAYOUT_COMPRESSED files get blocks of at least this many rows
+ * and bytes, the latter so that the room a sealed block does not need
+ * spans whole pages which can be handed back to the file system */
+#define RRD_BLOCK_ROWS 128
+#define RRD_BLOCK_BYTES 65536
+
 
 /****************************************************************************
  * POS 2: ds_def_t  (* ds_cnt)                        Data Source definitions
@@ -411,6 +430,7 @@ typedef struct rrd_t {
     rrd_value_t *rrd_value; /* list of rrd values */
     void *__mmap_start;	    /* all __ variables will be used internally */
     long __mmap_size;
+    struct rrd_desc_t *__desc;  /* decoded header, see rrd_get_desc() */
 } rrd_t;
 
 /****************************************************************************
@@ -431,8 +451,49 @@ typedef struct rrd_t {
  *RRA 2
 
  *RRA rra_cnt -1
+
+ With RRD_LAYOUT_COLUMN (version 6 and up) each RRA instead holds one
+ contiguous ring of row_cnt values per data source:
+
+ *RRA 0
+ (0,0) .................... (0, row_cnt -1)
+ .
+ .
+ .
+ (ds_cnt -1, 0) ... (ds_cnt -1, row_cnt -1)
+
+ With RRD_LAYOUT_COMPRESSED each RRA is cut into blocks of block_rows
+ rows. Every block sits in a slot of fixed size, a block_head_t followed
+ by room for block_rows rows. The block holding the current row is kept
+ as plain rows so that updates stay cheap, all others are sealed:
+ their values are XOR encoded against the previous value of the same
+ data source and only the bytes needed for that are written. The rest
+ of the slot is left alone or punched out of the file. A slot full of
+ zero bytes holds an empty block.
+
+ A file created with SH_sparse_since set leaves the rows of its RRAs
+ unwritten, as holes of the file system. Rows reached by no update since
+ then hold zero bytes and read as unknown; RRAs used by Holt-Winters
+ forecasting are written in full all the same. With RRD_LAYOUT_COMPRESSED
+ the holes are empty blocks anyway.
+
+ *RRA 0
+ block_head_t, rows 0 .. block_rows -1, padding
+ block_head_t, rows block_rows .. 2 * block_rows -1, padding
+ .
+ .
  
  ****************************************************************************/
 
+enum block_kind_en { BLOCK_EMPTY = 0,   /* every value is DNAN */
+    BLOCK_RAW,                  /* plain rows, as in RRD_LAYOUT_ROW */
+    BLOCK_XOR                   /* see rrd_compress.c */
+};
+
+typedef struct block_head_t {
+    unsigned int kind;          /* enum block_kind_en */
+    unsigned int len;           /* bytes of data following the head */
+} block_head_t;
+
 
 #endif
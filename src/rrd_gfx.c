@@ -152,20 +152,14 @@ void gfx_close_path(
     cairo_fill(cr);
 }
 
-/* create a text node */
-static PangoLayout *gfx_prep_text(
+/* set the tab stops of the layout */
+static void gfx_prep_tabs(
     image_desc_t *im,
     double x,
-    gfx_color_t color,
-    PangoFontDescription *font_desc,
     double tabwidth,
     const char *text)
 {
     PangoLayout  *layout = im->layout;
-    const PangoFontDescription *pfd;
-    cairo_t  *cr = im->cr;
-
-
 
     /* for performance reasons we might
        want todo that only once ... tabs will always
@@ -174,8 +168,6 @@ static PangoLayout *gfx_prep_text(
     long      tab_count = strlen(text);
     long      tab_shift = fmod(x, tabwidth);
     int       border = im->text_prop[TEXT_PROP_LEGEND].size * 2.0;
-    
-    gchar    *utf8_text;
 
     if (im->last_tabwidth < 0 || im->last_tabwidth != tabwidth){
         PangoTabArray *tab_array;
@@ -190,6 +182,23 @@ static PangoLayout *gfx_prep_text(
         pango_layout_set_tabs(layout, tab_array);
         pango_tab_array_free(tab_array);
     }
+}
+
+/* create a text node */
+static PangoLayout *gfx_prep_text(
+    image_desc_t *im,
+    double x,
+    gfx_color_t color,
+    PangoFontDescription *font_desc,
+    double tabwidth,
+    const char *text)
+{
+    PangoLayout  *layout = im->layout;
+    const PangoFontDescription *pfd;
+    cairo_t  *cr = im->cr;
+    gchar    *utf8_text;
+
+    gfx_prep_tabs(im, x, tabwidth, text);
    pfd = pango_layout_get_font_description(layout);
 
    if (!pfd || !pango_font_description_equal (pfd,font_desc)){
@@ -223,20 +232,111 @@ static PangoLayout *gfx_prep_text(
     return layout;
 }
 
-/* Size Text Node */
-double gfx_get_text_width(
+/* A render context remembers the extents of the texts it measured, as
+ * long as nothing was drawn with its layout yet: drawing leaves the
+ * transformation of the graph in the pango context. Texts with tabs depend
+ * on the tab stops of the graph and are always measured anew. */
+
+typedef struct gfx_extent_t {
+    PangoFontDescription *font_desc;
+    unsigned long options;  /* hash of the cairo font options */
+    int       markup;
+    char     *text;
+    PangoRectangle log_rect;
+} gfx_extent_t;
+
+#define GFX_EXTENT_MAX 4096
+
+static guint gfx_extent_hash(
+    gconstpointer p)
+{
+    const gfx_extent_t *ext = (const gfx_extent_t *) p;
+
+    return g_str_hash(ext->text) ^ pango_font_description_hash(ext->font_desc)
+        ^ (guint) ext->options ^ (guint) ext->markup;
+}
+
+static gboolean gfx_extent_equal(
+    gconstpointer a,
+    gconstpointer b)
+{
+    const gfx_extent_t *ea = (const gfx_extent_t *) a;
+    const gfx_extent_t *eb = (const gfx_extent_t *) b;
+
+    return ea->options == eb->options && ea->markup == eb->markup
+        && strcmp(ea->text, eb->text) == 0
+        && pango_font_description_equal(ea->font_desc, eb->font_desc);
+}
+
+static void gfx_extent_free(
+    gpointer p)
+{
+    gfx_extent_t *ext = (gfx_extent_t *) p;
+
+    pango_font_description_free(ext->font_desc);
+    free(ext->text);
+    free(ext);
+}
+
+GHashTable *gfx_extent_cache_new(
+    void)
+{
+    return g_hash_table_new_full(gfx_extent_hash, gfx_extent_equal,
+                                 gfx_extent_free, NULL);
+}
+
+static void gfx_text_extents(
     image_desc_t *im,
     double start,
     PangoFontDescription *font_desc,
     double tabwidth,
-    char *text)
+    char *text,
+    PangoRectangle *log_rect)
 {
     PangoLayout *layout;
-    PangoRectangle log_rect;
     gfx_color_t color = { 0, 0, 0, 0 };
+    gfx_extent_t key, *ext = NULL;
+    int       cache = im->ctx != NULL && im->layout_fresh
+        && strchr(text, '\t') == NULL;
+
+    if (cache) {
+        key.font_desc = font_desc;
+        key.options = cairo_font_options_hash(im->font_options);
+        key.markup = im->with_markup;
+        key.text = text;
+        ext = (gfx_extent_t *) g_hash_table_lookup(im->ctx->extents, &key);
+    }
+    if (ext != NULL) {
+        /* the tab stops go by the first text of the graph */
+        gfx_prep_tabs(im, start, tabwidth, text);
+        *log_rect = ext->log_rect;
+        return;
+    }
     layout = gfx_prep_text(im, start, color, font_desc, tabwidth, text);
-    pango_layout_get_pixel_extents(layout, NULL, &log_rect);
+    pango_layout_get_pixel_extents(layout, NULL, log_rect);
 /*    g_object_unref(layout); */
+    if (cache && (ext = (gfx_extent_t *) malloc(sizeof(*ext))) != NULL) {
+        if (g_hash_table_size(im->ctx->extents) >= GFX_EXTENT_MAX)
+            g_hash_table_remove_all(im->ctx->extents);
+        *ext = key;
+        ext->font_desc = pango_font_description_copy(font_desc);
+        ext->text = strdup(text);
+        ext->log_rect = *log_rect;
+        g_hash_table_insert(im->ctx->extents, ext, ext);
+    }
+}
+
+/* Size Text Node */
+double gfx_get_text_width(
+    image_desc_t *im,
+    double start,
+    PangoFontDescription *font_desc,
+    double tabwidth,
+    char *text)
+{
+    PangoRectangle log_rect;
+
+    gfx_text_extents(im, start, font_desc, tabwidth, text, &log_rect);
     return log_rect.width;
 }
 
@@ -247,12 +347,9 @@ double gfx_get_text_height(
     double tabwidth,
     char *text)
 {
-    PangoLayout *layout;
     PangoRectangle log_rect;
-    gfx_color_t color = { 0, 0, 0, 0 };
-    layout = gfx_prep_text(im, 0.0, color, font_desc, tabwidth, text);
-    pango_layout_get_pixel_extents(layout, NULL, &log_rect);
-/*    g_object_unref(layout); */
+
+    gfx_text_extents(im, 0.0, font_desc, tabwidth, text, &log_rect);
     return log_rect.height;
 }
 
@@ -308,6 +405,7 @@ void gfx_text(
         break;
     }
     pango_cairo_update_layout(cr, layout);
+    im->layout_fresh = 0;
     cairo_move_to(cr, sx, sy);
     pango_cairo_show_layout(cr, layout);
 /*    g_object_unref(layout); */
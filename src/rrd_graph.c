@@ -42,6 +42,7 @@
 #else
 #include "plbasename.h"
 #endif
+#include "fnv.h"
 
 #if defined(_WIN32)
 #define timegm _mkgmtime
@@ -428,6 +429,13 @@ int im_free(
         return 0;
 
     free(im->graphfile);
+    free(im->lazy_stamps);
+    free(im->cache_key);
+    free(im->cache_stamps);
+    if (im->fetched != NULL) {
+        data_prefetch_free(im->fetched);
+        free(im->fetched);
+    }
 
     if (im->daemon_addr != NULL)
         free(im->daemon_addr);
@@ -456,6 +464,7 @@ int im_free(
             free(im->gdes[i].p_dashes);
 
         free(im->gdes[i].p_data);
+        free(im->gdes[i].sel_data);
         free(im->gdes[i].rpnp);
     }
     free(im->gdes);
@@ -959,10 +968,205 @@ int rrd_reduce_data(
 /* get the data required for the graphs from the
    relevant rrds ... */
 
+/* NULL stands for the daemon of the environment */
+static int same_daemon(
+    const char *a,
+    const char *b)
+{
+    return a == b || (a != NULL && b != NULL && strcmp(a, b) == 0);
+}
+
+/* Work out one fetch for every distinct DEF, asking only for the data
+ * sources the DEFs use, for data_prefetch_run to run before data_fetch
+ * picks up the results. f->job_of[i] tells which job belongs to gdes i,
+ * or is -1 for the DEFs that share the fetch of an earlier one. */
+int data_prefetch(
+    image_desc_t *im,
+    graph_fetch_t *f)
+{
+    rrd_fetch_job_t *jobs;
+    GHashTable *keys;
+    gpointer  value;
+    unsigned long j;
+    unsigned long gstep;
+    const char *rrd_daemon;
+    const char **want;
+    char     *key;
+    int       i;
+
+    f->job_cnt = 0;
+    f->jobs = jobs = (rrd_fetch_job_t *) calloc(im->gdes_c + 1,
+                                                sizeof(rrd_fetch_job_t));
+    f->job_of = (int *) malloc((im->gdes_c + 1) * sizeof(int));
+    f->local = (int *) calloc(im->gdes_c + 1, sizeof(int));
+    f->daemon_of = (const char **) calloc(im->gdes_c + 1, sizeof(char *));
+    if (jobs == NULL || f->job_of == NULL || f->local == NULL
+        || f->daemon_of == NULL) {
+        data_prefetch_free(f);
+        rrd_set_error("malloc data_fetch jobs");
+        return -1;
+    }
+    keys = g_hash_table_new_full(g_str_hash, g_str_equal, free, NULL);
+    for (i = 0; i < (int) im->gdes_c; i++) {
+        f->job_of[i] = -1;
+        if (im->gdes[i].gf != GF_DEF)
+            continue;
+        key = gdes_fetch_key(im->gdes[i]);
+        if (g_hash_table_lookup_extended(keys, key, NULL, &value)) {
+            free(key);
+            /* one more column of an earlier fetch */
+            j = f->job_of[GPOINTER_TO_INT(value)];
+            if (jobs[j].want == NULL)
+                continue;
+            for (want = (const char **) jobs[j].want;
+                 want < jobs[j].want + jobs[j].want_cnt; want++)
+                if (strcmp(*want, im->gdes[i].ds_nam) == 0)
+                    break;
+            if (want == jobs[j].want + jobs[j].want_cnt)
+                ((const char **) jobs[j].want)[jobs[j].want_cnt++] =
+                    im->gdes[i].ds_nam;
+            continue;
+        }
+        g_hash_table_insert(keys, key, GINT_TO_POINTER(i));
+        j = f->job_cnt++;
+        f->job_of[i] = (int) j;
+        jobs[j].filename = im->gdes[i].rrd;
+        jobs[j].cf = cf_to_string(im->gdes[i].cf);
+        jobs[j].start = im->gdes[i].start;
+        jobs[j].end = im->gdes[i].end;
+        jobs[j].step = im->gdes[i].step;
+        jobs[j].reduce = RRD_REDUCE_CF;
+        /* missing data sources are fine then, so fetch all of them */
+        if (!(im->extra_flags & ALLOW_MISSING_DS)
+            && (want = (const char **)
+                malloc(im->gdes_c * sizeof(char *))) != NULL) {
+            want[0] = im->gdes[i].ds_nam;
+            jobs[j].want = want;
+            jobs[j].want_cnt = 1;
+        }
+
+        if (im->gdes[i].daemon[0] != 0)
+            rrd_daemon = im->gdes[i].daemon;
+        else
+            rrd_daemon = im->daemon_addr;
+        rrdc_connect(rrd_daemon);
+        f->local[j] = !rrdc_is_connected(rrd_daemon);
+        if (f->local[j])
+            continue;
+        f->daemon_of[j] = rrd_daemon;
+        /* let the daemon consolidate the rows the graph can not show
+         * anyway; where it comes up short rrd_reduce_data takes over */
+        gstep = max(im->gdes[i].step, im->step);
+        if (gstep > 0 && (!im->gdes[i].cf_reduce_set
+                          || im->gdes[i].cf_reduce == im->gdes[i].cf))
+            jobs[j].max_rows =
+                (im->gdes[i].end - im->gdes[i].start + gstep - 1) / gstep;
+    }
+    g_hash_table_destroy(keys);
+    return 0;
+}
+
+/* Run the jobs of f: those that read local files at the same time
+ * through rrd_fetch_many, those for rrdcached as one pipeline per daemon
+ * through rrdc_fetch_many. How each fetch went is up to data_fetch. */
+int data_prefetch_run(
+    graph_fetch_t *f)
+{
+    rrd_fetch_job_t *jobs = f->jobs, *sub_jobs;
+    unsigned long j, k, sub_cnt;
+    const char *rrd_daemon;
+    int      *done;
+
+    sub_jobs = (rrd_fetch_job_t *)
+        malloc((f->job_cnt + 1) * sizeof(rrd_fetch_job_t));
+    done = (int *) malloc((f->job_cnt + 1) * sizeof(int));
+    if (sub_jobs == NULL || done == NULL) {
+        free(sub_jobs);
+        free(done);
+        rrd_set_error("malloc data_fetch jobs");
+        return -1;
+    }
+    sub_cnt = 0;
+    for (j = 0; j < f->job_cnt; j++)
+        if (f->local[j])
+            sub_jobs[sub_cnt++] = jobs[j];
+    rrd_fetch_many(sub_jobs, sub_cnt, DATA_FETCH_THREADS, 0);
+    sub_cnt = 0;
+    for (j = 0; j < f->job_cnt; j++)
+        if ((done[j] = f->local[j]))
+            jobs[j] = sub_jobs[sub_cnt++];
+
+    /* the jobs of one daemon after another */
+    for (j = 0; j < f->job_cnt; j++) {
+        if (done[j])
+            continue;
+        rrd_daemon = f->daemon_of[j];
+        sub_cnt = 0;
+        for (k = j; k < f->job_cnt; k++)
+            if (!done[k] && same_daemon(f->daemon_of[k], rrd_daemon))
+                sub_jobs[sub_cnt++] = jobs[k];
+        rrdc_connect(rrd_daemon);
+        rrdc_fetch_many(sub_jobs, sub_cnt);
+        sub_cnt = 0;
+        for (k = j; k < f->job_cnt; k++)
+            if (!done[k] && same_daemon(f->daemon_of[k], rrd_daemon)) {
+                jobs[k] = sub_jobs[sub_cnt++];
+                done[k] = 1;
+            }
+    }
+    rrd_clear_error();
+    free(sub_jobs);
+    free(done);
+    return 0;
+}
+
+/* free what data_fetch did not take over of the prefetched jobs */
+void data_prefetch_free(
+    graph_fetch_t *f)
+{
+    rrd_fetch_job_t *job;
+    unsigned long ii;
+
+    for (job = f->jobs; job != NULL && job < f->jobs + f->job_cnt; job++) {
+        if (job->ds_namv != NULL) {
+            for (ii = 0; ii < job->ds_cnt; ii++)
+                free(job->ds_namv[ii]);
+            free(job->ds_namv);
+        }
+        free(job->data);
+        free(job->error);
+        free((void *) job->want);
+    }
+    free(f->jobs);
+    free(f->job_of);
+    free(f->local);
+    free(f->daemon_of);
+    f->jobs = NULL;
+    f->job_of = NULL;
+    f->local = NULL;
+    f->daemon_of = NULL;
+    f->job_cnt = 0;
+}
+
 int data_fetch(
     image_desc_t *im)
 {
     int       i, ii;
+    graph_fetch_t own, *f = im->fetched;
+    rrd_fetch_job_t *job;
+    unsigned long j;
+    int       rc = -1;
+
+    /* rrd_graph_many may have fetched for us */
+    if (f == NULL) {
+        f = &own;
+        if (data_prefetch(im, f) == -1)
+            return -1;
+        if (data_prefetch_run(f) == -1) {
+            data_prefetch_free(f);
+            return -1;
+        }
+    }
 
     /* pull the data from the rrd files ... */
     for (i = 0; i < (int) im->gdes_c; i++) {
@@ -976,6 +1180,14 @@ int data_fetch(
         gboolean  ok =
             g_hash_table_lookup_extended(im->rrd_map, key, NULL, &value);
         free(key);
+        /* the fetch may only have the columns of other DEFs */
+        if (ok) {
+            ii = GPOINTER_TO_INT(value);
+            ok = FALSE;
+            for (j = 0; j < im->gdes[ii].ds_cnt; j++)
+                if (strcmp(im->gdes[ii].ds_namv[j], im->gdes[i].ds_nam) == 0)
+                    ok = TRUE;
+        }
         if (ok) {
             ii = GPOINTER_TO_INT(value);
             im->gdes[i].start = im->gdes[ii].start;
@@ -995,25 +1207,26 @@ int data_fetch(
             else
                 rrd_daemon = im->daemon_addr;
 
-            /* "daemon" may be NULL. ENV_RRDCACHED_ADDRESS is evaluated in that
-             * case. If "daemon" holds the same value as in the previous
-             * iteration, no actual new connection is established - the
-             * existing connection is re-used. */
-            rrdc_connect(rrd_daemon);
-
-            /* If connecting was successful, use the daemon to query the data.
-             * If there is no connection, for example because no daemon address
-             * was specified, (try to) use the local file directly. */
-            if (rrdc_is_connected(rrd_daemon)) {
-                status = rrdc_fetch(im->gdes[i].rrd,
-                                    cf_to_string(im->gdes[i].cf),
-                                    &im->gdes[i].start,
-                                    &im->gdes[i].end,
-                                    &ft_step,
-                                    &im->gdes[i].ds_cnt,
-                                    &im->gdes[i].ds_namv, &im->gdes[i].data);
+            job = f->job_of[i] >= 0 ? f->jobs + f->job_of[i] : NULL;
+            if (job != NULL) {
+                /* fetched by data_prefetch */
+                status = job->rc;
+                if (status == 0) {
+                    im->gdes[i].start = job->start;
+                    im->gdes[i].end = job->end;
+                    ft_step = job->step;
+                    im->gdes[i].ds_cnt = job->ds_cnt;
+                    im->gdes[i].ds_namv = job->ds_namv;
+                    im->gdes[i].data = job->data;
+                    job->ds_namv = NULL;
+                    job->data = NULL;
+                } else {
+                    rrd_set_error("%s", job->error ? job->error
+                                  : "fetch failed");
+                }
                 if (status != 0) {
                     if (im->extra_flags & ALLOW_MISSING_DS) {
+                        /* Unable to fetch data, assume fake data */
                         rrd_clear_error();
                         if (rrd_fetch_empty(&im->gdes[i].start,
                                             &im->gdes[i].end,
@@ -1022,21 +1235,42 @@ int data_fetch(
                                             im->gdes[i].ds_nam,
                                             &im->gdes[i].ds_namv,
                                             &im->gdes[i].data) == -1)
-                            return -1;
+                            goto done;
                     } else
-                        return (status);
+                        goto done;
                 }
             } else {
-                if ((rrd_fetch_fn(im->gdes[i].rrd,
-                                  im->gdes[i].cf,
-                                  &im->gdes[i].start,
-                                  &im->gdes[i].end,
-                                  &ft_step,
-                                  &im->gdes[i].ds_cnt,
-                                  &im->gdes[i].ds_namv,
-                                  &im->gdes[i].data)) == -1) {
+                /* "daemon" may be NULL. ENV_RRDCACHED_ADDRESS is evaluated in
+                 * that case. If "daemon" holds the same value as in the
+                 * previous iteration, no actual new connection is
+                 * established - the existing connection is re-used. */
+                rrdc_connect(rrd_daemon);
+
+                /* If connecting was successful, use the daemon to query the
+                 * data. If there is no connection, for example because no
+                 * daemon address was specified, (try to) use the local file
+                 * directly. */
+                if (rrdc_is_connected(rrd_daemon)) {
+                    status = rrdc_fetch(im->gdes[i].rrd,
+                                        cf_to_string(im->gdes[i].cf),
+                                        &im->gdes[i].start,
+                                        &im->gdes[i].end,
+                                        &ft_step,
+                                        &im->gdes[i].ds_cnt,
+                                        &im->gdes[i].ds_namv,
+                                        &im->gdes[i].data);
+                } else {
+                    status = rrd_fetch_fn(im->gdes[i].rrd,
+                                          im->gdes[i].cf,
+                                          &im->gdes[i].start,
+                                          &im->gdes[i].end,
+                                          &ft_step,
+                                          &im->gdes[i].ds_cnt,
+                                          &im->gdes[i].ds_namv,
+                                          &im->gdes[i].data);
+                }
+                if (status != 0) {
                     if (im->extra_flags & ALLOW_MISSING_DS) {
-                        /* Unable to fetch data, assume fake data */
                         rrd_clear_error();
                         if (rrd_fetch_empty(&im->gdes[i].start,
                                             &im->gdes[i].end,
@@ -1045,9 +1279,9 @@ int data_fetch(
                                             im->gdes[i].ds_nam,
                                             &im->gdes[i].ds_namv,
                                             &im->gdes[i].data) == -1)
-                            return -1;
+                            goto done;
                     } else
-                        return -1;
+                        goto done;
                 }
             }
             im->gdes[i].data_first = 1;
@@ -1063,7 +1297,7 @@ int data_fetch(
                      gdes[i].cf, ft_step, &im->gdes[i].start,
                      &im->gdes[i].end, &im->gdes[i].step, &im->gdes[i].ds_cnt,
                      &im->gdes[i].data)) {
-                    return -1;
+                    goto done;
                 }
             } else {
                 im->gdes[i].step = ft_step;
@@ -1079,13 +1313,20 @@ int data_fetch(
         if ((im->gdes[i].ds == -1) && !(im->extra_flags & ALLOW_MISSING_DS)) {
             rrd_set_error("No DS called '%s' in '%s'",
                           im->gdes[i].ds_nam, im->gdes[i].rrd);
-            return -1;
+            goto done;
         }
         // remember that we already got this one
         g_hash_table_insert(im->rrd_map, gdes_fetch_key(im->gdes[i]),
                             GINT_TO_POINTER(i));
     }
-    return 0;
+    rc = 0;
+  done:
+    data_prefetch_free(f);
+    if (f == im->fetched) {
+        free(f);
+        im->fetched = NULL;
+    }
+    return rc;
 }
 
 /* evaluate the expressions in the CDEF functions */
@@ -1117,6 +1358,139 @@ long rrd_lcd(
 
 
 /* run the rpn calculator on all the VDEF and CDEF arguments */
+/* Tell which CDEFs and VDEFs something depends on, data_calc skips the
+ * others. What is not computed in data_calc counts as used, and so does
+ * everything it refers to. */
+static char *data_live(
+    image_desc_t *im)
+{
+    char     *live;
+    long      i, rpi;
+    rpnp_t   *rpnp;
+
+    if ((live = (char *) calloc(im->gdes_c + 1, 1)) == NULL)
+        return NULL;
+    for (i = im->gdes_c - 1; i >= 0; i--) {
+        switch (im->gdes[i].gf) {
+        case GF_DEF:
+            break;
+        case GF_CDEF:
+            if (!live[i])
+                break;
+            for (rpnp = im->gdes[i].rpnp, rpi = 0; rpnp[rpi].op != OP_END;
+                 rpi++)
+                if ((rpnp[rpi].op == OP_VARIABLE
+                     || rpnp[rpi].op == OP_PREV_OTHER) && rpnp[rpi].ptr >= 0)
+                    live[rpnp[rpi].ptr] = 1;
+            break;
+        case GF_VDEF:
+            if (live[i])
+                live[im->gdes[i].vidx] = 1;
+            break;
+        default:
+            live[i] = 1;
+            if (im->gdes[i].vidx >= 0 && im->gdes[i].vidx < im->gdes_c)
+                live[im->gdes[i].vidx] = 1;
+            if (im->gdes[i].gf == GF_SHIFT && im->gdes[i].shidx >= 0)
+                live[im->gdes[i].shidx] = 1;
+            break;
+        }
+    }
+    return live;
+}
+
+static int rpnp_same(
+    const rpnp_t *a,
+    const rpnp_t *b)
+{
+    if (a->op != b->op)
+        return 0;
+    if (a->op == OP_NUMBER)
+        return memcmp(&a->val, &b->val, sizeof(a->val)) == 0;
+    if (a->op == OP_VARIABLE || a->op == OP_PREV_OTHER)
+        return a->ptr == b->ptr;
+    return 1;
+}
+
+/* Replace the parts of the expression of CDEF gdi that are the whole
+ * expression of an earlier CDEF by that CDEF, once variables and VDEFs
+ * are resolved. The earlier CDEF must have been computed from rows of
+ * its variables alone, and those must all have its step and start, so
+ * that its rows are the values the part would come to. */
+static long data_share(
+    image_desc_t *im,
+    const char *live,
+    long gdi)
+{
+    graph_desc_t *x;
+    rpnp_t   *rpnp = im->gdes[gdi].rpnp;
+    long      xi, rpi, len, i, k, shared = 0;
+
+    /* these look at the ops before them */
+    for (rpi = 0; rpnp[rpi].op != OP_END; rpi++)
+        if (rpnp[rpi].op == OP_TREND || rpnp[rpi].op == OP_TRENDNAN
+            || rpnp[rpi].op == OP_PREDICT || rpnp[rpi].op == OP_PREDICTSIGMA
+            || rpnp[rpi].op == OP_PREDICTPERC)
+            return 0;
+
+    for (xi = gdi - 1; xi >= 0; xi--) {
+        x = &im->gdes[xi];
+        if (x->gf != GF_CDEF || !live[xi] || x->data == NULL
+            || x->start % (time_t) x->step != 0 || !rpn_row_only(x->rpnp))
+            continue;
+        for (len = 0; x->rpnp[len].op != OP_END; len++)
+            if (x->rpnp[len].op == OP_VARIABLE
+                && (im->gdes[x->rpnp[len].ptr].step != x->step
+                    || im->gdes[x->rpnp[len].ptr].start != x->start))
+                break;
+        if (x->rpnp[len].op != OP_END || len < 2)
+            continue;
+
+        for (i = 0; rpnp[i].op != OP_END; i++) {
+            for (k = 0; k < len && rpnp_same(rpnp + i + k, x->rpnp + k);
+                 k++);
+            if (k < len)
+                continue;
+            rpnp[i].op = OP_VARIABLE;
+            rpnp[i].ptr = xi;
+            rpnp[i].data = x->data + x->ds;
+            rpnp[i].step = x->step;
+            rpnp[i].ds_cnt = x->ds_cnt;
+            for (k = i + 1; rpnp[k + len - 1].op != OP_END; k++)
+                rpnp[k] = rpnp[k + len - 1];
+            rpnp[k] = rpnp[k + len - 1];
+            shared++;
+        }
+    }
+    return shared;
+}
+
+/* Take the result of a VDEF from an earlier one that does the same to
+ * the same data. Shifts change the data, so then it is computed. */
+static int data_share_vdef(
+    image_desc_t *im,
+    const char *live,
+    long gdi)
+{
+    graph_desc_t *v = &im->gdes[gdi];
+    long      i;
+
+    for (i = 0; i < im->gdes_c; i++)
+        if (im->gdes[i].gf == GF_SHIFT && im->gdes[i].vidx == v->vidx)
+            return 0;
+    for (i = gdi - 1; i >= 0; i--)
+        if (im->gdes[i].gf == GF_VDEF && im->gdes[i].vidx == v->vidx
+            && live[i] && im->gdes[i].vf.op == v->vf.op
+            && memcmp(&im->gdes[i].vf.param, &v->vf.param,
+                      sizeof(v->vf.param)) == 0) {
+            v->vf.val = im->gdes[i].vf.val;
+            v->vf.when = im->gdes[i].vf.when;
+            v->vf.never = im->gdes[i].vf.never;
+            return 1;
+        }
+    return 0;
+}
+
 int data_calc(
     image_desc_t *im)
 {
@@ -1129,7 +1503,14 @@ int data_calc(
     time_t    now;
     rpnstack_t rpnstack;
     rpnp_t   *rpnp;
+    short     block;
+    char     *live;
+    rrd_infoval_t info;
 
+    if ((live = data_live(im)) == NULL) {
+        rrd_set_error("malloc data_calc live");
+        return -1;
+    }
     rpnstack_init(&rpnstack);
 
     for (gdi = 0; gdi < im->gdes_c; gdi++) {
@@ -1166,14 +1547,28 @@ int data_calc(
              * of rrdtool that this is a VDEF value, not a CDEF.
              */
             im->gdes[gdi].ds_cnt = 0;
+            if (!live[gdi]) {
+                im->rpn_skipped++;
+                break;
+            }
+            if (data_share_vdef(im, live, gdi)) {
+                im->rpn_shared++;
+                break;
+            }
             if (vdef_calc(im, gdi)) {
                 rrd_set_error("Error processing VDEF '%s'",
                               im->gdes[gdi].vname);
                 rpnstack_free(&rpnstack);
+                free(live);
                 return -1;
             }
             break;
         case GF_CDEF:
+            if (!live[gdi]) {
+                /* nothing refers to it */
+                im->rpn_skipped++;
+                break;
+            }
             im->gdes[gdi].ds_cnt = 1;
             im->gdes[gdi].ds = 0;
             im->gdes[gdi].data_first = 1;
@@ -1220,6 +1615,7 @@ int data_calc(
                             NULL) {
                             rrd_set_error("realloc steparray");
                             rpnstack_free(&rpnstack);
+                            free(live);
                             return -1;
                         };
                         steparray = steparray_tmp;
@@ -1257,6 +1653,8 @@ int data_calc(
                 }       /* if OP_VARIABLE */
             }           /* loop through all rpi */
 
+            im->rpn_shared += data_share(im, live, gdi);
+
             /* move the data pointers to the correct period */
             for (rpi = 0; im->gdes[gdi].rpnp[rpi].op != OP_END; rpi++) {
                 if (im->gdes[gdi].rpnp[rpi].op == OP_VARIABLE ||
@@ -1276,6 +1674,7 @@ int data_calc(
                 rrd_set_error("rpn expressions without DEF"
                               " or CDEF variables are not supported");
                 rpnstack_free(&rpnstack);
+                free(live);
                 return -1;
             }
             steparray[stepcnt] = 0;
@@ -1291,14 +1690,29 @@ int data_calc(
                         * sizeof(double))) == NULL) {
                 rrd_set_error("malloc im->gdes[gdi].data");
                 rpnstack_free(&rpnstack);
+                free(live);
                 return -1;
             }
 
             /* Step through the new cdef results array and
-             * calculate the values
+             * calculate the values, a block of them at a time where
+             * the expression allows for it
              */
+            block = rpn_calc_block(rpnp, &rpnstack,
+                                   (long) (im->gdes[gdi].start +
+                                           im->gdes[gdi].step),
+                                   im->gdes[gdi].data, 0,
+                                   (im->gdes[gdi].end - im->gdes[gdi].start)
+                                   / im->gdes[gdi].step, im->gdes[gdi].step);
+            if (block == -1) {
+                rpnstack_free(&rpnstack);
+                free(live);
+                rpnp_freeextra(rpnp);
+                return -1;
+            }
             for (now = im->gdes[gdi].start + im->gdes[gdi].step;
-                 now <= im->gdes[gdi].end; now += im->gdes[gdi].step) {
+                 block == 0 && now <= im->gdes[gdi].end;
+                 now += im->gdes[gdi].step) {
 
                 /* 3rd arg of rpn_calc is for OP_VARIABLE lookups;
                  * in this case we are advancing by timesteps;
@@ -1309,6 +1723,7 @@ int data_calc(
                              im->gdes[gdi].step) == -1) {
                     /* rpn_calc sets the error string */
                     rpnstack_free(&rpnstack);
+                    free(live);
                     rpnp_freeextra(rpnp);
                     return -1;
                 }
@@ -1321,6 +1736,14 @@ int data_calc(
         }
     }                   /* enumerate over CDEFs */
     rpnstack_free(&rpnstack);
+    free(live);
+
+    info.u_cnt = im->rpn_folded;
+    grinfo_push(im, sprintf_alloc("rpn_folded"), RD_I_CNT, info);
+    info.u_cnt = im->rpn_shared;
+    grinfo_push(im, sprintf_alloc("rpn_shared"), RD_I_CNT, info);
+    info.u_cnt = im->rpn_skipped;
+    grinfo_push(im, sprintf_alloc("rpn_skipped"), RD_I_CNT, info);
     return 0;
 }
 
@@ -1361,6 +1784,52 @@ static int AlmostEqual2sComplement(
     return 0;
 }
 
+/* the rows of the data of one time frame and step, see data_proc_rows */
+typedef struct proc_rows_t {
+    time_t    start, end;
+    unsigned long step;
+    long     *row;
+} proc_rows_t;
+
+/* The row of the data of src for every pixel of the graph, -1 where the
+ * data does not cover the pixel. All sources with the same time frame and
+ * step share one table of tabs. */
+static const long *data_proc_rows(
+    image_desc_t *im,
+    graph_desc_t *src,
+    double pixstep,
+    proc_rows_t *tabs,
+    long *tab_cnt)
+{
+    proc_rows_t *tab;
+    unsigned long gr_time;
+    long      i;
+
+    for (tab = tabs; tab < tabs + *tab_cnt; tab++)
+        if (tab->start == src->start && tab->end == src->end
+            && tab->step == src->step)
+            return tab->row;
+    if ((tab->row = (long *) malloc((im->xsize + 1) * sizeof(long)))
+        == NULL) {
+        rrd_set_error("malloc data_proc");
+        return NULL;
+    }
+    tab->start = src->start;
+    tab->end = src->end;
+    tab->step = src->step;
+    (*tab_cnt)++;
+    for (i = 0; i < im->xsize; i++) {
+        gr_time = im->start + pixstep * i;  /* time of the current step */
+        if ((long int) gr_time >= (long int) src->start
+            && (long int) gr_time < (long int) src->end)
+            tab->row[i] = (long) floor((double) (gr_time - src->start)
+                                       / src->step);
+        else
+            tab->row[i] = -1;
+    }
+    return tab->row;
+}
+
 /* massage data so, that we get one value for each x coordinate in the graph */
 int data_proc(
     image_desc_t *im)
@@ -1369,10 +1838,11 @@ int data_proc(
     double    pixstep = (double) (im->end - im->start)
         / (double) im->xsize;   /* how much time
                                    passes in one pixel */
-    double    paintval;
     double    minval = DNAN, maxval = DNAN;
-
-    unsigned long gr_time;
+    double   *paint;
+    proc_rows_t *tabs;
+    long      tab_cnt = 0;
+    int       rc = 0;
 
     /* memory for the processed data */
     for (i = 0; i < im->gdes_c; i++) {
@@ -1391,76 +1861,102 @@ int data_proc(
         }
     }
 
-    for (i = 0; i < im->xsize; i++) {   /* for each pixel */
-        long      vidx;
+    /* the running sum of the stack at every pixel */
+    if ((paint = (double *) malloc((im->xsize + 1) * sizeof(double))) == NULL
+        || (tabs = (proc_rows_t *) calloc(im->gdes_c + 1,
+                                          sizeof(proc_rows_t))) == NULL) {
+        free(paint);
+        rrd_set_error("malloc data_proc");
+        return -1;
+    }
+    for (i = 0; i < im->xsize; i++)
+        paint[i] = 0.0;
 
-        gr_time = im->start + pixstep * i;  /* time of the current step */
-        paintval = 0.0;
-
-        for (ii = 0; ii < im->gdes_c; ii++) {
-            double    value;
-
-            switch (im->gdes[ii].gf) {
-            case GF_LINE:
-            case GF_AREA:
-            case GF_TICK:
-                if (!im->gdes[ii].stack)
-                    paintval = 0.0;
-                value = im->gdes[ii].yrule;
-                if (isnan(value) || (im->gdes[ii].gf == GF_TICK)) {
-                    /* The time of the data doesn't necessarily match
-                     ** the time of the graph. Beware.
-                     */
-                    vidx = im->gdes[ii].vidx;
-                    if (im->gdes[vidx].gf == GF_VDEF) {
-                        value = im->gdes[vidx].vf.val;
+    /* one element after the other, so that its pixels go in one sweep */
+    for (ii = 0; ii < im->gdes_c; ii++) {
+        graph_desc_t *gdp = &im->gdes[ii], *src = NULL;
+        rrd_value_t *p_data = gdp->p_data;
+        const long *row;
+        double    value;
+
+        switch (gdp->gf) {
+        case GF_LINE:
+        case GF_AREA:
+        case GF_TICK:
+            if (!gdp->stack)
+                for (i = 0; i < im->xsize; i++)
+                    paint[i] = 0.0;
+            value = gdp->yrule;
+            row = NULL;
+            if (isnan(value) || gdp->gf == GF_TICK) {
+                /* The time of the data doesn't necessarily match
+                 ** the time of the graph. Beware.
+                 */
+                src = &im->gdes[gdp->vidx];
+                if (src->gf == GF_VDEF)
+                    value = src->vf.val;
+                else if ((row = data_proc_rows(im, src, pixstep, tabs,
+                                               &tab_cnt)) == NULL) {
+                    rc = -1;
+                    goto done;
+                }
+            }
+            if (row != NULL) {
+                const rrd_value_t *data = src->data + src->ds;
+                unsigned long ds_cnt = src->ds_cnt;
+
+                for (i = 0; i < im->xsize; i++) {
+                    value = row[i] < 0 ? DNAN : data[row[i] * ds_cnt];
+                    if (!isnan(value)) {
+                        paint[i] += value;
+                        p_data[i] = paint[i];
                     } else
-                        if (((long int) gr_time >=
-                             (long int) im->gdes[vidx].start)
-                            && ((long int) gr_time <
-                                (long int) im->gdes[vidx].end)) {
-                        value = im->gdes[vidx].data[(unsigned long)
-                                                    floor((double)
-                                                          (gr_time -
-                                                           im->
-                                                           gdes[vidx].start)
-                                                          /
-                                                          im->gdes[vidx].step)
-                                                    * im->gdes[vidx].ds_cnt +
-                                                    im->gdes[vidx].ds];
-                    } else {
-                        value = DNAN;
-                    }
-                };
-
-                if (!isnan(value)) {
-                    paintval += value;
-                    im->gdes[ii].p_data[i] = paintval;
-                    /* GF_TICK: the data values are not
-                     ** relevant for min and max
-                     */
-                    if (finite(paintval) && im->gdes[ii].gf != GF_TICK
-                        && !im->gdes[ii].skipscale) {
-                        if ((isnan(minval) || paintval < minval)
-                            && !(im->logarithmic && paintval <= 0.0))
-                            minval = paintval;
-                        if (isnan(maxval) || paintval > maxval)
-                            maxval = paintval;
-                    }
-                } else {
-                    im->gdes[ii].p_data[i] = DNAN;
+                        p_data[i] = DNAN;
                 }
+            } else if (!isnan(value)) {
+                /* the same value at every pixel */
+                for (i = 0; i < im->xsize; i++) {
+                    paint[i] += value;
+                    p_data[i] = paint[i];
+                }
+            } else {
+                for (i = 0; i < im->xsize; i++)
+                    p_data[i] = DNAN;
+            }
+
+            /* GF_TICK: the data values are not
+             ** relevant for min and max
+             */
+            if (gdp->gf == GF_TICK || gdp->skipscale)
                 break;
-            case GF_STACK:
-                rrd_set_error
-                    ("STACK should already be turned into LINE or AREA here");
-                return -1;
-                break;
-            default:
-                break;
+            for (i = 0; i < im->xsize; i++) {
+                double    paintval = p_data[i];
+
+                if (!finite(paintval))
+                    continue;
+                if ((isnan(minval) || paintval < minval)
+                    && !(im->logarithmic && paintval <= 0.0))
+                    minval = paintval;
+                if (isnan(maxval) || paintval > maxval)
+                    maxval = paintval;
             }
+            break;
+        case GF_STACK:
+            rrd_set_error
+                ("STACK should already be turned into LINE or AREA here");
+            rc = -1;
+            goto done;
+        default:
+            break;
         }
     }
+  done:
+    for (i = 0; i < tab_cnt; i++)
+        free(tabs[i].row);
+    free(tabs);
+    free(paint);
+    if (rc != 0)
+        return rc;
 
     /* if min or max have not been assigned a value this is because
        there was no data in the graph ... this is not good ...
@@ -3486,6 +3982,331 @@ int lazy_check(
 }
 
 
+/* The sidecar of a lazy graph, graphfile.lazy, remembers what the image
+ * was drawn from: a hash of the arguments, the time frame, a stamp for
+ * every RRD, and the size and mtime of the image, followed by the info
+ * the graph returned. As long as all of these still hold, the info is
+ * handed out again without touching any RRD. The stamp of a local RRD is
+ * its mtime, that of an RRD behind rrdcached the answer to LAST. */
+
+static unsigned long lazy_hash(
+    int argc,
+    const char **argv)
+{
+    Fnv32_t   hash = FNV1_32_INIT;
+    const char *tz = getenv("TZ");
+    int       i;
+
+    /* argv[0] only tells graph from graphv */
+    for (i = 1; i < argc; i++)
+        hash = fnv_32_buf(argv[i], strlen(argv[i]) + 1, hash);
+    if (tz != NULL)
+        hash = fnv_32_buf(tz, strlen(tz) + 1, hash);
+    return hash;
+}
+
+/* the stamps of the RRDs of the graph, one line each, or NULL when the
+ * graph can not be cached; the graph cache takes them too */
+char     *lazy_stamps(
+    image_desc_t *im)
+{
+    time_t    now = time(NULL);
+    char     *stamps = strdup(""), *line;
+    const char *kind, *rrd_daemon;
+    long long stamp;
+    struct stat st;
+    long      i, j, k;
+
+    for (i = 0; stamps != NULL && i < im->gdes_c; i++) {
+        graph_desc_t *gdp = &im->gdes[i];
+
+        if (gdp->gf == GF_CDEF) {
+            /* NOW is different every time */
+            for (k = 0; gdp->rpnp[k].op != OP_END; k++)
+                if (gdp->rpnp[k].op == OP_NOW)
+                    break;
+            if (gdp->rpnp[k].op == OP_NOW) {
+                free(stamps);
+                return NULL;
+            }
+        }
+        if (gdp->gf != GF_DEF)
+            continue;
+        for (j = 0; j < i; j++)
+            if (im->gdes[j].gf == GF_DEF
+                && strcmp(im->gdes[j].rrd, gdp->rrd) == 0
+                && strcmp(im->gdes[j].daemon, gdp->daemon) == 0)
+                break;
+        if (j < i)
+            continue;
+
+        rrd_daemon = gdp->daemon[0] != 0 ? gdp->daemon : im->daemon_addr;
+        rrdc_connect(rrd_daemon);
+        if (rrdc_is_connected(rrd_daemon)) {
+            kind = "last";
+            stamp = rrdc_last(gdp->rrd);
+        } else {
+            kind = "mtime";
+            stamp = stat(gdp->rrd, &st) == 0 ? (long long) st.st_mtime : -1;
+        }
+        if (stamp == -1) {
+            /* the fetch will tell what is wrong */
+            rrd_clear_error();
+            free(stamps);
+            return NULL;
+        }
+        /* a change within the current second would go unnoticed */
+        if (stamp >= now)
+            stamp = -1;
+        line = sprintf_alloc("%s%s %lld %s\n", stamps, kind, stamp,
+                             gdp->rrd);
+        free(stamps);
+        stamps = line;
+    }
+    return stamps;
+}
+
+/* the header of the sidecar, up to the info */
+static char *lazy_header(
+    image_desc_t *im,
+    struct stat *img)
+{
+    return sprintf_alloc("RRDtool lazy 1\nhash %lx\nstart %lld end %lld\n"
+                         "%simage %lld %lld\n", im->lazy_hash,
+                         (long long) im->start, (long long) im->end,
+                         im->lazy_stamps, (long long) img->st_mtime,
+                         (long long) img->st_size);
+}
+
+/* hand out the info of the sidecar, when it is still good; fresh tells
+ * whether lazy_check would keep the image in any case */
+static int lazy_load(
+    image_desc_t *im,
+    int fresh)
+{
+    char     *path, *header, *frame, *rest, *buf = NULL, *p, *eol, *key,
+        *val, *q;
+    size_t    len = 0, got;
+    FILE     *fd;
+    struct stat img;
+    rrd_info_t *head = NULL, *tail = NULL;
+    rrd_infoval_t info;
+    unsigned char *bytes;
+    int       ok = 0, i;
+
+    if (im->lazy == 0 || im->graphfile == NULL || im->lazy_stamps == NULL)
+        return 0;
+    if (stat(im->graphfile, &img) != 0)
+        return 0;
+    path = sprintf_alloc("%s.lazy", im->graphfile);
+    fd = path ? rrd_fopen(path, "rbe") : NULL;
+    free(path);
+    if (fd == NULL)
+        return 0;
+    do {
+        p = (char *) realloc(buf, len + 4096 + 1);
+        if (p == NULL)
+            break;
+        buf = p;
+        got = fread(buf + len, 1, 4096, fd);
+        len += got;
+    } while (got == 4096);
+    fclose(fd);
+    if (buf == NULL || p == NULL) {
+        free(buf);
+        return 0;
+    }
+    buf[len] = '\0';
+
+    /* the same arguments, RRDs and image; a time frame that moved on
+     * will do as long as the image is fresh */
+    header = lazy_header(im, &img);
+    frame = header ? strstr(header, "start ") : NULL;
+    if (frame == NULL || strncmp(buf, header, frame - header) != 0) {
+        free(header);
+        free(buf);
+        return 0;
+    }
+    rest = strchr(frame, '\n') + 1;
+    p = buf + (frame - header);
+    eol = strchr(p, '\n');
+    if (eol == NULL || (strncmp(p, frame, rest - frame) != 0 && !fresh)
+        || strncmp(eol + 1, rest, strlen(rest)) != 0) {
+        free(header);
+        free(buf);
+        return 0;
+    }
+    p = eol + 1 + strlen(rest);
+    free(header);
+
+    /* info <type> <key> <value>, one per line */
+    for (; *p != '\0'; p = eol + 1) {
+        eol = strchr(p, '\n');
+        if (eol == NULL || strncmp(p, "info ", 5) != 0 || p[6] != ' ')
+            goto done;
+        *eol = '\0';
+        key = p + 7;
+        val = strchr(key, ' ');
+        if (val == NULL)
+            goto done;
+        *val++ = '\0';
+        switch (p[5]) {
+        case 'v':
+            if (strlen(val) != 2 * sizeof(double))
+                goto done;
+            bytes = (unsigned char *) &info.u_val;
+            for (i = 0; i < (int) sizeof(double); i++) {
+                unsigned int byte;
+
+                if (sscanf(val + 2 * i, "%2x", &byte) != 1)
+                    goto done;
+                bytes[i] = byte;
+            }
+            tail = rrd_info_push(tail, strdup(key), RD_I_VAL, info);
+            break;
+        case 'c':
+            info.u_cnt = strtoul(val, NULL, 10);
+            tail = rrd_info_push(tail, strdup(key), RD_I_CNT, info);
+            if (strcmp(key, "image_width") == 0)
+                im->ximg = info.u_cnt;
+            if (strcmp(key, "image_height") == 0)
+                im->yimg = info.u_cnt;
+            break;
+        case 'i':
+            info.u_int = atoi(val);
+            tail = rrd_info_push(tail, strdup(key), RD_I_INT, info);
+            break;
+        case 's':
+            /* undo the escapes of lazy_save */
+            for (q = val; *val != '\0'; val++) {
+                if (*val == '\\' && val[1] != '\0') {
+                    val++;
+                    *q++ = *val == 'n' ? '\n' : *val;
+                } else {
+                    *q++ = *val;
+                }
+            }
+            *q = '\0';
+            info.u_str = key + strlen(key) + 1;
+            tail = rrd_info_push(tail, strdup(key), RD_I_STR, info);
+            break;
+        default:
+            goto done;
+        }
+        if (head == NULL)
+            head = tail;
+    }
+    ok = 1;
+  done:
+    free(buf);
+    if (!ok) {
+        rrd_info_free(head);
+        return 0;
+    }
+    if (head != NULL) {
+        if (im->grinfo == NULL)
+            im->grinfo = head;
+        else
+            im->grinfo_current->next = head;
+        im->grinfo_current = tail;
+    }
+    return 1;
+}
+
+/* answer a lazy graph from its sidecar before any of its data is read;
+ * fresh is what lazy_check says. Returns 1 when the sidecar had the info.
+ * The stamps are taken only once, so a graph of rrd_graph_many keeps
+ * those from before its fetch. */
+int lazy_try(
+    image_desc_t *im,
+    int fresh)
+{
+    if (im->imgformat >= IF_XML || im->lazy == 0 || im->graphfile == NULL)
+        return 0;
+    if (im->lazy_stamps == NULL)
+        im->lazy_stamps = lazy_stamps(im);
+    return lazy_load(im, fresh);
+}
+
+/* remember the info of a graph just drawn; a sidecar that can not be
+ * written only costs the next run its laziness */
+static void lazy_save(
+    image_desc_t *im)
+{
+    char     *path, *tmp, *header;
+    FILE     *fh = NULL;
+    struct stat img;
+    rrd_info_t *walker;
+    const char *c;
+    unsigned char *bytes;
+    int       tmpfd, i, ok;
+
+    if (im->lazy == 0 || im->graphfile == NULL || im->lazy_stamps == NULL)
+        return;
+    /* the formats other than PNG are written out when the surface is
+     * finished */
+    if (im->imgformat != IF_PNG && im->surface != NULL)
+        cairo_surface_finish(im->surface);
+    if (stat(im->graphfile, &img) != 0)
+        return;
+    path = sprintf_alloc("%s.lazy", im->graphfile);
+    tmp = sprintf_alloc("%s.lazyXXXXXX", im->graphfile);
+    header = lazy_header(im, &img);
+    if (path == NULL || tmp == NULL || header == NULL)
+        goto done;
+    tmpfd = mkstemp(tmp);
+    if (tmpfd < 0)
+        goto done;
+    fh = fdopen(tmpfd, "wb");
+    if (fh == NULL) {
+        close(tmpfd);
+        unlink(tmp);
+        goto done;
+    }
+    fputs(header, fh);
+    for (walker = im->grinfo; walker != NULL; walker = walker->next) {
+        switch (walker->type) {
+        case RD_I_VAL:
+            fprintf(fh, "info v %s ", walker->key);
+            bytes = (unsigned char *) &walker->value.u_val;
+            for (i = 0; i < (int) sizeof(double); i++)
+                fprintf(fh, "%02x", bytes[i]);
+            fputc('\n', fh);
+            break;
+        case RD_I_CNT:
+            fprintf(fh, "info c %s %lu\n", walker->key, walker->value.u_cnt);
+            break;
+        case RD_I_INT:
+            fprintf(fh, "info i %s %d\n", walker->key, walker->value.u_int);
+            break;
+        case RD_I_STR:
+            fprintf(fh, "info s %s ", walker->key);
+            for (c = walker->value.u_str; *c != '\0'; c++) {
+                if (*c == '\n')
+                    fputs("\\n", fh);
+                else if (*c == '\\')
+                    fputs("\\\\", fh);
+                else
+                    fputc(*c, fh);
+            }
+            fputc('\n', fh);
+            break;
+        case RD_I_BLO:
+            /* the image is in the image file */
+            break;
+        }
+    }
+    ok = !ferror(fh);
+    if (fclose(fh) != 0)
+        ok = 0;
+    if (!ok || rename(tmp, path) != 0)
+        unlink(tmp);
+  done:
+    free(header);
+    free(tmp);
+    free(path);
+}
+
 int graph_size_location(
     image_desc_t
     *im,
@@ -3874,7 +4695,7 @@ int graph_paint(
     image_desc_t *im)
 {
     int       lazy = lazy_check(im);
-    int       cnt;
+    int       cnt, status;
 
     /* imgformat XML or higher dispatch to xport
      * output format there is selected via graph_type
@@ -3883,6 +4704,11 @@ int graph_paint(
         return rrd_graph_xport(im);
     }
 
+    /* a lazy graph whose RRDs did not change since it was drawn returns
+     * what it returned then */
+    if (lazy_try(im, lazy))
+        return 0;
+
     /* pull the data from the rrd files ... */
     if (data_fetch(im) != 0)
         return -1;
@@ -3905,15 +4731,20 @@ int graph_paint(
     /* otherwise call graph_paint_timestring */
     switch (im->graph_type) {
     case GTYPE_TIME:
-        return graph_paint_timestring(im, lazy, cnt);
+        status = graph_paint_timestring(im, lazy, cnt);
         break;
     case GTYPE_XY:
-        return graph_paint_xy(im, lazy, cnt);
+        status = graph_paint_xy(im, lazy, cnt);
         break;
+    default:
+        /* final return with error */
+        rrd_set_error("Graph type %i is not implemented", im->graph_type);
+        return -1;
     }
-    /* final return with error */
-    rrd_set_error("Graph type %i is not implemented", im->graph_type);
-    return -1;
+    /* an image kept by lazy_check may be older than the RRDs */
+    if (status == 0 && !lazy)
+        lazy_save(im);
+    return status;
 }
 
 int graph_paint_timestring(
@@ -4552,6 +5383,7 @@ int gdes_alloc(
     im->gdes[im->gdes_c - 1].ds_namv = NULL;
     im->gdes[im->gdes_c - 1].data_first = 0;
     im->gdes[im->gdes_c - 1].p_data = NULL;
+    im->gdes[im->gdes_c - 1].sel_data = NULL;
     im->gdes[im->gdes_c - 1].rpnp = NULL;
     im->gdes[im->gdes_c - 1].p_dashes = NULL;
     im->gdes[im->gdes_c - 1].shift = 0.0;
@@ -4688,108 +5520,159 @@ int rrd_graph(
 ** - script parsing   now in rrd_graph_script()
 */
 
-rrd_info_t *rrd_graph_v(
+/* Set im up for the graph of a graphv command line. Returns 0 when it
+ * is to be drawn by graph_v_output, 1 with its info in *grinfo when the
+ * graph cache had it and -1 on error; im is freed unless 0 comes back. */
+int graph_v_setup(
+    image_desc_t *im,
     int argc,
-    const char **argv)
+    const char **argv,
+    rrd_info_t **grinfo)
 {
-    image_desc_t im;
-    rrd_info_t *grinfo;
     struct optparse options;
 
-    rrd_thread_init();
-    rrd_graph_init(&im, IMAGE_INIT_CAIRO);
+    rrd_graph_init(im, IMAGE_INIT_CAIRO);
     /* a dummy surface so that we can measure text sizes for placements */
-    rrd_graph_options(argc, argv, &options, &im);
+    rrd_graph_options(argc, argv, &options, im);
     if (rrd_test_error()) {
-        rrd_info_free(im.grinfo);
-        im_free(&im);
-        return NULL;
+        rrd_info_free(im->grinfo);
+        im_free(im);
+        return -1;
     }
 
     if (options.optind >= options.argc) {
-        rrd_info_free(im.grinfo);
-        im_free(&im);
+        rrd_info_free(im->grinfo);
+        im_free(im);
         rrd_set_error("missing filename");
-        return NULL;
+        return -1;
     }
 
     if (strcmp(options.argv[options.optind], "-") != 0) {
-        im.graphfile = strdup(options.argv[options.optind]);
-        if (im.graphfile == NULL) {
+        im->graphfile = strdup(options.argv[options.optind]);
+        if (im->graphfile == NULL) {
             rrd_set_error
                 ("cannot allocate sufficient memory for filename length");
-            rrd_info_free(im.grinfo);
-            im_free(&im);
-            return NULL;
+            rrd_info_free(im->grinfo);
+            im_free(im);
+            return -1;
         }
-    }                   /* else we work in memory: im.graphfile==NULL */
+    }                   /* else we work in memory: im->graphfile==NULL */
 
-    rrd_graph_script(options.argc, options.argv, &im, options.optind + 1);
+    rrd_graph_script(options.argc, options.argv, im, options.optind + 1);
+    if (im->lazy)
+        im->lazy_hash = lazy_hash(argc, argv);
 
     if (rrd_test_error()) {
-        rrd_info_free(im.grinfo);
-        im_free(&im);
-        return NULL;
+        rrd_info_free(im->grinfo);
+        im_free(im);
+        return -1;
     }
 
+    /* an in-memory graph may have been drawn before */
+    im->cache_key = graph_cache_key(im, argc, argv);
+    if (im->cache_key != NULL
+        && (im->cache_stamps = lazy_stamps(im)) != NULL
+        && (*grinfo = graph_cache_get(im->cache_key, im->cache_stamps))
+        != NULL) {
+        rrd_info_free(im->grinfo);
+        im_free(im);
+        return 1;
+    }
+    return 0;
+}
+
+/* Draw the graph set up by graph_v_setup and return its info; im is
+ * freed either way. */
+rrd_info_t *graph_v_output(
+    image_desc_t *im)
+{
     /* Everything is now read and the actual work can start */
-    if (graph_paint(&im) == -1) {
-        rrd_info_free(im.grinfo);
-        im_free(&im);
+    if (graph_paint(im) == -1) {
+        rrd_info_free(im->grinfo);
+        im_free(im);
         return NULL;
     }
+    return graph_v_finish(im);
+}
+
+/* Add the image and its description to the info of a graph that was
+ * painted or answered by lazy_try and return it; im is freed either
+ * way. */
+rrd_info_t *graph_v_finish(
+    image_desc_t *im)
+{
+    rrd_info_t *grinfo;
 
     /* The image is generated and needs to be output.
      ** Also, if needed, print a line with information about the image.
      */
 
-    if (im.imginfo && *im.imginfo) {
+    if (im->imginfo && *im->imginfo) {
         rrd_infoval_t info;
         char     *path = NULL;
         char     *filename;
 
-        if (bad_format_imginfo(im.imginfo)) {
-            rrd_info_free(im.grinfo);
-            im_free(&im);
+        if (bad_format_imginfo(im->imginfo)) {
+            rrd_info_free(im->grinfo);
+            im_free(im);
             return NULL;
         }
-        if (im.graphfile) {
-            path = strdup(im.graphfile);
+        if (im->graphfile) {
+            path = strdup(im->graphfile);
             filename = basename(path);
         } else {
             filename = "memory";
         }
         info.u_str =
-            sprintf_alloc(im.imginfo,
+            sprintf_alloc(im->imginfo,
                           filename,
-                          (long) (im.zoom *
-                                  im.ximg), (long) (im.zoom * im.yimg));
-        grinfo_push(&im, sprintf_alloc("image_info"), RD_I_STR, info);
+                          (long) (im->zoom *
+                                  im->ximg), (long) (im->zoom * im->yimg));
+        grinfo_push(im, sprintf_alloc("image_info"), RD_I_STR, info);
         free(info.u_str);
         free(path);
     }
-    if (im.rendered_image) {
+    if (im->rendered_image) {
         rrd_infoval_t img;
 
-        img.u_blo.size = im.rendered_image_size;
-        img.u_blo.ptr = im.rendered_image;
-        grinfo_push(&im, sprintf_alloc("image"), RD_I_BLO, img);
+        img.u_blo.size = im->rendered_image_size;
+        img.u_blo.ptr = im->rendered_image;
+        grinfo_push(im, sprintf_alloc("image"), RD_I_BLO, img);
     }
-    if (im.extra_flags & FORCE_JSONTIME) {
-        im.imgformat = IF_JSONTIME;
-        if (rrd_graph_xport(&im)) {
+    if (im->extra_flags & FORCE_JSONTIME) {
+        im->imgformat = IF_JSONTIME;
+        if (rrd_graph_xport(im)) {
 	        rrd_infoval_t img;
 
-	        img.u_blo.size = im.rendered_image_size;
-	        img.u_blo.ptr = im.rendered_image;
-	        grinfo_push(&im, sprintf_alloc("datapoints"), RD_I_BLO, img);
+	        img.u_blo.size = im->rendered_image_size;
+	        img.u_blo.ptr = im->rendered_image;
+	        grinfo_push(im, sprintf_alloc("datapoints"), RD_I_BLO, img);
         }
     }
-    grinfo = im.grinfo;
-    im_free(&im);
+    if (im->cache_stamps != NULL)
+        graph_cache_put(im->cache_key, im->cache_stamps, im->grinfo);
+    grinfo = im->grinfo;
+    im_free(im);
     return grinfo;
 }
 
+rrd_info_t *rrd_graph_v(
+    int argc,
+    const char **argv)
+{
+    image_desc_t im;
+    rrd_info_t *grinfo = NULL;
+
+    rrd_thread_init();
+    switch (graph_v_setup(&im, argc, argv, &grinfo)) {
+    case -1:
+        return NULL;
+    case 1:
+        return grinfo;
+    }
+    return graph_v_output(&im);
+}
+
 static void rrd_set_font_desc(
     image_desc_t *im,
     int prop,
@@ -4815,13 +5698,97 @@ static void rrd_set_font_desc(
     };
 }
 
+static PangoLayout *graph_layout_new(
+    cairo_t *cr)
+{
+    PangoFontMap *fontmap = pango_cairo_font_map_get_default();
+    PangoContext *context;
+    PangoLayout *layout;
+
+#ifdef HAVE_PANGO_FONT_MAP_CREATE_CONTEXT
+    context = pango_font_map_create_context((PangoFontMap *) fontmap);
+#else
+    context = pango_cairo_font_map_create_context((PangoCairoFontMap *)
+                                                  fontmap);
+#endif
+    pango_cairo_context_set_resolution(context, 100);
+
+    pango_cairo_update_context(cr, context);
+
+    layout = pango_layout_new(context);
+    g_object_unref(context);
+
+//  layout = pango_cairo_create_layout(cr);
+    return layout;
+}
+
+/* give im a layout of its own made for the calling thread, as pango
+ * wants every thread to keep to its own font map */
+void graph_layout_renew(
+    image_desc_t *im)
+{
+    if (im->layout)
+        g_object_unref(im->layout);
+    im->ctx = NULL;
+    im->layout = graph_layout_new(im->cr);
+    pango_cairo_context_set_font_options(pango_layout_get_context
+                                         (im->layout), im->font_options);
+    pango_layout_context_changed(im->layout);
+    im->layout_fresh = 1;
+}
+
+/* A render context keeps the pango context and layout, and the extents of
+ * the texts measured, for all the graphs a thread draws after handing it
+ * to rrd_graph_context_use. */
+rrd_graph_context_t *rrd_graph_context_new(
+    void)
+{
+    rrd_graph_context_t *ctx;
+    cairo_surface_t *surface;
+    cairo_t  *cr;
+
+    ctx = (rrd_graph_context_t *) malloc(sizeof(rrd_graph_context_t));
+    if (ctx == NULL) {
+        rrd_set_error("cannot allocate a graph context");
+        return NULL;
+    }
+    surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 10, 10);
+    cr = cairo_create(surface);
+    ctx->layout = graph_layout_new(cr);
+    cairo_destroy(cr);
+    cairo_surface_destroy(surface);
+    ctx->extents = gfx_extent_cache_new();
+    return ctx;
+}
+
+void rrd_graph_context_free(
+    rrd_graph_context_t *ctx)
+{
+    if (ctx == NULL)
+        return;
+    g_object_unref(ctx->layout);
+    g_hash_table_destroy(ctx->extents);
+    free(ctx);
+}
+
+/* make ctx the render context of the calling thread, NULL to draw every
+ * graph from scratch again; returns the one used so far */
+rrd_graph_context_t *rrd_graph_context_use(
+    rrd_graph_context_t *ctx)
+{
+    rrd_context_t *rrd_ctx = rrd_get_context();
+    rrd_graph_context_t *old = rrd_ctx->graph_ctx;
+
+    rrd_ctx->graph_ctx = ctx;
+    return old;
+}
+
 void rrd_graph_init(
     image_desc_t *im,
     enum image_init_en init_mode)
 {
     unsigned int i;
     char     *deffont = getenv("RRD_DEFAULT_FONT");
-    PangoContext *context;
 
     /* zero the whole structure first */
     memset(im, 0, sizeof(image_desc_t));
@@ -4853,6 +5820,11 @@ void rrd_graph_init(
     im->imgformat = IF_PNG;
     im->imginfo = NULL;
     im->lazy = 0;
+    im->lazy_hash = 0;
+    im->lazy_stamps = NULL;
+    im->cache_key = NULL;
+    im->cache_stamps = NULL;
+    im->fetched = NULL;
     im->legenddirection = TOP_DOWN;
     im->legendheight = 0;
     im->legendposition = SOUTH;
@@ -4918,22 +5890,16 @@ void rrd_graph_init(
                               text_prop[i].size);
         }
 
-        PangoFontMap *fontmap = pango_cairo_font_map_get_default();
-
-#ifdef HAVE_PANGO_FONT_MAP_CREATE_CONTEXT
-        context = pango_font_map_create_context((PangoFontMap *) fontmap);
-#else
-        context = pango_cairo_font_map_create_context((PangoCairoFontMap *)
-                                                      fontmap);
-#endif
-        pango_cairo_context_set_resolution(context, 100);
-
-        pango_cairo_update_context(im->cr, context);
-
-        im->layout = pango_layout_new(context);
-        g_object_unref(context);
-
-//  im->layout = pango_cairo_create_layout(im->cr);
+        im->ctx = rrd_get_context()->graph_ctx;
+        if (im->ctx != NULL) {
+            /* bring the layout of the last graph back to a fresh state */
+            im->layout = (PangoLayout *) g_object_ref(im->ctx->layout);
+            pango_layout_set_attributes(im->layout, NULL);
+            pango_cairo_update_context(im->cr,
+                                       pango_layout_get_context(im->layout));
+        } else
+            im->layout = graph_layout_new(im->cr);
+        im->layout_fresh = 1;
 
 
         cairo_font_options_set_hint_style
@@ -5879,62 +6845,44 @@ int vdef_calc(
          src->start, src->end, steps);
 #endif
     switch (dst->vf.op) {
-    case VDEF_PERCENT:{
-        rrd_value_t *array;
-        int       field;
-
-        if ((array = (rrd_value_t *) malloc(steps * sizeof(double))) == NULL) {
-            rrd_set_error("malloc VDEV_PERCENT");
-            return -1;
-        }
-        for (step = 0; step < steps; step++) {
-            array[step] = data[step * src->ds_cnt];
-        }
-        qsort(array, step, sizeof(double), vdef_percent_compar);
-        field = round((dst->vf.param * (double) (steps - 1)) / 100.0);
-        dst->vf.val = array[field];
-        dst->vf.when = 0;   /* no time component */
-        dst->vf.never = 1;
-        free(array);
-#if 0
-        for (step = 0; step < steps; step++)
-            printf("DEBUG: %3li:%10.2f %c\n",
-                   step, array[step], step == field ? '*' : ' ');
-#endif
-    }
-        break;
+    case VDEF_PERCENT:
     case VDEF_PERCENTNAN:{
-        rrd_value_t *array;
-        int       field;
-
-        /* count number of "valid" values */
-        int       nancount = 0;
-
-        for (step = 0; step < steps; step++) {
-            if (!isnan(data[step * src->ds_cnt])) {
-                nancount++;
+        long      field;
+
+        /* the percentiles of a source select from one copy of its values,
+         * which every selection leaves better ordered for the next */
+        if (src->sel_data == NULL) {
+            if ((src->sel_data =
+                 (rrd_value_t *) malloc(steps * sizeof(double))) == NULL) {
+                rrd_set_error("malloc VDEV_PERCENT");
+                return -1;
+            }
+            src->sel_cnt = 0;
+            src->sel_nans = 0;
+            for (step = 0; step < steps; step++) {
+                if (isnan(data[step * src->ds_cnt])) {
+                    src->sel_nans++;
+                } else {
+                    src->sel_data[src->sel_cnt++] = data[step * src->ds_cnt];
+                }
             }
         }
-        /* and allocate it */
-        if ((array =
-             (rrd_value_t *) malloc(nancount * sizeof(double))) == NULL) {
-            rrd_set_error("malloc VDEV_PERCENT");
-            return -1;
+        if (dst->vf.op == VDEF_PERCENT) {
+            /* NaN sort first */
+            field = round((dst->vf.param * (double) (steps - 1)) / 100.0);
+            field -= src->sel_nans;
+        } else {
+            field = round(dst->vf.param * (double) (src->sel_cnt - 1)
+                          / 100.0);
         }
-        /* and fill it in */
-        field = 0;
-        for (step = 0; step < steps; step++) {
-            if (!isnan(data[step * src->ds_cnt])) {
-                array[field] = data[step * src->ds_cnt];
-                field++;
-            }
+        if (field < 0 || field >= src->sel_cnt) {
+            dst->vf.val = DNAN;
+        } else {
+            rpn_select(src->sel_data, src->sel_cnt, field);
+            dst->vf.val = src->sel_data[field];
         }
-        qsort(array, nancount, sizeof(double), vdef_percent_compar);
-        field = round(dst->vf.param * (double) (nancount - 1) / 100.0);
-        dst->vf.val = array[field];
         dst->vf.when = 0;   /* no time component */
         dst->vf.never = 1;
-        free(array);
     }
         break;
     case VDEF_MAXIMUM:
@@ -6119,35 +7067,6 @@ int vdef_calc(
 }
 
 /* NaN < -INF < finite_values < INF */
-int vdef_percent_compar(
-    const void
-    *a,
-    const void
-    *b)
-{
-    /* Equality is not returned; this doesn't hurt except
-     * (maybe) for a little performance.
-     */
-
-    /* First catch NaN values. They are smallest */
-    if (isnan(*(double *) a))
-        return -1;
-    if (isnan(*(double *) b))
-        return 1;
-    /* NaN doesn't reach this part so INF and -INF are extremes.
-     * The sign from isinf() is compatible with the sign we return
-     */
-    if (isinf(*(double *) a))
-        return isinf(*(double *) a);
-    if (isinf(*(double *) b))
-        return isinf(*(double *) b);
-    /* If we reach this, both values must be finite */
-    if (*(double *) a < *(double *) b)
-        return -1;
-    else
-        return 1;
-}
-
 void grinfo_push(
     image_desc_t *im,
     char *key,
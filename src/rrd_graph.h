@@ -49,6 +49,9 @@
 
 #define gdes_fetch_key(x)  sprintf_alloc("%s:%s:%d:%d:%d:%d:%d:%d",x.rrd,x.daemon,x.cf,x.cf_reduce,x.start_orig,x.end_orig,x.step_orig,x.step)
 
+/* local files data_fetch reads at the same time */
+#define DATA_FETCH_THREADS 8
+
 enum tmt_en { TMT_SECOND = 0, TMT_MINUTE, TMT_HOUR, TMT_DAY,
     TMT_WEEK, TMT_MONTH, TMT_YEAR
 };
@@ -248,6 +251,10 @@ typedef struct graph_desc_t {
     char    **ds_namv;  /* name of datasources  in the fetch. */
     rrd_value_t *data;  /* the raw data drawn from the rrd */
     rrd_value_t *p_data;    /* processed data, xsize elements */
+    rrd_value_t *sel_data;  /* values other than NaN, as left by the
+                             * percentile VDEFs selecting from them */
+    long      sel_cnt;  /* number of values in sel_data */
+    long      sel_nans; /* number of NaN left out of sel_data */
     double    linewidth;    /* linewidth */
 
     /* dashed line stuff */
@@ -266,6 +273,15 @@ typedef struct graph_desc_t {
 
 enum image_init_en { IMAGE_INIT_NO_CAIRO, IMAGE_INIT_CAIRO };
 
+/* the fetches for the DEFs of a graph, see data_prefetch */
+typedef struct graph_fetch_t {
+    rrd_fetch_job_t *jobs;
+    unsigned long job_cnt;
+    int      *job_of;   /* job of every gdes, -1 if it has none */
+    int      *local;    /* job reads the file, not asks a daemon */
+    const char **daemon_of; /* the daemon of the other jobs */
+} graph_fetch_t;
+
 typedef struct image_desc_t {
 
     /* configuration of graph */
@@ -310,6 +326,10 @@ typedef struct image_desc_t {
     int       lazy;     /* only update the image if there is
                            reasonable probability that the
                            existing one is out of date */
+    unsigned long lazy_hash;    /* hash of the arguments, for the sidecar */
+    char     *lazy_stamps;  /* stamps of the RRDs before the fetch */
+    char     *cache_key;    /* key of an in-memory graph in the graph cache */
+    char     *cache_stamps; /* stamps of the RRDs for the graph cache */
     int       slopemode;    /* connect the dots of the curve directly, not using a stair */
     enum legend_pos legendposition; /* the position of the legend: north, west, south or east */
     enum legend_direction legenddirection; /* The direction of the legend topdown or bottomup */
@@ -343,6 +363,9 @@ typedef struct image_desc_t {
     long      prt_c;    /* number of print elements */
     long      gdes_c;   /* number of graphics elements */
     graph_desc_t *gdes; /* points to an array of graph elements */
+    long      rpn_folded;   /* RPN ops replaced by the constant they compute */
+    long      rpn_shared;   /* CDEF parts and VDEFs taken from earlier ones */
+    long      rpn_skipped;  /* CDEFs and VDEFs nothing depends on */
     cairo_surface_t *surface;   /* graphics library */
     cairo_t  *cr;       /* drawing context */
     cairo_font_options_t *font_options; /* cairo font options */
@@ -356,8 +379,19 @@ typedef struct image_desc_t {
     double x_pixie; /* scale for X (see xtr() for reference) */
     double y_pixie; /* scale for Y (see ytr() for reference) */
     double last_tabwidth; /* (see gfx_prep_text() for reference) */
+    rrd_graph_context_t *ctx;   /* render context of the thread, or NULL */
+    int       layout_fresh; /* nothing drawn yet, so text extents measured
+                               by earlier graphs of ctx still hold */
+    graph_fetch_t *fetched; /* fetches rrd_graph_many ran for the DEFs, or
+                               NULL for data_fetch to run them itself */
 } image_desc_t;
 
+/* what rrd_graph_context_use keeps from graph to graph */
+struct rrd_graph_context_t {
+    PangoLayout *layout;    /* the layout, and with it the pango context */
+    GHashTable *extents;    /* text extents measured before */
+};
+
 typedef struct image_title_t
 {
     char **lines;
@@ -404,6 +438,13 @@ int     rrd_reduce_data(
     unsigned long *,
     unsigned long *,
     rrd_value_t **);
+int       data_prefetch(
+    image_desc_t *,
+    graph_fetch_t *);
+int       data_prefetch_run(
+    graph_fetch_t *);
+void      data_prefetch_free(
+    graph_fetch_t *);
 int       data_fetch(
     image_desc_t *);
 long      rrd_lcd(
@@ -441,8 +482,24 @@ int      grid_paint(
     image_desc_t *);
 int       lazy_check(
     image_desc_t *);
+char     *lazy_stamps(
+    image_desc_t *);
+int       lazy_try(
+    image_desc_t *,
+    int);
 int       graph_paint(
     image_desc_t *);
+int       graph_v_setup(
+    image_desc_t *,
+    int,
+    const char **,
+    rrd_info_t **);
+rrd_info_t *graph_v_output(
+    image_desc_t *);
+rrd_info_t *graph_v_finish(
+    image_desc_t *);
+void      graph_layout_renew(
+    image_desc_t *);
 int       graph_paint_timestring(
                                 image_desc_t *,int,int);
 int       graph_paint_xy(
@@ -498,9 +555,6 @@ int       vdef_parse(
 int       vdef_calc(
     image_desc_t *,
     int);
-int       vdef_percent_compar(
-    const void *,
-    const void *);
 int       graph_size_location(
     image_desc_t *,
     int);
@@ -581,6 +635,10 @@ void      gfx_text(
     enum gfx_v_align_en v_align,
     const char *text);
 
+/* a cache for the text extents of a render context */
+GHashTable *gfx_extent_cache_new(
+    void);
+
 /* measure width of a text string */
 double    gfx_get_text_width(
     image_desc_t *im,
@@ -619,3 +677,16 @@ void      grinfo_push(
     char *key,
     rrd_info_type_t type,    rrd_infoval_t value);
 
+
+/* in-process cache of in-memory graphs, rrd_graph_cache.c */
+char     *graph_cache_key(
+    image_desc_t *im,
+    int argc,
+    const char **argv);
+rrd_info_t *graph_cache_get(
+    const char *key,
+    const char *stamps);
+void      graph_cache_put(
+    const char *key,
+    const char *stamps,
+    const rrd_info_t *info);
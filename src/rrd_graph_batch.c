@@ -0,0 +1,454 @@
+/****************************************************************************
+ * RRDtool 1.9.0 Copyright by Tobi Oetiker, 1997-2024
+ ****************************************************************************
+ * rrd_graph_batch.c  draw several graphs at once
+ ****************************************************************************/
+
+#include "rrd_tool.h"
+#include "rrd_graph.h"
+
+/* rrd_graph_many sets all graphs up first and works out the fetches of
+ * all their DEFs, so that each fetch runs only once for all of them:
+ * fetches that ask for the same rows of the same RRA go together, and
+ * a fetch whose rows come out of the RRA a wider fetch reads anyway, as
+ * when a day and a week graph of an RRD both land on its coarse RRA, is
+ * cut out of that one. Fetches from daemons, callbacks and databases go
+ * together only when they ask for the very same. The graphs are then
+ * drawn on a pool of threads, every one with a pango layout of its own. */
+
+typedef struct batch_member_t {
+    rrd_fetch_job_t *job;   /* in the fetch of its graph */
+    int       local;
+    const char *daemon;
+    int       planned;  /* the rows of an RRA are known */
+    long      rra_idx;
+    time_t    start, end;   /* the rows rrd_fetch_r would answer with */
+    unsigned long step;
+    unsigned long src;  /* the shared fetch it gets its rows from */
+    unsigned long retry;    /* 1 + its fetch of its own, 0 for none */
+} batch_member_t;
+
+typedef struct batch_source_t {
+    time_t    start, end;   /* planned rows of its first member */
+    unsigned long members;
+    unsigned long want_cnt;
+    int       want_all;
+} batch_source_t;
+
+typedef struct batch_t {
+    rrd_graph_job_t *jobs;
+    image_desc_t *ims;
+    int      *state;    /* BATCH_* */
+} batch_t;
+
+#define BATCH_DONE  0   /* failed, taken from the graph cache or lazy */
+#define BATCH_DRAW  1
+
+/* the planned first, grouped by RRA, with the widest in front */
+static int member_cmp(
+    const void *a_,
+    const void *b_)
+{
+    const batch_member_t *a = (const batch_member_t *) a_;
+    const batch_member_t *b = (const batch_member_t *) b_;
+    int       c;
+
+    if (a->planned != b->planned)
+        return b->planned - a->planned;
+    if (!a->planned)
+        return 0;
+    if ((c = strcmp(a->job->filename, b->job->filename)) != 0)
+        return c;
+    if ((c = strcmp(a->job->cf, b->job->cf)) != 0)
+        return c;
+    if (a->rra_idx != b->rra_idx)
+        return a->rra_idx < b->rra_idx ? -1 : 1;
+    if (a->step != b->step)
+        return a->step < b->step ? -1 : 1;
+    if (a->end - a->start != b->end - b->start)
+        return a->end - a->start > b->end - b->start ? -1 : 1;
+    return a->start < b->start ? -1 : a->start > b->start;
+}
+
+static int member_same_rra(
+    const batch_member_t *a,
+    const batch_member_t *b)
+{
+    return strcmp(a->job->filename, b->job->filename) == 0
+        && strcmp(a->job->cf, b->job->cf) == 0
+        && a->rra_idx == b->rra_idx && a->step == b->step;
+}
+
+/* the key under which fetches without a plan go together */
+static char *member_key(
+    const batch_member_t *m)
+{
+    return sprintf_alloc("%d:%s:%s:%s:%lld:%lld:%lu:%lu:%d", m->local,
+                         m->daemon ? m->daemon : "", m->job->filename,
+                         m->job->cf, (long long) m->job->start,
+                         (long long) m->job->end, m->job->step,
+                         m->job->max_rows, m->job->reduce);
+}
+
+/* add the data sources of m to the want list of src, once each */
+static void want_add(
+    rrd_fetch_job_t *src,
+    const rrd_fetch_job_t *m)
+{
+    unsigned long i, k;
+
+    if (src->want == NULL)
+        return;
+    for (i = 0; i < m->want_cnt; i++) {
+        for (k = 0; k < src->want_cnt; k++)
+            if (strcmp(src->want[k], m->want[i]) == 0)
+                break;
+        if (k == src->want_cnt)
+            ((const char **) src->want)[src->want_cnt++] = m->want[i];
+    }
+}
+
+/* Hand the rows from start to end of src to dst, as if dst had fetched
+ * them itself. src keeps its rows unless take is set. */
+static void member_give(
+    rrd_fetch_job_t *src,
+    rrd_fetch_job_t *dst,
+    time_t start,
+    time_t end,
+    int take)
+{
+    unsigned long rows, off, i;
+
+    if (take) {
+        dst->start = src->start;
+        dst->end = src->end;
+        dst->step = src->step;
+        dst->ds_cnt = src->ds_cnt;
+        dst->ds_namv = src->ds_namv;
+        dst->data = src->data;
+        dst->rc = 0;
+        src->ds_namv = NULL;
+        src->data = NULL;
+        return;
+    }
+    rows = (end - start) / src->step;
+    off = (start - src->start) / src->step;
+    dst->data = (rrd_value_t *)
+        malloc((rows + 1) * src->ds_cnt * sizeof(rrd_value_t));
+    dst->ds_namv = (char **) calloc(src->ds_cnt, sizeof(char *));
+    for (i = 0; dst->ds_namv != NULL && i < src->ds_cnt; i++)
+        if ((dst->ds_namv[i] = strdup(src->ds_namv[i])) == NULL)
+            break;
+    if (dst->data == NULL || dst->ds_namv == NULL || i < src->ds_cnt) {
+        while (dst->ds_namv != NULL && i > 0)
+            free(dst->ds_namv[--i]);
+        free(dst->ds_namv);
+        free(dst->data);
+        dst->ds_namv = NULL;
+        dst->data = NULL;
+        dst->rc = -1;
+        dst->error = strdup("malloc fetch data area");
+        return;
+    }
+    memcpy(dst->data, src->data + off * src->ds_cnt,
+           rows * src->ds_cnt * sizeof(rrd_value_t));
+    /* one spare row like rrd_fetch_fn */
+    for (i = 0; i < src->ds_cnt; i++)
+        dst->data[rows * src->ds_cnt + i] = DNAN;
+    dst->start = start;
+    dst->end = end;
+    dst->step = src->step;
+    dst->ds_cnt = src->ds_cnt;
+    dst->rc = 0;
+}
+
+/* Run the fetches of all graphs to be drawn, each of them only once, and
+ * leave the results with the graphs. Returns -1 when out of memory. */
+static int batch_fetch(
+    batch_t *b,
+    unsigned long job_cnt)
+{
+    batch_member_t *members, *m;
+    batch_source_t *sources;
+    graph_fetch_t shared, retry;
+    rrd_fetch_job_t *src;
+    GHashTable *keys;
+    gpointer  value;
+    graph_fetch_t *f;
+    unsigned long member_cnt = 0, i, j, s, first;
+    char     *key;
+    int       rc = -1;
+
+    for (i = 0; i < job_cnt; i++)
+        if (b->state[i] == BATCH_DRAW)
+            member_cnt += b->ims[i].fetched->job_cnt;
+    memset(&shared, 0, sizeof(shared));
+    memset(&retry, 0, sizeof(retry));
+    members = (batch_member_t *) calloc(member_cnt + 1,
+                                        sizeof(batch_member_t));
+    sources = (batch_source_t *) calloc(member_cnt + 1,
+                                        sizeof(batch_source_t));
+    shared.jobs = (rrd_fetch_job_t *) calloc(member_cnt + 1,
+                                             sizeof(rrd_fetch_job_t));
+    shared.local = (int *) calloc(member_cnt + 1, sizeof(int));
+    shared.daemon_of = (const char **) calloc(member_cnt + 1,
+                                              sizeof(char *));
+    retry.jobs = (rrd_fetch_job_t *) calloc(member_cnt + 1,
+                                            sizeof(rrd_fetch_job_t));
+    retry.local = (int *) calloc(member_cnt + 1, sizeof(int));
+    retry.daemon_of = (const char **) calloc(member_cnt + 1,
+                                             sizeof(char *));
+    if (members == NULL || sources == NULL || shared.jobs == NULL
+        || shared.local == NULL || shared.daemon_of == NULL
+        || retry.jobs == NULL || retry.local == NULL
+        || retry.daemon_of == NULL)
+        goto done;
+
+    /* which rows of which RRA every fetch of a local file comes down to */
+    m = members;
+    for (i = 0; i < job_cnt; i++) {
+        if (b->state[i] != BATCH_DRAW)
+            continue;
+        f = b->ims[i].fetched;
+        for (j = 0; j < f->job_cnt; j++, m++) {
+            m->job = f->jobs + j;
+            m->local = f->local[j];
+            m->daemon = f->daemon_of[j];
+            if (!m->local || m->job->max_rows > 0)
+                continue;
+            m->start = m->job->start;
+            m->end = m->job->end;
+            m->step = m->job->step;
+            m->planned = rrd_fetch_plan_r(m->job->filename, m->job->cf,
+                                          &m->start, &m->end, &m->step,
+                                          &m->rra_idx) == 0;
+        }
+    }
+    rrd_clear_error();
+    qsort(members, member_cnt, sizeof(batch_member_t), member_cmp);
+
+    /* a fetch of an RRA serves all narrower ones of the same RRA inside
+     * its rows, the others share the fetches that ask for the same */
+    keys = g_hash_table_new_full(g_str_hash, g_str_equal, free, NULL);
+    first = 0;
+    for (m = members; m < members + member_cnt; m++) {
+        if (m->planned) {
+            if (m == members || !member_same_rra(m - 1, m))
+                first = shared.job_cnt;
+            for (s = first; s < shared.job_cnt; s++)
+                if (sources[s].start <= m->start && sources[s].end >= m->end)
+                    break;
+        } else {
+            key = member_key(m);
+            if (g_hash_table_lookup_extended(keys, key, NULL, &value)) {
+                free(key);
+                s = (unsigned long) GPOINTER_TO_INT(value);
+            } else {
+                s = shared.job_cnt;
+                g_hash_table_insert(keys, key, GINT_TO_POINTER((int) s));
+            }
+        }
+        if (s == shared.job_cnt) {
+            shared.job_cnt++;
+            shared.jobs[s] = *m->job;
+            shared.jobs[s].want = NULL;
+            shared.jobs[s].want_cnt = 0;
+            shared.local[s] = m->local;
+            shared.daemon_of[s] = m->daemon;
+            sources[s].start = m->start;
+            sources[s].end = m->end;
+        }
+        m->src = s;
+        sources[s].members++;
+        if (m->job->want == NULL)
+            sources[s].want_all = 1;
+        sources[s].want_cnt += m->job->want_cnt;
+    }
+    g_hash_table_destroy(keys);
+
+    /* a shared fetch asks for the data sources of all its members */
+    for (s = 0; s < shared.job_cnt; s++)
+        if (!sources[s].want_all
+            && (shared.jobs[s].want = (const char **)
+                malloc((sources[s].want_cnt + 1) * sizeof(char *))) == NULL)
+            goto done;
+    for (m = members; m < members + member_cnt; m++)
+        want_add(shared.jobs + m->src, m->job);
+    if (data_prefetch_run(&shared) == -1)
+        goto done;
+
+    /* members the shared fetch could not serve fetch on their own: when
+     * a data source of another member was missing, or the RRD changed
+     * its RRA since the plan */
+    for (m = members; m < members + member_cnt; m++) {
+        src = shared.jobs + m->src;
+        if (src->rc == 0
+            && (!m->planned || (src->step == m->step
+                                && src->start <= m->start
+                                && src->end >= m->end))) {
+            member_give(src, m->job, m->planned ? m->start : src->start,
+                        m->planned ? m->end : src->end,
+                        sources[m->src].members == 1);
+        } else if (src->rc != 0 && sources[m->src].members == 1) {
+            m->job->rc = src->rc;
+            m->job->error = src->error;
+            src->error = NULL;
+        } else {
+            retry.jobs[retry.job_cnt] = *m->job;
+            retry.local[retry.job_cnt] = m->local;
+            retry.daemon_of[retry.job_cnt] = m->daemon;
+            m->retry = ++retry.job_cnt;
+        }
+    }
+    rc = retry.job_cnt > 0 ? data_prefetch_run(&retry) : 0;
+    /* the want lists stay with the members */
+    for (m = members; m < members + member_cnt; m++)
+        if (m->retry > 0) {
+            *m->job = retry.jobs[m->retry - 1];
+            memset(retry.jobs + m->retry - 1, 0, sizeof(rrd_fetch_job_t));
+            if (rc != 0)
+                m->job->rc = -1;
+        }
+  done:
+    if (rc != 0)
+        rrd_set_error("malloc graph batch fetches");
+    data_prefetch_free(&shared);
+    data_prefetch_free(&retry);
+    free(members);
+    free(sources);
+    return rc;
+}
+
+static void batch_draw(
+    void *arg,
+    unsigned long idx)
+{
+    batch_t  *b = (batch_t *) arg;
+    rrd_graph_job_t *job = b->jobs + idx;
+
+    if (b->state[idx] != BATCH_DRAW)
+        return;
+    rrd_clear_error();
+    graph_layout_renew(b->ims + idx);
+    job->info = graph_v_output(b->ims + idx);
+    if (job->info == NULL) {
+        job->error = strdup(rrd_test_error()? rrd_get_error() :
+                            "graph failed");
+        rrd_clear_error();
+    }
+}
+
+/*
+ * Draw job_cnt graphs like rrd_graph_v, fetching the data of all of them
+ * together and drawing them on a pool of up to threads threads. Each job
+ * gets its info or its error the way rrd_graph_v would have returned
+ * them.
+ *
+ * Returns 0 if all graphs went through and -1 if any failed.
+ */
+int rrd_graph_many(
+    rrd_graph_job_t *jobs,
+    unsigned long job_cnt,
+    int threads)
+{
+    batch_t   b;
+    const char **names = NULL;
+    char    **spare = NULL;
+    image_desc_t *im;
+    unsigned long i, failed = 0;
+    int       rc = -1;
+
+    if (job_cnt == 0)
+        return 0;
+    rrd_thread_init();
+    b.jobs = jobs;
+    b.ims = (image_desc_t *) calloc(job_cnt, sizeof(image_desc_t));
+    b.state = (int *) calloc(job_cnt, sizeof(int));
+    names = (const char **) calloc(job_cnt, sizeof(char *));
+    spare = (char **) calloc(job_cnt, sizeof(char *));
+    if (b.ims == NULL || b.state == NULL || names == NULL || spare == NULL) {
+        rrd_set_error("allocating graph jobs");
+        goto done;
+    }
+
+    for (i = 0; i < job_cnt; i++) {
+        im = b.ims + i;
+        jobs[i].info = NULL;
+        jobs[i].error = NULL;
+        rrd_clear_error();
+        switch (graph_v_setup(im, jobs[i].argc, jobs[i].argv,
+                              &jobs[i].info)) {
+        case 0:
+            /* a lazy graph its sidecar answers needs no data at all */
+            if (lazy_try(im, lazy_check(im))) {
+                if ((jobs[i].info = graph_v_finish(im)) != NULL)
+                    break;
+            } else if ((im->fetched = (graph_fetch_t *)
+                        calloc(1, sizeof(graph_fetch_t))) != NULL
+                       && data_prefetch(im, im->fetched) == 0) {
+                b.state[i] = BATCH_DRAW;
+                break;
+            } else {
+                free(im->fetched);
+                im->fetched = NULL;
+                rrd_info_free(im->grinfo);
+                im_free(im);
+            }
+            /* fall through */
+        case -1:
+            jobs[i].error = strdup(rrd_test_error()? rrd_get_error() :
+                                   "graph failed");
+            break;
+        }
+        rrd_clear_error();
+    }
+    if (batch_fetch(&b, job_cnt) == -1) {
+        for (i = 0; i < job_cnt; i++)
+            if (b.state[i] == BATCH_DRAW) {
+                rrd_info_free(b.ims[i].grinfo);
+                im_free(b.ims + i);
+            }
+        goto done;
+    }
+
+    /* graphs to the same file are drawn one after the other, those in
+     * memory each on their own; the layout of the calling thread goes,
+     * every graph gets one of the thread it is drawn in */
+    for (i = 0; i < job_cnt; i++) {
+        im = b.ims + i;
+        if (b.state[i] == BATCH_DRAW && im->graphfile != NULL)
+            names[i] = im->graphfile;
+        else
+            names[i] = spare[i] = sprintf_alloc("-%lu", i);
+        if (b.state[i] == BATCH_DRAW && im->layout != NULL) {
+            g_object_unref(im->layout);
+            im->layout = NULL;
+            im->ctx = NULL;
+        }
+    }
+    if (rrd_run_jobs(names, job_cnt, threads, 0, batch_draw, &b) != 0) {
+        for (i = 0; i < job_cnt; i++)
+            if (b.state[i] == BATCH_DRAW && jobs[i].info == NULL
+                && jobs[i].error == NULL) {
+                rrd_info_free(b.ims[i].grinfo);
+                im_free(b.ims + i);
+            }
+        goto done;
+    }
+
+    for (i = 0; i < job_cnt; i++)
+        if (jobs[i].info == NULL)
+            failed++;
+    if (failed > 0)
+        rrd_set_error("%lu of %lu graphs failed", failed, job_cnt);
+    else
+        rc = 0;
+  done:
+    for (i = 0; spare != NULL && i < job_cnt; i++)
+        free(spare[i]);
+    free(spare);
+    free(names);
+    free(b.state);
+    free(b.ims);
+    return rc;
+}
@@ -0,0 +1,242 @@
+/****************************************************************************
+ * RRDtool 1.9.0 Copyright by Tobi Oetiker, 1997-2024
+ ****************************************************************************
+ * rrd_graph_cache.c  in-process cache of rendered graphs
+ ****************************************************************************/
+
+#include "rrd_tool.h"
+#include "rrd_graph.h"
+#include "mutex.h"
+
+/* A graph drawn in memory is remembered together with the info it
+ * returned, keyed by its arguments and its time frame counted in pixels,
+ * so that a dashboard asking for the same graph again within the same
+ * pixel gets the image without a fetch or a redraw. The stamps of the
+ * RRDs taken by lazy_stamps tell when an entry has gone stale. The least
+ * recently used entries go when the cache would grow beyond max_bytes;
+ * a max_bytes of 0, the default, turns the cache off. */
+
+typedef struct graph_cache_entry_t {
+    char     *key;
+    char     *stamps;
+    rrd_info_t *info;
+    unsigned long bytes;
+    struct graph_cache_entry_t *prev, *next;    /* most recently used first */
+} graph_cache_entry_t;
+
+static mutex_t lock = MUTEX_INITIALIZER;
+static GHashTable *entries = NULL;
+static graph_cache_entry_t *head = NULL, *tail = NULL;
+static unsigned long max_bytes = 0, bytes = 0;
+static unsigned long hits = 0, misses = 0, evictions = 0;
+
+/* copy an info list, adding what it takes to *size */
+static rrd_info_t *info_copy(
+    const rrd_info_t *info,
+    unsigned long *size)
+{
+    rrd_info_t *copy = NULL, *last = NULL;
+
+    for (; info != NULL; info = info->next) {
+        last = rrd_info_push(last, strdup(info->key), info->type,
+                             info->value);
+        if (copy == NULL)
+            copy = last;
+        *size += sizeof(rrd_info_t) + strlen(info->key) + 1;
+        if (info->type == RD_I_STR)
+            *size += strlen(info->value.u_str) + 1;
+        else if (info->type == RD_I_BLO)
+            *size += info->value.u_blo.size;
+    }
+    return copy;
+}
+
+static void entry_unlink(
+    graph_cache_entry_t *entry)
+{
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        head = entry->next;
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        tail = entry->prev;
+    entry->prev = entry->next = NULL;
+}
+
+static void entry_link(
+    graph_cache_entry_t *entry)
+{
+    entry->next = head;
+    if (head)
+        head->prev = entry;
+    head = entry;
+    if (tail == NULL)
+        tail = entry;
+}
+
+static void entry_drop(
+    graph_cache_entry_t *entry)
+{
+    entry_unlink(entry);
+    g_hash_table_remove(entries, entry->key);
+    bytes -= entry->bytes;
+    free(entry->key);
+    free(entry->stamps);
+    rrd_info_free(entry->info);
+    free(entry);
+}
+
+static void cache_trim(
+    void)
+{
+    while (tail != NULL && bytes > max_bytes) {
+        entry_drop(tail);
+        evictions++;
+    }
+}
+
+int rrd_graph_cache_set(
+    unsigned long cap)
+{
+    mutex_lock(&lock);
+    max_bytes = cap;
+    cache_trim();
+    if (max_bytes == 0)
+        hits = misses = evictions = 0;
+    mutex_unlock(&lock);
+    return 0;
+}
+
+rrd_info_t *rrd_graph_cache_info(
+    void)
+{
+    rrd_info_t *info, *last;
+    rrd_infoval_t val;
+    unsigned long cnt;
+
+    mutex_lock(&lock);
+    cnt = entries ? g_hash_table_size(entries) : 0;
+    val.u_cnt = max_bytes;
+    info = last = rrd_info_push(NULL, sprintf_alloc("max_bytes"), RD_I_CNT,
+                                val);
+    val.u_cnt = bytes;
+    last = rrd_info_push(last, sprintf_alloc("bytes"), RD_I_CNT, val);
+    val.u_cnt = cnt;
+    last = rrd_info_push(last, sprintf_alloc("entries"), RD_I_CNT, val);
+    val.u_cnt = hits;
+    last = rrd_info_push(last, sprintf_alloc("hits"), RD_I_CNT, val);
+    val.u_cnt = misses;
+    last = rrd_info_push(last, sprintf_alloc("misses"), RD_I_CNT, val);
+    val.u_cnt = evictions;
+    last = rrd_info_push(last, sprintf_alloc("evictions"), RD_I_CNT, val);
+    val.u_val = hits + misses > 0
+        ? (double) hits / (double) (hits + misses) : DNAN;
+    rrd_info_push(last, sprintf_alloc("hit_ratio"), RD_I_VAL, val);
+    mutex_unlock(&lock);
+    return info;
+}
+
+/* the key of a graph, or NULL when the cache is off or the graph goes
+ * to a file */
+char     *graph_cache_key(
+    image_desc_t *im,
+    int argc,
+    const char **argv)
+{
+    const char *tz = getenv("TZ");
+    long long px;
+    size_t    len;
+    char     *key, *end;
+    int       i, on;
+
+    mutex_lock(&lock);
+    on = max_bytes > 0;
+    mutex_unlock(&lock);
+    if (!on || im->graphfile != NULL)
+        return NULL;
+
+    px = (im->end - im->start) / (im->xsize > 0 ? im->xsize : 1);
+    if (px < 1)
+        px = 1;
+    /* argv[0] only tells graph from graphv; the arguments go in with
+     * their length so that no two vectors run together */
+    len = 64 + (tz ? strlen(tz) : 0);
+    for (i = 1; i < argc; i++)
+        len += 24 + strlen(argv[i]);
+    if ((key = (char *) malloc(len)) == NULL)
+        return NULL;
+    end = key + sprintf(key, "%lld %lld %s\n", (long long) im->start / px,
+                        (long long) im->end / px, tz ? tz : "");
+    for (i = 1; i < argc; i++)
+        end += sprintf(end, "%lu:%s", (unsigned long) strlen(argv[i]),
+                       argv[i]);
+    return key;
+}
+
+/* a copy of the info cached for key, when the RRDs still have stamps */
+rrd_info_t *graph_cache_get(
+    const char *key,
+    const char *stamps)
+{
+    graph_cache_entry_t *entry;
+    rrd_info_t *info = NULL;
+    unsigned long size = 0;
+
+    mutex_lock(&lock);
+    entry = entries ? (graph_cache_entry_t *)
+        g_hash_table_lookup(entries, key) : NULL;
+    if (entry != NULL && strcmp(entry->stamps, stamps) != 0) {
+        entry_drop(entry);
+        entry = NULL;
+    }
+    if (entry != NULL) {
+        entry_unlink(entry);
+        entry_link(entry);
+        info = info_copy(entry->info, &size);
+        hits++;
+    } else
+        misses++;
+    mutex_unlock(&lock);
+    return info;
+}
+
+/* remember the info of a graph drawn from RRDs with stamps */
+void graph_cache_put(
+    const char *key,
+    const char *stamps,
+    const rrd_info_t *info)
+{
+    graph_cache_entry_t *entry, *old;
+
+    /* an RRD that changed within the current second may change again */
+    if (strstr(stamps, " -1 ") != NULL)
+        return;
+    if ((entry = (graph_cache_entry_t *) calloc(1, sizeof(*entry))) == NULL)
+        return;
+    entry->bytes = sizeof(*entry) + strlen(key) + strlen(stamps) + 2;
+    entry->key = strdup(key);
+    entry->stamps = strdup(stamps);
+    entry->info = info_copy(info, &entry->bytes);
+
+    mutex_lock(&lock);
+    if (entry->key == NULL || entry->stamps == NULL
+        || entry->bytes > max_bytes) {
+        mutex_unlock(&lock);
+        free(entry->key);
+        free(entry->stamps);
+        rrd_info_free(entry->info);
+        free(entry);
+        return;
+    }
+    if (entries == NULL)
+        entries = g_hash_table_new(g_str_hash, g_str_equal);
+    if ((old = (graph_cache_entry_t *) g_hash_table_lookup(entries, key)))
+        entry_drop(old);
+    g_hash_table_insert(entries, entry->key, entry);
+    entry_link(entry);
+    bytes += entry->bytes;
+    cache_trim();
+    mutex_unlock(&lock);
+}
@@ -1341,6 +1341,7 @@ static int parse_cvdef(
              rpn_parse((void *) im, gdp->rpn, &find_var_wrapper)) == NULL) {
             return 1;
         }
+        im->rpn_folded += rpn_fold(gdp->rpnp);
     } else {            /* VDEF */
         /* parse vdef, as vdef_parse is a bit "stupid" right now we have to touch things here */
         /* so find first , */
@@ -21,6 +21,11 @@
 static unsigned long MyMod(
     signed long val,
     unsigned long mod);
+static int clear_ds_rows(
+    rrd_t *rrd,
+    rrd_file_t *rrd_file,
+    unsigned long rra_idx,
+    unsigned long ds_idx);
 
 int lookup_seasonal(
     rrd_t *rrd,
@@ -56,7 +61,14 @@ int lookup_seasonal(
         return -1;
     }
 
-    if (!rrd_seek(rrd_file, pos_tmp, SEEK_SET)) {
+    if (rrd->__desc->layout != RRD_LAYOUT_ROW) {
+        /* one value from the ring of every DS, or from a block */
+        if (rrd_read_rows(rrd_file, rrd, rra_idx, row_idx, 1,
+                          *seasonal_coef) == 0)
+            return 0;
+        rrd_set_error("read operation failed in lookup_seasonal(): row %lu\n",
+                      row_idx);
+    } else if (!rrd_seek(rrd_file, pos_tmp, SEEK_SET)) {
         if (rrd_read
             (rrd_file, *seasonal_coef,
              sizeof(rrd_value_t) * rrd->stat_head->ds_cnt)
@@ -91,7 +103,7 @@ void erase_violations(
     char     *violations_array;
 
     /* check that rra_idx is a CF_FAILURES array */
-    if (rrd_cf_conv(rrd->rra_def[rra_idx].cf_nam) != CF_FAILURES) {
+    if (rrd->__desc->cf[rra_idx] != CF_FAILURES) {
 #ifdef DEBUG
         fprintf(stderr, "erase_violations called for non-FAILURES RRA: %s\n",
                 rrd->rra_def[rra_idx].cf_nam);
@@ -161,24 +173,15 @@ int apply_smoother(
         return -1;
     }
 
-    /* rra_start is at the beginning of this rra */
-    if (rrd_seek(rrd_file, rra_start, SEEK_SET)) {
-        rrd_set_error("seek to rra %d failed", rra_start);
+    /* read the whole rra in row order, then check for NA values */
+    if (rrd_read_rows(rrd_file, rrd, rra_idx, 0, row_count, rrd_values)) {
+        rrd_set_error("reading rra %lu failed: %s", rra_idx,
+                      rrd_strerror(errno));
         free(rrd_values);
         return -1;
     }
-
-    /* could read all data in a single block, but we need to
-     * check for NA values */
     for (i = 0; i < row_count; ++i) {
         for (j = 0; j < row_length; ++j) {
-            if (rrd_read
-                (rrd_file, &(rrd_values[i * row_length + j]),
-                 sizeof(rrd_value_t) * 1)
-                != (ssize_t) (sizeof(rrd_value_t) * 1)) {
-                rrd_set_error("reading value failed: %s",
-                              rrd_strerror(errno));
-            }
             if (isnan(rrd_values[i * row_length + j])) {
                 /* can't apply smoothing, still uninitialized values */
 #ifdef DEBUG
@@ -245,13 +248,13 @@ int apply_smoother(
     free(buffers);
     free(working_average);
 
-    if (rrd_cf_conv(rrd->rra_def[rra_idx].cf_nam) == CF_SEASONAL) {
+    if (rrd->__desc->cf[rra_idx] == CF_SEASONAL) {
         rrd_value_t (
     *init_seasonality) (
     rrd_value_t seasonal_coef,
     rrd_value_t intercept);
 
-        switch (rrd_cf_conv(rrd->rra_def[hw_dep_idx(rrd, rra_idx)].cf_nam)) {
+        switch (rrd->__desc->cf[hw_dep_idx(rrd, rra_idx)]) {
         case CF_HWPREDICT:
             init_seasonality = hw_additive_init_seasonality;
             break;
@@ -306,15 +309,8 @@ int apply_smoother(
 
     /* endif CF_SEASONAL */
     /* flush updated values to disk */
-    if (rrd_seek(rrd_file, rra_start, SEEK_SET)) {
-        rrd_set_error("apply_smoother: seek to pos %d failed", rra_start);
-        free(rrd_values);
-        return -1;
-    }
-    /* write as a single block */
-    if (rrd_write
-        (rrd_file, rrd_values, sizeof(rrd_value_t) * row_length * row_count)
-        != (ssize_t) (sizeof(rrd_value_t) * row_length * row_count)) {
+    if (rrd_write_rows(rrd_file, rrd, rra_idx, 0, row_count, rrd_values,
+                       0)) {
         rrd_set_error("apply_smoother: write failed to %lu", rra_start);
         free(rrd_values);
         free(baseline);
@@ -334,7 +330,7 @@ void reset_aberrant_coefficients(
     unsigned long ds_idx)
 {
     unsigned long cdp_idx, rra_idx, i;
-    unsigned long cdp_start, rra_start;
+    unsigned long cdp_start;
     rrd_value_t nan_buffer = DNAN;
 
     /* compute the offset for the cdp area */
@@ -342,15 +338,11 @@ void reset_aberrant_coefficients(
         rrd->stat_head->ds_cnt * sizeof(ds_def_t) +
         rrd->stat_head->rra_cnt * sizeof(rra_def_t) +
         sizeof(live_head_t) + rrd->stat_head->ds_cnt * sizeof(pdp_prep_t);
-    /* compute the offset for the first rra */
-    rra_start = cdp_start +
-        (rrd->stat_head->ds_cnt) * (rrd->stat_head->rra_cnt) *
-        sizeof(cdp_prep_t) + rrd->stat_head->rra_cnt * sizeof(rra_ptr_t);
 
     /* loop over the RRAs */
     for (rra_idx = 0; rra_idx < rrd->stat_head->rra_cnt; rra_idx++) {
         cdp_idx = rra_idx * (rrd->stat_head->ds_cnt) + ds_idx;
-        switch (rrd_cf_conv(rrd->rra_def[rra_idx].cf_nam)) {
+        switch (rrd->__desc->cf[rra_idx]) {
         case CF_HWPREDICT:
         case CF_MHWPREDICT:
             init_hwpredict_cdp(&(rrd->cdp_prep[cdp_idx]));
@@ -362,9 +354,32 @@ void reset_aberrant_coefficients(
              * at different times. */
             rrd->cdp_prep[cdp_idx].scratch[CDP_hw_seasonal].u_val = DNAN;
             rrd->cdp_prep[cdp_idx].scratch[CDP_hw_last_seasonal].u_val = DNAN;
+            if (rrd->__desc->layout == RRD_LAYOUT_COMPRESSED) {
+                if (clear_ds_rows(rrd, rrd_file, rra_idx, ds_idx) != 0) {
+                    rrd_set_error
+                        ("reset_aberrant_coefficients: write failed data source %lu rra %s",
+                         ds_idx, rrd->rra_def[rra_idx].cf_nam);
+                    return;
+                }
+                break;
+            }
             /* move to first entry of data source for this rra */
-            rrd_seek(rrd_file, rra_start + ds_idx * sizeof(rrd_value_t),
+            rrd_seek(rrd_file, rrd_value_offset(rrd, rra_idx, 0, ds_idx),
                      SEEK_SET);
+            if (rrd->__desc->layout == RRD_LAYOUT_COLUMN) {
+                /* the data source has a ring of its own */
+                if (rrd_write_repeat(rrd_file, &nan_buffer,
+                                     sizeof(rrd_value_t),
+                                     rrd->rra_def[rra_idx].row_cnt)
+                    != (ssize_t) (sizeof(rrd_value_t) *
+                                  rrd->rra_def[rra_idx].row_cnt)) {
+                    rrd_set_error
+                        ("reset_aberrant_coefficients: write failed data source %lu rra %s",
+                         ds_idx, rrd->rra_def[rra_idx].cf_nam);
+                    return;
+                }
+                break;
+            }
             /* entries for the same data source are not contiguous,
              * temporal entries are contiguous */
             for (i = 0; i < rrd->rra_def[rra_idx].row_cnt; ++i) {
@@ -385,9 +400,6 @@ void reset_aberrant_coefficients(
         default:
             break;
         }
-        /* move offset to the next rra */
-        rra_start += rrd->rra_def[rra_idx].row_cnt * rrd->stat_head->ds_cnt *
-            sizeof(rrd_value_t);
     }
     rrd_seek(rrd_file, cdp_start, SEEK_SET);
     if (rrd_write(rrd_file, rrd->cdp_prep,
@@ -399,6 +411,32 @@ void reset_aberrant_coefficients(
     }
 }
 
+/* Set the values of DS ds_idx in all rows of RRA rra_idx to DNAN by
+ * unpacking and packing every block of a RRD_LAYOUT_COMPRESSED file. */
+static int clear_ds_rows(
+    rrd_t *rrd,
+    rrd_file_t *rrd_file,
+    unsigned long rra_idx,
+    unsigned long ds_idx)
+{
+    unsigned long row_cnt = rrd->rra_def[rra_idx].row_cnt;
+    unsigned long ds_cnt = rrd->stat_head->ds_cnt, i;
+    rrd_value_t *rrd_values;
+    int       ret = -1;
+
+    rrd_values = (rrd_value_t *) malloc(row_cnt * ds_cnt * sizeof(rrd_value_t));
+    if (rrd_values == NULL)
+        return -1;
+    if (rrd_read_rows(rrd_file, rrd, rra_idx, 0, row_cnt, rrd_values) == 0) {
+        for (i = 0; i < row_cnt; i++)
+            rrd_values[i * ds_cnt + ds_idx] = DNAN;
+        ret = rrd_write_rows(rrd_file, rrd, rra_idx, 0, row_cnt, rrd_values,
+                             0);
+    }
+    free(rrd_values);
+    return ret;
+}
+
 void init_hwpredict_cdp(
     cdp_prep_t *cdp)
 {
@@ -463,7 +501,7 @@ int update_aberrant_CF(
         return update_devpredict(rrd, cdp_idx, rra_idx, ds_idx,
                                  CDP_scratch_idx);
     case CF_SEASONAL:
-        switch (rrd_cf_conv(rrd->rra_def[hw_dep_idx(rrd, rra_idx)].cf_nam)) {
+        switch (rrd->__desc->cf[hw_dep_idx(rrd, rra_idx)]) {
         case CF_HWPREDICT:
             return update_seasonal(rrd, cdp_idx, rra_idx, ds_idx,
                                    CDP_scratch_idx, seasonal_coef,
@@ -476,7 +514,7 @@ int update_aberrant_CF(
             return -1;
         }
     case CF_DEVSEASONAL:
-        switch (rrd_cf_conv(rrd->rra_def[hw_dep_idx(rrd, rra_idx)].cf_nam)) {
+        switch (rrd->__desc->cf[hw_dep_idx(rrd, rra_idx)]) {
         case CF_HWPREDICT:
             return update_devseasonal(rrd, cdp_idx, rra_idx, ds_idx,
                                       CDP_scratch_idx, seasonal_coef,
@@ -489,9 +527,7 @@ int update_aberrant_CF(
             return -1;
         }
     case CF_FAILURES:
-        switch (rrd_cf_conv
-                (rrd->rra_def[hw_dep_idx(rrd, hw_dep_idx(rrd, rra_idx))].
-                 cf_nam)) {
+        switch (rrd->__desc->cf[hw_dep_idx(rrd, hw_dep_idx(rrd, rra_idx))]) {
         case CF_HWPREDICT:
             return update_failures(rrd, cdp_idx, rra_idx, ds_idx,
                                    CDP_scratch_idx, &hw_additive_functions);
@@ -0,0 +1,284 @@
+/*****************************************************************************
+ * rrd_jobs.c  Run jobs on many RRDs on a pool of threads
+ *****************************************************************************
+ * Working on a file is mostly waiting for its pages, so the time goes into
+ * how many files are in flight at once and in which order a disk gets to
+ * see them. The worker threads keep their error messages apart in their
+ * own rrd_context (see THREADS).
+ *
+ * The jobs are sorted by the device and inode of their files, which for
+ * most file systems is close to the order the files lie on disk in. The
+ * jobs of one file form a group that runs on one thread in the order the
+ * jobs were given in, as rrd_open would not let two updates at the file at
+ * the same time. io_concurrency caps the number of groups in flight on
+ * any one device, so a large pool can keep several disks busy without
+ * making one of them seek between more files than it copes with.
+ *****************************************************************************/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <limits.h>
+
+#include "rrd_tool.h"
+#include "rrd_container.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+typedef struct job_key_t {
+    dev_t     dev;
+    ino_t     ino;
+    const char *member; /* container member, or the whole name of a file
+                         * that could not be looked at */
+    unsigned long idx;  /* of the job */
+} job_key_t;
+
+typedef struct job_group_t {
+    unsigned long first;    /* in keys */
+    unsigned long cnt;
+    unsigned long dev_idx;
+} job_group_t;
+
+typedef struct job_device_t {
+    unsigned long next; /* group to hand out next */
+    unsigned long end;  /* one past its last group */
+    int       busy;     /* groups in flight */
+} job_device_t;
+
+typedef struct job_pool_t {
+    rrd_job_fn_t fn;
+    void     *arg;
+    job_key_t *keys;
+    job_group_t *groups;
+    job_device_t *devs;
+    unsigned long dev_cnt;
+    int       io_limit;
+#ifndef _WIN32
+    pthread_mutex_t lock;
+    pthread_cond_t idle;    /* a device got below io_limit */
+#endif
+} job_pool_t;
+
+static int key_cmp(
+    const void *a_,
+    const void *b_)
+{
+    const job_key_t *a = (const job_key_t *) a_;
+    const job_key_t *b = (const job_key_t *) b_;
+    int       c;
+
+    if (a->dev != b->dev)
+        return a->dev < b->dev ? -1 : 1;
+    if (a->ino != b->ino)
+        return a->ino < b->ino ? -1 : 1;
+    if ((c = strcmp(a->member, b->member)) != 0)
+        return c;
+    /* keeps the jobs of one file in order */
+    return a->idx < b->idx ? -1 : a->idx > b->idx;
+}
+
+static int same_file(
+    const job_key_t *a,
+    const job_key_t *b)
+{
+    return a->dev == b->dev && a->ino == b->ino
+        && strcmp(a->member, b->member) == 0;
+}
+
+/* Where the file of a job lives. Files that can not be looked at sort in
+ * front by name, the job tells what is wrong with them. */
+static void job_key(
+    const char *filename,
+    unsigned long idx,
+    job_key_t *key)
+{
+    const char *hash = NULL;
+    const char *path = filename;
+    char     *copy = NULL;
+    struct stat st;
+
+    key->idx = idx;
+    key->member = "";
+    if (rrd_container_name(filename)) {
+        hash = strchr(strstr(filename, ".rrdc#"), '#');
+        if ((copy = (char *) malloc(hash - filename + 1)) != NULL) {
+            memcpy(copy, filename, hash - filename);
+            copy[hash - filename] = '\0';
+            path = copy;
+            key->member = hash + 1;
+        }
+    }
+    if (stat(path, &st) == 0) {
+        key->dev = st.st_dev;
+        key->ino = st.st_ino;
+    } else {
+        key->dev = 0;
+        key->ino = 0;
+        key->member = filename;
+    }
+    free(copy);
+}
+
+/* Returns the index of the next group to run or -1 once all are taken. */
+static long claim_group(
+    job_pool_t *pool)
+{
+    unsigned long i;
+    long      group;
+    job_device_t *dev, *best;
+
+#ifndef _WIN32
+    pthread_mutex_lock(&pool->lock);
+#endif
+    for (;;) {
+        best = NULL;
+        group = -1;
+        for (i = 0; i < pool->dev_cnt; i++) {
+            dev = pool->devs + i;
+            if (dev->next == dev->end)
+                continue;
+            group = 0;
+            /* spread the work over the devices */
+            if (dev->busy < pool->io_limit
+                && (best == NULL || dev->busy < best->busy))
+                best = dev;
+        }
+        if (best != NULL) {
+            group = (long) best->next++;
+            best->busy++;
+            break;
+        }
+        if (group < 0)
+            break;
+#ifndef _WIN32
+        pthread_cond_wait(&pool->idle, &pool->lock);
+#endif
+    }
+#ifndef _WIN32
+    pthread_mutex_unlock(&pool->lock);
+#endif
+    return group;
+}
+
+static void release_group(
+    job_pool_t *pool,
+    unsigned long group)
+{
+#ifndef _WIN32
+    pthread_mutex_lock(&pool->lock);
+#endif
+    pool->devs[pool->groups[group].dev_idx].busy--;
+#ifndef _WIN32
+    pthread_cond_broadcast(&pool->idle);
+    pthread_mutex_unlock(&pool->lock);
+#endif
+}
+
+static void *worker(
+    void *pool_)
+{
+    job_pool_t *pool = (job_pool_t *) pool_;
+    const job_group_t *g;
+    unsigned long i;
+    long      group;
+
+    while ((group = claim_group(pool)) >= 0) {
+        g = pool->groups + group;
+        for (i = g->first; i < g->first + g->cnt; i++)
+            pool->fn(pool->arg, pool->keys[i].idx);
+        release_group(pool, group);
+    }
+    return NULL;
+}
+
+/*
+ * Call fn(arg, i) for each of the job_cnt jobs on a pool of up to threads
+ * threads, with at most io_concurrency files of one device in flight at
+ * once (no limit if io_concurrency < 1). filenames[i] is the file job i
+ * works on, fn must be safe to call from several threads at once for
+ * different files. Returns 0 once all jobs have run or -1 if they could
+ * not be started.
+ */
+int rrd_run_jobs(
+    const char *const *filenames,
+    unsigned long job_cnt,
+    int threads,
+    int io_concurrency,
+    rrd_job_fn_t fn,
+    void *arg)
+{
+    job_pool_t pool;
+    unsigned long i, group_cnt = 0;
+    int       started = 0;
+    int       rc = -1;
+
+#ifndef _WIN32
+    pthread_t *tids = NULL;
+#endif
+
+    memset(&pool, 0, sizeof(pool));
+    pool.fn = fn;
+    pool.arg = arg;
+    pool.io_limit = io_concurrency < 1 ? INT_MAX : io_concurrency;
+    if (job_cnt == 0)
+        return 0;
+
+    pool.keys = (job_key_t *) malloc(job_cnt * sizeof(job_key_t));
+    pool.groups = (job_group_t *) malloc(job_cnt * sizeof(job_group_t));
+    pool.devs = (job_device_t *) malloc(job_cnt * sizeof(job_device_t));
+    if (pool.keys == NULL || pool.groups == NULL || pool.devs == NULL) {
+        rrd_set_error("allocating jobs");
+        goto done;
+    }
+    for (i = 0; i < job_cnt; i++)
+        job_key(filenames[i], i, pool.keys + i);
+    qsort(pool.keys, job_cnt, sizeof(job_key_t), key_cmp);
+
+    for (i = 0; i < job_cnt; i++) {
+        if (i > 0 && same_file(pool.keys + i - 1, pool.keys + i)) {
+            pool.groups[group_cnt - 1].cnt++;
+            continue;
+        }
+        if (i == 0 || pool.keys[i - 1].dev != pool.keys[i].dev) {
+            pool.devs[pool.dev_cnt].next = group_cnt;
+            pool.devs[pool.dev_cnt].busy = 0;
+            pool.dev_cnt++;
+        }
+        pool.devs[pool.dev_cnt - 1].end = group_cnt + 1;
+        pool.groups[group_cnt].first = i;
+        pool.groups[group_cnt].cnt = 1;
+        pool.groups[group_cnt].dev_idx = pool.dev_cnt - 1;
+        group_cnt++;
+    }
+
+    if ((unsigned long) threads > group_cnt)
+        threads = (int) group_cnt;
+#ifndef _WIN32
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.idle, NULL);
+    if (threads > 1
+        && (tids = (pthread_t *) malloc(threads * sizeof(pthread_t))) != NULL) {
+        for (started = 0; started < threads; started++)
+            if (pthread_create(tids + started, NULL, worker, &pool) != 0)
+                break;
+    }
+#endif
+    /* without threads the calling thread does all the work */
+    if (started == 0)
+        worker(&pool);
+#ifndef _WIN32
+    while (started > 0)
+        pthread_join(tids[--started], NULL);
+    free(tids);
+    pthread_cond_destroy(&pool.idle);
+    pthread_mutex_destroy(&pool.lock);
+#endif
+
+    rc = 0;
+  done:
+    free(pool.devs);
+    free(pool.groups);
+    free(pool.keys);
+    return rc;
+}
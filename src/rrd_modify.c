@@ -770,8 +770,8 @@ static rrd_t *rrd_modify_structure(const rrd_t *in,
        files should be modified, a dump/restore cycle should be
        done.... */
     
-    if (atoi(in->stat_head->version) < atoi(RRD_VERSION3) || atoi(in->stat_head->version) > atoi(RRD_VERSION5)) {
-	rrd_set_error("direct modification is only supported for version 3, 4 or 5 of RRD files. Consider to dump/restore before retrying a modification");
+    if (atoi(in->stat_head->version) < atoi(RRD_VERSION3) || atoi(in->stat_head->version) > atoi(RRD_VERSION6)) {
+	rrd_set_error("direct modification is only supported for version 3, 4, 5 or 6 of RRD files. Consider to dump/restore before retrying a modification");
 	goto done;
     }
     
@@ -790,6 +790,8 @@ static rrd_t *rrd_modify_structure(const rrd_t *in,
     strcpy(out->stat_head->version, in->stat_head->version);
     out->stat_head->float_cookie = FLOAT_COOKIE;
     out->stat_head->pdp_step = in->stat_head->pdp_step;
+    out->stat_head->par[SH_layout] = in->stat_head->par[SH_layout];
+    out->stat_head->par[SH_block_rows] = in->stat_head->par[SH_block_rows];
     
     out->stat_head->ds_cnt = 0;
     out->stat_head->rra_cnt = 0;
@@ -1216,7 +1218,8 @@ static int add_rras(const rrd_t *in, rrd_t *out, const int *ds_map,
 	}
     }
 
-    if (require_version != NULL && atoi(require_version) < atoi(out->stat_head->version)) {
+    if (require_version != NULL && atoi(require_version) < atoi(out->stat_head->version)
+        && rrd_layout(out) == RRD_LAYOUT_ROW) {
         strncpy(out->stat_head->version, require_version, 4);
         out->stat_head->version[4] = '\0';
     }
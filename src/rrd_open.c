@@ -21,6 +21,8 @@
 #endif                          /* WIN32 */
 
 #include "rrd_tool.h"
+#include "rrd_compress.h"
+#include "rrd_container.h"
 #include "compat-cloexec.h"
 #include "unused.h"
 
@@ -34,6 +36,13 @@
 #endif
 
 #define MEMBLK 8192
+/* largest buffer rrd_write_repeat stages when it cannot copy in place */
+#define REPEAT_CHUNK 65536
+/* rows rrd_read_rows gathers from the columns of an RRA in one go */
+#define ROWS_BLOCK 1024
+
+/* upper bound for the rows per block of RRD_LAYOUT_COMPRESSED files */
+#define MAX_BLOCK_ROWS 65536
 
 #ifdef _WIN32
 #define    _LK_UNLCK    0   /* Unlock */
@@ -144,6 +153,10 @@ static int rrd_rwlock(
     int lock_mode);
 static int close_and_unlock(
     int fd);
+static int read_values(
+    rrd_file_t *rrd_file,
+    rrd_t *rrd,
+    unsigned long row_cnt);
 
 /* Open a database file, return its header and an open filehandle,
  * positioned to the first cdp in the first rra.
@@ -180,15 +193,13 @@ rrd_file_t *rrd_open(
 
     /* Are we creating a new file? */
     if (rdwr & RRD_CREAT) {
-        size_t    header_len, value_cnt, data_len;
+        size_t    header_len, data_len;
 
         header_len = rrd_get_header_size(rrd);
 
-        value_cnt = 0;
+        data_len = 0;
         for (ui = 0; ui < rrd->stat_head->rra_cnt; ui++)
-            value_cnt += rrd->stat_head->ds_cnt * rrd->rra_def[ui].row_cnt;
-
-        data_len = sizeof(rrd_value_t) * value_cnt;
+            data_len += rrd_rra_data_size(rrd, ui);
 
         newfile_size = header_len + data_len;
     }
@@ -250,6 +261,25 @@ rrd_file_t *rrd_open(
     }
 #endif
 
+#ifdef HAVE_RRD_CONTAINER
+    if (rrd_container_name(file_name)) {
+        if (rdwr & RRD_CREAT) {
+            rrd_set_error("can't create container member '%s' in place",
+                          file_name);
+            goto out_free;
+        }
+        if (rrd_member_open(rrd_file, file_name, rdwr & RRD_READWRITE) != 0)
+            goto out_free;
+        if (rrd_rwlock(rrd_file, rdwr & RRD_READWRITE, rdwr & RRD_LOCK_MASK)
+            != 0) {
+            rrd_set_error("could not lock RRD");
+            goto out_close;
+        }
+        data = rrd_simple_file->file_start;
+        goto mapped;
+    }
+#endif
+
 #ifdef HAVE_MMAP
     rrd_simple_file->mm_prot = PROT_READ;
     rrd_simple_file->mm_flags = 0;
@@ -450,6 +480,9 @@ rrd_file_t *rrd_open(
                       rrd_strerror(errno));
         goto out_close;
     }
+#ifdef HAVE_RRD_CONTAINER
+  mapped:
+#endif
     rrd->__mmap_start = data;
     rrd->__mmap_size = rrd_file->file_len;
 
@@ -498,17 +531,32 @@ rrd_file_t *rrd_open(
     }
 
     if (rrd->stat_head->float_cookie != FLOAT_COOKIE) {
-        rrd_set_error("This RRD was created on another architecture");
+        rrd_set_error("This RRD was created on another architecture, "
+                      "see rrdtool convert");
         goto out_close;
     }
 
     version = atoi(rrd->stat_head->version);
 
-    if (version > atoi(RRD_VERSION5)) {
+    if (version > atoi(RRD_VERSION6)) {
         rrd_set_error("can't handle RRD file version %s",
                       rrd->stat_head->version);
         goto out_close;
     }
+    if (rrd_layout(rrd) != RRD_LAYOUT_ROW
+        && rrd_layout(rrd) != RRD_LAYOUT_COLUMN
+        && rrd_layout(rrd) != RRD_LAYOUT_COMPRESSED) {
+        rrd_set_error("can't handle data layout %d of RRD file '%s'",
+                      rrd_layout(rrd), file_name);
+        goto out_close;
+    }
+    if (rrd_layout(rrd) == RRD_LAYOUT_COMPRESSED
+        && (rrd->stat_head->par[SH_block_rows].u_cnt < 1
+            || rrd->stat_head->par[SH_block_rows].u_cnt > MAX_BLOCK_ROWS)) {
+        rrd_set_error("invalid block size %lu in RRD file '%s'",
+                      rrd->stat_head->par[SH_block_rows].u_cnt, file_name);
+        goto out_close;
+    }
     __rrd_read(rrd->ds_def, ds_def_t,
                rrd->stat_head->ds_cnt);
 
@@ -541,6 +589,9 @@ rrd_file_t *rrd_open(
     rrd_file->header_len = offset;
     rrd_file->pos = offset;
 
+    if (rrd_get_desc(rrd) == NULL)
+        goto out_close;
+
 #if defined(HAVE_MMAP) && defined(USE_MADVISE)
     if (data != MAP_FAILED) {
         /* MADV_SEQUENTIAL mentions drop-behind.  Override it for the header
@@ -558,12 +609,12 @@ rrd_file_t *rrd_open(
 
     {
         unsigned long row_cnt = 0;
+        size_t    correct_len = rrd_file->header_len;
 
-        for (ui = 0; ui < rrd->stat_head->rra_cnt; ui++)
+        for (ui = 0; ui < rrd->stat_head->rra_cnt; ui++) {
             row_cnt += rrd->rra_def[ui].row_cnt;
-
-        size_t    correct_len = rrd_file->header_len +
-            sizeof(rrd_value_t) * row_cnt * rrd->stat_head->ds_cnt;
+            correct_len += rrd_rra_data_size(rrd, ui);
+        }
 
 #ifdef HAVE_LIBRADOS
         /* skip length checking for rados file */
@@ -578,8 +629,15 @@ rrd_file_t *rrd_open(
             goto out_close;
         }
         if (rdwr & RRD_READVALUES) {
-            __rrd_read(rrd->rrd_value, rrd_value_t,
-                       row_cnt * rrd->stat_head->ds_cnt);
+            /* in memory the values are always kept in rows, and the
+             * rows a sparse file has not written yet hold DNAN */
+            if (rrd_layout(rrd) == RRD_LAYOUT_ROW
+                && (version < 6
+                    || rrd->stat_head->par[SH_sparse_since].u_cnt == 0)) {
+                __rrd_read(rrd->rrd_value, rrd_value_t,
+                           row_cnt * rrd->stat_head->ds_cnt);
+            } else if (read_values(rrd_file, rrd, row_cnt) == -1)
+                goto out_close;
 
             if (rrd_seek(rrd_file, rrd_file->header_len, SEEK_SET) != 0)
                 goto out_close;
@@ -591,7 +649,7 @@ rrd_file_t *rrd_open(
 
   out_close:
 #ifdef HAVE_MMAP
-    if (data != MAP_FAILED)
+    if (data != MAP_FAILED && rrd_simple_file->member == NULL)
         munmap(data, rrd_file->file_len);
 #endif
 #ifdef HAVE_LIBRADOS
@@ -602,7 +660,10 @@ rrd_file_t *rrd_open(
         /* keep the original error */
         char     *e = strdup(rrd_get_error());
 
-        close_and_unlock(rrd_simple_file->fd);
+        if (rrd_simple_file->member != NULL)
+            rrd_member_close(rrd_file);
+        else
+            close_and_unlock(rrd_simple_file->fd);
 
         if (e) {
             rrd_set_error(e);
@@ -818,6 +879,11 @@ int rrd_rwlock(
         lock.l_len = 0; /* whole file */
         lock.l_start = 0;   /* start of file */
         lock.l_whence = SEEK_SET;   /* end of file */
+        if (rrd_simple_file->member != NULL) {
+            /* just the member of a container */
+            lock.l_len = rrd_file->file_len;
+            lock.l_start = rrd_simple_file->member->base;
+        }
 
         rcstat = fcntl(rrd_simple_file->fd, op, &lock);
     }
@@ -836,9 +902,10 @@ void rrd_dontneed(
     rrd_simple_file_t *rrd_simple_file;
 
 #if defined USE_MADVISE || defined HAVE_POSIX_FADVISE
+    const rrd_desc_t *desc;
     size_t    dontneed_start;
-    size_t    rra_start;
     size_t    active_block;
+    size_t    base = 0, file_end;
     size_t    i;
     ssize_t   _page_size = sysconf(_SC_PAGESIZE);
 
@@ -854,17 +921,27 @@ void rrd_dontneed(
     mincore_print(rrd_file, "before");
 #endif
 
+    desc = rrd_get_desc(rrd);
+    if (desc == NULL)
+        return;
+
+    /* the pages are those of the container for its members, which need
+     * not start on a page; their last page may be the next one's first */
+    file_end = rrd_file->file_len;
+    if (rrd_simple_file->member != NULL) {
+        base = rrd_simple_file->member->base;
+        file_end = PAGE_START(base + rrd_file->file_len);
+    }
+
     /* ignoring errors from RRDs that are smaller then the file_len+rounding */
-    rra_start = rrd_file->header_len;
-    dontneed_start = PAGE_START(rra_start) + _page_size;
+    dontneed_start = PAGE_START(base + desc->rra_start[0]) + _page_size;
     for (i = 0; i < rrd->stat_head->rra_cnt; ++i) {
         active_block =
-            PAGE_START(rra_start
-                       + rrd->rra_ptr[i].cur_row
-                       * rrd->stat_head->ds_cnt * sizeof(rrd_value_t));
+            PAGE_START(base +
+                       rrd_value_offset(rrd, i, rrd->rra_ptr[i].cur_row, 0));
         if (active_block > dontneed_start) {
 #ifdef USE_MADVISE
-            madvise(rrd_simple_file->file_start + dontneed_start,
+            madvise(rrd_simple_file->file_start - base + dontneed_start,
                     active_block - dontneed_start - 1, MADV_DONTNEED);
 #else
 #ifdef HAVE_POSIX_FADVISE
@@ -878,25 +955,20 @@ void rrd_dontneed(
         dontneed_start = active_block;
         /* do not release 'hot' block if update for this RAA will occur
          * within 10 minutes */
-        if (rrd->stat_head->pdp_step * rrd->rra_def[i].pdp_cnt -
-            rrd->live_head->last_up % (rrd->stat_head->pdp_step *
-                                       rrd->rra_def[i].pdp_cnt) < 10 * 60) {
+        if (desc->rra_step[i] -
+            rrd->live_head->last_up % desc->rra_step[i] < 10 * 60) {
             dontneed_start += _page_size;
         }
-        rra_start +=
-            rrd->rra_def[i].row_cnt * rrd->stat_head->ds_cnt *
-            sizeof(rrd_value_t);
     }
 
-    if (dontneed_start < rrd_file->file_len) {
+    if (dontneed_start < file_end) {
 #ifdef USE_MADVISE
-        madvise(rrd_simple_file->file_start + dontneed_start,
-                rrd_file->file_len - dontneed_start, MADV_DONTNEED);
+        madvise(rrd_simple_file->file_start - base + dontneed_start,
+                file_end - dontneed_start, MADV_DONTNEED);
 #else
 #ifdef HAVE_POSIX_FADVISE
         posix_fadvise(rrd_simple_file->fd, dontneed_start,
-                      rrd_file->file_len - dontneed_start,
-                      POSIX_FADV_DONTNEED);
+                      file_end - dontneed_start, POSIX_FADV_DONTNEED);
 #endif
 #endif
     }
@@ -912,6 +984,81 @@ void rrd_dontneed(
 #endif                          /* without madvise and posix_fadvise it does not make much sense todo anything */
 }
 
+/* hint that len bytes at offset pos of the file are about to be read */
+static void read_ahead_range(
+    rrd_file_t *rrd_file,
+    size_t pos,
+    size_t len)
+{
+#if defined USE_MADVISE || defined HAVE_POSIX_FADVISE
+    rrd_simple_file_t *rrd_simple_file = (rrd_simple_file_t *) rrd_file->pvt;
+    ssize_t   _page_size = sysconf(_SC_PAGESIZE);
+    size_t    start;
+
+    if (pos >= rrd_file->file_len)
+        return;
+    len = min(len, rrd_file->file_len - pos);
+#if defined HAVE_MMAP && defined USE_MADVISE
+    if (rrd_simple_file->file_start != NULL) {
+        /* members of a container need not start on a page */
+        start = PAGE_START((size_t) (rrd_simple_file->file_start + pos));
+        madvise((char *) start,
+                (size_t) (rrd_simple_file->file_start + pos) - start + len,
+                MADV_WILLNEED);
+        return;
+    }
+#endif
+#ifdef HAVE_POSIX_FADVISE
+    /* the descriptor of a member is that of its container */
+    if (rrd_simple_file->member != NULL)
+        pos += rrd_simple_file->member->base;
+    start = PAGE_START(pos);
+    posix_fadvise(rrd_simple_file->fd, start, pos - start + len,
+                  POSIX_FADV_WILLNEED);
+#endif
+#else
+    (void) rrd_file;
+    (void) pos;
+    (void) len;
+#endif
+}
+
+/* Hint that rows row .. row + row_cnt - 1 of RRA rra_idx, without
+ * wrapping, are about to be read with rrd_read_rows, so that the reads
+ * for all of them go out at once instead of one page fault after the
+ * other. */
+void rrd_read_ahead(
+    rrd_file_t *rrd_file,
+    rrd_t *rrd,
+    unsigned long rra_idx,
+    unsigned long row,
+    unsigned long row_cnt)
+{
+    const rrd_desc_t *desc = rrd->__desc;
+    unsigned long ds_cnt = rrd->stat_head->ds_cnt, ds_idx, first, last;
+
+    if (row_cnt == 0)
+        return;
+    switch (desc->layout) {
+    case RRD_LAYOUT_COLUMN:
+        for (ds_idx = 0; ds_idx < ds_cnt; ds_idx++)
+            read_ahead_range(rrd_file,
+                             rrd_value_offset(rrd, rra_idx, row, ds_idx),
+                             row_cnt * sizeof(rrd_value_t));
+        break;
+    case RRD_LAYOUT_COMPRESSED:
+        first = row / desc->block_rows;
+        last = (row + row_cnt - 1) / desc->block_rows;
+        read_ahead_range(rrd_file,
+                         desc->rra_start[rra_idx] + first * desc->block_size,
+                         (last - first + 1) * desc->block_size);
+        break;
+    default:
+        read_ahead_range(rrd_file, rrd_value_offset(rrd, rra_idx, row, 0),
+                         row_cnt * ds_cnt * sizeof(rrd_value_t));
+    }
+}
+
 
 
 
@@ -930,6 +1077,10 @@ int rrd_close(
             ret = -1;
     }
 #endif
+    if (rrd_simple_file->member != NULL) {
+        if (rrd_member_close(rrd_file) != 0)
+            ret = -1;
+    }
 #ifdef HAVE_MMAP
     if (rrd_simple_file->file_start != NULL) {
         if (munmap(rrd_simple_file->file_start, rrd_file->file_len) != 0) {
@@ -1094,6 +1245,559 @@ ssize_t rrd_write(
 }
 
 
+/* Write count copies of the size bytes at buf, as count calls to
+ * rrd_write would. On a mapped file the copies are made in place by
+ * doubling the part already written, otherwise they go out in chunks of
+ * up to REPEAT_CHUNK bytes. */
+ssize_t rrd_write_repeat(
+    rrd_file_t *rrd_file,
+    const void *buf,
+    size_t size,
+    size_t count)
+{
+    size_t    total = size * count, done, chunk, copies;
+    char     *staging;
+    ssize_t   _sz;
+
+    if (count <= 1)
+        return rrd_write(rrd_file, buf, total);
+
+#ifdef HAVE_MMAP
+#ifdef HAVE_LIBRADOS
+    if (!rrd_file->rados)
+#endif
+    {
+        rrd_simple_file_t *rrd_simple_file =
+            (rrd_simple_file_t *) rrd_file->pvt;
+        char     *dst;
+
+        if (buf == NULL)
+            return -1;  /* EINVAL */
+        if ((rrd_file->pos + total) > rrd_file->file_len) {
+            rrd_set_error
+                ("attempting to write beyond end of file (%ld + %ld > %ld)",
+                 rrd_file->pos, total, rrd_file->file_len);
+            return -1;
+        }
+        dst = rrd_simple_file->file_start + rrd_file->pos;
+        memmove(dst, buf, size);
+        for (done = size; done < total; done += chunk) {
+            chunk = min(done, total - done);
+            memcpy(dst + done, dst, chunk);
+        }
+        rrd_file->pos += total;
+        return total;
+    }
+#endif
+
+    copies = REPEAT_CHUNK / size > 0 ? min(REPEAT_CHUNK / size, count) : 1;
+    if ((staging = (char *) malloc(copies * size)) == NULL) {
+        rrd_set_error("allocating write buffer");
+        return -1;
+    }
+    memcpy(staging, buf, size);
+    for (done = size; done < copies * size; done += chunk) {
+        chunk = min(done, copies * size - done);
+        memcpy(staging + done, staging, chunk);
+    }
+    for (done = 0; done < total; done += _sz) {
+        chunk = min(copies * size, total - done);
+        _sz = rrd_write(rrd_file, staging, chunk);
+        if (_sz != (ssize_t) chunk) {
+            free(staging);
+            return _sz < 0 ? _sz : (ssize_t) (done + _sz);
+        }
+    }
+    free(staging);
+    return total;
+}
+
+
+/* Return the address the len bytes at offset of the file are mapped to,
+ * or NULL if they cannot be read in place. The address stays valid until
+ * rrd_close. */
+const void *rrd_mapped(
+    rrd_file_t *rrd_file,
+    size_t offset,
+    size_t len)
+{
+#ifdef HAVE_MMAP
+    rrd_simple_file_t *rrd_simple_file = (rrd_simple_file_t *) rrd_file->pvt;
+
+#ifdef HAVE_LIBRADOS
+    if (rrd_file->rados)
+        return NULL;
+#endif
+    if (rrd_simple_file->file_start == NULL
+        || offset + len > rrd_file->file_len)
+        return NULL;
+    return rrd_simple_file->file_start + offset;
+#else
+    (void) rrd_file;
+    (void) offset;
+    (void) len;
+    return NULL;
+#endif
+}
+
+
+/* Blocks of RRD_LAYOUT_COMPRESSED files. The values of the block last
+ * unpacked stay in the block cache of the descriptor, so that reading
+ * or writing one row after the other does not unpack a block each time. */
+
+/* file offset of block of RRA rra_idx, *block_cnt is set to the rows it
+ * holds */
+static size_t block_offset(
+    const rrd_t *rrd,
+    unsigned long rra_idx,
+    unsigned long block,
+    unsigned long *block_cnt)
+{
+    const rrd_desc_t *desc = rrd->__desc;
+
+    *block_cnt = min(desc->block_rows,
+                     rrd->rra_def[rra_idx].row_cnt
+                     - block * desc->block_rows);
+    return desc->rra_start[rra_idx] + block * desc->block_size;
+}
+
+static int read_block_head(
+    rrd_file_t *rrd_file,
+    size_t pos,
+    block_head_t *head)
+{
+    const void *mapped = rrd_mapped(rrd_file, pos, sizeof(block_head_t));
+
+    if (mapped != NULL) {
+        memcpy(head, mapped, sizeof(block_head_t));
+        return 0;
+    }
+    if (rrd_seek(rrd_file, pos, SEEK_SET) != 0
+        || rrd_read(rrd_file, head, sizeof(block_head_t))
+        != (ssize_t) sizeof(block_head_t))
+        return -1;
+    return 0;
+}
+
+static rrd_value_t *block_cache(
+    rrd_t *rrd)
+{
+    rrd_desc_t *desc = rrd->__desc;
+
+    if (desc->block_cache == NULL) {
+        desc->block_cache = (rrd_value_t *)
+            malloc(desc->block_rows * rrd->stat_head->ds_cnt
+                   * sizeof(rrd_value_t));
+        if (desc->block_cache == NULL)
+            rrd_set_error("allocating block cache");
+    }
+    /* whatever it held is about to be overwritten */
+    desc->cache_rra = rrd->stat_head->rra_cnt;
+    return desc->block_cache;
+}
+
+/* Unpack block of RRA rra_idx into the block cache, unless it is there
+ * already. Returns the cache or NULL on error. */
+static rrd_value_t *load_block(
+    rrd_file_t *rrd_file,
+    rrd_t *rrd,
+    unsigned long rra_idx,
+    unsigned long block)
+{
+    rrd_desc_t *desc = rrd->__desc;
+    unsigned long ds_cnt = rrd->stat_head->ds_cnt, block_cnt;
+    size_t    pos = block_offset(rrd, rra_idx, block, &block_cnt);
+    block_head_t head;
+    const unsigned char *data;
+    unsigned char *buf = NULL;
+    rrd_value_t *values;
+
+    if (desc->cache_rra == rra_idx && desc->cache_block == block)
+        return desc->block_cache;
+    if ((values = block_cache(rrd)) == NULL)
+        return NULL;
+    if (read_block_head(rrd_file, pos, &head) != 0)
+        goto read_error;
+    if (head.len > block_cnt * ds_cnt * sizeof(rrd_value_t))
+        goto damaged;
+    pos += sizeof(block_head_t);
+    data = (const unsigned char *) rrd_mapped(rrd_file, pos, head.len);
+    if (data == NULL && head.len > 0) {
+        if ((buf = (unsigned char *) malloc(head.len)) == NULL) {
+            rrd_set_error("allocating block buffer");
+            return NULL;
+        }
+        if (rrd_seek(rrd_file, pos, SEEK_SET) != 0
+            || rrd_read(rrd_file, buf, head.len) != (ssize_t) head.len) {
+            free(buf);
+            goto read_error;
+        }
+        data = buf;
+    }
+    if (rrd_block_unpack(&head, data, block_cnt, ds_cnt, values) != 0) {
+        free(buf);
+        goto damaged;
+    }
+    free(buf);
+    desc->cache_rra = rra_idx;
+    desc->cache_block = block;
+    return values;
+
+  read_error:
+    rrd_set_error("reading block %lu of RRA %lu", block, rra_idx);
+    return NULL;
+  damaged:
+    rrd_set_error("block %lu of RRA %lu is damaged", block, rra_idx);
+    return NULL;
+}
+
+/* Hand the whole pages among the len bytes from offset back to the file
+ * system. It may well refuse, which only costs space. */
+static void punch_hole(
+    rrd_file_t *rrd_file,
+    size_t offset,
+    size_t len)
+{
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_PUNCH_HOLE)
+    rrd_simple_file_t *rrd_simple_file = (rrd_simple_file_t *) rrd_file->pvt;
+    size_t    page_size = sysconf(_SC_PAGESIZE);
+    size_t    base = 0, start, end;
+
+    /* pages are those of the container for its members */
+    if (rrd_simple_file->member != NULL)
+        base = rrd_simple_file->member->base;
+    start = (base + offset + page_size - 1) & ~(page_size - 1);
+    end = (base + offset + len) & ~(page_size - 1);
+
+#ifdef HAVE_LIBRADOS
+    if (rrd_file->rados)
+        return;
+#endif
+    if (end <= start)
+        return;
+#ifdef HAVE_MMAP
+    /* pages still dirty in the mapping would take the room again when
+     * they get written out */
+    if (rrd_simple_file->file_start != NULL)
+        msync(rrd_simple_file->file_start + start - base, end - start,
+              MS_SYNC);
+#endif
+    fallocate(rrd_simple_file->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+              start, end - start);
+#else
+    (void) rrd_file;
+    (void) offset;
+    (void) len;
+#endif
+}
+
+/* Pack the block cache, which holds block of RRA rra_idx, into the file.
+ * Unless raw is set the block gets sealed and the room it no longer needs
+ * is handed back to the file system where possible. */
+static int store_block(
+    rrd_file_t *rrd_file,
+    rrd_t *rrd,
+    unsigned long rra_idx,
+    unsigned long block,
+    int raw)
+{
+    unsigned long ds_cnt = rrd->stat_head->ds_cnt, block_cnt;
+    size_t    pos = block_offset(rrd, rra_idx, block, &block_cnt);
+    size_t    size = block_cnt * ds_cnt * sizeof(rrd_value_t);
+    block_head_t *head;
+    unsigned char *buf;
+    int       ret = -1;
+
+    if ((buf = (unsigned char *) malloc(sizeof(block_head_t) + size))
+        == NULL) {
+        rrd_set_error("allocating block buffer");
+        return -1;
+    }
+    head = (block_head_t *) (void *) buf;
+    rrd_block_pack(rrd->__desc->block_cache, block_cnt, ds_cnt, raw, head,
+                   buf + sizeof(block_head_t));
+    errno = 0;
+    if (rrd_seek(rrd_file, pos, SEEK_SET) != 0
+        || rrd_write(rrd_file, buf, sizeof(block_head_t) + head->len)
+        != (ssize_t) (sizeof(block_head_t) + head->len)) {
+        rrd_set_error("writing block %lu of RRA %lu: %s", block, rra_idx,
+                      rrd_strerror(errno));
+        goto out;
+    }
+    punch_hole(rrd_file, pos + sizeof(block_head_t) + head->len,
+               size - head->len);
+    ret = 0;
+  out:
+    free(buf);
+    return ret;
+}
+
+/* the rows of values to write, followed by fill_cnt copies of the last */
+static void fill_rows(
+    rrd_value_t *dst,
+    const rrd_value_t *values,
+    unsigned long ds_cnt,
+    unsigned long row_cnt,
+    unsigned long first,
+    unsigned long cnt)
+{
+    unsigned long i;
+
+    for (i = 0; i < cnt; i++)
+        memcpy(dst + i * ds_cnt,
+               values + min(first + i, row_cnt - 1) * ds_cnt,
+               ds_cnt * sizeof(rrd_value_t));
+}
+
+static int read_blocks(
+    rrd_file_t *rrd_file,
+    rrd_t *rrd,
+    unsigned long rra_idx,
+    unsigned long row,
+    unsigned long row_cnt,
+    rrd_value_t *values)
+{
+    unsigned long ds_cnt = rrd->stat_head->ds_cnt;
+    unsigned long block_rows = rrd->__desc->block_rows;
+    unsigned long done, cnt, block, first, block_cnt;
+    const rrd_value_t *src;
+
+    for (done = 0; done < row_cnt; done += cnt) {
+        block = (row + done) / block_rows;
+        first = row + done - block * block_rows;
+        block_offset(rrd, rra_idx, block, &block_cnt);
+        cnt = min(row_cnt - done, block_cnt - first);
+        if ((src = load_block(rrd_file, rrd, rra_idx, block)) == NULL)
+            return -1;
+        memcpy(values + done * ds_cnt, src + first * ds_cnt,
+               cnt * ds_cnt * sizeof(rrd_value_t));
+    }
+    return 0;
+}
+
+static int write_blocks(
+    rrd_file_t *rrd_file,
+    rrd_t *rrd,
+    unsigned long rra_idx,
+    unsigned long row,
+    unsigned long row_cnt,
+    const rrd_value_t *values,
+    unsigned long fill_cnt)
+{
+    rrd_desc_t *desc = rrd->__desc;
+    unsigned long ds_cnt = rrd->stat_head->ds_cnt;
+    unsigned long block_rows = desc->block_rows;
+    unsigned long hot = rrd->rra_ptr[rra_idx].cur_row / block_rows;
+    unsigned long done, cnt, block, first, block_cnt, head_cnt;
+    size_t    row_size = ds_cnt * sizeof(rrd_value_t);
+    block_head_t head;
+    rrd_value_t *dst;
+
+    for (done = 0; done < row_cnt + fill_cnt; done += cnt) {
+        block = (row + done) / block_rows;
+        first = row + done - block * block_rows;
+        if (read_block_head(rrd_file,
+                            block_offset(rrd, rra_idx, block, &block_cnt),
+                            &head) != 0)
+            return -1;
+        cnt = min(row_cnt + fill_cnt - done, block_cnt - first);
+
+        if (block == hot && head.kind == BLOCK_RAW) {
+            /* the current block is kept raw, write the rows in place */
+            head_cnt = done < row_cnt ? min(cnt, row_cnt - done) : 0;
+            if (rrd_seek(rrd_file,
+                         rrd_value_offset(rrd, rra_idx, row + done, 0),
+                         SEEK_SET) != 0
+                || (head_cnt > 0
+                    && rrd_write(rrd_file, values + done * ds_cnt,
+                                 head_cnt * row_size)
+                    != (ssize_t) (head_cnt * row_size))
+                || (cnt > head_cnt
+                    && rrd_write_repeat(rrd_file,
+                                        values + (row_cnt - 1) * ds_cnt,
+                                        row_size, cnt - head_cnt)
+                    != (ssize_t) ((cnt - head_cnt) * row_size)))
+                return -1;
+            if (desc->cache_rra == rra_idx && desc->cache_block == block)
+                fill_rows(desc->block_cache + first * ds_cnt, values,
+                          ds_cnt, row_cnt, done, cnt);
+            continue;
+        }
+
+        /* rows the update does not cover have to be unpacked first */
+        if (cnt < block_cnt)
+            dst = load_block(rrd_file, rrd, rra_idx, block);
+        else
+            dst = block_cache(rrd);
+        if (dst == NULL)
+            return -1;
+        desc->cache_rra = rrd->stat_head->rra_cnt;
+        fill_rows(dst + first * ds_cnt, values, ds_cnt, row_cnt, done, cnt);
+        if (store_block(rrd_file, rrd, rra_idx, block, block == hot) != 0)
+            return -1;
+        desc->cache_rra = rra_idx;
+        desc->cache_block = block;
+    }
+    return 0;
+}
+
+/* Seal the block of RRA rra_idx holding row, unless it holds the current
+ * row or has been sealed already. Files with a layout other than
+ * RRD_LAYOUT_COMPRESSED have nothing to seal.
+ *
+ * Returns 0 on success, -1 on error. */
+int rrd_seal_block(
+    rrd_file_t *rrd_file,
+    rrd_t *rrd,
+    unsigned long rra_idx,
+    unsigned long row)
+{
+    unsigned long block, block_cnt;
+    block_head_t head;
+
+    if (rrd->__desc->layout != RRD_LAYOUT_COMPRESSED)
+        return 0;
+    block = row / rrd->__desc->block_rows;
+    if (block == rrd->rra_ptr[rra_idx].cur_row / rrd->__desc->block_rows)
+        return 0;
+    if (read_block_head(rrd_file,
+                        block_offset(rrd, rra_idx, block, &block_cnt),
+                        &head) != 0) {
+        rrd_set_error("reading block %lu of RRA %lu", block, rra_idx);
+        return -1;
+    }
+    if (head.kind != BLOCK_RAW)
+        return 0;
+    if (load_block(rrd_file, rrd, rra_idx, block) == NULL)
+        return -1;
+    return store_block(rrd_file, rrd, rra_idx, block, 0);
+}
+
+/* Read row_cnt rows of RRA rra_idx from row on, without wrapping, into
+ * values, one row of ds_cnt values after the other whatever the layout
+ * of the file. Rows a sparse file has not written yet read as DNAN.
+ *
+ * Returns 0 on success, -1 on error. */
+int rrd_read_rows(
+    rrd_file_t *rrd_file,
+    rrd_t *rrd,
+    unsigned long rra_idx,
+    unsigned long row,
+    unsigned long row_cnt,
+    rrd_value_t *values)
+{
+    unsigned long ds_cnt = rrd->stat_head->ds_cnt, ds_idx, i, block;
+    size_t    len = row_cnt * sizeof(rrd_value_t);
+    const rrd_value_t *ring;
+    rrd_value_t *column = NULL;
+    int       ret = -1;
+
+    if (row_cnt == 0)
+        return 0;
+    if (rrd->__desc->layout == RRD_LAYOUT_COMPRESSED)
+        return read_blocks(rrd_file, rrd, rra_idx, row, row_cnt, values);
+    if (rrd->__desc->layout == RRD_LAYOUT_ROW) {
+        if (rrd_seek(rrd_file, rrd_value_offset(rrd, rra_idx, row, 0),
+                     SEEK_SET) != 0
+            || rrd_read(rrd_file, values, len * ds_cnt)
+            != (ssize_t) (len * ds_cnt))
+            return -1;
+        rrd_mask_unwritten(rrd, rra_idx, row, row_cnt, values);
+        return 0;
+    }
+
+    /* scatter the columns a block of rows at a time, so that the rows
+     * being filled stay in the cache */
+    for (block = 0; block < row_cnt; block += ROWS_BLOCK) {
+        unsigned long block_cnt = min(row_cnt - block, ROWS_BLOCK);
+
+        for (ds_idx = 0; ds_idx < ds_cnt; ds_idx++) {
+            size_t    pos = rrd_value_offset(rrd, rra_idx, row + block, ds_idx);
+
+            if ((ring = (const rrd_value_t *)
+                 rrd_mapped(rrd_file, pos,
+                            block_cnt * sizeof(rrd_value_t))) == NULL) {
+                if (column == NULL
+                    && (column = (rrd_value_t *)
+                        malloc(ROWS_BLOCK * sizeof(rrd_value_t))) == NULL)
+                    goto out;
+                if (rrd_seek(rrd_file, pos, SEEK_SET) != 0
+                    || rrd_read(rrd_file, column,
+                                block_cnt * sizeof(rrd_value_t))
+                    != (ssize_t) (block_cnt * sizeof(rrd_value_t)))
+                    goto out;
+                ring = column;
+            }
+            for (i = 0; i < block_cnt; i++)
+                values[(block + i) * ds_cnt + ds_idx] = ring[i];
+        }
+    }
+    rrd_mask_unwritten(rrd, rra_idx, row, row_cnt, values);
+    ret = 0;
+  out:
+    free(column);
+    return ret;
+}
+
+/* Write row_cnt rows of values to RRA rra_idx from row on, followed by
+ * fill_cnt more copies of the last of them, without wrapping; the
+ * counterpart of rrd_read_rows.
+ *
+ * Returns 0 on success, -1 on error. */
+int rrd_write_rows(
+    rrd_file_t *rrd_file,
+    rrd_t *rrd,
+    unsigned long rra_idx,
+    unsigned long row,
+    unsigned long row_cnt,
+    const rrd_value_t *values,
+    unsigned long fill_cnt)
+{
+    unsigned long ds_cnt = rrd->stat_head->ds_cnt, ds_idx, i;
+    size_t    len = row_cnt * sizeof(rrd_value_t);
+    rrd_value_t *column;
+    int       ret = -1;
+
+    if (row_cnt == 0)
+        return 0;
+    if (rrd->__desc->layout == RRD_LAYOUT_COMPRESSED)
+        return write_blocks(rrd_file, rrd, rra_idx, row, row_cnt, values,
+                            fill_cnt);
+    if (rrd->__desc->layout == RRD_LAYOUT_ROW) {
+        if (rrd_seek(rrd_file, rrd_value_offset(rrd, rra_idx, row, 0),
+                     SEEK_SET) != 0
+            || rrd_write(rrd_file, values, len * ds_cnt)
+            != (ssize_t) (len * ds_cnt)
+            || (fill_cnt > 0
+                && rrd_write_repeat(rrd_file,
+                                    values + (row_cnt - 1) * ds_cnt,
+                                    ds_cnt * sizeof(rrd_value_t), fill_cnt)
+                != (ssize_t) (fill_cnt * ds_cnt * sizeof(rrd_value_t))))
+            return -1;
+        return 0;
+    }
+
+    if ((column = (rrd_value_t *) malloc(len)) == NULL)
+        return -1;
+    for (ds_idx = 0; ds_idx < ds_cnt; ds_idx++) {
+        for (i = 0; i < row_cnt; i++)
+            column[i] = values[i * ds_cnt + ds_idx];
+        if (rrd_seek(rrd_file, rrd_value_offset(rrd, rra_idx, row, ds_idx),
+                     SEEK_SET) != 0
+            || rrd_write(rrd_file, column, len) != (ssize_t) len
+            || (fill_cnt > 0
+                && rrd_write_repeat(rrd_file, &column[row_cnt - 1],
+                                    sizeof(rrd_value_t), fill_cnt)
+                != (ssize_t) (fill_cnt * sizeof(rrd_value_t))))
+            goto out;
+    }
+    ret = 0;
+  out:
+    free(column);
+    return ret;
+}
+
+
 /* this is a leftover from the old days, it serves no purpose
    and is therefore turned into a no-op */
 void rrd_flush(
@@ -1117,6 +1821,7 @@ void rrd_init(
     rrd->rrd_value = NULL;
     rrd->__mmap_start = NULL;
     rrd->__mmap_size = 0;
+    rrd->__desc = NULL;
 }
 
 
@@ -1136,7 +1841,7 @@ static void free_rrd_ptr_if_not_mmapped(
     /* is this ALWAYS correct on all supported platforms ??? */
     long      ofs = (char *) m - (char *) rrd->__mmap_start;
 
-    if (ofs < rrd->__mmap_size) {
+    if (ofs >= 0 && ofs < rrd->__mmap_size) {
         // DO NOT FREE, this memory is mmapped!!
         return;
     }
@@ -1144,6 +1849,35 @@ static void free_rrd_ptr_if_not_mmapped(
     free(m);
 }
 
+/* Read the values of a file whose layout is not RRD_LAYOUT_ROW, or which
+ * is sparse, into rows. */
+static int read_values(
+    rrd_file_t *rrd_file,
+    rrd_t *rrd,
+    unsigned long row_cnt)
+{
+    unsigned long ds_cnt = rrd->stat_head->ds_cnt, i;
+    rrd_value_t *rows, *dst;
+
+    rows = (rrd_value_t *) malloc(row_cnt * ds_cnt * sizeof(rrd_value_t));
+    if (rows == NULL) {
+        rrd_set_error("allocating rrd values");
+        return -1;
+    }
+    dst = rows;
+    for (i = 0; i < rrd->stat_head->rra_cnt; i++) {
+        if (rrd_read_rows(rrd_file, rrd, i, 0, rrd->rra_def[i].row_cnt,
+                          dst) != 0) {
+            rrd_set_error("reading rrd values");
+            free(rows);
+            return -1;
+        }
+        dst += rrd->rra_def[i].row_cnt * ds_cnt;
+    }
+    rrd->rrd_value = rows;
+    return 0;
+}
+
 void rrd_free(
     rrd_t *rrd)
 {
@@ -1166,6 +1900,7 @@ void rrd_free(
     rrd->cdp_prep = NULL;
     free_rrd_ptr_if_not_mmapped(rrd->rrd_value, rrd);
     rrd->rrd_value = NULL;
+    rrd_desc_free(rrd);
 }
 
 /* routine used by external libraries to free memory allocated by
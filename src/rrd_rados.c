@@ -77,6 +77,8 @@ int rrd_rados_close(rrd_rados_t *rrd_rados) {
 
 int rrd_rados_create(const char *oid, rrd_t *rrd) {
     int err;
+    char *packed = NULL;
+    size_t data_len = 0, pos = 0;
 
     rrd_rados_t *rrd_rados = rrd_rados_open(oid);
     if (rrd_rados == NULL)
@@ -100,20 +102,42 @@ int rrd_rados_create(const char *oid, rrd_t *rrd) {
                     sizeof(cdp_prep_t) * rrd->stat_head->rra_cnt * rrd->stat_head->ds_cnt);
     rados_write_op_append(rrd_rados->write_op, (char*)rrd->rra_ptr, sizeof(rra_ptr_t) * rrd->stat_head->rra_cnt);
 
+    /* the values are kept in rows in memory, the write op needs the
+     * packed copy until it is flushed */
+    if (rrd_layout(rrd) != RRD_LAYOUT_ROW) {
+        for (unsigned int i = 0; i < rrd->stat_head->rra_cnt; i++)
+            data_len += rrd_rra_data_size(rrd, i);
+        packed = malloc(data_len);
+        if (packed == NULL) {
+            rrd_set_error("allocating rrd values");
+            rrd_rados_close(rrd_rados);
+            return -1;
+        }
+    }
+
     /* calculate the number of rrd_values to dump */
     int rra_offset = 0;
     for (unsigned int i = 0; i < rrd->stat_head->rra_cnt; i++) {
         unsigned long num_rows = rrd->rra_def[i].row_cnt;
         unsigned long ds_cnt = rrd->stat_head->ds_cnt;
         if (num_rows > 0){
-            rados_write_op_append(rrd_rados->write_op, (char*)(rrd->rrd_value + rra_offset * ds_cnt),
-                                  sizeof(rrd_value_t) * num_rows * ds_cnt);
+            if (packed != NULL) {
+                size_t size = rrd_rra_data_size(rrd, i);
+
+                rrd_pack_rra(rrd, i, rrd->rrd_value + rra_offset * ds_cnt,
+                             packed + pos);
+                rados_write_op_append(rrd_rados->write_op, packed + pos, size);
+                pos += size;
+            } else
+                rados_write_op_append(rrd_rados->write_op, (char*)(rrd->rrd_value + rra_offset * ds_cnt),
+                                      sizeof(rrd_value_t) * num_rows * ds_cnt);
 
             rra_offset += num_rows;
         }
     }
 
     err = rrd_rados_flush(rrd_rados);
+    free(packed);
     if (err < 0)
         rrd_set_error("rados flush: %s", strerror(-err));
 
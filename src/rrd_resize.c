@@ -64,6 +64,20 @@ int rrd_resize(
         return (-1);
     }
 
+    /* the rows are copied in file order below, which only works for
+     * files keeping all the data sources of a row together */
+    if (rrd_layout(&rrdold) != RRD_LAYOUT_ROW) {
+        rrd_set_error("can not resize an RRD with %s layout, "
+                      "use 'rrdtool tune %s RRA#%lu:%c%ld' instead",
+                      rrd_layout(&rrdold) == RRD_LAYOUT_COMPRESSED ?
+                      "compressed" : "column",
+                      infilename, target_rra, modify < 0 ? '-' : '+',
+                      modify < 0 ? -modify : modify);
+        rrd_free(&rrdold);
+        rrd_close(rrd_file);
+        return (-1);
+    }
+
     if (target_rra >= rrdold.stat_head->rra_cnt) {
         rrd_set_error("no such RRA in this RRD");
         rrd_free(&rrdold);
@@ -135,6 +149,10 @@ int rrd_resize(
 
     version = atoi(rrdold.stat_head->version);
     switch (version) {
+    case 6:
+        /* only row layout files get here; SH_sparse_since came along
+         * with the stat_head, rows never written stay unknown */
+    case 5:
     case 4:
         break;        
     case 3:
@@ -15,6 +15,7 @@
 #include "unused.h"
 #include "rrd_strtod.h"
 #include "rrd_create.h"
+#include "rrd_container.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -1114,6 +1115,19 @@ static int parse_tag_rrd(
             status = get_xml_string(reader,
                                           rrd->stat_head->version,
                                           sizeof(rrd->stat_head->version));
+        else if (xmlStrcasecmp(element, (const xmlChar *) "layout") == 0) {
+            char      layout[16];
+
+            status = get_xml_string(reader, layout, sizeof(layout));
+            if (status == 0 && strcmp(layout, "column") == 0)
+                rrd->stat_head->par[SH_layout].u_cnt = RRD_LAYOUT_COLUMN;
+            else if (status == 0 && strcmp(layout, "compressed") == 0)
+                rrd->stat_head->par[SH_layout].u_cnt = RRD_LAYOUT_COMPRESSED;
+            else if (status == 0 && strcmp(layout, "row") != 0) {
+                rrd_set_error("parse_tag_rrd: unknown layout: %s", layout);
+                status = -1;
+            }
+        }
         else if (xmlStrcasecmp(element, (const xmlChar *) "step") == 0)
             status = get_xml_ulong(reader,
                                         &rrd->stat_head->pdp_step);
@@ -1139,6 +1153,26 @@ static int parse_tag_rrd(
         }
         else if (xmlStrcasecmp(element, (const xmlChar *) "/rrd") == 0) {
             xmlFree(element);
+            /* the layout flag is only looked at from version 6 on */
+            if (rrd->stat_head->par[SH_layout].u_cnt != RRD_LAYOUT_ROW
+                && atoi(rrd->stat_head->version) < 6) {
+                unsigned long i;
+
+                /* before version 4 the smoothing window was fixed */
+                if (atoi(rrd->stat_head->version) < 4)
+                    for (i = 0; i < rrd->stat_head->rra_cnt; i++) {
+                        enum cf_en cf = rrd_cf_conv(rrd->rra_def[i].cf_nam);
+
+                        if (cf == CF_SEASONAL || cf == CF_DEVSEASONAL)
+                            rrd->rra_def[i].
+                                par[RRA_seasonal_smoothing_window].u_val =
+                                0.05;
+                    }
+                strcpy(rrd->stat_head->version, RRD_VERSION6);
+            }
+            if (rrd->stat_head->par[SH_layout].u_cnt == RRD_LAYOUT_COMPRESSED)
+                rrd->stat_head->par[SH_block_rows].u_cnt =
+                    rrd_block_rows(rrd);
             return status;
         }
         else {
@@ -1331,6 +1365,9 @@ int write_file(
     }
 #endif
 
+    if (rrd_container_name(file_name))
+        return rrd_member_write(file_name, rrd, opt_force_overwrite == 0);
+
     if (strcmp("-", file_name) == 0)
         fh = stdout;
     else {
@@ -486,6 +486,108 @@ rpnp_t   *rpn_parse(
     return rpnp;
 }
 
+/* the number of values ops that only combine values of the same row take
+ * off the stack, 0 for the other ops */
+static int rpn_row_arity(
+    enum op_en op)
+{
+    switch (op) {
+    case OP_SIN:
+    case OP_COS:
+    case OP_LOG:
+    case OP_EXP:
+    case OP_ATAN:
+    case OP_SQRT:
+    case OP_RAD2DEG:
+    case OP_DEG2RAD:
+    case OP_CEIL:
+    case OP_ROUND:
+    case OP_FLOOR:
+    case OP_ABS:
+    case OP_UN:
+    case OP_ISINF:
+        return 1;
+    case OP_ADD:
+    case OP_ADDNAN:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_MOD:
+    case OP_POW:
+    case OP_ATAN2:
+    case OP_LT:
+    case OP_LE:
+    case OP_GT:
+    case OP_GE:
+    case OP_EQ:
+    case OP_NE:
+    case OP_MIN:
+    case OP_MAX:
+    case OP_MINNAN:
+    case OP_MAXNAN:
+        return 2;
+    case OP_IF:
+    case OP_LIMIT:
+        return 3;
+    default:
+        return 0;
+    }
+}
+
+static int rpn_constant(
+    const rpnp_t *rpnp)
+{
+    return rpnp->op == OP_NUMBER || rpnp->op == OP_UNKN
+        || rpnp->op == OP_INF || rpnp->op == OP_NEGINF;
+}
+
+/* rpn_fold: replace every op that only sees constants, with those
+ * constants, by an OP_NUMBER holding what rpn_calc makes of them.
+ * returns: the number of ops that went away */
+long rpn_fold(
+    rpnp_t *rpnp)
+{
+    rpnp_t    prog[5];
+    rpnstack_t rpnstack;
+    rrd_value_t val;
+    long      r, w, k, arity, folded = 0;
+
+    rpnstack_init(&rpnstack);
+    for (r = w = 0; rpnp[r].op != OP_END; r++) {
+        rpnp[w++] = rpnp[r];
+        arity = rpn_row_arity(rpnp[w - 1].op);
+        if (arity == 0 || w - 1 < arity)
+            continue;
+        for (k = w - 1 - arity; k < w - 1 && rpn_constant(rpnp + k); k++);
+        if (k < w - 1)
+            continue;
+        memcpy(prog, rpnp + w - 1 - arity, (arity + 1) * sizeof(rpnp_t));
+        prog[arity + 1].op = OP_END;
+        if (rpn_calc(prog, &rpnstack, 0, &val, 0, 0) == -1)
+            continue;
+        w -= arity;
+        rpnp[w - 1].op = OP_NUMBER;
+        rpnp[w - 1].val = val;
+        folded += arity;
+    }
+    rpnp[w] = rpnp[r];
+    rpnstack_free(&rpnstack);
+    return folded;
+}
+
+/* rpn_row_only: tells whether the value of the expression in a row only
+ * depends on the values of its variables in the same row */
+int rpn_row_only(
+    const rpnp_t *rpnp)
+{
+    for (; rpnp->op != OP_END; rpnp++)
+        if (!rpn_constant(rpnp) && rpnp->op != OP_VARIABLE
+            && rpnp->op != OP_DUP && rpnp->op != OP_POP
+            && rpnp->op != OP_EXC && rpn_row_arity(rpnp->op) == 0)
+            return 0;
+    return 1;
+}
+
 void rpnstack_init(
     rpnstack_t *rpnstack)
 {
@@ -533,18 +635,206 @@ static int rpn_compare_double(
     if (isnan(*(double *) y))
         return 1;
     /* NaN doesn't reach this part so INF and -INF are extremes.
-     * The sign from isinf() is compatible with the sign we return
+     * An infinite y sorts the other way round than an infinite x.
      */
+    if (*(double *) x == *(double *) y)
+        return 0;
     if (isinf(*(double *) x))
-        return isinf(*(double *) x);
+        return *(double *) x > 0 ? 1 : -1;
     if (isinf(*(double *) y))
-        return isinf(*(double *) y);
+        return *(double *) y > 0 ? -1 : 1;
 
     double    diff = *((const double *) x) - *((const double *) y);
 
     return (diff < 0) ? -1 : (diff > 0) ? 1 : 0;
 }
 
+/* rpn_select: reorder count values without NaN so that values[k] holds
+ * the value a sort would put there, with no bigger value before it and
+ * no smaller one after it. Hoare's selection with a median of three
+ * pivot; should the ranges not shrink, the rest is sorted instead. */
+void rpn_select(
+    double *values,
+    long count,
+    long k)
+{
+    long      lo = 0, hi = count - 1, i, j, rounds = 0;
+    double    pivot, x;
+
+    while (lo < hi) {
+        if (++rounds > 64) {
+            qsort(values + lo, hi - lo + 1, sizeof(double),
+                  rpn_compare_double);
+            return;
+        }
+        i = lo + (hi - lo) / 2;
+        if (values[i] < values[lo]) {
+            x = values[i];
+            values[i] = values[lo];
+            values[lo] = x;
+        }
+        if (values[hi] < values[lo]) {
+            x = values[hi];
+            values[hi] = values[lo];
+            values[lo] = x;
+        }
+        if (values[hi] < values[i]) {
+            x = values[hi];
+            values[hi] = values[i];
+            values[i] = x;
+        }
+        pivot = values[i];
+        i = lo;
+        j = hi;
+        while (i <= j) {
+            while (values[i] < pivot)
+                i++;
+            while (pivot < values[j])
+                j--;
+            if (i <= j) {
+                x = values[i];
+                values[i++] = values[j];
+                values[j--] = x;
+            }
+        }
+        if (k <= j)
+            hi = j;
+        else if (k >= i)
+            lo = i;
+        else
+            return;
+    }
+}
+
+/* the window of a TREND or PREDICT op, kept from one row to the next so
+ * that a row only adds the values entering the window and drops those
+ * leaving it. The sums are rebuilt from scratch once the window has
+ * turned over, which keeps the rounding errors from piling up. */
+typedef struct rpn_window_t {
+    double   *data;     /* data pointer of the variable at the last row */
+    int       output_idx;   /* output_idx of the last row */
+    int       width;    /* TREND: rows in the window, PREDICT: locstep */
+    int       age;      /* rows slid since the sums were rebuilt */
+    int      *shifts;   /* PREDICT: the shifts in rows */
+    int       shift_cnt;
+    int       shift_max;
+    double    sum;      /* sum of the finite values */
+    double    sum2;     /* sum of their squares */
+    long      count;    /* values other than NaN */
+    long      nans;
+    long      pinfs;
+    long      ninfs;
+    double   *sorted;   /* PREDICTPERC: the values other than NaN, in order */
+    long      sorted_max;
+} rpn_window_t;
+
+static void rpn_window_free(
+    void *extra)
+{
+    rpn_window_t *w = (rpn_window_t *) extra;
+
+    free(w->shifts);
+    free(w->sorted);
+    free(w);
+}
+
+static rpn_window_t *rpn_window(
+    rpnp_t *rpnp)
+{
+    if (rpnp->extra == NULL) {
+        rpnp->extra = calloc(1, sizeof(rpn_window_t));
+        if (rpnp->extra == NULL) {
+            rrd_set_error("RPN window: out of memory");
+            return NULL;
+        }
+        rpnp->free_extra = rpn_window_free;
+    }
+    return (rpn_window_t *) rpnp->extra;
+}
+
+static void rpn_window_reset(
+    rpn_window_t *w)
+{
+    w->age = 0;
+    w->sum = 0;
+    w->sum2 = 0;
+    w->count = 0;
+    w->nans = 0;
+    w->pinfs = 0;
+    w->ninfs = 0;
+}
+
+/* add (sign 1) or remove (sign -1) a value; sorted keeps the values of
+ * the window in order as well */
+static int rpn_window_add(
+    rpn_window_t *w,
+    double val,
+    int sign,
+    int sorted)
+{
+    long      lo, hi, mid;
+
+    if (isnan(val)) {
+        w->nans += sign;
+        return 0;
+    }
+    if (isinf(val)) {
+        if (val > 0)
+            w->pinfs += sign;
+        else
+            w->ninfs += sign;
+    } else {
+        w->sum += sign * val;
+        w->sum2 += sign * val * val;
+    }
+    if (sorted) {
+        if (sign > 0 && w->count == w->sorted_max) {
+            long      size = w->sorted_max ? 2 * w->sorted_max : 64;
+            double   *p = (double *) realloc(w->sorted, size * sizeof(double));
+
+            if (p == NULL) {
+                rrd_set_error("RPN window: out of memory");
+                return -1;
+            }
+            w->sorted = p;
+            w->sorted_max = size;
+        }
+        /* the first position not before val; there is no NaN to order */
+        lo = 0;
+        hi = sign > 0 ? w->count : w->count - 1;
+        while (lo < hi) {
+            mid = (lo + hi) / 2;
+            if (w->sorted[mid] < val)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (sign > 0)
+            memmove(w->sorted + lo + 1, w->sorted + lo,
+                    (w->count - lo) * sizeof(double));
+        else
+            memmove(w->sorted + lo, w->sorted + lo + 1,
+                    (w->count - lo - 1) * sizeof(double));
+        if (sign > 0)
+            w->sorted[lo] = val;
+    }
+    w->count += sign;
+    return 0;
+}
+
+/* the average of the values other than NaN */
+static double rpn_window_mean(
+    const rpn_window_t *w)
+{
+    if (w->count == 0 || (w->pinfs > 0 && w->ninfs > 0))
+        return DNAN;
+    if (w->pinfs > 0)
+        return DINF;
+    if (w->ninfs > 0)
+        return -DINF;
+    return w->sum / (double) w->count;
+}
+
 int find_first_weekday(
     void)
 {
@@ -1053,13 +1343,10 @@ short rpn_calc(
             /* the info on the datasource */
             time_t    dsstep = (time_t) rpnp[rpi - 1].step;
             int       dscount = rpnp[rpi - 1].ds_cnt;
+            double   *data = rpnp[rpi - 1].data;
             int       locstep =
                 (int) ceil((float) locstepsize / (float) dsstep);
-
-            /* the sums */
-            double    sum = 0;
-            double    sum2 = 0;
-            int       count = 0;
+            int       perc = (rpnp[rpi].op == OP_PREDICTPERC);
 
             /* now loop for each position */
             int       doshifts = shifts;
@@ -1067,17 +1354,30 @@ short rpn_calc(
             if (shifts < 0) {
                 doshifts = -shifts;
             }
-            /* alloc memory */
-            double   *extra = (double *) rpnp[rpi].extra;
+            rpn_window_t *w = rpn_window(&rpnp[rpi]);
 
-            if (rpnp[rpi].op == OP_PREDICTPERC) {
-                if (!extra) {
-                    int       size = (doshifts + 1) * (locstep + 2);
+            if (w == NULL) {
+                return -1;
+            }
+            if (doshifts > w->shift_max) {
+                int      *p = (int *) realloc(w->shifts,
+                                              doshifts * sizeof(int));
 
-                    rpnp[rpi].extra =
-                        extra = (double *) malloc(sizeof(double) * size);
+                if (p == NULL) {
+                    rrd_set_error("RPN window: out of memory");
+                    return -1;
                 }
+                w->shifts = p;
+                w->shift_max = doshifts;
             }
+            /* the window only slides on when the shifts stay the same */
+            int       slide = (w->data != NULL
+                               && w->shift_cnt == doshifts
+                               && w->width == locstep && locstep >= 0
+                               && w->output_idx + 1 == output_idx
+                               && w->data + dscount == data
+                               && (perc || w->age <= locstep));
+
             /* loop the shifts */
             for (int loop = 0; loop < doshifts; loop++) {
                 /* calculate shift step */
@@ -1094,40 +1394,70 @@ short rpn_calc(
                     return -1;
                 }
                 shiftstep = (int) ceil((float) shiftstep / (float) dsstep);
-                /* loop all local shifts */
-                for (int i = 0; i <= locstep; i++) {
-                    /* now calculate offset into data-array
-                     * - relative to output_idx */
-                    int       offset = shiftstep + i;
-
-                    /* and process if we have index 0 of above */
-                    if ((offset >= 0) && (offset < output_idx)) {
-                        /* get the value */
-                        val = rpnp[rpi - 1].data[-dscount * offset];
-                        /* and handle the non NAN case only */
-                        if (!isnan(val)) {
-                            sum += val;
-                            sum2 += val * val;
-                            if (extra) {
-                                extra[count] = val;
-                            }
-                            count++;
+                if (loop >= w->shift_cnt || w->shifts[loop] != shiftstep) {
+                    slide = 0;
+                }
+                w->shifts[loop] = shiftstep;
+            }
+            w->shift_cnt = doshifts;
+            w->width = locstep;
+            /* the offsets into the data-array, relative to output_idx,
+             * are processed when they lie in [0, output_idx). Going from
+             * one row to the next, each shift's window gains the offset
+             * of the shift and loses the one after its end. */
+            if (slide) {
+                for (int loop = 0; loop < doshifts; loop++) {
+                    int       offset = w->shifts[loop];
+
+                    if (offset < output_idx
+                        && rpn_window_add(w, data[-dscount * offset], 1,
+                                          perc) == -1) {
+                        return -1;
+                    }
+                    offset += locstep + 1;
+                    if (offset < output_idx
+                        && rpn_window_add(w, data[-dscount * offset], -1,
+                                          perc) == -1) {
+                        return -1;
+                    }
+                }
+                w->age++;
+            } else {
+                rpn_window_reset(w);
+                for (int loop = 0; loop < doshifts; loop++) {
+                    /* loop all local shifts */
+                    for (int i = 0; i <= locstep; i++) {
+                        int       offset = w->shifts[loop] + i;
+
+                        if ((offset >= 0) && (offset < output_idx)
+                            && rpn_window_add(w, data[-dscount * offset], 1,
+                                              perc) == -1) {
+                            return -1;
                         }
                     }
                 }
             }
+            w->data = data;
+            w->output_idx = output_idx;
+
+            /* the sums, NaN left out */
+            double    sum = w->sum;
+            double    sum2 = w->sum2;
+            long      count = w->count;
+            double   *extra = w->sorted;
+
             /* do the final calculations */
             val = DNAN;
             switch (rpnp[rpi].op) {
             case OP_PREDICT:
-                if (count > 0) {
-                    val = sum / (double) count;
-                }
+                val = rpn_window_mean(w);
                 break;
             case OP_PREDICTSIGMA:
                 if (count > 1) {    /* the sigma case */
                     val = count * sum2 - sum * sum;
-                    if (val < 0) {
+                    if (w->pinfs > 0 || w->ninfs > 0) {
+                        val = DNAN;
+                    } else if (val < 0) {
                         val = DNAN;
                     } else {
                         val =
@@ -1137,9 +1467,7 @@ short rpn_calc(
                 }
                 break;
             case OP_PREDICTPERC:
-                if ((count > 0) && extra) {
-                    /* sort the numbers */
-                    qsort(extra, count, sizeof(double), rpn_compare_double);
+                if (count > 0) {
                     /* get the percentile selected */
                     double    idxf = percentile * ((float) count - 1.0);
 
@@ -1178,25 +1506,42 @@ short rpn_calc(
 
                 if (output_idx + 1 >= (int) ceil((float) dur / (float) step)) {
                     int       ignorenan = (rpnp[rpi].op == OP_TREND);
-                    double    accum = 0.0;
-                    int       i = -1;   /* pick the current entries, not the next one
-                                           as the data pointer has already been forwarded
-                                           when the OP_VARIABLE was processed */
-                    int       count = 0;
-
-                    do {
-                        double    val =
-                            rpnp[rpi - 2].data[rpnp[rpi - 2].ds_cnt * i--];
-                        if (ignorenan || !isnan(val)) {
-                            accum += val;
-                            ++count;
-                        }
+                    long      ds_cnt = rpnp[rpi - 2].ds_cnt;
+                    double   *data = rpnp[rpi - 2].data;
+
+                    /* the window is the current entry and the ones before,
+                     * at data[-ds_cnt] and below, as the data pointer has
+                     * already been forwarded when the OP_VARIABLE was
+                     * processed */
+                    int       width = dur > 0 ? (dur + step - 1) / step : 1;
+                    rpn_window_t *w = rpn_window(&rpnp[rpi]);
+
+                    if (w == NULL) {
+                        return -1;
+                    }
+                    if (w->data != NULL && w->width == width
+                        && w->data == data) {
+                        /* the data pointer stayed where it was */
+                    } else if (w->data != NULL && w->width == width
+                               && w->data + ds_cnt == data
+                               && w->age < width) {
+                        rpn_window_add(w, data[-ds_cnt], 1, 0);
+                        rpn_window_add(w, data[-ds_cnt * (width + 1)], -1, 0);
+                        w->age++;
+                    } else {
+                        int       i;
 
-                        dur -= step;
-                    } while (dur > 0);
+                        rpn_window_reset(w);
+                        for (i = 1; i <= width; i++) {
+                            rpn_window_add(w, data[-ds_cnt * i], 1, 0);
+                        }
+                    }
+                    w->data = data;
+                    w->width = width;
+                    w->output_idx = output_idx;
 
-                    rpnstack->s[--stptr] =
-                        (count == 0) ? DNAN : (accum / count);
+                    rpnstack->s[--stptr] = (ignorenan && w->nans > 0)
+                        ? DNAN : rpn_window_mean(w);
                 } else
                     rpnstack->s[--stptr] = DNAN;
             }
@@ -1265,16 +1610,23 @@ short rpn_calc(
                     rpnstack->s[++stptr] = DNAN;
                 } else {
                     /* and finally, take the median of the remaining non-NAN
-                     * elements. */
-                    qsort(element_ptr, final_elements, sizeof(double),
-                          rpn_compare_double);
+                     * elements; the lower one of an even count is the
+                     * biggest of those before the upper one. */
+                    int       half = final_elements / 2;
+
+                    rpn_select(element_ptr, final_elements, half);
                     if (final_elements % 2 == 1) {
-                        rpnstack->s[++stptr] =
-                            element_ptr[final_elements / 2];
+                        rpnstack->s[++stptr] = element_ptr[half];
                     } else {
+                        double    lower = element_ptr[0];
+                        int       i;
+
+                        for (i = 1; i < half; i++) {
+                            if (element_ptr[i] > lower)
+                                lower = element_ptr[i];
+                        }
                         rpnstack->s[++stptr] =
-                            0.5 * (element_ptr[final_elements / 2] +
-                                   element_ptr[final_elements / 2 - 1]);
+                            0.5 * (element_ptr[half] + lower);
                     }
                 }
             }
@@ -1317,13 +1669,27 @@ short rpn_calc(
                 }
 
                 stackunderflow(elements - 1);
-                qsort(rpnstack->s + stptr - elements + 1, elements,
-                      sizeof(double), rpn_compare_double);
                 stptr -= elements;
-                rpnstack->s[stptr + 1] =
-                    rpnstack->s[stptr +
-                                (int) round(percent * (double) (elements) /
-                                            100.0)];
+                int       rank =
+                    (int) round(percent * (double) (elements) / 100.0);
+
+                if (rank > 0) {
+                    /* NaN sort first, the rest is selected from */
+                    double   *p = rpnstack->s + stptr + 1;
+                    int       nans = 0, i;
+
+                    for (i = 0; i < elements; i++) {
+                        if (isnan(p[i])) {
+                            p[i] = p[nans];
+                            p[nans++] = DNAN;
+                        }
+                    }
+                    if (rank - 1 >= nans) {
+                        rpn_select(p + nans, elements - nans,
+                                   rank - 1 - nans);
+                    }
+                }
+                rpnstack->s[stptr + 1] = rpnstack->s[stptr + rank];
                 stptr++;
             }
             break;
@@ -1445,6 +1811,353 @@ short rpn_calc(
     return 0;
 }
 
+/* the rows rpn_calc_block runs each op over at once */
+#define RPN_BLOCK 256
+
+/* rpn_calc_block: compute the rows output_idx up to output_idx + rows - 1
+ * of a CDEF at the times data_idx, data_idx + step_width, ... the way
+ * calling rpn_calc for every one of them would, but run each op over a
+ * block of rows before going on to the next op. The stack then holds a
+ * column of RPN_BLOCK values per entry. This only works for expressions
+ * whose ops neither look at earlier rows nor take the number of stack
+ * entries they use from the data; for the others nothing is computed.
+ * returns: -1 if the computation failed (also calls rrd_set_error)
+ *           0 if rpn_calc has to compute the rows
+ *           1 on success
+ */
+short rpn_calc_block(
+    rpnp_t *rpnp,
+    rpnstack_t *rpnstack,
+    long data_idx,
+    rrd_value_t *output,
+    int output_idx,
+    int rows,
+    int step_width)
+{
+    int       rpi;
+    long      depth = 0, max_depth = 0, need, pushed;
+    long      stptr;
+    int       done, n, k;
+    double   *x, *y, *z;
+
+    /* the stack depth before every op is known in advance, which is also
+     * when over- and underflows show */
+    for (rpi = 0; rpnp[rpi].op != OP_END; rpi++) {
+        switch (rpnp[rpi].op) {
+        case OP_VARIABLE:
+            /* rpn_calc complains about VDEFs */
+            if (rpnp[rpi].ds_cnt == 0)
+                return 0;
+            /* fall through */
+        case OP_NUMBER:
+        case OP_STEPWIDTH:
+        case OP_COUNT:
+        case OP_UNKN:
+        case OP_INF:
+        case OP_NEGINF:
+        case OP_TIME:
+            need = 0;
+            pushed = 1;
+            break;
+        case OP_DUP:
+            need = 1;
+            pushed = 2;
+            break;
+        case OP_SIN:
+        case OP_COS:
+        case OP_LOG:
+        case OP_EXP:
+        case OP_ATAN:
+        case OP_SQRT:
+        case OP_RAD2DEG:
+        case OP_DEG2RAD:
+        case OP_CEIL:
+        case OP_ROUND:
+        case OP_FLOOR:
+        case OP_ABS:
+        case OP_UN:
+        case OP_ISINF:
+            need = 1;
+            pushed = 1;
+            break;
+        case OP_POP:
+            need = 1;
+            pushed = 0;
+            break;
+        case OP_EXC:
+            need = 2;
+            pushed = 2;
+            break;
+        case OP_ADD:
+        case OP_ADDNAN:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+        case OP_MOD:
+        case OP_POW:
+        case OP_ATAN2:
+        case OP_LT:
+        case OP_LE:
+        case OP_GT:
+        case OP_GE:
+        case OP_EQ:
+        case OP_NE:
+        case OP_MIN:
+        case OP_MAX:
+        case OP_MINNAN:
+        case OP_MAXNAN:
+            need = 2;
+            pushed = 1;
+            break;
+        case OP_IF:
+        case OP_LIMIT:
+            need = 3;
+            pushed = 1;
+            break;
+        default:
+            return 0;
+        }
+        if (depth < need)
+            return 0;
+        depth += pushed - need;
+        if (depth > max_depth)
+            max_depth = depth;
+    }
+    if (depth != 1)
+        return 0;
+
+    if (rpnstack->dc_stacksize < max_depth * RPN_BLOCK) {
+        double   *s = (double *) rrd_realloc(rpnstack->s,
+                                             max_depth * RPN_BLOCK *
+                                             sizeof(*(rpnstack->s)));
+
+        if (s == NULL) {
+            rrd_set_error("RPN stack overflow");
+            return -1;
+        }
+        rpnstack->s = s;
+        rpnstack->dc_stacksize = max_depth * RPN_BLOCK;
+    }
+#define column(i) (rpnstack->s + (i) * RPN_BLOCK)
+#define unary(expr) \
+	for (x = column(stptr), k = 0; k < n; k++) { \
+	    double a = x[k]; \
+	    x[k] = (expr); \
+	}
+#define binary(expr) \
+	for (x = column(stptr - 1), y = column(stptr), k = 0; k < n; k++) { \
+	    double a = x[k], b = y[k]; \
+	    x[k] = (expr); \
+	} \
+	stptr--;
+
+    for (done = 0; done < rows; done += n) {
+        long      now = data_idx + (long) done * step_width;
+
+        n = rows - done < RPN_BLOCK ? rows - done : RPN_BLOCK;
+        stptr = -1;
+        for (rpi = 0; rpnp[rpi].op != OP_END; rpi++) {
+            switch (rpnp[rpi].op) {
+            case OP_NUMBER:
+                x = column(++stptr);
+                for (k = 0; k < n; k++)
+                    x[k] = rpnp[rpi].val;
+                break;
+            case OP_VARIABLE:
+            {
+                double   *p = rpnp[rpi].data;
+                long      ds_cnt = rpnp[rpi].ds_cnt;
+                long      step = rpnp[rpi].step;
+
+                x = column(++stptr);
+                if (step_width % step == 0 && now % step == 0) {
+                    /* every row moves on to the next one of the DEF */
+                    for (k = 0; k < n; k++)
+                        x[k] = p[k * ds_cnt];
+                    p += n * ds_cnt;
+                } else {
+                    for (k = 0; k < n; k++) {
+                        x[k] = *p;
+                        if ((now + (long) k * step_width) % step == 0)
+                            p += ds_cnt;
+                    }
+                }
+                rpnp[rpi].data = p;
+            }
+                break;
+            case OP_STEPWIDTH:
+                x = column(++stptr);
+                for (k = 0; k < n; k++)
+                    x[k] = step_width;
+                break;
+            case OP_COUNT:
+                x = column(++stptr);
+                for (k = 0; k < n; k++)
+                    x[k] = output_idx + done + k + 1;
+                break;
+            case OP_UNKN:
+                x = column(++stptr);
+                for (k = 0; k < n; k++)
+                    x[k] = DNAN;
+                break;
+            case OP_INF:
+                x = column(++stptr);
+                for (k = 0; k < n; k++)
+                    x[k] = DINF;
+                break;
+            case OP_NEGINF:
+                x = column(++stptr);
+                for (k = 0; k < n; k++)
+                    x[k] = -DINF;
+                break;
+            case OP_TIME:
+                x = column(++stptr);
+                for (k = 0; k < n; k++)
+                    x[k] = (double) (now + (long) k * step_width);
+                break;
+            case OP_DUP:
+                x = column(stptr);
+                y = column(++stptr);
+                memcpy(y, x, n * sizeof(double));
+                break;
+            case OP_POP:
+                stptr--;
+                break;
+            case OP_EXC:
+                for (x = column(stptr - 1), y = column(stptr), k = 0; k < n;
+                     k++) {
+                    double    a = x[k];
+
+                    x[k] = y[k];
+                    y[k] = a;
+                }
+                break;
+            case OP_SIN:
+                unary(sin(a));
+                break;
+            case OP_COS:
+                unary(cos(a));
+                break;
+            case OP_LOG:
+                unary(log(a));
+                break;
+            case OP_EXP:
+                unary(exp(a));
+                break;
+            case OP_ATAN:
+                unary(atan(a));
+                break;
+            case OP_SQRT:
+                unary(sqrt(a));
+                break;
+            case OP_RAD2DEG:
+                unary(57.29577951 * a);
+                break;
+            case OP_DEG2RAD:
+                unary(0.0174532952 * a);
+                break;
+            case OP_CEIL:
+                unary(ceil(a));
+                break;
+            case OP_ROUND:
+                unary(round(a));
+                break;
+            case OP_FLOOR:
+                unary(floor(a));
+                break;
+            case OP_ABS:
+                unary(fabs(a));
+                break;
+            case OP_UN:
+                unary(isnan(a) ? 1.0 : 0.0);
+                break;
+            case OP_ISINF:
+                unary(isinf(a) ? 1.0 : 0.0);
+                break;
+            case OP_ADD:
+                binary(a + b);
+                break;
+            case OP_ADDNAN:
+                binary(isnan(a) ? b : isnan(b) ? a : a + b);
+                break;
+            case OP_SUB:
+                binary(a - b);
+                break;
+            case OP_MUL:
+                binary(a * b);
+                break;
+            case OP_DIV:
+                binary(a / b);
+                break;
+            case OP_MOD:
+                binary(fmod(a, b));
+                break;
+            case OP_POW:
+                binary(pow(a, b));
+                break;
+            case OP_ATAN2:
+                binary(atan2(a, b));
+                break;
+            case OP_LT:
+                binary(isnan(a) ? a : isnan(b) ? b : a < b ? 1.0 : 0.0);
+                break;
+            case OP_LE:
+                binary(isnan(a) ? a : isnan(b) ? b : a <= b ? 1.0 : 0.0);
+                break;
+            case OP_GT:
+                binary(isnan(a) ? a : isnan(b) ? b : a > b ? 1.0 : 0.0);
+                break;
+            case OP_GE:
+                binary(isnan(a) ? a : isnan(b) ? b : a >= b ? 1.0 : 0.0);
+                break;
+            case OP_EQ:
+                binary(isnan(a) ? a : isnan(b) ? b : a == b ? 1.0 : 0.0);
+                break;
+            case OP_NE:
+                binary(isnan(a) ? a : isnan(b) ? b : a == b ? 0.0 : 1.0);
+                break;
+            case OP_MIN:
+                binary(isnan(a) ? a : isnan(b) ? b : a > b ? b : a);
+                break;
+            case OP_MAX:
+                binary(isnan(a) ? a : isnan(b) ? b : a < b ? b : a);
+                break;
+            case OP_MINNAN:
+                binary(isnan(a) ? b : isnan(b) ? a : a > b ? b : a);
+                break;
+            case OP_MAXNAN:
+                binary(isnan(a) ? b : isnan(b) ? a : a < b ? b : a);
+                break;
+            case OP_IF:
+                for (x = column(stptr - 2), y = column(stptr - 1),
+                     z = column(stptr), k = 0; k < n; k++)
+                    x[k] = (isnan(x[k]) || x[k] == 0.0) ? z[k] : y[k];
+                stptr -= 2;
+                break;
+            case OP_LIMIT:
+                for (x = column(stptr - 2), y = column(stptr - 1),
+                     z = column(stptr), k = 0; k < n; k++) {
+                    double    a = x[k];
+
+                    x[k] = isnan(a) ? a : isnan(y[k]) ? y[k]
+                        : isnan(z[k]) ? z[k]
+                        : (a < y[k] || a > z[k]) ? DNAN : a;
+                }
+                stptr -= 2;
+                break;
+            default:
+                /* ruled out above */
+                break;
+            }
+        }
+        memcpy(output + output_idx + done, column(0), n * sizeof(double));
+    }
+#undef binary
+#undef unary
+#undef column
+    return 1;
+}
+
 /* figure out what the local timezone offset for any point in
    time was. Return it in seconds */
 static int tzoffset(
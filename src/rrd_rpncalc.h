@@ -62,6 +62,11 @@ typedef struct rpnstack_t {
     long      dc_stackblock;
 } rpnstack_t;
 
+void      rpn_select(
+    double *values,
+    long count,
+    long k);
+
 void      rpnstack_init(
     rpnstack_t *rpnstack);
 void      rpnstack_free(
@@ -93,6 +98,10 @@ rpnp_t   *rpn_parse(
     const char *const expr,
     long      (*lookup)(void *,
                         char *));
+long      rpn_fold(
+    rpnp_t *rpnp);
+int       rpn_row_only(
+    const rpnp_t *rpnp);
 short     rpn_calc(
     rpnp_t *rpnp,
     rpnstack_t *rpnstack,
@@ -100,6 +109,14 @@ short     rpn_calc(
     rrd_value_t *output,
     int output_idx,
     int step_width);
+short     rpn_calc_block(
+    rpnp_t *rpnp,
+    rpnstack_t *rpnstack,
+    long data_idx,
+    rrd_value_t *output,
+    int output_idx,
+    int rows,
+    int step_width);
 
 int       find_first_weekday(
     void);
@@ -39,6 +39,7 @@ int       ChangeRoot = 0;
 #define TRUE		1
 #define FALSE		0
 #define MAX_LENGTH	10000
+#define FETCH_CHUNK_ROWS	4096
 
 
 static void PrintUsage(
@@ -62,8 +63,8 @@ static void PrintUsage(
     const char *help_list =
         N_
         ("Valid commands: create, update, updatev, graph, graphv,  dump, restore,\n"
-         "\t\tlast, lastupdate, first, info, list, fetch, tune,\n"
-         "\t\tresize, xport, flushcached\n");
+         "\t\tgraphbatch, last, lastupdate, first, info, list, fetch, tune,\n"
+         "\t\tresize, convert, xport, flushcached\n");
 
     const char *help_listremote =
         N_("Valid remote commands: quit, ls, cd, mkdir, pwd\n");
@@ -76,6 +77,8 @@ static void PrintUsage(
            "\t\t[--template|-t template-file]\n"
            "\t\t[--source|-r source-file]\n"
            "\t\t[--no-overwrite|-O]\n"
+           "\t\t[--layout|-L row|column|compressed]\n"
+           "\t\t[--sparse|-S]\n"
            "\t\t[--daemon|-d address]\n"
            "\t\t[DS:ds-name:DST:dst arguments]\n"
            "\t\t[RRA:CF:cf arguments]\n");
@@ -137,7 +140,9 @@ static void PrintUsage(
            "\trrdtool fetch filename.rrd CF\n"
            "\t\t[-r|--resolution resolution]\n"
            "\t\t[-s|--start start] [-e|--end end]\n"
-           "\t\t[-a|--align-start]\n" "\t\t[-d|--daemon <address>]\n");
+           "\t\t[-a|--align-start]\n" "\t\t[-d|--daemon <address>]\n"
+           "\t\t[-c|--columns ds[,ds...]]\n"
+           "\t\t[-m|--max-rows rows] [-R|--reduce cf|minmax|lttb]\n");
 
     const char *help_flushcached =
         N_("* flushcached - flush cached data out to an RRD file\n\n"
@@ -153,6 +158,11 @@ static void PrintUsage(
         N_("* graphv - generate a graph from one or several RRD\n"
            "           with meta data printed before the graph\n\n"
            "\trrdtool graphv filename [-s|--start seconds] [-e|--end seconds]\n");
+    const char *help_graphbatch =
+        N_("* graphbatch - generate several graphs at once, fetching the\n"
+           "               data they share only once\n\n"
+           "\trrdtool graphbatch [-t|--threads count]\n"
+           "\t\tfilename graphv-options ... [:: filename graphv-options ...]\n");
     const char *help_graph1 =
         N_("\t\t[-x|--x-grid x-axis grid and label]\n"
            "\t\t[-Y|--alt-y-grid] [--full-size-mode]\n"
@@ -235,6 +245,11 @@ static void PrintUsage(
         N_
         (" * resize - alter the length of one of the RRAs in an RRD\n\n"
          "\trrdtool resize filename rranum GROW|SHRINK rows\n");
+    const char *help_convert =
+        N_
+        (" * convert - rewrite RRDs created on another architecture\n\n"
+         "\trrdtool convert [--target|-t native|portable|layout]\n"
+         "\t\tfilename [filename ...]\n");
     const char *help_xport =
         N_("* xport - generate XML dump from one or several RRD\n\n"
            "\trrdtool xport [-s|--start seconds] [-e|--end seconds]\n"
@@ -265,8 +280,8 @@ static void PrintUsage(
            "For more information read the RRD manpages\n");
     enum { C_NONE, C_CREATE, C_DUMP, C_INFO, C_LIST, C_RESTORE, C_LAST,
         C_LASTUPDATE, C_FIRST, C_UPDATE, C_FETCH, C_GRAPH, C_GRAPHV,
-        C_TUNE,
-        C_RESIZE, C_XPORT, C_QUIT, C_LS, C_CD, C_MKDIR, C_PWD,
+        C_GRAPHBATCH, C_TUNE,
+        C_RESIZE, C_CONVERT, C_XPORT, C_QUIT, C_LS, C_CD, C_MKDIR, C_PWD,
         C_UPDATEV, C_FLUSHCACHED
     };
     int       help_cmd = C_NONE;
@@ -300,10 +315,14 @@ static void PrintUsage(
             help_cmd = C_GRAPH;
         else if (!strcmp(cmd, "graphv"))
             help_cmd = C_GRAPHV;
+        else if (!strcmp(cmd, "graphbatch"))
+            help_cmd = C_GRAPHBATCH;
         else if (!strcmp(cmd, "tune"))
             help_cmd = C_TUNE;
         else if (!strcmp(cmd, "resize"))
             help_cmd = C_RESIZE;
+        else if (!strcmp(cmd, "convert"))
+            help_cmd = C_CONVERT;
         else if (!strcmp(cmd, "xport"))
             help_cmd = C_XPORT;
         else if (!strcmp(cmd, "quit"))
@@ -378,6 +397,9 @@ static void PrintUsage(
         puts(_(help_graph2));
         puts(_(help_graph3));
         break;
+    case C_GRAPHBATCH:
+        puts(_(help_graphbatch));
+        break;
     case C_TUNE:
         puts(_(help_tune1));
         puts(_(help_tune2));
@@ -386,6 +408,9 @@ static void PrintUsage(
     case C_RESIZE:
         puts(_(help_resize));
         break;
+    case C_CONVERT:
+        puts(_(help_convert));
+        break;
     case C_XPORT:
         puts(_(help_xport));
         break;
@@ -518,6 +543,10 @@ int main(
             }
         }
 
+#ifdef HAVE_RRD_GRAPH
+        /* the graphs of a session share their fonts */
+        rrd_graph_context_use(rrd_graph_context_new());
+#endif
         while (fgetslong(&aLine, stdin)) {
             char     *aLineOrig = aLine;
 
@@ -730,6 +759,8 @@ static int HandleInputLine(
 #endif
     else if (strcmp("resize", argv[1]) == 0)
         rrd_resize(argc - 1, &argv[1]);
+    else if (strcmp("convert", argv[1]) == 0)
+        rrd_convert(argc - 1, &argv[1]);
     else if (strcmp("last", argv[1]) == 0)
 #if SIZEOF_TIME_T == 8    /* in case of __MINGW64__, _WIN64 and _MSC_VER >= 1400 (ifndef _USE_32BIT_TIME_T) */
         printf("%lld\n", rrd_last(argc - 1, &argv[1]));
@@ -749,46 +780,56 @@ static int HandleInputLine(
     else if (strcmp("fetch", argv[1]) == 0) {
         time_t    start, end, ti;
         unsigned long step, ds_cnt, i, ii;
+        long      rows;
         rrd_value_t *data, *datai;
         char    **ds_namv;
+        rrd_fetch_cursor_t *cursor;
 
-        if (rrd_fetch
-            (argc - 1, &argv[1], &start, &end, &step, &ds_cnt, &ds_namv,
-             &data) == 0) {
-            datai = data;
+        if ((cursor = rrd_fetch_cursor
+             (argc - 1, &argv[1], &start, &end, &step, &ds_cnt,
+              &ds_namv)) != NULL) {
             printf("           ");
             for (i = 0; i < ds_cnt; i++)
                 printf("%20s", ds_namv[i]);
             printf("\n\n");
-            for (ti = start + step; ti <= end; ti += step) {
+            data = (rrd_value_t *) malloc(FETCH_CHUNK_ROWS * ds_cnt
+                                          * sizeof(rrd_value_t));
+            if (data == NULL)
+                rrd_set_error("malloc fetch chunk");
+            while (data != NULL
+                   && (rows = rrd_fetch_cursor_next(cursor, FETCH_CHUNK_ROWS,
+                                                    &ti, data)) > 0) {
+                for (datai = data; rows-- > 0; ti += step) {
 #if SIZEOF_TIME_T == 8    /* in case of __MINGW64__, _WIN64 and _MSC_VER >= 1400 (ifndef _USE_32BIT_TIME_T) */
-                printf("%10llu:", ti);
+                    printf("%10llu:", ti);
 #else
-                printf("%10lu:", ti);
+                    printf("%10lu:", ti);
 #endif
-                for (ii = 0; ii < ds_cnt; ii++)
-                    printf(" %0.10e", *(datai++));
-                printf("\n");
+                    for (ii = 0; ii < ds_cnt; ii++)
+                        printf(" %0.10e", *(datai++));
+                    printf("\n");
+                }
             }
             for (i = 0; i < ds_cnt; i++)
                 free(ds_namv[i]);
             free(ds_namv);
             free(data);
+            rrd_fetch_cursor_close(cursor);
         }
     } else if (strcmp("xport", argv[1]) == 0) {
 #ifdef HAVE_RRD_GRAPH
         time_t    start, end;
         unsigned long step, col_cnt;
-        rrd_value_t *data;
         char    **legend_v;
 
+        /* without a place for the data the rows are written as they are
+         * read */
         if(rrd_xport
               (argc - 1, &argv[1], NULL, &start, &end, &step, &col_cnt,
-               &legend_v, &data) == 0) {
+               &legend_v, NULL) == 0) {
           while (col_cnt--)
             free(legend_v[col_cnt]);
           free(legend_v);
-          free(data);
         }
 #else
         rrd_set_error
@@ -845,6 +886,61 @@ static int HandleInputLine(
 #else
         rrd_set_error
             ("the instance of rrdtool has been compiled without graphics");
+#endif
+    } else if (strcmp("graphbatch", argv[1]) == 0) {
+#ifdef HAVE_RRD_GRAPH
+        rrd_graph_job_t *jobs;
+        const char **args;
+        unsigned long job_cnt = 1, i;
+        int       threads = 4;
+        int       first = 2, k;
+
+        if (argc > 3 && (strcmp(argv[2], "--threads") == 0
+                         || strcmp(argv[2], "-t") == 0)) {
+            threads = atoi(argv[3]);
+            first = 4;
+        }
+        for (k = first; k < argc; k++)
+            if (strcmp(argv[k], "::") == 0)
+                job_cnt++;
+        /* every graph gets "graphv" in front and a NULL behind */
+        jobs = (rrd_graph_job_t *) calloc(job_cnt, sizeof(rrd_graph_job_t));
+        args = (const char **) malloc((argc + 2 * job_cnt) * sizeof(char *));
+        if (jobs == NULL || args == NULL) {
+            rrd_set_error("cannot allocate the graph jobs");
+        } else {
+            const char **arg = args;
+
+            i = 0;
+            jobs[0].argv = arg;
+            *arg++ = "graphv";
+            for (k = first; k < argc; k++) {
+                if (strcmp(argv[k], "::") == 0) {
+                    jobs[i].argc = (int) (arg - jobs[i].argv);
+                    *arg++ = NULL;
+                    jobs[++i].argv = arg;
+                    *arg++ = "graphv";
+                } else
+                    *arg++ = argv[k];
+            }
+            jobs[i].argc = (int) (arg - jobs[i].argv);
+            *arg = NULL;
+            rrd_graph_many(jobs, job_cnt, threads);
+            for (i = 0; i < job_cnt; i++) {
+                printf("graph = %lu\n", i);
+                if (jobs[i].info) {
+                    rrd_info_print(jobs[i].info);
+                    rrd_info_free(jobs[i].info);
+                } else if (jobs[i].error)
+                    printf("error = \"%s\"\n", jobs[i].error);
+                free(jobs[i].error);
+            }
+        }
+        free(args);
+        free(jobs);
+#else
+        rrd_set_error
+            ("the instance of rrdtool has been compiled without graphics");
 #endif
     } else if (strcmp("tune", argv[1]) == 0)
         rrd_tune(argc - 1, &argv[1]);
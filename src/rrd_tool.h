@@ -92,6 +92,14 @@ extern    "C" {
         char ***ds_namv,
         rrd_value_t **data);
 
+    int rrd_fetch_plan_r(
+        const char *filename,
+        const char *cf,
+        time_t *start,
+        time_t *end,
+        unsigned long *step,
+        long *rra_idx);
+
 
 #ifdef HAVE_LIBDBI
     int rrd_fetch_fn_libdbi(const char *filename, enum cf_en cf_idx,
@@ -152,9 +160,127 @@ typedef int (*rrd_fetch_cb_t)(
     double    rrd_diff(
     char *a,
     char *b);
+    double    rrd_diff_counter(
+    char *a,
+    char *b);
+    double    rrd_diff_values(
+    double a,
+    double b,
+    int counter);
+
+    ssize_t   rrd_write_repeat(
+    rrd_file_t *rrd_file,
+    const void *buf,
+    size_t size,
+    size_t count);
+    const void *rrd_mapped(
+    rrd_file_t *rrd_file,
+    size_t offset,
+    size_t len);
 
     const char *cf_to_string (enum cf_en cf);
 
+/* The textual DST and CF names in the header are decoded once into this
+ * descriptor so that the update and fetch loops do not have to go through
+ * dst_conv() and rrd_cf_conv() for every DS and RRA they touch. */
+    typedef struct rrd_desc_t {
+        enum dst_en *dst;   /* ds_cnt decoded data source types */
+        enum cf_en *cf;     /* rra_cnt decoded consolidation functions */
+        unsigned long *rra_step;    /* seconds covered by one row of an RRA */
+        size_t   *rra_start;    /* file offset of the first row of each RRA,
+                                 * rra_start[rra_cnt] is the end of the data */
+        unsigned long *ds_input;    /* indices of the DS accepting updates,
+                                     * that is all but the COMPUTE ones */
+        unsigned long ds_input_cnt;
+        int       layout;   /* RRD_LAYOUT_* of the data area */
+        unsigned long block_rows;   /* rows per block, RRD_LAYOUT_COMPRESSED */
+        size_t    block_size;   /* bytes from one block to the next */
+        rrd_value_t *block_cache;   /* the values of the block last
+                                     * unpacked */
+        unsigned long cache_rra, cache_block;   /* which block that is,
+                                                 * cache_rra is rra_cnt
+                                                 * if none */
+    } rrd_desc_t;
+
+    const rrd_desc_t *rrd_get_desc(
+    rrd_t *rrd);
+    void      rrd_desc_free(
+    rrd_t *rrd);
+    int       rrd_layout(
+    const rrd_t *rrd);
+    unsigned long rrd_block_rows(
+    const rrd_t *rrd);
+    size_t    rrd_rra_data_size(
+    const rrd_t *rrd,
+    unsigned long rra_idx);
+    int       rrd_sparse_rra(
+    const rrd_t *rrd,
+    unsigned long rra_idx);
+    unsigned long rrd_rows_written(
+    const rrd_t *rrd,
+    unsigned long rra_idx);
+    void      rrd_mask_unwritten(
+    const rrd_t *rrd,
+    unsigned long rra_idx,
+    unsigned long row,
+    unsigned long row_cnt,
+    rrd_value_t *values);
+    size_t    rrd_value_offset(
+    const rrd_t *rrd,
+    unsigned long rra_idx,
+    unsigned long row,
+    unsigned long ds_idx);
+    void      rrd_transpose_rra(
+    rrd_value_t *dst,
+    const rrd_value_t *src,
+    unsigned long row_cnt,
+    unsigned long ds_cnt,
+    int to_columns);
+    void      rrd_pack_rra(
+    const rrd_t *rrd,
+    unsigned long rra_idx,
+    const rrd_value_t *values,
+    void *data);
+    int       rrd_read_rows(
+    rrd_file_t *rrd_file,
+    rrd_t *rrd,
+    unsigned long rra_idx,
+    unsigned long row,
+    unsigned long row_cnt,
+    rrd_value_t *values);
+    void      rrd_read_ahead(
+    rrd_file_t *rrd_file,
+    rrd_t *rrd,
+    unsigned long rra_idx,
+    unsigned long row,
+    unsigned long row_cnt);
+    int       rrd_write_rows(
+    rrd_file_t *rrd_file,
+    rrd_t *rrd,
+    unsigned long rra_idx,
+    unsigned long row,
+    unsigned long row_cnt,
+    const rrd_value_t *values,
+    unsigned long fill_cnt);
+    int       rrd_seal_block(
+    rrd_file_t *rrd_file,
+    rrd_t *rrd,
+    unsigned long rra_idx,
+    unsigned long row);
+
+/* rrd_jobs.c */
+    typedef void (
+    *rrd_job_fn_t) (
+    void *arg,
+    unsigned long job_idx);
+    int       rrd_run_jobs(
+    const char *const *filenames,
+    unsigned long job_cnt,
+    int threads,
+    int io_concurrency,
+    rrd_job_fn_t fn,
+    void *arg);
+
     int _rrd_lock_default(void);
     int _rrd_lock_from_opt(int *out_flags, const char *opt);
     int _rrd_lock_flags(int extra_flags);
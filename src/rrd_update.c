@@ -13,6 +13,7 @@
 #include <io.h>
 #endif
 
+#include <float.h>
 #include <locale.h>
 #ifdef HAVE_STDINT_H
 #  include <stdint.h>
@@ -29,6 +30,7 @@
 #include <glib.h>
 
 #include "rrd_strtod.h"
+#include "rrd_snprintf.h"
 
 #if defined(_WIN32) && !defined(__CYGWIN__) && !defined(__CYGWIN32__) && !defined(__MINGW32__)
 /* Remark: HAVE_GETTIMEOFDAY could be used here alternatively */
@@ -70,6 +72,12 @@ static int _rrd_updatex(
     const char **argv,
     rrd_info_t *);
 
+static int finish_update(
+    rrd_t *rrd,
+    rrd_file_t *rrd_file,
+    int version,
+    int schedule_smooth);
+
 static int allocate_data_structures(
     rrd_t *rrd,
     char ***updvals,
@@ -91,7 +99,6 @@ static int process_arg(
     char *step_start,
     rrd_t *rrd,
     rrd_file_t *rrd_file,
-    unsigned long rra_begin,
     time_t *current_time,
     unsigned long *current_time_usec,
     rrd_value_t *pdp_temp,
@@ -105,6 +112,59 @@ static int process_arg(
     unsigned long *skip_update,
     int *schedule_smooth);
 
+/* The PDP steps reached by the samples of an rrd_update_bulk_r batch,
+ * queued up to be consolidated into each RRA in one go. */
+typedef struct bulk_steps_t {
+    unsigned long cnt;          /* steps queued */
+    unsigned long max;          /* room for that many */
+    unsigned long *elapsed_pdp_st;  /* PDPs each step closes */
+    unsigned long *proc_pdp_cnt;    /* PDPs done before it */
+    time_t   *time;             /* when it was reached */
+    rrd_value_t *pdp_temp;      /* the new PDPs, ds_cnt for each step */
+    rrd_value_t *rows;          /* RRA rows waiting to be written */
+} bulk_steps_t;
+
+/* values of all DS the queue of PDP steps should hold at most */
+#define BULK_VALUES (1 << 18)
+
+static int process_pdp_new(
+    rrd_t *rrd,
+    rrd_file_t *rrd_file,
+    time_t current_time,
+    unsigned long current_time_usec,
+    double interval,
+    rrd_value_t *pdp_temp,
+    rrd_value_t *pdp_new,
+    unsigned long *rra_step_cnt,
+    rrd_info_t ** pcdp_summary,
+    int version,
+    unsigned long *skip_update,
+    int *schedule_smooth,
+    bulk_steps_t *steps);
+
+static int bulk_batchable(
+    rrd_t *rrd);
+
+static int bulk_steps_alloc(
+    rrd_t *rrd,
+    bulk_steps_t *steps);
+
+static void bulk_steps_free(
+    bulk_steps_t *steps);
+
+static void queue_pdp_st(
+    rrd_t *rrd,
+    bulk_steps_t *steps,
+    unsigned long elapsed_pdp_st,
+    unsigned long proc_pdp_cnt,
+    const rrd_value_t *pdp_temp,
+    time_t step_time);
+
+static int consolidate_steps(
+    rrd_t *rrd,
+    rrd_file_t *rrd_file,
+    bulk_steps_t *steps);
+
 static int parse_ds(
     rrd_t *rrd,
     char **updvals,
@@ -123,12 +183,30 @@ static int get_time_from_reading(
     unsigned long *current_time_usec,
     int version);
 
+static int check_update_time(
+    rrd_t *rrd,
+    time_t current_time,
+    unsigned long current_time_usec);
+
 static int update_pdp_prep(
     rrd_t *rrd,
     char **updvals,
     rrd_value_t *pdp_new,
     double interval);
 
+static int update_pdp_prep_values(
+    rrd_t *rrd,
+    const rrd_value_t *ds_val,
+    rrd_value_t *last_val,
+    char *last_set,
+    rrd_value_t *pdp_new,
+    double interval);
+
+static void flush_last_ds(
+    rrd_t *rrd,
+    const rrd_value_t *last_val,
+    char *last_set);
+
 static int calculate_elapsed_steps(
     rrd_t *rrd,
     unsigned long current_time,
@@ -165,7 +243,6 @@ static int process_pdp_st(
 static int update_all_cdp_prep(
     rrd_t *rrd,
     unsigned long *rra_step_cnt,
-    unsigned long rra_begin,
     rrd_file_t *rrd_file,
     unsigned long elapsed_pdp_st,
     unsigned long proc_pdp_cnt,
@@ -227,7 +304,6 @@ static rrd_value_t calculate_cdp_val(
 static int update_aberrant_cdps(
     rrd_t *rrd,
     rrd_file_t *rrd_file,
-    unsigned long rra_begin,
     unsigned long elapsed_pdp_st,
     rrd_value_t *pdp_temp,
     rrd_value_t **seasonal_coef);
@@ -236,13 +312,30 @@ static int write_to_rras(
     rrd_t *rrd,
     rrd_file_t *rrd_file,
     unsigned long *rra_step_cnt,
-    unsigned long rra_begin,
     time_t current_time,
     unsigned long *skip_update,
     rrd_info_t ** pcdp_summary);
 
-static int write_RRA_row(
+static int write_RRA_steps(
     rrd_file_t *rrd_file,
+    rrd_t *rrd,
+    unsigned long rra_idx,
+    unsigned long first_row,
+    unsigned long step_cnt,
+    const rrd_value_t *staging,
+    time_t current_time);
+
+static int write_RRA_rows(
+    rrd_file_t *rrd_file,
+    rrd_t *rrd,
+    unsigned long rra_idx,
+    unsigned long row,
+    unsigned long row_cnt,
+    const rrd_value_t *values,
+    unsigned long fill_cnt,
+    time_t rra_time);
+
+static int summarize_RRA_row(
     rrd_t *rrd,
     unsigned long rra_idx,
     unsigned short CDP_scratch_idx,
@@ -251,8 +344,7 @@ static int write_RRA_row(
 
 static int smooth_all_rras(
     rrd_t *rrd,
-    rrd_file_t *rrd_file,
-    unsigned long rra_begin);
+    rrd_file_t *rrd_file);
 
 #if !defined(HAVE_MMAP) || defined(HAVE_LIBRADOS)
 static int write_changes_to_disk(
@@ -838,9 +930,6 @@ static int _rrd_updatex(
 
     int       arg_i = 2;
 
-    unsigned long rra_begin;    /* byte pointer to the rra
-                                 * area in the rrd file.  this
-                                 * pointer never changes value */
     rrd_value_t *pdp_new;   /* prepare the incoming data to be added
                              * to the existing entry */
     rrd_value_t *pdp_temp;  /* prepare the pdp values to be added
@@ -876,9 +965,6 @@ static int _rrd_updatex(
     if (rrd_file == NULL) {
         goto err_free;
     }
-    /* We are now at the beginning of the rra's */
-    rra_begin = rrd_file->header_len;
-
     version = atoi(rrd.stat_head->version);
 
     initialize_time(&current_time, &current_time_usec, version);
@@ -896,7 +982,7 @@ static int _rrd_updatex(
             rrd_set_error("failed duplication argv entry");
             break;
         }
-        process_ret = process_arg(arg_copy, &rrd, rrd_file, rra_begin,
+        process_ret = process_arg(arg_copy, &rrd, rrd_file,
                         &current_time, &current_time_usec, pdp_temp, pdp_new,
                         rra_step_cnt, updvals, tmpl_idx, tmpl_cnt,
                         &pcdp_summary, version, skip_update,
@@ -928,31 +1014,184 @@ static int _rrd_updatex(
     if (rrd_test_error()) {
         goto err_free_structures;
     }
-#ifdef HAVE_LIBRADOS
-    if (rrd_file->rados)
-      write_changes_to_disk(&rrd, rrd_file, version);
-#ifndef HAVE_MMAP
-    else
-#endif
-#endif
-#ifndef HAVE_MMAP
-    if (write_changes_to_disk(&rrd, rrd_file, version) == -1) {
+    if (finish_update(&rrd, rrd_file, version, schedule_smooth) == -1) {
         goto err_free_structures;
     }
-#endif
 
-    /* calling the smoothing code here guarantees at most one smoothing
-     * operation per rrd_update call. Unfortunately, it is possible with bulk
-     * updates, or a long-delayed update for smoothing to occur off-schedule.
-     * This really isn't critical except during the burn-in cycles. */
-    if (schedule_smooth) {
-        smooth_all_rras(&rrd, rrd_file, rra_begin);
+/*    rrd_dontneed(rrd_file,&rrd); */
+    rrd_free(&rrd);
+    rrd_close(rrd_file);
+
+    free(pdp_new);
+    free(tmpl_idx);
+    free(pdp_temp);
+    free(skip_update);
+    free(updvals);
+    return 0;
+
+  err_free_structures:
+    free(pdp_new);
+    free(tmpl_idx);
+    free(pdp_temp);
+    free(skip_update);
+    free(updvals);
+  err_close:
+    rrd_close(rrd_file);
+  err_free:
+    rrd_free(&rrd);
+  err_out:
+    return -1;
+}
+
+/*
+ * Update an RRD with a batch of readings that are already numbers.
+ *
+ * values holds one column of sample_cnt readings for each DS named in
+ * tmplt, or for each DS accepting input if tmplt is NULL; stamps holds the
+ * sample_cnt update times. Unknown readings are NaN. The result is the same
+ * as passing the corresponding "time:value:..." strings to rrd_updatex_r,
+ * but without formatting and parsing them.
+ */
+int rrd_update_bulk_r(
+    const char *filename,
+    const char *tmplt,
+    int extra_flags,
+    unsigned long sample_cnt,
+    const time_t *stamps,
+    const rrd_value_t *const *values)
+{
+    rrd_value_t *pdp_new;
+    rrd_value_t *pdp_temp;
+    rrd_value_t *ds_val;    /* readings of the current sample by DS */
+    rrd_value_t *last_val;  /* readings not yet copied to last_ds */
+    char     *last_set;
+    rrd_info_t *pcdp_summary = NULL;
+    long     *tmpl_idx;
+    unsigned long tmpl_cnt = 2;
+    rrd_t     rrd;
+    char    **updvals;
+    int       schedule_smooth = 0;
+    unsigned long *rra_step_cnt = NULL;
+    unsigned long *skip_update;
+    unsigned long sample, ds_idx, i;
+    int       version;
+    rrd_file_t *rrd_file;
+    double    interval;
+    int       ret;
+    bulk_steps_t steps, *queue = NULL;
+
+    if (sample_cnt < 1) {
+        rrd_set_error("Not enough arguments");
+        goto err_out;
+    }
+
+    rrd_init(&rrd);
+    rrd_file = rrd_open(filename, &rrd, RRD_READWRITE |
+                        _rrd_lock_flags(extra_flags));
+    if (rrd_file == NULL) {
+        goto err_free;
+    }
+    version = atoi(rrd.stat_head->version);
+
+    if (allocate_data_structures(&rrd, &updvals,
+                                 &pdp_temp, tmplt, &tmpl_idx, &tmpl_cnt,
+                                 &rra_step_cnt, &skip_update,
+                                 &pdp_new) == -1) {
+        goto err_close;
+    }
+    if ((ds_val = (rrd_value_t *) malloc(sizeof(rrd_value_t) * 2
+                                         * rrd.stat_head->ds_cnt)) == NULL) {
+        rrd_set_error("allocating ds_val.");
+        goto err_free_structures;
+    }
+    last_val = ds_val + rrd.stat_head->ds_cnt;
+    if ((last_set = (char *) calloc(rrd.stat_head->ds_cnt, 1)) == NULL) {
+        rrd_set_error("allocating last_set.");
+        free(ds_val);
+        goto err_free_structures;
+    }
+
+    for (ds_idx = 0; ds_idx < rrd.stat_head->ds_cnt; ds_idx++)
+        ds_val[ds_idx] = DNAN;
+
+    /* unless Holt-Winters or the compressed layout need them to be taken
+     * one by one, the PDP steps are queued and consolidated an RRA at a
+     * time */
+    if (bulk_batchable(&rrd)) {
+        if (bulk_steps_alloc(&rrd, &steps) == -1) {
+            free(last_set);
+            free(ds_val);
+            goto err_free_structures;
+        }
+        queue = &steps;
+    }
+
+    for (sample = 0; sample < sample_cnt; sample++) {
+        /* a sample closes at most two PDP steps */
+        if (queue != NULL && queue->cnt + 2 > queue->max
+            && consolidate_steps(&rrd, rrd_file, queue) == -1)
+            break;
+        ret = check_update_time(&rrd, stamps[sample], 0);
+        if (ret == -2 && (extra_flags & RRD_SKIP_PAST_UPDATES)) {
+            rrd_clear_error();
+            continue;
+        }
+        if (ret == 0) {
+            for (i = 1; i < tmpl_cnt; i++)
+                ds_val[tmpl_idx[i] - 1] = values[i - 1][sample];
+            interval = (double) (stamps[sample] - rrd.live_head->last_up)
+                - (double) ((long) rrd.live_head->last_up_usec) / 1e6f;
+            ret = update_pdp_prep_values(&rrd, ds_val, last_val, last_set,
+                                         pdp_new, interval);
+        }
+        if (ret == 0) {
+            ret = process_pdp_new(&rrd, rrd_file, stamps[sample], 0,
+                                  interval, pdp_temp, pdp_new, rra_step_cnt,
+                                  &pcdp_summary, version, skip_update,
+                                  &schedule_smooth, queue);
+        }
+        if (ret != 0) {
+            char     *save_error;
+
+            /* Prepend file name to error message */
+            if ((save_error = strdup(rrd_get_error())) != NULL) {
+                rrd_set_error("%s: %s", filename, save_error);
+                free(save_error);
+            } else
+                rrd_set_error("error message was lost (out of memory)");
+            break;
+        }
+    }
+
+    /* the samples processed so far are part of the file even if we stop
+     * because of an error */
+    if (queue != NULL) {
+        if (consolidate_steps(&rrd, rrd_file, queue) == -1) {
+            char     *save_error;
+
+            if ((save_error = strdup(rrd_get_error())) != NULL) {
+                rrd_set_error("%s: %s", filename, save_error);
+                free(save_error);
+            } else
+                rrd_set_error("error message was lost (out of memory)");
+        }
+        bulk_steps_free(queue);
+    }
+    flush_last_ds(&rrd, last_val, last_set);
+    free(last_set);
+    free(ds_val);
+
+    if (rrd_test_error()) {
+        goto err_free_structures;
+    }
+    if (finish_update(&rrd, rrd_file, version, schedule_smooth) == -1) {
+        goto err_free_structures;
     }
 
-/*    rrd_dontneed(rrd_file,&rrd); */
     rrd_free(&rrd);
     rrd_close(rrd_file);
 
+    free(rra_step_cnt);
     free(pdp_new);
     free(tmpl_idx);
     free(pdp_temp);
@@ -961,6 +1200,7 @@ static int _rrd_updatex(
     return 0;
 
   err_free_structures:
+    free(rra_step_cnt);
     free(pdp_new);
     free(tmpl_idx);
     free(pdp_temp);
@@ -974,6 +1214,236 @@ static int _rrd_updatex(
     return -1;
 }
 
+/*
+ * Can the PDP steps of a batch be consolidated an RRA at a time? Not with
+ * the Holt-Winters RRAs, which read each other's rows, nor with
+ * RRD_LAYOUT_COMPRESSED, which seals blocks as the current row moves on.
+ */
+static int bulk_batchable(
+    rrd_t *rrd)
+{
+    const rrd_desc_t *desc = rrd->__desc;
+    unsigned long rra_idx;
+
+    if (desc->layout == RRD_LAYOUT_COMPRESSED)
+        return 0;
+    for (rra_idx = 0; rra_idx < rrd->stat_head->rra_cnt; rra_idx++) {
+        switch (desc->cf[rra_idx]) {
+        case CF_HWPREDICT:
+        case CF_MHWPREDICT:
+        case CF_SEASONAL:
+        case CF_DEVSEASONAL:
+        case CF_DEVPREDICT:
+        case CF_FAILURES:
+            return 0;
+        default:
+            break;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Returns 0 on success, -1 on error.
+ */
+static int bulk_steps_alloc(
+    rrd_t *rrd,
+    bulk_steps_t *steps)
+{
+    unsigned long ds_cnt = rrd->stat_head->ds_cnt;
+
+    steps->cnt = 0;
+    steps->max = max(BULK_VALUES / ds_cnt, 16);
+    steps->elapsed_pdp_st = (unsigned long *)
+        malloc(2 * steps->max * sizeof(unsigned long));
+    steps->proc_pdp_cnt = steps->elapsed_pdp_st + steps->max;
+    steps->time = (time_t *) malloc(steps->max * sizeof(time_t));
+    /* each step moves an RRA on by two rows at most, the longer gaps are
+     * written straight away */
+    steps->pdp_temp = (rrd_value_t *)
+        malloc(3 * steps->max * ds_cnt * sizeof(rrd_value_t));
+    steps->rows = steps->pdp_temp + steps->max * ds_cnt;
+    if (steps->elapsed_pdp_st == NULL || steps->time == NULL
+        || steps->pdp_temp == NULL) {
+        bulk_steps_free(steps);
+        rrd_set_error("allocating the PDP step queue");
+        return -1;
+    }
+    return 0;
+}
+
+static void bulk_steps_free(
+    bulk_steps_t *steps)
+{
+    free(steps->elapsed_pdp_st);
+    free(steps->time);
+    free(steps->pdp_temp);
+}
+
+/*
+ * Queue the PDPs in pdp_temp, closing elapsed_pdp_st steps at step_time.
+ */
+static void queue_pdp_st(
+    rrd_t *rrd,
+    bulk_steps_t *steps,
+    unsigned long elapsed_pdp_st,
+    unsigned long proc_pdp_cnt,
+    const rrd_value_t *pdp_temp,
+    time_t step_time)
+{
+    unsigned long ds_cnt = rrd->stat_head->ds_cnt;
+
+    steps->elapsed_pdp_st[steps->cnt] = elapsed_pdp_st;
+    steps->proc_pdp_cnt[steps->cnt] = proc_pdp_cnt;
+    steps->time[steps->cnt] = step_time;
+    memcpy(steps->pdp_temp + steps->cnt * ds_cnt, pdp_temp,
+           ds_cnt * sizeof(rrd_value_t));
+    steps->cnt++;
+}
+
+/*
+ * Consolidate the queued PDP steps into the CDPs of one RRA after the
+ * other, the same way update_all_cdp_prep(), update_aberrant_cdps() and
+ * write_to_rras() do it a step at a time for all of them. The rows of an
+ * RRA are gathered and written in runs as long as the ring allows, only
+ * the gaps longer than two rows are written as they come.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int consolidate_steps(
+    rrd_t *rrd,
+    rrd_file_t *rrd_file,
+    bulk_steps_t *steps)
+{
+    unsigned long ds_cnt = rrd->stat_head->ds_cnt;
+    const rrd_desc_t *desc = rrd->__desc;
+    unsigned long rra_idx, ds_idx, i, j;
+
+    for (rra_idx = 0; rra_idx < rrd->stat_head->rra_cnt; rra_idx++) {
+        rra_def_t *rra_def = &rrd->rra_def[rra_idx];
+        rra_ptr_t *rra_ptr = &rrd->rra_ptr[rra_idx];
+        cdp_prep_t *cdp_prep = &rrd->cdp_prep[rra_idx * ds_cnt];
+        unsigned long pdp_cnt = rra_def->pdp_cnt;
+        unsigned long row_cnt = rra_def->row_cnt;
+        unsigned long rra_step = desc->rra_step[rra_idx];
+        unsigned long elapsed_pdp_st, start_pdp_offset, step_cnt, row;
+        unsigned long run = 0, run_row = 0;
+        time_t    run_time = 0, row_time;
+        const rrd_value_t *pdp_temp;
+
+        for (i = 0; i < steps->cnt; i++) {
+            elapsed_pdp_st = steps->elapsed_pdp_st[i];
+            pdp_temp = steps->pdp_temp + i * ds_cnt;
+            start_pdp_offset = pdp_cnt - steps->proc_pdp_cnt[i] % pdp_cnt;
+            step_cnt = start_pdp_offset <= elapsed_pdp_st
+                ? min((elapsed_pdp_st - start_pdp_offset) / pdp_cnt + 1,
+                      row_cnt) : 0;
+            for (ds_idx = 0; ds_idx < ds_cnt; ds_idx++) {
+                unival   *scratch = cdp_prep[ds_idx].scratch;
+
+                if (pdp_cnt > 1) {
+                    update_cdp(scratch, desc->cf[rra_idx], pdp_temp[ds_idx],
+                               step_cnt, elapsed_pdp_st, start_pdp_offset,
+                               pdp_cnt, rra_def->par[RRA_cdp_xff_val].u_val,
+                               rra_idx, ds_idx);
+                } else {
+                    /* what reset_cdp() and update_aberrant_CF() leave
+                     * behind for the CFs that do not forecast */
+                    scratch[CDP_primary_val].u_val = pdp_temp[ds_idx];
+                    if (elapsed_pdp_st > 1)
+                        scratch[CDP_secondary_val].u_val = pdp_temp[ds_idx];
+                }
+            }
+            if (step_cnt == 0)
+                continue;
+
+            row = (rra_ptr->cur_row + 1) % row_cnt;
+            rra_ptr->cur_row = (rra_ptr->cur_row + step_cnt) % row_cnt;
+            if (step_cnt > 2) {
+                if (run > 0
+                    && write_RRA_rows(rrd_file, rrd, rra_idx, run_row, run,
+                                      steps->rows, 0, run_time) == -1)
+                    return -1;
+                run = 0;
+                for (ds_idx = 0; ds_idx < ds_cnt; ds_idx++) {
+                    steps->rows[ds_idx] =
+                        cdp_prep[ds_idx].scratch[CDP_primary_val].u_val;
+                    steps->rows[ds_cnt + ds_idx] =
+                        cdp_prep[ds_idx].scratch[CDP_secondary_val].u_val;
+                }
+                if (write_RRA_steps(rrd_file, rrd, rra_idx, row, step_cnt,
+                                    steps->rows, steps->time[i]) == -1)
+                    return -1;
+                continue;
+            }
+
+            row_time = steps->time[i] - steps->time[i] % rra_step
+                - (time_t) ((step_cnt - 1) * rra_step);
+            for (j = 0; j < step_cnt; j++) {
+                /* a run ends where the ring wraps around */
+                if (run > 0 && run_row + run != row) {
+                    if (write_RRA_rows(rrd_file, rrd, rra_idx, run_row, run,
+                                       steps->rows, 0, run_time) == -1)
+                        return -1;
+                    run = 0;
+                }
+                if (run == 0) {
+                    run_row = row;
+                    run_time = row_time;
+                }
+                for (ds_idx = 0; ds_idx < ds_cnt; ds_idx++)
+                    steps->rows[run * ds_cnt + ds_idx] =
+                        cdp_prep[ds_idx].scratch[j == 0 ? CDP_primary_val
+                                                 : CDP_secondary_val].u_val;
+                run++;
+                row = (row + 1) % row_cnt;
+                row_time += rra_step;
+            }
+        }
+        if (run > 0
+            && write_RRA_rows(rrd_file, rrd, rra_idx, run_row, run,
+                              steps->rows, 0, run_time) == -1)
+            return -1;
+    }
+    steps->cnt = 0;
+    return 0;
+}
+
+/*
+ * Write the pending changes to disk if the file is not mapped and run the
+ * smoother if it got scheduled during the update.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int finish_update(
+    rrd_t *rrd,
+    rrd_file_t *rrd_file,
+    int version,
+    int schedule_smooth)
+{
+#ifdef HAVE_LIBRADOS
+    if (rrd_file->rados)
+      write_changes_to_disk(rrd, rrd_file, version);
+#ifndef HAVE_MMAP
+    else
+#endif
+#endif
+#ifndef HAVE_MMAP
+    if (write_changes_to_disk(rrd, rrd_file, version) == -1) {
+        return -1;
+    }
+#endif
+
+    /* calling the smoothing code here guarantees at most one smoothing
+     * operation per rrd_update call. Unfortunately, it is possible with bulk
+     * updates, or a long-delayed update for smoothing to occur off-schedule.
+     * This really isn't critical except during the burn-in cycles. */
+    if (schedule_smooth) {
+        smooth_all_rras(rrd, rrd_file);
+    }
+    return 0;
+}
+
 /*
  * Allocate some important arrays used, and initialize the template.
  *
@@ -993,7 +1463,9 @@ static int allocate_data_structures(
     unsigned long **skip_update,
     rrd_value_t **pdp_new)
 {
-    unsigned  i, ii;
+    const rrd_desc_t *desc = rrd->__desc;
+    unsigned long i;
+
     if ((*updvals = (char **) malloc(sizeof(char *)
                                      * (rrd->stat_head->ds_cnt + 1))) == NULL) {
         rrd_set_error("allocating updvals pointer array.");
@@ -1032,11 +1504,9 @@ static int allocate_data_structures(
        tmpl_idx[2] -> 3; (DS 2)
        tmpl_idx[3] -> 4; (DS 3) */
     (*tmpl_idx)[0] = 0; /* time */
-    for (i = 1, ii = 1; i <= rrd->stat_head->ds_cnt; i++) {
-        if (dst_conv(rrd->ds_def[i - 1].dst) != DST_CDEF)
-            (*tmpl_idx)[ii++] = i;
-    }
-    *tmpl_cnt = ii;
+    for (i = 0; i < desc->ds_input_cnt; i++)
+        (*tmpl_idx)[i + 1] = desc->ds_input[i] + 1;
+    *tmpl_cnt = desc->ds_input_cnt + 1;
 
     if (tmplt != NULL) {
         if (parse_template(rrd, tmplt, tmpl_cnt, *tmpl_idx) == -1) {
@@ -1125,7 +1595,6 @@ static int process_arg(
     char *step_start,
     rrd_t *rrd,
     rrd_file_t *rrd_file,
-    unsigned long rra_begin,
     time_t *current_time,
     unsigned long *current_time_usec,
     rrd_value_t *pdp_temp,
@@ -1139,14 +1608,7 @@ static int process_arg(
     unsigned long *skip_update,
     int *schedule_smooth)
 {
-    rrd_value_t *seasonal_coef = NULL, *last_seasonal_coef = NULL;
-
-    /* a vector of future Holt-Winters seasonal coefs */
-    unsigned long elapsed_pdp_st;
-
-    double    interval, pre_int, post_int;  /* interval between this and
-                                             * the last run */
-    unsigned long proc_pdp_cnt;
+    double    interval; /* interval between this and the last run */
     int ds_ret;
     if ((ds_ret = parse_ds(rrd, updvals, tmpl_idx, step_start, tmpl_cnt,
                  current_time, current_time_usec, version)) != 0) {
@@ -1163,9 +1625,46 @@ static int process_arg(
         return -1;
     }
 
+    return process_pdp_new(rrd, rrd_file, *current_time, *current_time_usec,
+                           interval, pdp_temp, pdp_new, rra_step_cnt,
+                           pcdp_summary, version, skip_update,
+                           schedule_smooth, NULL);
+}
+
+/*
+ * Advance the PDPs and CDPs to current_time with the pdp_new values
+ * prepared for this update and write out the finished RRA rows. If steps
+ * is not NULL the finished PDPs are only queued there, consolidate_steps()
+ * takes care of the CDPs and rows.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int process_pdp_new(
+    rrd_t *rrd,
+    rrd_file_t *rrd_file,
+    time_t current_time,
+    unsigned long current_time_usec,
+    double interval,
+    rrd_value_t *pdp_temp,
+    rrd_value_t *pdp_new,
+    unsigned long *rra_step_cnt,
+    rrd_info_t ** pcdp_summary,
+    int version,
+    unsigned long *skip_update,
+    int *schedule_smooth,
+    bulk_steps_t *steps)
+{
+    rrd_value_t *seasonal_coef = NULL, *last_seasonal_coef = NULL;
+
+    /* a vector of future Holt-Winters seasonal coefs */
+    unsigned long elapsed_pdp_st;
+
+    double    pre_int, post_int;
+    unsigned long proc_pdp_cnt;
+
     elapsed_pdp_st = calculate_elapsed_steps(rrd,
-                                             *current_time,
-                                             *current_time_usec, interval,
+                                             current_time,
+                                             current_time_usec, interval,
                                              &pre_int, &post_int,
                                              &proc_pdp_cnt);
 
@@ -1216,28 +1715,25 @@ static int process_arg(
                     return -1;
                 }
 
-                if (update_all_cdp_prep(rrd, rra_step_cnt,
-                                        rra_begin, rrd_file,
-                                        1L,  /* elapsed_pdp_st */
-                                        proc_pdp_cnt,
-                                        &last_seasonal_coef,
-                                        &seasonal_coef,
-                                        pdp_temp,
-                                        skip_update, schedule_smooth) == -1) {
-                    goto err_free_coefficients;
-                }
-
-                if (update_aberrant_cdps(rrd, rrd_file, rra_begin,
-                                         1L, /* elapsed_pdp_st */
-                                         pdp_temp,
-                                         &seasonal_coef) == -1) {
-                    goto err_free_coefficients;
-                }
-
-                if (write_to_rras(rrd, rrd_file, rra_step_cnt, rra_begin,
-                                  (rrd->live_head->last_up + sec_open_pdp), /* left PDP close time */
-                                  skip_update,
-                                  pcdp_summary) == -1) {
+                if (steps != NULL) {
+                    queue_pdp_st(rrd, steps, 1L, proc_pdp_cnt, pdp_temp,
+                                 rrd->live_head->last_up + sec_open_pdp);
+                } else if (update_all_cdp_prep(rrd, rra_step_cnt, rrd_file,
+                                               1L,  /* elapsed_pdp_st */
+                                               proc_pdp_cnt,
+                                               &last_seasonal_coef,
+                                               &seasonal_coef,
+                                               pdp_temp,
+                                               skip_update,
+                                               schedule_smooth) == -1
+                           || update_aberrant_cdps(rrd, rrd_file,
+                                                   1L, /* elapsed_pdp_st */
+                                                   pdp_temp,
+                                                   &seasonal_coef) == -1
+                           || write_to_rras(rrd, rrd_file, rra_step_cnt,
+                                            (rrd->live_head->last_up + sec_open_pdp), /* left PDP close time */
+                                            skip_update,
+                                            pcdp_summary) == -1) {
                     goto err_free_coefficients;
                 }
 
@@ -1257,29 +1753,27 @@ static int process_arg(
                                elapsed_pdp_st, pdp_new, pdp_temp) == -1) {
             return -1;
         }
-        if (update_all_cdp_prep(rrd, rra_step_cnt,
-                                rra_begin, rrd_file,
-                                elapsed_pdp_st,
-                                proc_pdp_cnt,
-                                &last_seasonal_coef,
-                                &seasonal_coef,
-                                pdp_temp,
-                                skip_update, schedule_smooth) == -1) {
-            goto err_free_coefficients;
-        }
-        if (update_aberrant_cdps(rrd, rrd_file, rra_begin,
-                                 elapsed_pdp_st, pdp_temp,
-                                 &seasonal_coef) == -1) {
-            goto err_free_coefficients;
-        }
-        if (write_to_rras(rrd, rrd_file, rra_step_cnt, rra_begin,
-                          *current_time, skip_update,
-                          pcdp_summary) == -1) {
+        if (steps != NULL) {
+            queue_pdp_st(rrd, steps, elapsed_pdp_st, proc_pdp_cnt, pdp_temp,
+                         current_time);
+        } else if (update_all_cdp_prep(rrd, rra_step_cnt, rrd_file,
+                                       elapsed_pdp_st,
+                                       proc_pdp_cnt,
+                                       &last_seasonal_coef,
+                                       &seasonal_coef,
+                                       pdp_temp,
+                                       skip_update, schedule_smooth) == -1
+                   || update_aberrant_cdps(rrd, rrd_file,
+                                           elapsed_pdp_st, pdp_temp,
+                                           &seasonal_coef) == -1
+                   || write_to_rras(rrd, rrd_file, rra_step_cnt,
+                                    current_time, skip_update,
+                                    pcdp_summary) == -1) {
             goto err_free_coefficients;
         }
     }                   /* endif a pdp_st has occurred */
-    rrd->live_head->last_up = *current_time;
-    rrd->live_head->last_up_usec = *current_time_usec;
+    rrd->live_head->last_up = current_time;
+    rrd->live_head->last_up_usec = current_time_usec;
 
     if (version < 3) {
         *rrd->legacy_last_up = rrd->live_head->last_up;
@@ -1413,12 +1907,25 @@ static int get_time_from_reading(
     if (version < 3)
         *current_time_usec = 0;
 
-    if (*current_time < rrd->live_head->last_up ||
-        (*current_time == rrd->live_head->last_up &&
-         (long) *current_time_usec <= (long) rrd->live_head->last_up_usec)) {
+    return check_update_time(rrd, *current_time, *current_time_usec);
+}
+
+/*
+ * Verify that current_time is later than the last update.
+ *
+ * Returns 0 on success, -2 on time stamp error.
+ */
+static int check_update_time(
+    rrd_t *rrd,
+    time_t current_time,
+    unsigned long current_time_usec)
+{
+    if (current_time < rrd->live_head->last_up ||
+        (current_time == rrd->live_head->last_up &&
+         (long) current_time_usec <= (long) rrd->live_head->last_up_usec)) {
         rrd_set_error("illegal attempt to update using time %ld when "
                       "last update time is %ld (minimum one second step)",
-                      *current_time, rrd->live_head->last_up);
+                      current_time, rrd->live_head->last_up);
         return -2;
     }
     return 0;
@@ -1440,9 +1947,10 @@ static int update_pdp_prep(
     int       ii;
     double    rate, newval, oldval;
     enum dst_en dst_idx;
+    const rrd_desc_t *desc = rrd->__desc;
 
     for (ds_idx = 0; ds_idx < rrd->stat_head->ds_cnt; ds_idx++) {
-        dst_idx = dst_conv(rrd->ds_def[ds_idx].dst);
+        dst_idx = desc->dst[ds_idx];
 
         /* make sure we do not build diffs with old last_ds values */
         if (rrd->ds_def[ds_idx].par[DS_mrhb_cnt].u_cnt < interval) {
@@ -1483,19 +1991,15 @@ static int update_pdp_prep(
                 } /* for (ii = 0; updvals[ds_idx + 1][ii] != 0; ii++) */
 
                 if (rrd->pdp_prep[ds_idx].last_ds[0] != 'U') {
-                    pdp_new[ds_idx] =
-                        rrd_diff(updvals[ds_idx + 1],
-                                 rrd->pdp_prep[ds_idx].last_ds);
-                    if (dst_idx == DST_COUNTER) {
-                        /* simple overflow catcher. This will fail
-                         * terribly for non 32 or 64 bit counters
-                         * ... are there any others in SNMP land?
-                         */
-                        if (pdp_new[ds_idx] < (double) 0.0)
-                            pdp_new[ds_idx] += (double) 4294967295.0;   /* 2^32-1 */
-                        if (pdp_new[ds_idx] < (double) 0.0)
-                            pdp_new[ds_idx] += (double) 18446744069414584320.0; /* 2^64-2^32 */
-                    }
+                    /* rrd_diff_counter() has the simple overflow catcher */
+                    if (dst_idx == DST_COUNTER)
+                        pdp_new[ds_idx] =
+                            rrd_diff_counter(updvals[ds_idx + 1],
+                                             rrd->pdp_prep[ds_idx].last_ds);
+                    else
+                        pdp_new[ds_idx] =
+                            rrd_diff(updvals[ds_idx + 1],
+                                     rrd->pdp_prep[ds_idx].last_ds);
                     rate = pdp_new[ds_idx] / interval;
                 } else {
                     pdp_new[ds_idx] = DNAN;
@@ -1591,6 +2095,196 @@ static int update_pdp_prep(
     return 0;
 }
 
+/*
+ * Update pdp_new like update_pdp_prep() does, but from readings that are
+ * already numbers, one per DS with NaN for unknown. Instead of being
+ * formatted into pdp_prep[].last_ds right away, each reading is kept in
+ * last_val with last_set flagging it; flush_last_ds() stores them once the
+ * batch is done.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int update_pdp_prep_values(
+    rrd_t *rrd,
+    const rrd_value_t *ds_val,
+    rrd_value_t *last_val,
+    char *last_set,
+    rrd_value_t *pdp_new,
+    double interval)
+{
+    unsigned long ds_idx;
+    double    rate, newval, oldval;
+    enum dst_en dst_idx;
+    const rrd_desc_t *desc = rrd->__desc;
+
+    for (ds_idx = 0; ds_idx < rrd->stat_head->ds_cnt; ds_idx++) {
+        dst_idx = desc->dst[ds_idx];
+        newval = ds_val[ds_idx];
+
+        /* make sure we do not build diffs with old last_ds values */
+        if (rrd->ds_def[ds_idx].par[DS_mrhb_cnt].u_cnt < interval) {
+            strncpy(rrd->pdp_prep[ds_idx].last_ds, "U", LAST_DS_LEN - 1);
+            rrd->pdp_prep[ds_idx].last_ds[LAST_DS_LEN - 1] = '\0';
+            last_set[ds_idx] = 0;
+        }
+
+        if (!isnan(newval) &&
+            (dst_idx != DST_CDEF) &&
+            rrd->ds_def[ds_idx].par[DS_mrhb_cnt].u_cnt >= interval) {
+            rate = DNAN;
+
+            switch (dst_idx) {
+            case DST_COUNTER:
+            case DST_DERIVE:
+                if (isinf(newval) || newval != floor(newval)
+                    || (dst_idx == DST_COUNTER && newval < 0)) {
+                    rrd_set_error("not a simple %s integer: '%.17g'",
+                                  (dst_idx == DST_DERIVE) ? "signed" : "unsigned",
+                                  newval);
+                    return -1;
+                }
+                /* no negative zero, "-0" is not a valid COUNTER reading */
+                newval += 0.0;
+                if (last_set[ds_idx]) {
+                    pdp_new[ds_idx] =
+                        rrd_diff_values(newval, last_val[ds_idx],
+                                        dst_idx == DST_COUNTER);
+                    rate = pdp_new[ds_idx] / interval;
+                } else if (rrd->pdp_prep[ds_idx].last_ds[0] != 'U') {
+                    char      newval_str[DBL_MAX_10_EXP + 3];
+
+                    snprintf(newval_str, sizeof(newval_str), "%.0f", newval);
+                    if (dst_idx == DST_COUNTER)
+                        pdp_new[ds_idx] =
+                            rrd_diff_counter(newval_str,
+                                             rrd->pdp_prep[ds_idx].last_ds);
+                    else
+                        pdp_new[ds_idx] =
+                            rrd_diff(newval_str,
+                                     rrd->pdp_prep[ds_idx].last_ds);
+                    rate = pdp_new[ds_idx] / interval;
+                } else {
+                    pdp_new[ds_idx] = DNAN;
+                }
+                break;
+            case DST_ABSOLUTE:
+                pdp_new[ds_idx] = newval;
+                rate = pdp_new[ds_idx] / interval;
+                break;
+            case DST_GAUGE:
+                pdp_new[ds_idx] = newval * interval;
+                rate = newval;
+                break;
+            case DST_DCOUNTER:
+            case DST_DDERIVE:
+                if (last_set[ds_idx]) {
+                    oldval = last_val[ds_idx];
+                } else if (rrd->pdp_prep[ds_idx].last_ds[0] != 'U') {
+                    if (rrd_strtodbl(rrd->pdp_prep[ds_idx].last_ds, NULL,
+                                     &oldval,
+                                     dst_idx == DST_DCOUNTER
+                                     ? "Function update_pdp_prep, case DST_DCOUNTER"
+                                     : "Function update_pdp_prep, case DST_DDERIVE")
+                        != 2) {
+                        return -1;
+                    }
+                } else {
+                    pdp_new[ds_idx] = DNAN;
+                    break;
+                }
+                if (dst_idx == DST_DCOUNTER &&
+                    ((newval > 0 && oldval > newval) ||
+                     (newval < 0 && newval > oldval))) {
+                    /* Counter reset detected */
+                    pdp_new[ds_idx] = DNAN;
+                    break;
+                }
+                pdp_new[ds_idx] = newval - oldval;
+                rate = pdp_new[ds_idx] / interval;
+                break;
+            default:
+                rrd_set_error("rrd contains unknown DS type : '%s'",
+                              rrd->ds_def[ds_idx].dst);
+                return -1;
+            }
+            /* make sure pdp_temp is neither too large or too small
+             * if any of these occur it becomes unknown ...
+             * sorry folks ... */
+            if (!isnan(rate) &&
+                ((!isnan(rrd->ds_def[ds_idx].par[DS_max_val].u_val) &&
+                  rate > rrd->ds_def[ds_idx].par[DS_max_val].u_val) ||
+                 (!isnan(rrd->ds_def[ds_idx].par[DS_min_val].u_val) &&
+                  rate < rrd->ds_def[ds_idx].par[DS_min_val].u_val))) {
+                pdp_new[ds_idx] = DNAN;
+            }
+        } else {
+            /* no news is news all the same */
+            pdp_new[ds_idx] = DNAN;
+        }
+
+        /* remember the reading for the next run */
+        if (isnan(newval)) {
+            strncpy(rrd->pdp_prep[ds_idx].last_ds, "U", LAST_DS_LEN - 1);
+            rrd->pdp_prep[ds_idx].last_ds[LAST_DS_LEN - 1] = '\0';
+            last_set[ds_idx] = 0;
+        } else {
+            last_val[ds_idx] = newval;
+            last_set[ds_idx] = 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Store the readings kept back by update_pdp_prep_values() in
+ * pdp_prep[].last_ds. COUNTER and DERIVE readings are written as plain
+ * integers for rrd_diff(); the others in the plain decimal notation update
+ * strings carry, with as few decimals as read back to the same value. Only
+ * readings that do not fit that way fall back to exponent notation.
+ */
+static void flush_last_ds(
+    rrd_t *rrd,
+    const rrd_value_t *last_val,
+    char *last_set)
+{
+    unsigned long ds_idx;
+    enum dst_en dst_idx;
+    char     *last_ds;
+    double    check;
+    int       prec, len;
+
+    for (ds_idx = 0; ds_idx < rrd->stat_head->ds_cnt; ds_idx++) {
+        if (!last_set[ds_idx])
+            continue;
+        last_ds = rrd->pdp_prep[ds_idx].last_ds;
+        dst_idx = rrd->__desc->dst[ds_idx];
+        if (dst_idx == DST_COUNTER || dst_idx == DST_DERIVE) {
+            snprintf(last_ds, LAST_DS_LEN, "%.0f", last_val[ds_idx]);
+            last_set[ds_idx] = 0;
+            continue;
+        }
+        for (prec = 0; prec <= 17; prec++) {
+            len = rrd_snprintf(last_ds, LAST_DS_LEN, "%.*f", prec,
+                               last_val[ds_idx]);
+            if (len < 0 || len >= LAST_DS_LEN)
+                break;
+            if (rrd_strtodbl(last_ds, NULL, &check, NULL) == 2
+                && check == last_val[ds_idx])
+                break;
+        }
+        if (prec > 17 || len < 0 || len >= LAST_DS_LEN) {
+            for (prec = 6; prec <= 17; prec++) {
+                rrd_snprintf(last_ds, LAST_DS_LEN, "%.*g", prec,
+                             last_val[ds_idx]);
+                if (rrd_strtodbl(last_ds, NULL, &check, NULL) == 2
+                    && check == last_val[ds_idx])
+                    break;
+            }
+        }
+        last_set[ds_idx] = 0;
+    }
+}
+
 /*
  * How many PDP steps have elapsed since the last update? Returns the answer,
  * and stores the time between the last update and the last PDP in pre_time,
@@ -1784,7 +2478,7 @@ static int process_pdp_st(
 
     /* process CDEF data sources; remember each CDEF DS can
      * only reference other DS with a lower index number */
-    if (dst_conv(rrd->ds_def[ds_idx].dst) == DST_CDEF) {
+    if (rrd->__desc->dst[ds_idx] == DST_CDEF) {
         rpnp_t   *rpnp;
 
         rpnp =
@@ -1840,7 +2534,6 @@ static int process_pdp_st(
 static int update_all_cdp_prep(
     rrd_t *rrd,
     unsigned long *rra_step_cnt,
-    unsigned long rra_begin,
     rrd_file_t *rrd_file,
     unsigned long elapsed_pdp_st,
     unsigned long proc_pdp_cnt,
@@ -1854,14 +2547,13 @@ static int update_all_cdp_prep(
 
     /* index into the CDP scratch array */
     enum cf_en current_cf;
-    unsigned long rra_start;
+    const rrd_desc_t *desc = rrd->__desc;
 
     /* number of rows to be updated in an RRA for a data value. */
     unsigned long start_pdp_offset;
 
-    rra_start = rra_begin;
     for (rra_idx = 0; rra_idx < rrd->stat_head->rra_cnt; rra_idx++) {
-        current_cf = rrd_cf_conv(rrd->rra_def[rra_idx].cf_nam);
+        current_cf = desc->cf[rra_idx];
         start_pdp_offset =
             rrd->rra_def[rra_idx].pdp_cnt -
             proc_pdp_cnt % rrd->rra_def[rra_idx].pdp_cnt;
@@ -1881,10 +2573,10 @@ static int update_all_cdp_prep(
              * furthermore, HWPREDICT and DEVPREDICT will be set to DNAN. */
             if (rra_step_cnt[rra_idx] > 1) {
                 skip_update[rra_idx] = 1;
-                lookup_seasonal(rrd, rra_idx, rra_start, rrd_file,
-                                elapsed_pdp_st, last_seasonal_coef);
-                lookup_seasonal(rrd, rra_idx, rra_start, rrd_file,
-                                elapsed_pdp_st + 1, seasonal_coef);
+                lookup_seasonal(rrd, rra_idx, desc->rra_start[rra_idx],
+                                rrd_file, elapsed_pdp_st, last_seasonal_coef);
+                lookup_seasonal(rrd, rra_idx, desc->rra_start[rra_idx],
+                                rrd_file, elapsed_pdp_st + 1, seasonal_coef);
             }
             /* periodically run a smoother for seasonal effects */
             if (do_schedule_smooth(rrd, rra_idx, elapsed_pdp_st)) {
@@ -1907,9 +2599,6 @@ static int update_all_cdp_prep(
              current_cf) == -1) {
             return -1;
         }
-        rra_start +=
-            rrd->rra_def[rra_idx].row_cnt * rrd->stat_head->ds_cnt *
-            sizeof(rrd_value_t);
     }
     return 0;
 }
@@ -2276,7 +2965,6 @@ static rrd_value_t calculate_cdp_val(
 static int update_aberrant_cdps(
     rrd_t *rrd,
     rrd_file_t *rrd_file,
-    unsigned long rra_begin,
     unsigned long elapsed_pdp_st,
     rrd_value_t *pdp_temp,
     rrd_value_t **seasonal_coef)
@@ -2287,23 +2975,24 @@ static int update_aberrant_cdps(
      * are assigned to the first CDP to be generated
      * since the last update. */
     unsigned short scratch_idx;
-    unsigned long rra_start;
     enum cf_en current_cf;
+    const rrd_desc_t *desc = rrd->__desc;
 
     /* this loop is only entered if elapsed_pdp_st < 3 */
     for (j = elapsed_pdp_st, scratch_idx = CDP_primary_val;
          j > 0 && j < 3; j--, scratch_idx = CDP_secondary_val) {
-        rra_start = rra_begin;
         for (rra_idx = 0; rra_idx < rrd->stat_head->rra_cnt; rra_idx++) {
             if (rrd->rra_def[rra_idx].pdp_cnt == 1) {
-                current_cf = rrd_cf_conv(rrd->rra_def[rra_idx].cf_nam);
+                current_cf = desc->cf[rra_idx];
                 if (current_cf == CF_SEASONAL || current_cf == CF_DEVSEASONAL) {
                     if (scratch_idx == CDP_primary_val) {
-                        lookup_seasonal(rrd, rra_idx, rra_start, rrd_file,
-                                        elapsed_pdp_st + 1, seasonal_coef);
+                        lookup_seasonal(rrd, rra_idx, desc->rra_start[rra_idx],
+                                        rrd_file, elapsed_pdp_st + 1,
+                                        seasonal_coef);
                     } else {
-                        lookup_seasonal(rrd, rra_idx, rra_start, rrd_file,
-                                        elapsed_pdp_st + 2, seasonal_coef);
+                        lookup_seasonal(rrd, rra_idx, desc->rra_start[rra_idx],
+                                        rrd_file, elapsed_pdp_st + 2,
+                                        seasonal_coef);
                     }
                 }
                 if (rrd_test_error())
@@ -2316,8 +3005,6 @@ static int update_aberrant_cdps(
                                        *seasonal_coef);
                 }
             }
-            rra_start += rrd->rra_def[rra_idx].row_cnt
-                * rrd->stat_head->ds_cnt * sizeof(rrd_value_t);
         }
     }
     return 0;
@@ -2328,95 +3015,176 @@ static int update_aberrant_cdps(
  * architecture divorces the computation of CDP with flushing updated RRA
  * entries to disk.
  *
+ * After a gap all the rows due but the first one hold the same secondary
+ * values, so whatever the length of the gap an RRA costs at most two block
+ * writes (before and after the wrap at row_cnt), the first of them led by
+ * the primary row.
+ *
  * Return 0 on success, -1 on error.
  */
 static int write_to_rras(
     rrd_t *rrd,
     rrd_file_t *rrd_file,
     unsigned long *rra_step_cnt,
-    unsigned long rra_begin,
     time_t current_time,
     unsigned long *skip_update,
     rrd_info_t ** pcdp_summary)
 {
-    unsigned long rra_idx;
-    unsigned long rra_start;
+    unsigned long rra_idx, ds_idx;
     time_t    rra_time = 0; /* time of update for a RRA */
 
     unsigned long ds_cnt = rrd->stat_head->ds_cnt;
+    rrd_value_t *staging, *secondary;
+    const rrd_desc_t *desc = rrd->__desc;
+    int       ret = -1;
+
+    /* the primary row followed by the secondary one */
+    if ((staging = (rrd_value_t *) malloc(2 * ds_cnt * sizeof(rrd_value_t)))
+        == NULL) {
+        rrd_set_error("allocating RRA staging buffer");
+        return -1;
+    }
+    secondary = staging + ds_cnt;
 
     /* Ready to write to disk */
-    rra_start = rra_begin;
-
     for (rra_idx = 0; rra_idx < rrd->stat_head->rra_cnt; rra_idx++) {
         rra_def_t *rra_def = &rrd->rra_def[rra_idx];
         rra_ptr_t *rra_ptr = &rrd->rra_ptr[rra_idx];
+        cdp_prep_t *cdp_prep = &rrd->cdp_prep[rra_idx * ds_cnt];
+        unsigned long step_cnt = rra_step_cnt[rra_idx];
+        unsigned long step, first_row, row;
+
+        if (step_cnt == 0)
+            continue;
+        rra_step_cnt[rra_idx] = 0;
+
+        /* the first step writes the primary values, all further ones the
+         * secondary values */
+        first_row = (rra_ptr->cur_row + 1) % rra_def->row_cnt;
+        row = rra_ptr->cur_row;
+        rra_ptr->cur_row = (rra_ptr->cur_row + step_cnt) % rra_def->row_cnt;
+
+        /* with RRD_LAYOUT_COMPRESSED the block of the old current row
+         * may not be the current one any more */
+        if (rrd_seal_block(rrd_file, rrd, rra_idx, row) == -1)
+            goto out;
 
-        /* for cdp_prep */
-        unsigned short scratch_idx;
-        unsigned long step_subtract;
-
-        for (scratch_idx = CDP_primary_val,
-                 step_subtract = 1;
-             rra_step_cnt[rra_idx] > 0;
-             rra_step_cnt[rra_idx]--,
-                 scratch_idx = CDP_secondary_val,
-                 step_subtract = 2) {
-
-            size_t rra_pos_new;
-#ifdef DEBUG
-            fprintf(stderr, "  -- RRA Preseek %ld\n", rrd_file->pos);
-#endif
-            /* increment, with wrap-around */
-            if (++rra_ptr->cur_row >= rra_def->row_cnt)
-              rra_ptr->cur_row = 0;
-
-            /* we know what our position should be */
-            rra_pos_new = rra_start
-              + ds_cnt * rra_ptr->cur_row * sizeof(rrd_value_t);
-
-            /* re-seek if the position is wrong or we wrapped around */
-            if ((size_t)rra_pos_new != rrd_file->pos) {
-                if (rrd_seek(rrd_file, rra_pos_new, SEEK_SET) != 0) {
-                    rrd_set_error("seek error in rrd");
-                    return -1;
-                }
-            }
-#ifdef DEBUG
-            fprintf(stderr, "  -- RRA Postseek %ld\n", rrd_file->pos);
-#endif
-
-            if (skip_update[rra_idx])
-                continue;
+        if (skip_update[rra_idx])
+            continue;
 
-            if (*pcdp_summary != NULL) {
-                unsigned long step_time = rra_def->pdp_cnt * rrd->stat_head->pdp_step;
+        if (*pcdp_summary != NULL) {
+            unsigned long step_time = desc->rra_step[rra_idx];
 
+            for (step = 0; step < step_cnt; step++) {
                 rra_time = (current_time - current_time % step_time)
-                    - ((rra_step_cnt[rra_idx] - step_subtract) * step_time);
+                    - ((step_cnt - step - (step == 0 ? 1 : 2)) * step_time);
+                if (summarize_RRA_row(rrd, rra_idx,
+                                      step == 0 ? CDP_primary_val
+                                      : CDP_secondary_val,
+                                      pcdp_summary, rra_time) == -1)
+                    goto out;
             }
+        }
 
-            if (write_RRA_row
-                (rrd_file, rrd, rra_idx, scratch_idx,
-                 pcdp_summary, rra_time) == -1)
-                return -1;
-
-            rrd_notify_row(rrd_file, rra_idx, rra_pos_new, rra_time);
+        for (ds_idx = 0; ds_idx < ds_cnt; ds_idx++) {
+            staging[ds_idx] = cdp_prep[ds_idx].scratch[CDP_primary_val].u_val;
+#ifdef DEBUG
+            fprintf(stderr, "  -- RRA WRITE VALUE %e, at row %lu CF:%s\n",
+                    staging[ds_idx], first_row, rra_def->cf_nam);
+#endif
         }
+        if (step_cnt > 1)
+            for (ds_idx = 0; ds_idx < ds_cnt; ds_idx++)
+                secondary[ds_idx] =
+                    cdp_prep[ds_idx].scratch[CDP_secondary_val].u_val;
 
-        rra_start += rra_def->row_cnt * ds_cnt * sizeof(rrd_value_t);
+        if (write_RRA_steps(rrd_file, rrd, rra_idx, first_row, step_cnt,
+                            staging, current_time) == -1)
+            goto out;
     } /* RRA LOOP */
+    ret = 0;
+
+  out:
+    free(staging);
+    return ret;
+}
 
+/*
+ * Write the step_cnt rows an update has moved RRA rra_idx on by, from
+ * first_row on: the primary values in staging for the first, the
+ * secondary ones following them for all others.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int write_RRA_steps(
+    rrd_file_t *rrd_file,
+    rrd_t *rrd,
+    unsigned long rra_idx,
+    unsigned long first_row,
+    unsigned long step_cnt,
+    const rrd_value_t *staging,
+    time_t current_time)
+{
+    unsigned long row_cnt = rrd->rra_def[rra_idx].row_cnt;
+    unsigned long rra_step = rrd->__desc->rra_step[rra_idx];
+    unsigned long step, row, run, head;
+    time_t    rra_time;
+
+    /* rows overwritten later on in this run need not be written */
+    step = step_cnt > row_cnt ? step_cnt - row_cnt : 0;
+    row = (first_row + step) % row_cnt;
+    while (step < step_cnt) {
+        run = min(step_cnt - step, row_cnt - row);
+        head = step == 0 ? min(run, 2) : 1;
+        /* the last row written ends at the current step */
+        rra_time = (current_time - current_time % rra_step)
+            - (time_t) ((step_cnt - 1 - step) * rra_step);
+        if (write_RRA_rows(rrd_file, rrd, rra_idx, row, head,
+                           step == 0 ? staging
+                           : staging + rrd->stat_head->ds_cnt,
+                           run - head, rra_time) == -1)
+            return -1;
+        step += run;
+        row = (row + run) % row_cnt;
+    }
     return 0;
 }
 
 /*
- * Write out one row of values (one value per DS) to the archive.
+ * Write out row_cnt rows of values (one value per DS) starting at row of
+ * the archive, followed by fill_cnt more copies of the last of them. The
+ * first of these rows ends at rra_time.
  *
  * Returns 0 on success, -1 on error.
  */
-static int write_RRA_row(
+static int write_RRA_rows(
     rrd_file_t *rrd_file,
+    rrd_t *rrd,
+    unsigned long rra_idx,
+    unsigned long row,
+    unsigned long row_cnt,
+    const rrd_value_t *values,
+    unsigned long fill_cnt,
+    time_t rra_time)
+{
+    errno = 0;
+    if (rrd_write_rows(rrd_file, rrd, rra_idx, row, row_cnt, values,
+                       fill_cnt) == -1) {
+        rrd_set_error("writing rrd: %s", rrd_strerror(errno));
+        return -1;
+    }
+    /* once for the whole run of consecutive rows */
+    rrd_notify_row(rrd_file, rra_idx,
+                   rrd_value_offset(rrd, rra_idx, row, 0), rra_time);
+    return 0;
+}
+
+/*
+ * Append the values of one row to the update summary.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int summarize_RRA_row(
     rrd_t *rrd,
     unsigned long rra_idx,
     unsigned short CDP_scratch_idx,
@@ -2425,35 +3193,27 @@ static int write_RRA_row(
 {
     unsigned long ds_idx, cdp_idx;
     rrd_infoval_t iv;
-
+    char     *prefix;
+
+    /* the key prefix is the same for all the values of a row */
+    prefix = sprintf_alloc("[%lli]RRA[%s][%lu]", (long long) rra_time,
+                           rrd->rra_def[rra_idx].cf_nam,
+                           rrd->rra_def[rra_idx].pdp_cnt);
+    if (prefix == NULL) {
+        rrd_set_error("allocating update summary");
+        return -1;
+    }
     for (ds_idx = 0; ds_idx < rrd->stat_head->ds_cnt; ds_idx++) {
         /* compute the cdp index */
         cdp_idx = rra_idx * (rrd->stat_head->ds_cnt) + ds_idx;
-#ifdef DEBUG
-        fprintf(stderr, "  -- RRA WRITE VALUE %e, at %ld CF:%s\n",
-                rrd->cdp_prep[cdp_idx].scratch[CDP_scratch_idx].u_val,
-                rrd_file->pos, rrd->rra_def[rra_idx].cf_nam);
-#endif
-        if (*pcdp_summary != NULL) {
-            iv.u_val = rrd->cdp_prep[cdp_idx].scratch[CDP_scratch_idx].u_val;
-            /* append info to the return hash */
-            *pcdp_summary = rrd_info_push(*pcdp_summary,
-                                          sprintf_alloc
-                                          ("[%lli]RRA[%s][%lu]DS[%s]",
-                                           (long long)rra_time,
-                                           rrd->rra_def[rra_idx].cf_nam,
-                                           rrd->rra_def[rra_idx].pdp_cnt,
-                                           rrd->ds_def[ds_idx].ds_nam),
-                                           RD_I_VAL, iv);
-        }
-        errno = 0;
-        if (rrd_write(rrd_file,
-                      &(rrd->cdp_prep[cdp_idx].scratch[CDP_scratch_idx].
-                        u_val), sizeof(rrd_value_t)) != sizeof(rrd_value_t)) {
-            rrd_set_error("writing rrd: %s", rrd_strerror(errno));
-            return -1;
-        }
+        iv.u_val = rrd->cdp_prep[cdp_idx].scratch[CDP_scratch_idx].u_val;
+        /* append info to the return hash */
+        *pcdp_summary = rrd_info_push(*pcdp_summary,
+                                      sprintf_alloc("%sDS[%s]", prefix,
+                                                    rrd->ds_def[ds_idx].
+                                                    ds_nam), RD_I_VAL, iv);
     }
+    free(prefix);
     return 0;
 }
 
@@ -2464,24 +3224,21 @@ static int write_RRA_row(
  */
 static int smooth_all_rras(
     rrd_t *rrd,
-    rrd_file_t *rrd_file,
-    unsigned long rra_begin)
+    rrd_file_t *rrd_file)
 {
-    unsigned long rra_start = rra_begin;
+    const rrd_desc_t *desc = rrd->__desc;
     unsigned long rra_idx;
 
     for (rra_idx = 0; rra_idx < rrd->stat_head->rra_cnt; ++rra_idx) {
-        if (rrd_cf_conv(rrd->rra_def[rra_idx].cf_nam) == CF_DEVSEASONAL ||
-            rrd_cf_conv(rrd->rra_def[rra_idx].cf_nam) == CF_SEASONAL) {
+        if (desc->cf[rra_idx] == CF_DEVSEASONAL ||
+            desc->cf[rra_idx] == CF_SEASONAL) {
 #ifdef DEBUG
             fprintf(stderr, "Running smoother for rra %lu\n", rra_idx);
 #endif
-            apply_smoother(rrd, rra_idx, rra_start, rrd_file);
+            apply_smoother(rrd, rra_idx, desc->rra_start[rra_idx], rrd_file);
             if (rrd_test_error())
                 return -1;
         }
-        rra_start += rrd->rra_def[rra_idx].row_cnt
-            * rrd->stat_head->ds_cnt * sizeof(rrd_value_t);
     }
     return 0;
 }
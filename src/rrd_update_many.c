@@ -0,0 +1,77 @@
+/*****************************************************************************
+ * rrd_update_many.c  Update many RRDs on a pool of threads
+ *****************************************************************************/
+
+#include "rrd_tool.h"
+
+typedef struct update_many_t {
+    const rrd_update_job_t *jobs;
+    rrd_update_status_t *status;
+    int       extra_flags;
+} update_many_t;
+
+static void run_job(
+    void *arg,
+    unsigned long idx)
+{
+    update_many_t *um = (update_many_t *) arg;
+    const rrd_update_job_t *job = um->jobs + idx;
+    rrd_update_status_t *status = um->status + idx;
+
+    rrd_clear_error();
+    status->rc = rrd_updatex_r(job->filename, job->tmplt, um->extra_flags,
+                               job->argc, job->argv);
+    status->error = NULL;
+    if (status->rc != 0) {
+        status->error = strdup(rrd_test_error()? rrd_get_error() :
+                               "update failed");
+        rrd_clear_error();
+    }
+}
+
+/*
+ * Run job_cnt updates on a pool of up to threads threads, see rrd_run_jobs.
+ * status[i] tells how job i went. Returns 0 if all jobs went through and
+ * -1 if any failed or the pool could not be set up, in which case status
+ * is only filled in if all of it could be.
+ */
+int rrd_update_many(
+    const rrd_update_job_t *jobs,
+    unsigned long job_cnt,
+    int threads,
+    int io_concurrency,
+    int extra_flags,
+    rrd_update_status_t *status)
+{
+    update_many_t um;
+    const char **filenames;
+    unsigned long i, failed = 0;
+
+    if (job_cnt == 0)
+        return 0;
+    if ((filenames = (const char **) malloc(job_cnt * sizeof(char *)))
+        == NULL) {
+        rrd_set_error("allocating update jobs");
+        return -1;
+    }
+    for (i = 0; i < job_cnt; i++)
+        filenames[i] = jobs[i].filename;
+    um.jobs = jobs;
+    um.status = status;
+    um.extra_flags = extra_flags;
+    if (rrd_run_jobs(filenames, job_cnt, threads, io_concurrency, run_job,
+                     &um) != 0) {
+        free(filenames);
+        return -1;
+    }
+    free(filenames);
+
+    for (i = 0; i < job_cnt; i++)
+        if (status[i].rc != 0)
+            failed++;
+    if (failed > 0) {
+        rrd_set_error("%lu of %lu updates failed", failed, job_cnt);
+        return -1;
+    }
+    return 0;
+}
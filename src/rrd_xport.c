@@ -32,6 +32,15 @@ static int rrd_xport_fn(
     char ***,
     rrd_value_t **,
     int);
+static int xport_columns(
+    image_desc_t *,
+    time_t *,
+    time_t *,
+    unsigned long *,
+    unsigned long *,
+    char ***,
+    int **,
+    int);
 
 /* helper function for buffer handling */
 typedef struct stringbuffer_t {
@@ -40,6 +49,46 @@ typedef struct stringbuffer_t {
     unsigned char *data;
     FILE     *file;
 } stringbuffer_t;
+
+/* rows read from a DEF at a time when an export is streamed */
+#define XPORT_CHUNK_ROWS 1024
+
+/* a DEF read through a cursor while the export is written */
+typedef struct xport_source_t {
+    long      owner;    /* the gdes whose source reads it, DEFs that fetch
+                         * the same share the one of the first of them */
+    rrd_fetch_cursor_t *cursor;
+    unsigned long ds_cnt;
+    char    **ds_namv;
+    rrd_value_t *chunk; /* XPORT_CHUNK_ROWS rows from the cursor */
+    unsigned long chunk_first;  /* the row of the fetch in chunk[0] */
+    unsigned long chunk_rows;
+    time_t    wish_start;   /* what the DEF asked for, to go back to */
+    time_t    wish_end;     /* if the export cannot be streamed */
+    unsigned long wish_step;
+} xport_source_t;
+
+/* hands the rows of an export to the formatters one after the other,
+ * from data or, when streaming, from the sources of the DEFs */
+typedef struct xport_rows_t {
+    image_desc_t *im;
+    unsigned long col_cnt;
+    rrd_value_t *data;  /* the next row, if all rows are in memory */
+    xport_source_t *sources;    /* one per gdes, only DEFs use theirs */
+    int      *ref_list; /* the gdes of every column */
+    rrd_value_t *row;   /* the row handed out when streaming */
+    time_t    now;      /* start of the next row */
+    unsigned long step;
+} xport_rows_t;
+
+static int xport_stream_open(
+    image_desc_t *,
+    xport_source_t **);
+static void xport_stream_close(
+    image_desc_t *,
+    xport_source_t *);
+static const rrd_value_t *xport_next_row(
+    xport_rows_t *);
 static int addToBuffer(
     stringbuffer_t *,
     char *,
@@ -57,7 +106,7 @@ static int rrd_xport_format_xmljson(
     unsigned long,
     unsigned long,
     char **,
-    rrd_value_t *);
+    xport_rows_t *);
 static int rrd_xport_format_sv(
     char,
     stringbuffer_t *,
@@ -67,7 +116,7 @@ static int rrd_xport_format_sv(
     unsigned long,
     unsigned long,
     char **,
-    rrd_value_t *);
+    xport_rows_t *);
 static int rrd_xport_format_addprints(
     int,
     stringbuffer_t *,
@@ -91,6 +140,10 @@ int rrd_xport(
     rrd_time_value_t start_tv, end_tv;
     char     *parsetime_error = NULL;
     struct optparse options;
+    xport_source_t *sources = NULL;
+    int      *ref_list = NULL;
+    rrd_value_t *all = NULL;
+    int       rc;
 
     optparse_init(&options, argc, argv);
 
@@ -213,7 +266,15 @@ int rrd_xport(
             return status;
     }
 
-    if (rrd_xport_fn(&im, start, end, step, col_cnt, legend_v, data, 0) == -1) {
+    /* with nobody to hand the rows to, write them as they are read */
+    if (xsize == NULL && data == NULL && xport_stream_open(&im, &sources))
+        rc = xport_columns(&im, start, end, step, col_cnt, legend_v,
+                               &ref_list, 0);
+    else
+        rc = rrd_xport_fn(&im, start, end, step, col_cnt, legend_v,
+                              data != NULL ? data : &all, 0);
+    if (rc == -1) {
+        xport_stream_close(&im, sources);
         im_free(&im);
         return -1;
     }
@@ -232,12 +293,37 @@ int rrd_xport(
             flags |= 4;
         }
         stringbuffer_t buffer = { 0, 0, NULL, stdout };
-        rrd_xport_format_xmljson(flags, &buffer, &im,
-                                 *start, *end, *step,
-                                 *col_cnt, *legend_v, *data);
+        xport_rows_t rows = { &im, *col_cnt, data != NULL ? *data : all,
+            sources, ref_list, NULL, *start, *step
+        };
+
+        if (sources != NULL
+            && (rows.row = (rrd_value_t *)
+                malloc(*col_cnt * sizeof(rrd_value_t))) == NULL) {
+            rrd_set_error("malloc xport row");
+            rc = -1;
+        } else
+            rc = rrd_xport_format_xmljson(flags, &buffer, &im,
+                                              *start, *end, *step,
+                                              *col_cnt, *legend_v, &rows);
+        free(rows.row);
     }
 
+    xport_stream_close(&im, sources);
+    free(ref_list);
+    free(all);
     im_free(&im);
+    if (rc != 0) {
+        while ((*col_cnt)--)
+            free((*legend_v)[*col_cnt]);
+        free(*legend_v);
+        *legend_v = NULL;
+        if (data != NULL) {
+            free(*data);
+            *data = NULL;
+        }
+        return -1;
+    }
     return 0;
 }
 
@@ -270,15 +356,11 @@ static int rrd_xport_fn(
     int dolines)
 {                       /* two dimensional array containing the data */
 
-    int       i = 0, j = 0;
+    int       i = 0;
     unsigned long dst_row, row_cnt;
     rrd_value_t *dstptr;
 
-    unsigned long xport_counter = 0;
     int      *ref_list;
-    long     *step_list;
-    long     *step_list_ptr;
-    char    **legend_list;
 
 
     /* pull the data from the rrd files ... */
@@ -289,6 +371,70 @@ static int rrd_xport_fn(
     if (data_calc(im) == -1)
         return -1;
 
+    if (xport_columns(im, start, end, step, col_cnt, legend_v, &ref_list,
+                      dolines) == -1)
+        return -1;
+
+    /* room for rearranged data */
+    /* this is a return value! */
+    row_cnt = ((*end) - (*start)) / (*step);
+    if (((*data) =
+         (rrd_value_t *) malloc((*col_cnt) * row_cnt *
+                                sizeof(rrd_value_t))) == NULL) {
+        free(ref_list);
+        while ((*col_cnt)--)
+            free((*legend_v)[*col_cnt]);
+        free(*legend_v);
+        rrd_set_error("malloc xport data area");
+        return (-1);
+    }
+    dstptr = (*data);
+
+	long unsigned int chosen_idx  = 0;
+
+    /* fill data structure */
+    for (dst_row = 0; (int) dst_row < (int) row_cnt; dst_row++) {
+        for (i = 0; i < (int) (*col_cnt); i++) {
+            long       vidx = im->gdes[ref_list[i]].vidx;
+            time_t     now = *start + dst_row * *step;
+
+            if (im->gdes[vidx].step > 0) {
+                chosen_idx = floor((double) (now - im->gdes[vidx].start) / im->gdes[vidx].step) * im->gdes[vidx].ds_cnt + im->gdes[vidx].ds;
+
+                (*dstptr++) = im->gdes[vidx].data[chosen_idx];
+            }
+        }
+    }
+
+    free(ref_list);
+    return 0;
+
+}
+
+/*
+ * Find the columns of an export, their legends and the step, start and end
+ * that suit the DEFs and CDEFs they show. *ref_list gets the gdes of every
+ * column.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int xport_columns(
+    image_desc_t *im,
+    time_t *start,
+    time_t *end,
+    unsigned long *step,
+    unsigned long *col_cnt,
+    char ***legend_v,
+    int **ref_list_p,
+    int dolines)
+{
+    int       i = 0, j = 0;
+    unsigned long xport_counter = 0;
+    int      *ref_list;
+    long     *step_list;
+    long     *step_list_ptr;
+    char    **legend_list;
+
     /* how many xports or lines/AREA/STACK ? */
     *col_cnt = 0;
     for (i = 0; i < im->gdes_c; i++) {
@@ -365,7 +511,6 @@ static int rrd_xport_fn(
             /* reserve room for one legend entry */
             if ((legend_list[j] = strdup(im->gdes[i].legend)) == NULL) {
                 free(ref_list);
-                *data = NULL;
                 while (--j > -1)
                     free(legend_list[j]);
                 free(legend_list);
@@ -392,41 +537,178 @@ static int rrd_xport_fn(
         *end = *end + *step;
     }
 
-    /* room for rearranged data */
-    /* this is a return value! */
-    row_cnt = ((*end) - (*start)) / (*step);
-    if (((*data) =
-         (rrd_value_t *) malloc((*col_cnt) * row_cnt *
-                                sizeof(rrd_value_t))) == NULL) {
-        free(ref_list);
-        while ((*col_cnt)--)
-            free(legend_list[*col_cnt]);
-        free(legend_list);
-        rrd_set_error("malloc xport data area");
-        return (-1);
+    *legend_v = legend_list;
+    *ref_list_p = ref_list;
+    return 0;
+}
+
+/*
+ * Open a cursor on every DEF of an export that is made of nothing but DEFs
+ * and XPORTs of them, doing the part of data_fetch such an export needs,
+ * so that its rows can be written as they are read instead of all being
+ * fetched first. DEFs that go through rrdcached or would have to be
+ * consolidated to a coarser step are left to data_fetch.
+ *
+ * Returns 1 with *sources set if the export can be streamed, 0 if not.
+ */
+static int xport_stream_open(
+    image_desc_t *im,
+    xport_source_t **sources)
+{
+    xport_source_t *src;
+    unsigned long ft_step, ii;
+    int       i, j;
+
+    *sources = NULL;
+    if (rrdc_is_connected(im->daemon_addr))
+        return 0;
+    for (i = 0; i < im->gdes_c; i++) {
+        if (im->gdes[i].gf == GF_XPORT
+            && im->gdes[im->gdes[i].vidx].gf == GF_DEF)
+            continue;
+        if (im->gdes[i].gf != GF_DEF || im->gdes[i].daemon[0] != '\0')
+            return 0;
     }
-    dstptr = (*data);
 
-	long unsigned int chosen_idx  = 0;
+    if ((*sources = (xport_source_t *)
+         calloc(im->gdes_c + 1, sizeof(xport_source_t))) == NULL)
+        return 0;
+    for (i = 0; i < im->gdes_c; i++) {
+        if (im->gdes[i].gf != GF_DEF)
+            continue;
+        src = *sources + i;
+        src->owner = i;
+        src->wish_start = im->gdes[i].start;
+        src->wish_end = im->gdes[i].end;
+        src->wish_step = ft_step = im->gdes[i].step;
+        for (ii = 0; ii < (unsigned long) i; ii++) {
+            if (im->gdes[ii].gf == GF_DEF
+                && (*sources)[ii].owner == (long) ii
+                && strcmp(im->gdes[ii].rrd, im->gdes[i].rrd) == 0
+                && im->gdes[ii].cf == im->gdes[i].cf
+                && (*sources)[ii].wish_start == src->wish_start
+                && (*sources)[ii].wish_end == src->wish_end
+                && (*sources)[ii].wish_step == src->wish_step)
+                src->owner = ii;
+        }
+        if (src->owner != i) {
+            im->gdes[i].start = im->gdes[src->owner].start;
+            im->gdes[i].end = im->gdes[src->owner].end;
+            im->gdes[i].step = im->gdes[src->owner].step;
+            src = *sources + src->owner;
+        } else {
+            src->cursor = rrd_fetch_cursor_r(im->gdes[i].rrd,
+                                             cf_to_string(im->gdes[i].cf),
+                                             &im->gdes[i].start,
+                                             &im->gdes[i].end, &ft_step, 0,
+                                             &src->ds_cnt, &src->ds_namv);
+            if (src->cursor == NULL
+                || ft_step < max(im->gdes[i].step, im->step))
+                goto fallback;
+            im->gdes[i].step = ft_step;
+            if ((src->chunk = (rrd_value_t *)
+                 malloc(XPORT_CHUNK_ROWS * src->ds_cnt *
+                        sizeof(rrd_value_t))) == NULL)
+                goto fallback;
+        }
+        for (ii = 0; ii < src->ds_cnt; ii++) {
+            if (strcmp(src->ds_namv[ii], im->gdes[i].ds_nam) == 0)
+                im->gdes[i].ds = ii;
+        }
+        if (im->gdes[i].ds == -1)
+            goto fallback;
+    }
+    return 1;
 
-    /* fill data structure */
-    for (dst_row = 0; (int) dst_row < (int) row_cnt; dst_row++) {
-        for (i = 0; i < (int) (*col_cnt); i++) {
-            long       vidx = im->gdes[ref_list[i]].vidx;
-            time_t     now = *start + dst_row * *step;
+  fallback:
+    /* data_fetch starts over and reports what went wrong, if anything */
+    rrd_clear_error();
+    for (j = 0; j <= i; j++) {
+        if (im->gdes[j].gf != GF_DEF)
+            continue;
+        im->gdes[j].start = (*sources)[j].wish_start;
+        im->gdes[j].end = (*sources)[j].wish_end;
+        im->gdes[j].step = (*sources)[j].wish_step;
+        im->gdes[j].ds = -1;
+    }
+    xport_stream_close(im, *sources);
+    *sources = NULL;
+    return 0;
+}
 
-            if (im->gdes[vidx].step > 0) {
-                chosen_idx = floor((double) (now - im->gdes[vidx].start) / im->gdes[vidx].step) * im->gdes[vidx].ds_cnt + im->gdes[vidx].ds;
+static void xport_stream_close(
+    image_desc_t *im,
+    xport_source_t *sources)
+{
+    unsigned long ii;
+    int       i;
 
-                (*dstptr++) = im->gdes[vidx].data[chosen_idx];
-            }
-        }
+    if (sources == NULL)
+        return;
+    for (i = 0; i < im->gdes_c; i++) {
+        if (sources[i].cursor == NULL)
+            continue;
+        rrd_fetch_cursor_close(sources[i].cursor);
+        for (ii = 0; ii < sources[i].ds_cnt; ii++)
+            free(sources[i].ds_namv[ii]);
+        free(sources[i].ds_namv);
+        free(sources[i].chunk);
     }
+    free(sources);
+}
 
-    *legend_v = legend_list;
-    free(ref_list);
+/* value of the DEF gdes read by src for the row that starts at now */
+static int xport_source_value(
+    xport_source_t *src,
+    const graph_desc_t *gdes,
+    time_t now,
+    rrd_value_t *value)
+{
+    unsigned long row;
+    time_t    first;
+    long      n;
+
+    *value = DNAN;
+    if (now < gdes->start)
+        return 0;
+    row = (now - gdes->start) / gdes->step;
+    while (row >= src->chunk_first + src->chunk_rows) {
+        src->chunk_first += src->chunk_rows;
+        n = rrd_fetch_cursor_next(src->cursor, XPORT_CHUNK_ROWS, &first,
+                                  src->chunk);
+        if (n == -1)
+            return -1;
+        src->chunk_rows = n;
+        if (n == 0)
+            return 0;
+    }
+    if (row >= src->chunk_first)
+        *value = src->chunk[(row - src->chunk_first) * src->ds_cnt
+                            + gdes->ds];
     return 0;
+}
 
+/* the next row of an export, or NULL on error */
+static const rrd_value_t *xport_next_row(
+    xport_rows_t *rows)
+{
+    const rrd_value_t *row = rows->data;
+    unsigned long i;
+    long      vidx;
+
+    if (rows->sources == NULL) {
+        rows->data += rows->col_cnt;
+        return row;
+    }
+    for (i = 0; i < rows->col_cnt; i++) {
+        vidx = rows->im->gdes[rows->ref_list[i]].vidx;
+        if (xport_source_value(rows->sources + rows->sources[vidx].owner,
+                               rows->im->gdes + vidx,
+                               rows->now, rows->row + i) == -1)
+            return NULL;
+    }
+    rows->now += rows->step;
+    return rows->row;
 }
 
 int rrd_graph_xport(
@@ -482,35 +764,36 @@ int rrd_graph_xport(
 
     /* format it for output */
     int       r = 0;
+    xport_rows_t rows = { im, col_cnt, data, NULL, NULL, NULL, start, step };
 
     switch (im->imgformat) {
     case IF_XML:
         r = rrd_xport_format_xmljson(2, &buffer, im, start, end, step,
-                                     col_cnt, legend_v, data);
+                                     col_cnt, legend_v, &rows);
         break;
     case IF_XMLENUM:
         r = rrd_xport_format_xmljson(6, &buffer, im, start, end, step,
-                                     col_cnt, legend_v, data);
+                                     col_cnt, legend_v, &rows);
         break;
     case IF_JSON:
         r = rrd_xport_format_xmljson(1, &buffer, im, start, end, step,
-                                     col_cnt, legend_v, data);
+                                     col_cnt, legend_v, &rows);
         break;
     case IF_JSONTIME:
         r = rrd_xport_format_xmljson(3, &buffer, im, start, end, step,
-                                     col_cnt, legend_v, data);
+                                     col_cnt, legend_v, &rows);
         break;
     case IF_CSV:
         r = rrd_xport_format_sv(',', &buffer, im, start, end, step, col_cnt,
-                                legend_v, data);
+                                legend_v, &rows);
         break;
     case IF_TSV:
         r = rrd_xport_format_sv('\t', &buffer, im, start, end, step, col_cnt,
-                                legend_v, data);
+                                legend_v, &rows);
         break;
     case IF_SSV:
         r = rrd_xport_format_sv(';', &buffer, im, start, end, step, col_cnt,
-                                legend_v, data);
+                                legend_v, &rows);
         break;
     default:
         break;
@@ -620,7 +903,7 @@ static int rrd_xport_format_sv(
     unsigned long step,
     unsigned long col_cnt,
     char **legend_v,
-    rrd_value_t *data)
+    xport_rows_t *rows)
 {
     /* define the time format */
     char     *timefmt = NULL;
@@ -661,9 +944,12 @@ static int rrd_xport_format_sv(
         return 1;
     }
     /* and now write the data */
-    rrd_value_t *ptr = data;
+    const rrd_value_t *ptr;
 
     for (time_t ti = start + step; ti <= end; ti += step) {
+        if ((ptr = xport_next_row(rows)) == NULL) {
+            return 1;
+        }
         /* write time */
         if (timefmt) {
             struct tm loc;
@@ -679,9 +965,8 @@ static int rrd_xport_format_sv(
         /* write the columns */
         for (unsigned long i = 0; i < col_cnt; i++) {
             /* get the value */
-            rrd_value_t v = *ptr;
+            rrd_value_t v = ptr[i];
 
-            ptr++;
             /* and print it */
             if (isnan(v)) {
                 snprintf(buf, 255, "%c\"NaN\"", sep);
@@ -711,7 +996,7 @@ static int rrd_xport_format_xmljson(
     unsigned long step,
     unsigned long col_cnt,
     char **legend_v,
-    rrd_value_t *data)
+    xport_rows_t *rows)
 {
 
     /* define some other stuff based on flags */
@@ -756,7 +1041,7 @@ static int rrd_xport_format_xmljson(
     /* avoid calling escapeJSON() with garbage */
     memset(dbuf, 0, sizeof(dbuf));
 
-    rrd_value_t *ptr = data;
+    const rrd_value_t *ptr;
 
     if (json == 0) {
         snprintf(buf, sizeof(buf),
@@ -906,6 +1191,9 @@ static int rrd_xport_format_xmljson(
     addToBuffer(buffer, buf, 0);
     /* iterate over data */
     for (time_t ti = start + step; ti <= end; ti += step) {
+        if ((ptr = xport_next_row(rows)) == NULL) {
+            return -1;
+        }
         if (timefmt) {
             struct tm loc;
 
@@ -934,7 +1222,7 @@ static int rrd_xport_format_xmljson(
         for (unsigned long j = 0; j < col_cnt; j++) {
             rrd_value_t newval = DNAN;
 
-            newval = *ptr;
+            newval = ptr[j];
             if (json) {
                 if (isnan(newval) || isinf(newval)) {
                     addToBuffer(buffer, "null", 0);
@@ -966,7 +1254,6 @@ static int rrd_xport_format_xmljson(
                 }
                 addToBuffer(buffer, buf, 0);
             }
-            ptr++;
         }
         if (json) {
             addToBuffer(buffer,
@@ -0,0 +1,172 @@
+/*
+ * Measure the codec of RRD_LAYOUT_COMPRESSED files. Not run by make check;
+ * build it with "make bench-compress" and run it by hand:
+ *
+ *   ./bench-compress [rows [ds_cnt]]
+ *
+ * The defaults are 524288 rows of 8 DS. Every kind of series fills all DS
+ * of its own run, cut into blocks of the size rrdtool create picks. For
+ * each kind the bytes per point of the sealed blocks, heads included, and
+ * the encode and decode throughput are printed, next to the row layout,
+ * which stores 8 bytes per point and only copies them on a read.
+ */
+/* block_head_t and the block sizes are internal */
+#define RRD_EXPORT_DEPRECATED
+#include "test_helpers.h"
+#include "rrd_compress.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+enum series { FLAT, STATUS, NAN_RUNS, TEMPERATURE, NOISY, SERIES };
+
+static const char *names[SERIES] = {
+	"flat", "status", "NaN runs", "temperature", "noisy counter"
+};
+
+static double now(void)
+{
+	struct timeval	tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* consolidated values as an RRA holds them, row by row */
+static void fill(rrd_value_t *values, enum series kind, unsigned long rows,
+		 unsigned long ds_cnt)
+{
+	unsigned long	row, ds;
+	double		v;
+	int		unknown;
+
+	rnd_seed(42);
+	for (ds = 0; ds < ds_cnt; ds++) {
+		v = 20 + ds;
+		unknown = 0;
+		for (row = 0; row < rows; row++) {
+			switch (kind) {
+			case FLAT:
+				break;
+			case STATUS:
+				if (rnd(500) == 0)
+					v = rnd(4);
+				break;
+			case NAN_RUNS:
+				/* a collector that drops out for hours */
+				if (rnd(unknown ? 300 : 2000) == 0)
+					unknown = !unknown;
+				v = unknown ? DNAN : 100 + rnd(50) / 4.0;
+				break;
+			case TEMPERATURE:
+				/* a sensor of 0.1 degree resolution drifting
+				 * slowly */
+				if (rnd(8) == 0)
+					v = floor(v * 10 + 0.5
+						  + ((long) rnd(3) - 1)) / 10;
+				break;
+			default:
+				v = rnd(1000000) / 60.0;
+				break;
+			}
+			values[row * ds_cnt + ds] = v;
+		}
+	}
+}
+
+static void run(const char *name, const rrd_value_t *values,
+		unsigned long rows, unsigned long ds_cnt, unsigned long block_rows,
+		int raw)
+{
+	unsigned long	blocks = (rows + block_rows - 1) / block_rows;
+	size_t		slot = block_rows * ds_cnt * sizeof(rrd_value_t);
+	block_head_t	*heads = malloc(blocks * sizeof(block_head_t));
+	unsigned char	*data = malloc(blocks * slot);
+	rrd_value_t	*out = malloc(block_rows * ds_cnt * sizeof(rrd_value_t));
+	double		bytes = (double) rows * ds_cnt * sizeof(rrd_value_t);
+	double		stored = 0, start, encode, decode;
+	unsigned long	b, cnt;
+	int		i, loops;
+
+	if (heads == NULL || data == NULL || out == NULL)
+		fail("malloc", __LINE__);
+	/* keep the page faults out of the timing */
+	memset(data, 0, blocks * slot);
+
+	start = now();
+	for (b = 0; b < blocks; b++) {
+		cnt = rows - b * block_rows < block_rows
+			? rows - b * block_rows : block_rows;
+		rrd_block_pack(values + b * block_rows * ds_cnt, cnt, ds_cnt,
+			       raw, heads + b, data + b * slot);
+		stored += heads[b].len + (raw ? 0 : sizeof(block_head_t));
+	}
+	encode = now() - start;
+
+	for (b = 0; b < blocks; b++) {
+		cnt = rows - b * block_rows < block_rows
+			? rows - b * block_rows : block_rows;
+		if (rrd_block_unpack(heads + b, data + b * slot, cnt, ds_cnt,
+				     out) != 0)
+			fail("rrd_block_unpack", __LINE__);
+		if (memcmp(out, values + b * block_rows * ds_cnt,
+			   cnt * ds_cnt * sizeof(rrd_value_t)) != 0)
+			fail("decoded block differs", __LINE__);
+	}
+
+	/* decoding the raw blocks is fast, repeat it to get a reading */
+	loops = raw ? 20 : 3;
+	start = now();
+	for (i = 0; i < loops; i++) {
+		for (b = 0; b < blocks; b++) {
+			cnt = rows - b * block_rows < block_rows
+				? rows - b * block_rows : block_rows;
+			rrd_block_unpack(heads + b, data + b * slot, cnt,
+					 ds_cnt, out);
+		}
+	}
+	decode = (now() - start) / loops;
+
+	printf("%-14s %-10s %6.2f bytes/point  encode %6.2f GB/s  "
+	       "decode %6.2f GB/s\n", name, raw ? "row" : "compressed",
+	       stored / ((double) rows * ds_cnt), bytes / encode / 1e9,
+	       bytes / decode / 1e9);
+	free(heads);
+	free(data);
+	free(out);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long	rows = argc > 1 ? strtoul(argv[1], NULL, 10) : 524288;
+	unsigned long	ds_cnt = argc > 2 ? strtoul(argv[2], NULL, 10) : 8;
+	unsigned long	row_size, block_rows;
+	rrd_value_t	*values;
+	int		kind;
+
+	if (rows < 1 || ds_cnt < 1) {
+		fprintf(stderr, "usage: %s [rows [ds_cnt]]\n", argv[0]);
+		return 1;
+	}
+	/* what rrd_block_rows picks for a new file */
+	row_size = ds_cnt * sizeof(rrd_value_t);
+	block_rows = (RRD_BLOCK_BYTES + row_size - 1) / row_size;
+	if (block_rows < RRD_BLOCK_ROWS)
+		block_rows = RRD_BLOCK_ROWS;
+
+	values = malloc(rows * ds_cnt * sizeof(rrd_value_t));
+	if (values == NULL)
+		fail("malloc", __LINE__);
+	printf("%lu rows of %lu DS, %lu rows per block\n", rows, ds_cnt,
+	       block_rows);
+	for (kind = 0; kind < SERIES; kind++) {
+		fill(values, kind, rows, ds_cnt);
+		run(names[kind], values, rows, ds_cnt, block_rows, 0);
+		run(names[kind], values, rows, ds_cnt, block_rows, 1);
+	}
+	free(values);
+	return 0;
+}
@@ -0,0 +1,137 @@
+/*
+ * Time rrd_xport of the RPN operators that work over a window of rows,
+ * TREND and the PREDICT family. Not run by make check; build it with
+ * "make bench-rpn-window" in a build with graphs and run it by hand:
+ *
+ *   ./bench-rpn-window [rows [runs]]
+ *
+ * The defaults are 100000 one minute rows and the best of 3 runs. The
+ * RRD holds a week more than that, for the shifted windows of PREDICT to
+ * look back on, with a daily cycle, some noise and a few runs of unknown
+ * values.
+ */
+#include "test_helpers.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#define STEP	60
+#define HISTORY	(7 * 1440)
+#define BATCH	1000
+
+static const char *file = "bench-rpn-window.rrd";
+
+static const char *exprs[] = {
+	"a,86400,TREND",
+	"a,3600,TRENDNAN",
+	"86400,-7,1800,a,PREDICT",
+	"86400,-7,1800,a,PREDICTSIGMA",
+	"86400,-7,1800,95,a,PREDICTPERC",
+	"86400,-4,7200,95,a,PREDICTPERC",
+};
+
+static double now(void)
+{
+	struct timeval	tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void fill(long rows)
+{
+	char		args[BATCH][48];
+	const char	*argv[BATCH];
+	char		rra[48];
+	const char	*create_argv[] = { "DS:a:GAUGE:120:U:U", rra };
+	long		i, n;
+	int		j;
+
+	sprintf(rra, "RRA:AVERAGE:0.5:1:%ld", rows + HISTORY + 10);
+	remove(file);
+	if (rrd_create_r2(file, STEP, TEST_START - STEP, 0, NULL, NULL, 2,
+			  create_argv) != 0)
+		fail("rrd_create_r2", __LINE__);
+	rnd_seed(42);
+	for (i = 0; i < rows + HISTORY; i += n) {
+		n = rows + HISTORY - i < BATCH ? rows + HISTORY - i : BATCH;
+		for (j = 0; j < n; j++) {
+			long	row = i + j;
+
+			if (row % 5000 < 30)
+				sprintf(args[j], "%ld:U", TEST_START + row * STEP);
+			else
+				sprintf(args[j], "%ld:%.3f",
+					TEST_START + row * STEP,
+					50 + 40 * sin(row * 2 * M_PI / 1440)
+					+ rnd(1000) / 100.0);
+			argv[j] = args[j];
+		}
+		if (rrd_update_r(file, NULL, (int) n, argv) != 0)
+			fail("rrd_update_r", __LINE__);
+	}
+}
+
+static double run(const char *expr, long rows)
+{
+	char		start[32], end[32], maxrows[32], def[128], cdef[128];
+	const char	*argv[] = {
+		"xport", "--start", start, "--end", end, "--step", "60",
+		"--maxrows", maxrows, def, cdef, "XPORT:x"
+	};
+	time_t		x_start, x_end;
+	unsigned long	step, col_cnt, i;
+	char		**legend_v;
+	rrd_value_t	*data;
+	double		t;
+	int		xsize;
+
+	sprintf(start, "%ld", (long) TEST_START + HISTORY * STEP);
+	sprintf(end, "%ld", (long) TEST_START + (HISTORY + rows) * STEP);
+	sprintf(maxrows, "%ld", rows + 1);
+	sprintf(def, "DEF:a=%s:a:AVERAGE", file);
+	sprintf(cdef, "CDEF:x=%s", expr);
+
+	/* with xsize the rows only come back in data */
+	t = now();
+	if (rrd_xport(sizeof(argv) / sizeof(argv[0]), argv, &xsize, &x_start,
+		      &x_end, &step, &col_cnt, &legend_v, &data) != 0)
+		fail("rrd_xport", __LINE__);
+	t = now() - t;
+	if ((x_end - x_start) / (long) step < rows)
+		fail("xport returned too few rows", __LINE__);
+
+	for (i = 0; i < col_cnt; i++)
+		free(legend_v[i]);
+	free(legend_v);
+	free(data);
+	return t;
+}
+
+int main(int argc, char **argv)
+{
+	long		rows = argc > 1 ? atol(argv[1]) : 100000;
+	int		runs = argc > 2 ? atoi(argv[2]) : 3;
+	double		best, t;
+	size_t		i;
+	int		r;
+
+	if (rows < 10 || runs < 1) {
+		fprintf(stderr, "usage: %s [rows [runs]]\n", argv[0]);
+		return 1;
+	}
+	fill(rows);
+	printf("xport of %ld one minute rows, best of %d runs\n", rows, runs);
+	for (i = 0; i < sizeof(exprs) / sizeof(exprs[0]); i++) {
+		best = 0;
+		for (r = 0; r < runs; r++) {
+			t = run(exprs[i], rows);
+			if (r == 0 || t < best)
+				best = t;
+		}
+		printf("  %-32s %.3f s\n", exprs[i], best);
+	}
+	return 0;
+}
@@ -0,0 +1,113 @@
+/*
+ * Time rrd_update_r on a wide rrd. Not run by make check; build it with
+ * "make bench-update" and run it by hand:
+ *
+ *   ./bench-update [ds_cnt [rra_cnt [samples [per_call [gap]]]]]
+ *
+ * The defaults are 100 DS, 10 RRAs, 20000 samples, 10 samples per call
+ * and a sample every step. The DS alternate between GAUGE and COUNTER,
+ * the RRAs go through AVERAGE, MIN, MAX and LAST with growing
+ * consolidation steps. With a gap of more than one step every sample
+ * catches up on as many rows, which is where a build with
+ * --disable-mmap spends its time writing.
+ */
+#include "test_helpers.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+static const char *file = "bench-update.rrd";
+
+static double now(void)
+{
+	struct timeval	tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+	static const char *cf[] = { "AVERAGE", "MIN", "MAX", "LAST" };
+	static const int pdp_cnt[] = { 1, 5, 30, 120, 1440 };
+	int		ds_cnt = argc > 1 ? atoi(argv[1]) : 100;
+	int		rra_cnt = argc > 2 ? atoi(argv[2]) : 10;
+	int		samples = argc > 3 ? atoi(argv[3]) : 20000;
+	int		per_call = argc > 4 ? atoi(argv[4]) : 10;
+	int		gap = argc > 5 ? atoi(argv[5]) : 1;
+	const char	**create_argv;
+	const char	**update_argv;
+	char		*args, *p;
+	int		line = 24 + ds_cnt * 12;
+	time_t		t = TEST_START;
+	double		start, elapsed;
+	int		i, j, n;
+
+	if (ds_cnt < 1 || rra_cnt < 1 || samples < 1 || per_call < 1
+	    || gap < 1) {
+		fprintf(stderr, "usage: %s [ds_cnt [rra_cnt [samples "
+			"[per_call [gap]]]]]\n", argv[0]);
+		return 1;
+	}
+	create_argv = malloc((ds_cnt + rra_cnt) * sizeof(char *));
+	update_argv = malloc(per_call * sizeof(char *));
+	args = malloc((size_t) samples * line);
+	if (create_argv == NULL || update_argv == NULL || args == NULL)
+		fail("malloc", __LINE__);
+
+	for (i = 0; i < ds_cnt; i++) {
+		char	*def = malloc(48);
+
+		if (def == NULL)
+			fail("malloc", __LINE__);
+		sprintf(def, "DS:ds%d:%s:%d:U:U", i,
+			i % 2 ? "COUNTER" : "GAUGE", 120 * gap);
+		create_argv[i] = def;
+	}
+	for (i = 0; i < rra_cnt; i++) {
+		char	*def = malloc(48);
+
+		if (def == NULL)
+			fail("malloc", __LINE__);
+		sprintf(def, "RRA:%s:0.5:%d:%d", cf[i % 4],
+			pdp_cnt[i % 5], 2000);
+		create_argv[ds_cnt + i] = def;
+	}
+	remove(file);
+	if (rrd_create_r2(file, 60, t, 0, NULL, NULL, ds_cnt + rra_cnt,
+			  create_argv) != 0)
+		fail("rrd_create_r2", __LINE__);
+
+	/* the update strings are made up front so only rrd_update_r is
+	 * timed */
+	for (i = 0; i < samples; i++) {
+		t += 60 * gap;
+		p = args + (size_t) i * line;
+		p += sprintf(p, "%ld", (long) t);
+		for (j = 0; j < ds_cnt; j++)
+			p += sprintf(p, ":%d", j % 2 ? i * (j + 1) : (i + j) % 97);
+	}
+
+	start = now();
+	for (i = 0; i < samples; i += n) {
+		n = samples - i < per_call ? samples - i : per_call;
+		for (j = 0; j < n; j++)
+			update_argv[j] = args + (size_t) (i + j) * line;
+		if (rrd_update_r(file, NULL, n, update_argv) != 0)
+			fail("rrd_update_r", __LINE__);
+	}
+	elapsed = now() - start;
+
+	printf("%d samples of %d DS into %d RRAs, %d per call, %d steps "
+	       "apart: %.3f s, %.1f us per sample\n", samples, ds_cnt,
+	       rra_cnt, per_call, gap, elapsed, elapsed * 1e6 / samples);
+
+	for (i = 0; i < ds_cnt + rra_cnt; i++)
+		free((char *) create_argv[i]);
+	free(create_argv);
+	free(update_argv);
+	free(args);
+	return 0;
+}
@@ -0,0 +1,112 @@
+/*
+ * Fetch from a bunch of rrds through rrd_fetch_many, with several jobs per
+ * file asking for different consolidation functions and ranges, and check
+ * that every job gets exactly what rrd_fetch_r returns for it. A job for a
+ * file that does not exist must fail on its own and leave the others be.
+ */
+#include "test_helpers.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FILES		16
+#define UPDATES		600
+#define JOBS_PER_FILE	4
+#define JOBS		(FILES * JOBS_PER_FILE + 1)
+
+static const char *cfs[JOBS_PER_FILE] = { "AVERAGE", "MAX", "LAST", "AVERAGE" };
+
+int main(void)
+{
+	static char	names[FILES][40];
+	static char	args[UPDATES][40];
+	static const char *argv[UPDATES];
+	rrd_fetch_job_t	jobs[JOBS];
+	time_t		start, end;
+	unsigned long	step, ds_cnt, rows, i, k;
+	char		**ds_namv;
+	rrd_value_t	*data;
+	int		j;
+
+	for (i = 0; i < FILES; i++) {
+		sprintf(names[i], "fetch-many-%lu.rrd", i);
+		create_file(names[i]);
+		for (j = 0; j < UPDATES; j++) {
+			sprintf(args[j], "%d:%lu:%lu", TEST_START + j * 60,
+				(i * 7 + j * 3) % 101, i * 1000 + j * j);
+			argv[j] = args[j];
+		}
+		if (rrd_update_r(names[i], NULL, UPDATES, argv) != 0)
+			fail("rrd_update_r", __LINE__);
+	}
+
+	/* the jobs of one file interleaved with the others */
+	memset(jobs, 0, sizeof(jobs));
+	k = 0;
+	for (j = 0; j < JOBS_PER_FILE; j++) {
+		for (i = 0; i < FILES; i++) {
+			jobs[k].filename = names[(i * 5) % FILES];
+			jobs[k].cf = cfs[j];
+			jobs[k].start = TEST_START + j * 3000;
+			jobs[k].end = jobs[k].start + (j + 1) * 6000;
+			jobs[k].step = j == 3 ? 300 : 60;
+			k++;
+		}
+	}
+	jobs[k].filename = "fetch-many-missing.rrd";
+	jobs[k].cf = "AVERAGE";
+	jobs[k].start = TEST_START;
+	jobs[k].end = TEST_START + 6000;
+	jobs[k].step = 60;
+	remove(jobs[k].filename);
+
+	if (rrd_fetch_many(jobs, JOBS, 8, 2) != -1)
+		fail("rrd_fetch_many did not report the missing file",
+		     __LINE__);
+	for (k = 0; k < JOBS - 1; k++) {
+		if (jobs[k].rc != 0 || jobs[k].error != NULL) {
+			fprintf(stderr, "job %lu: %s\n", k, jobs[k].error);
+			fail("rrd_fetch_many", __LINE__);
+		}
+		start = TEST_START + (k / FILES) * 3000;
+		end = start + (k / FILES + 1) * 6000;
+		step = k / FILES == 3 ? 300 : 60;
+		if (rrd_fetch_r(jobs[k].filename, jobs[k].cf, &start, &end,
+				&step, &ds_cnt, &ds_namv, &data) != 0)
+			fail("rrd_fetch_r", __LINE__);
+		if (start != jobs[k].start || end != jobs[k].end
+		    || step != jobs[k].step || ds_cnt != jobs[k].ds_cnt) {
+			fprintf(stderr, "job %lu: different time range\n", k);
+			return 1;
+		}
+		for (i = 0; i < ds_cnt; i++) {
+			if (strcmp(ds_namv[i], jobs[k].ds_namv[i]) != 0) {
+				fprintf(stderr, "job %lu: ds %lu is %s\n", k,
+					i, jobs[k].ds_namv[i]);
+				return 1;
+			}
+			rrd_freemem(ds_namv[i]);
+			rrd_freemem(jobs[k].ds_namv[i]);
+		}
+		rows = (end - start) / step;
+		for (i = 0; i < rows * ds_cnt; i++) {
+			if (!same_value(data[i], jobs[k].data[i])) {
+				fprintf(stderr, "job %lu: value %lu is %f, "
+					"not %f\n", k, i, jobs[k].data[i],
+					data[i]);
+				return 1;
+			}
+		}
+		rrd_freemem(ds_namv);
+		rrd_freemem(data);
+		rrd_freemem(jobs[k].ds_namv);
+		rrd_freemem(jobs[k].data);
+	}
+	if (jobs[k].rc == 0 || jobs[k].error == NULL
+	    || jobs[k].ds_namv != NULL || jobs[k].data != NULL
+	    || strstr(jobs[k].error, "fetch-many-missing.rrd") == NULL)
+		fail("result of the missing file", __LINE__);
+	rrd_freemem(jobs[k].error);
+	return 0;
+}
@@ -0,0 +1,196 @@
+/*
+ * Check that rrd_fetch_view_r and rrd_fetch_cursor_r hand out the rows
+ * rrd_fetch_r returns for time frames before, across and after the data
+ * of wrapped RRAs, for all data layouts. The cursor has to get the time
+ * stamps right too, whatever the size of the chunks, going forward and
+ * backward.
+ */
+#include "test_helpers.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define UPDATES	180
+
+static const char *files[] = {
+	"fetch-view.rrd", "fetch-view-col.rrd", "fetch-view-z.rrd",
+	"fetch-view-sparse.rrd"
+};
+static const int layouts[] = {
+	RRD_LAYOUT_ROW, RRD_LAYOUT_COLUMN, RRD_LAYOUT_COMPRESSED,
+	RRD_LAYOUT_ROW | RRD_CREATE_SPARSE
+};
+
+static const char *create_argv[] = {
+	"DS:a:GAUGE:120:U:U",
+	"DS:b:GAUGE:120:U:U",
+	"RRA:AVERAGE:0.5:1:50",
+	"RRA:MAX:0.5:4:30",
+	"RRA:LAST:0.5:1:200",
+	"RRA:AVERAGE:0.5:10:20",
+};
+
+static const char *cfs[] = { "AVERAGE", "MAX", "LAST", "MIN" };
+
+/* a time frame asked for and what rrd_fetch_r made of it */
+struct frame {
+	const char	*cf;
+	time_t		start, end;
+	unsigned long	step;
+	time_t		fetch_start, fetch_end;
+	unsigned long	fetch_step, ds_cnt, rows;
+	char		**ds_namv;
+	rrd_value_t	*data;
+};
+
+static void check_view(const char *file, const struct frame *f)
+{
+	time_t		start = f->start, end = f->end;
+	unsigned long	step = f->step, row, ds, r;
+	rrd_fetch_view_t view;
+	rrd_value_t	v;
+
+	if (rrd_fetch_view_r(file, f->cf, &start, &end, &step, &view) != 0)
+		fail("rrd_fetch_view_r", __LINE__);
+	if (start != f->fetch_start || end != f->fetch_end
+	    || step != f->fetch_step || view.ds_cnt != f->ds_cnt
+	    || view.pad_before + view.seg_rows[0] + view.seg_rows[1]
+	    + view.pad_after != f->rows)
+		fail("view and fetch disagree on the shape", __LINE__);
+	for (ds = 0; ds < f->ds_cnt; ds++)
+		if (strcmp(view.ds_namv[ds], f->ds_namv[ds]) != 0)
+			fail("view and fetch disagree on the DS names",
+			     __LINE__);
+
+	for (row = 0; row < f->rows; row++) {
+		for (ds = 0; ds < f->ds_cnt; ds++) {
+			r = row - view.pad_before;
+			if (row < view.pad_before)
+				v = NAN;
+			else if (r < view.seg_rows[0])
+				v = view.seg[0][r * view.row_stride
+						+ ds * view.ds_stride];
+			else if (r < view.seg_rows[0] + view.seg_rows[1])
+				v = view.seg[1][(r - view.seg_rows[0])
+						* view.row_stride
+						+ ds * view.ds_stride];
+			else
+				v = NAN;
+			if (!same_value(v, f->data[row * f->ds_cnt + ds]))
+				fail("view and fetch disagree on the data",
+				     __LINE__);
+		}
+	}
+	view.release(&view);
+}
+
+static void check_cursor(const char *file, const struct frame *f,
+			 unsigned long chunk, int reverse)
+{
+	time_t		start = f->start, end = f->end, first;
+	unsigned long	step = f->step, ds_cnt, seen, row, ds, i;
+	char		**ds_namv;
+	rrd_value_t	*buf;
+	rrd_fetch_cursor_t *cursor;
+	long		n;
+
+	cursor = rrd_fetch_cursor_r(file, f->cf, &start, &end, &step,
+				    reverse ? RRD_FETCH_REVERSE : 0,
+				    &ds_cnt, &ds_namv);
+	if (cursor == NULL)
+		fail("rrd_fetch_cursor_r", __LINE__);
+	if (start != f->fetch_start || end != f->fetch_end
+	    || step != f->fetch_step || ds_cnt != f->ds_cnt)
+		fail("cursor and fetch disagree on the shape", __LINE__);
+	for (ds = 0; ds < ds_cnt; ds++)
+		if (strcmp(ds_namv[ds], f->ds_namv[ds]) != 0)
+			fail("cursor and fetch disagree on the DS names",
+			     __LINE__);
+
+	buf = (rrd_value_t *) malloc(chunk * ds_cnt * sizeof(rrd_value_t));
+	if (buf == NULL)
+		fail("malloc", __LINE__);
+	seen = 0;
+	while ((n = rrd_fetch_cursor_next(cursor, chunk, &first, buf)) > 0) {
+		if ((unsigned long) n > chunk || seen + n > f->rows)
+			fail("cursor hands out too many rows", __LINE__);
+		for (i = 0; i < (unsigned long) n; i++) {
+			row = reverse ? f->rows - 1 - seen - i : seen + i;
+			if (first + (reverse ? -(long) i : (long) i)
+			    * (long) step
+			    != start + (time_t) ((row + 1) * step))
+				fail("cursor has the wrong time stamp",
+				     __LINE__);
+			for (ds = 0; ds < ds_cnt; ds++)
+				if (!same_value(buf[i * ds_cnt + ds],
+						f->data[row * ds_cnt + ds]))
+					fail("cursor and fetch disagree "
+					     "on the data", __LINE__);
+		}
+		seen += n;
+	}
+	if (n != 0 || seen != f->rows)
+		fail("cursor misses rows", __LINE__);
+
+	rrd_fetch_cursor_close(cursor);
+	free(buf);
+	for (ds = 0; ds < ds_cnt; ds++)
+		free(ds_namv[ds]);
+	free(ds_namv);
+}
+
+static void check(const char *file, int layout)
+{
+	static char	args[UPDATES][64];
+	const char	*argv[UPDATES];
+	struct frame	f;
+	unsigned long	ds, i, k;
+
+	test_what = file;
+	rnd_seed(42);
+	if (rrd_create_r3(file, 60, TEST_START, 0, layout, NULL, NULL,
+			  sizeof(create_argv) / sizeof(create_argv[0]),
+			  create_argv) != 0)
+		fail("rrd_create_r3", __LINE__);
+	for (i = 0; i < UPDATES; i++) {
+		sprintf(args[i], "%lu:%lu:%lu", TEST_START + (i + 1) * 60, i,
+			rnd(1000));
+		argv[i] = args[i];
+	}
+	if (rrd_update_r(file, NULL, UPDATES, argv) != 0)
+		fail("rrd_update_r", __LINE__);
+
+	for (k = 0; k < 500; k++) {
+		f.cf = cfs[rnd(4)];
+		f.start = TEST_START + ((long) rnd(300) - 100) * 60 + rnd(60);
+		f.end = f.start + rnd(250) * 60 + rnd(120);
+		f.step = 1 + rnd(5) * 60;
+		f.fetch_start = f.start;
+		f.fetch_end = f.end;
+		f.fetch_step = f.step;
+		if (rrd_fetch_r(file, f.cf, &f.fetch_start, &f.fetch_end,
+				&f.fetch_step, &f.ds_cnt, &f.ds_namv,
+				&f.data) != 0)
+			fail("rrd_fetch_r", __LINE__);
+		f.rows = (f.fetch_end - f.fetch_start) / f.fetch_step;
+
+		check_view(file, &f);
+		check_cursor(file, &f, 1 + rnd(70), rnd(2));
+
+		for (ds = 0; ds < f.ds_cnt; ds++)
+			free(f.ds_namv[ds]);
+		free(f.ds_namv);
+		free(f.data);
+	}
+}
+
+int main(void)
+{
+	unsigned long i;
+
+	for (i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+		check(files[i], layouts[i]);
+	return 0;
+}
@@ -0,0 +1,136 @@
+/*
+ * Check that the graph cache hands out the same image and prints as a
+ * fresh graph, that it notices a change of the RRD, that it keeps to its
+ * memory cap and that a cap of 0 empties it.
+ */
+#include "test_helpers.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <utime.h>
+
+#define RRD_FILE	"graph-cache.rrd"
+
+static const char *create_argv[] = {
+	"DS:a:GAUGE:120:U:U",
+	"RRA:AVERAGE:0.5:1:200",
+};
+
+static const char *graph_argv[] = {
+	"graphv", "-", "--start", "1300000000", "--end", "1300007200",
+	"--width", NULL, "DEF:a=" RRD_FILE ":a:AVERAGE", "LINE1:a#ff0000",
+	"PRINT:a:AVERAGE:%lf"
+};
+#define GRAPH_ARGC	(sizeof(graph_argv) / sizeof(graph_argv[0]))
+
+static rrd_info_t *find(rrd_info_t *info, const char *key)
+{
+	for (; info != NULL; info = info->next)
+		if (strcmp(info->key, key) == 0)
+			return info;
+	fail(key, __LINE__);
+	return NULL;
+}
+
+static unsigned long stat_of(const char *key)
+{
+	rrd_info_t *info = rrd_graph_cache_info();
+	unsigned long cnt = find(info, key)->value.u_cnt;
+
+	rrd_info_free(info);
+	return cnt;
+}
+
+static void update(unsigned long from, unsigned long to, time_t mtime)
+{
+	char		args[120][32];
+	const char	*argv[120];
+	struct utimbuf	times;
+	unsigned long	i;
+
+	for (i = from; i < to; i++) {
+		sprintf(args[i - from], "%lu:%lu", TEST_START + (i + 1) * 60, i % 17);
+		argv[i - from] = args[i - from];
+	}
+	if (rrd_update_r(RRD_FILE, NULL, (int) (to - from), argv) != 0)
+		fail("rrd_update_r", __LINE__);
+	/* the cache does not trust a stamp of the current second */
+	times.actime = times.modtime = mtime;
+	if (utime(RRD_FILE, &times) != 0)
+		fail("utime", __LINE__);
+}
+
+/* the option parser shuffles argv, so every graph gets a fresh copy */
+static rrd_info_t *graph(const char *width)
+{
+	const char	*argv[GRAPH_ARGC];
+	rrd_info_t	*info;
+
+	memcpy(argv, graph_argv, sizeof(argv));
+	argv[7] = width;
+	if ((info = rrd_graph_v(GRAPH_ARGC, argv)) == NULL)
+		fail("rrd_graph_v", __LINE__);
+	return info;
+}
+
+static int same(rrd_info_t *a, rrd_info_t *b)
+{
+	rrd_info_t *ia = find(a, "image"), *ib = find(b, "image");
+
+	return ia->value.u_blo.size == ib->value.u_blo.size
+		&& memcmp(ia->value.u_blo.ptr, ib->value.u_blo.ptr,
+			  ia->value.u_blo.size) == 0
+		&& strcmp(find(a, "print[0]")->value.u_str,
+			  find(b, "print[0]")->value.u_str) == 0;
+}
+
+int main(void)
+{
+	rrd_info_t	*first, *second, *third;
+	time_t		now = time(NULL);
+	unsigned long	bytes;
+
+	/* the stamps have to come from the file itself */
+	unsetenv("RRDCACHED_ADDRESS");
+
+	if (rrd_create_r(RRD_FILE, 60, TEST_START, 2, create_argv) != 0)
+		fail("rrd_create_r", __LINE__);
+	update(0, 60, now - 100);
+
+	if (rrd_graph_cache_set(1 << 24) != 0)
+		fail("rrd_graph_cache_set", __LINE__);
+	first = graph("200");
+	second = graph("200");
+	if (stat_of("hits") != 1 || stat_of("misses") != 1
+	    || stat_of("entries") != 1)
+		fail("second graph not taken from the cache", __LINE__);
+	if (!same(first, second))
+		fail("cached graph differs", __LINE__);
+
+	/* new data has to show */
+	update(60, 120, now - 50);
+	third = graph("200");
+	if (stat_of("hits") != 1 || stat_of("misses") != 2
+	    || stat_of("entries") != 1)
+		fail("changed RRD not noticed", __LINE__);
+	if (same(first, third))
+		fail("graph of the changed RRD did not change", __LINE__);
+	rrd_info_free(first);
+	rrd_info_free(second);
+	rrd_info_free(third);
+
+	/* a cap for one graph only keeps the last one */
+	bytes = stat_of("bytes");
+	rrd_graph_cache_set(bytes + bytes / 2);
+	rrd_info_free(graph("300"));
+	if (stat_of("evictions") != 1 || stat_of("entries") != 1
+	    || stat_of("bytes") > bytes + bytes / 2)
+		fail("cap not kept", __LINE__);
+
+	rrd_graph_cache_set(0);
+	if (stat_of("entries") != 0 || stat_of("bytes") != 0)
+		fail("cache not emptied", __LINE__);
+	return 0;
+}
@@ -0,0 +1,100 @@
+#include "test_helpers.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+const char *test_create_argv[] = {
+	"DS:g:GAUGE:300:U:U",
+	"DS:c:COUNTER:300:U:U",
+	"RRA:AVERAGE:0.5:1:500",
+	"RRA:MAX:0.5:5:200",
+	"RRA:LAST:0.5:12:100",
+};
+const int test_create_argc =
+	sizeof(test_create_argv) / sizeof(test_create_argv[0]);
+
+const char *test_what = NULL;
+
+static unsigned long seed = 42;
+
+void test_fail(const char *file, int line, const char *msg)
+{
+	fprintf(stderr, "%s:%u %s%s%s: %s\n", file, line,
+		test_what ? test_what : "", test_what ? ": " : "", msg,
+		rrd_test_error() ? rrd_get_error() : "");
+	exit(1);
+}
+
+void rnd_seed(unsigned long s)
+{
+	seed = s;
+}
+
+unsigned long rnd(unsigned long range)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) % range;
+}
+
+int same_value(rrd_value_t a, rrd_value_t b)
+{
+	return isnan(a) ? isnan(b) : a == b;
+}
+
+char *read_file(const char *name, long *len)
+{
+	FILE	*f = fopen(name, "rb");
+	char	*buf;
+
+	if (f == NULL)
+		return NULL;
+	fseek(f, 0, SEEK_END);
+	*len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	buf = malloc(*len);
+	if (buf == NULL || fread(buf, 1, *len, f) != (size_t) *len) {
+		free(buf);
+		fclose(f);
+		return NULL;
+	}
+	fclose(f);
+	return buf;
+}
+
+void copy_file(const char *from, const char *to)
+{
+	char	*buf;
+	long	len;
+	FILE	*f;
+
+	buf = read_file(from, &len);
+	if (buf == NULL || (f = fopen(to, "wb")) == NULL
+	    || fwrite(buf, 1, len, f) != (size_t) len || fclose(f) != 0)
+		fail("copying the rrd file", __LINE__);
+	free(buf);
+}
+
+int same_file(const char *a, const char *b)
+{
+	char	*a_buf, *b_buf;
+	long	a_len, b_len;
+	int	same;
+
+	a_buf = read_file(a, &a_len);
+	b_buf = read_file(b, &b_len);
+	if (a_buf == NULL || b_buf == NULL)
+		fail("reading back the rrd files", __LINE__);
+	same = a_len == b_len && memcmp(a_buf, b_buf, a_len) == 0;
+	free(a_buf);
+	free(b_buf);
+	return same;
+}
+
+void create_file(const char *name)
+{
+	if (rrd_create_r2(name, 60, TEST_START - 10, 0, NULL, NULL,
+			  test_create_argc, test_create_argv) != 0)
+		fail("rrd_create_r2", __LINE__);
+}
@@ -0,0 +1,41 @@
+/*
+ * Helpers the test programs share.
+ */
+#ifndef TEST_HELPERS_H
+#define TEST_HELPERS_H
+
+#include <rrd.h>
+
+/* an rrd with a GAUGE and a COUNTER DS and three RRAs of different
+ * resolutions, for tests that need a few files of some size */
+#define TEST_START	1300000000
+extern const char *test_create_argv[];
+extern const int test_create_argc;
+
+/* what the program is checking right now, printed with a failure */
+extern const char *test_what;
+
+/* print the message, the position and the rrd error, then exit */
+void test_fail(const char *file, int line, const char *msg);
+#define fail(msg, line)	test_fail(__FILE__, (line), (msg))
+
+/* a small pseudo random generator, the same on every platform */
+void rnd_seed(unsigned long seed);
+unsigned long rnd(unsigned long range);
+
+/* equal values, with NaN equal to NaN */
+int same_value(rrd_value_t a, rrd_value_t b);
+
+/* read a whole file into a malloced buffer, NULL if that fails */
+char *read_file(const char *name, long *len);
+/* copy a file or fail */
+void copy_file(const char *from, const char *to);
+/* whether two files are byte for byte identical; fails if they can not
+ * be read */
+int same_file(const char *a, const char *b);
+
+/* create test_create_argv as name with a step of 60 s, starting just
+ * before TEST_START, or fail */
+void create_file(const char *name);
+
+#endif
@@ -0,0 +1,228 @@
+/*
+ * Feed the same readings to one rrd through rrd_update_r and to another
+ * one through rrd_update_bulk_r and check that both files end up
+ * byte for byte identical. With Holt-Winters RRAs both get the readings
+ * in batches of the same size since the smoothing runs at most once per
+ * call; without them the bulk path queues the PDP steps and consolidates
+ * them an RRA at a time, which a single call with all samples and a file
+ * with enough DS to overflow the queue exercise best.
+ */
+#include "test_helpers.h"
+#include <rrd_strtod.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SAMPLES		6000
+#define TYPES		6
+
+static const char *file_a = "update-bulk-a.rrd";
+static const char *file_b = "update-bulk-b.rrd";
+
+/* one group of DS, %d is the number of the group */
+static const char *ds_fmt[TYPES + 1] = {
+	"DS:g%d:GAUGE:300:U:U",
+	"DS:c%d:COUNTER:300:U:U",
+	"DS:d%d:DERIVE:300:U:U",
+	"DS:a%d:ABSOLUTE:300:U:1000",
+	"DS:dc%d:DCOUNTER:300:U:U",
+	"DS:dd%d:DDERIVE:300:U:U",
+	"DS:x%d:COMPUTE:g%d,2,*",
+};
+
+static const char *rra_hw[] = {
+	"RRA:AVERAGE:0.5:1:500",
+	"RRA:MIN:0.5:5:200",
+	"RRA:MAX:0.5:5:200",
+	"RRA:LAST:0.5:12:100",
+	"RRA:HWPREDICT:288:0.1:0.0035:144",
+	NULL
+};
+
+/* a short ring wraps around all the time and gaps overrun it */
+static const char *rra_plain[] = {
+	"RRA:AVERAGE:0.5:1:500",
+	"RRA:MIN:0.5:5:200",
+	"RRA:MAX:0.5:5:200",
+	"RRA:LAST:0.5:12:100",
+	"RRA:AVERAGE:0.5:1:7",
+	"RRA:MAX:0:3:4",
+	NULL
+};
+
+struct setup {
+	const char	*name;
+	int		layout;
+	int		groups;
+	const char	**rra;
+	int		per_call;
+};
+
+static const struct setup setups[] = {
+	{ "Holt-Winters", RRD_LAYOUT_ROW, 1, rra_hw, 500 },
+	{ "plain RRAs", RRD_LAYOUT_ROW, 1, rra_plain, SAMPLES },
+	{ "column layout", RRD_LAYOUT_COLUMN, 1, rra_plain, 700 },
+	{ "many DS", RRD_LAYOUT_ROW, 20, rra_plain, SAMPLES },
+};
+
+static void run(const struct setup *s)
+{
+	int		cols = s->groups * TYPES;
+	/* a single group gets the columns in a different order than the DS */
+	static const int shuffle[TYPES] = { 1, 0, 5, 2, 3, 4 };
+	static const char *names[TYPES] = { "g", "c", "d", "a", "dc", "dd" };
+	int		line = 24 + cols * 24;
+	char		*args = malloc((size_t) SAMPLES * line);
+	time_t		*stamps = malloc(SAMPLES * sizeof(time_t));
+	rrd_value_t	*columns = malloc((size_t) cols * SAMPLES
+					  * sizeof(rrd_value_t));
+	const char	**argv = malloc(SAMPLES * sizeof(char *));
+	const rrd_value_t **values = malloc(cols * sizeof(rrd_value_t *));
+	const char	**create_argv = malloc((s->groups * (TYPES + 1) + 8)
+					       * sizeof(char *));
+	unsigned long	*c = malloc(s->groups * sizeof(unsigned long));
+	long		*d = malloc(s->groups * 2 * sizeof(long));
+	long		*dc = d + s->groups;
+	char		*tmplt = malloc(cols * 8);
+	char		reading[40], *p;
+	time_t		t = TEST_START;
+	int		create_argc = 0;
+	int		i, j, k, n, col;
+
+	test_what = s->name;
+	if (args == NULL || stamps == NULL || columns == NULL || argv == NULL
+	    || values == NULL || create_argv == NULL || c == NULL || d == NULL
+	    || tmplt == NULL)
+		fail("malloc", __LINE__);
+
+	tmplt[0] = '\0';
+	for (k = 0; k < s->groups; k++) {
+		for (j = 0; j <= TYPES; j++) {
+			char	*def = malloc(40);
+
+			if (def == NULL)
+				fail("malloc", __LINE__);
+			sprintf(def, ds_fmt[j], k, k);
+			create_argv[create_argc++] = def;
+		}
+		for (j = 0; j < TYPES; j++)
+			sprintf(tmplt + strlen(tmplt), "%s%s%d",
+				tmplt[0] ? ":" : "",
+				names[s->groups == 1 ? shuffle[j] : j], k);
+		c[k] = 4294960000UL;
+		d[k] = 1000;
+		dc[k] = 0;
+	}
+	for (j = 0; s->rra[j] != NULL; j++)
+		create_argv[create_argc++] = s->rra[j];
+
+	for (i = 0; i < SAMPLES; i++) {
+		/* mostly regular updates, sometimes beyond the heartbeat */
+		t += rnd(20) == 0 ? 301 + rnd(2000) : 1 + rnd(150);
+		stamps[i] = t;
+		p = args + (size_t) i * line;
+		p += sprintf(p, "%ld", (long) t);
+		for (col = 0; col < cols; col++) {
+			k = col / TYPES;
+			j = s->groups == 1 ? shuffle[col] : col % TYPES;
+
+			/* last_ds gets a reading in plain decimal notation
+			 * on the bulk path, so no trailing zeros here */
+			switch (j) {
+			case 0:
+				if (rnd(10) == 0)
+					sprintf(reading, "%lu000000", rnd(1000));
+				else
+					sprintf(reading, "%lu.%lu", rnd(1000),
+						1 + rnd(9));
+				break;
+			case 1:
+				c[k] += rnd(5000);
+				sprintf(reading, "%lu", c[k] & 0xffffffffUL);
+				break;
+			case 2:
+				d[k] += (long) rnd(2000) - 1000;
+				sprintf(reading, "%ld", d[k]);
+				break;
+			case 3:
+				sprintf(reading, "%lu", rnd(100000));
+				break;
+			case 4:
+				dc[k] += rnd(10) == 0 ? -dc[k] : (long) rnd(1000);
+				sprintf(reading, "%ld.%lu", dc[k], 1 + rnd(9));
+				break;
+			default:
+				sprintf(reading, "%.10g", (double) d[k] / 7);
+				break;
+			}
+			if (rnd(30) == 0)
+				strcpy(reading, "U");
+			p += sprintf(p, ":%s", reading);
+
+			if (strcmp(reading, "U") == 0)
+				columns[(size_t) col * SAMPLES + i] = DNAN;
+			else if (rrd_strtodbl(reading, NULL,
+					      &columns[(size_t) col * SAMPLES + i],
+					      NULL) != 2)
+				fail("rrd_strtodbl", __LINE__);
+		}
+	}
+
+	/* copy the file instead of creating it twice, the seasonal smoothing
+	 * index is picked at random on create */
+	if (rrd_create_r3(file_a, 60, TEST_START - 10, 0, s->layout, NULL,
+			  NULL, create_argc, create_argv) != 0)
+		fail("rrd_create_r3", __LINE__);
+	copy_file(file_a, file_b);
+
+	for (i = 0; i < SAMPLES; i += n) {
+		n = SAMPLES - i < s->per_call ? SAMPLES - i : s->per_call;
+		for (j = 0; j < n; j++)
+			argv[j] = args + (size_t) (i + j) * line;
+		if (rrd_update_r(file_a, tmplt, n, argv) != 0)
+			fail("rrd_update_r", __LINE__);
+	}
+
+	for (i = 0; i < SAMPLES; i += n) {
+		n = SAMPLES - i < s->per_call ? SAMPLES - i : s->per_call;
+		for (j = 0; j < cols; j++)
+			values[j] = columns + (size_t) j * SAMPLES + i;
+		if (rrd_update_bulk_r(file_b, tmplt, 0, n, stamps + i,
+				      values) != 0)
+			fail("rrd_update_bulk_r", __LINE__);
+	}
+
+	/* updates in the past must be rejected just the same */
+	for (j = 0; j < cols; j++)
+		values[j] = columns + (size_t) j * SAMPLES;
+	if (rrd_update_bulk_r(file_b, tmplt, 0, 1, stamps, values) == 0)
+		fail("rrd_update_bulk_r accepted an old time stamp",
+		     __LINE__);
+	rrd_clear_error();
+
+	if (!same_file(file_a, file_b))
+		fail("rrd_update_bulk_r and rrd_update_r results differ",
+		     __LINE__);
+
+	for (j = 0; j < s->groups * (TYPES + 1); j++)
+		free((char *) create_argv[j]);
+	free(create_argv);
+	free(args);
+	free(stamps);
+	free(columns);
+	free(argv);
+	free(values);
+	free(c);
+	free(d);
+	free(tmplt);
+}
+
+int main(void)
+{
+	size_t	i;
+
+	for (i = 0; i < sizeof(setups) / sizeof(setups[0]); i++)
+		run(&setups[i]);
+	return 0;
+}
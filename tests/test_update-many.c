@@ -0,0 +1,81 @@
+/*
+ * Update a bunch of rrds through rrd_update_many, with several jobs per
+ * file, and check that every file ends up byte for byte identical to a
+ * copy of it that got the same readings through rrd_update_r. A job for a
+ * file that does not exist must fail on its own and leave the others be.
+ */
+#include "test_helpers.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FILES		24
+#define JOBS_PER_FILE	5
+#define PER_JOB		40
+#define JOBS		(FILES * JOBS_PER_FILE + 1)
+
+int main(void)
+{
+	static char	names[FILES][2][40];
+	static char	args[FILES][JOBS_PER_FILE * PER_JOB][40];
+	static const char *argv[FILES][JOBS_PER_FILE * PER_JOB];
+	rrd_update_job_t jobs[JOBS];
+	rrd_update_status_t status[JOBS];
+	int		i, j, k;
+
+	for (i = 0; i < FILES; i++) {
+		sprintf(names[i][0], "update-many-%d.rrd", i);
+		sprintf(names[i][1], "update-many-%d-ref.rrd", i);
+		create_file(names[i][0]);
+		copy_file(names[i][0], names[i][1]);
+		for (j = 0; j < JOBS_PER_FILE * PER_JOB; j++) {
+			sprintf(args[i][j], "%d:%d:%d", TEST_START + j * 60,
+				(i * 7 + j * 3) % 101, i * 1000 + j * j);
+			argv[i][j] = args[i][j];
+		}
+		if (rrd_update_r(names[i][1], NULL, JOBS_PER_FILE * PER_JOB,
+				 argv[i]) != 0)
+			fail("rrd_update_r", __LINE__);
+	}
+
+	/* the jobs of one file interleaved with the others, in order */
+	k = 0;
+	for (j = 0; j < JOBS_PER_FILE; j++) {
+		for (i = 0; i < FILES; i++) {
+			jobs[k].filename = names[(i * 5) % FILES][0];
+			jobs[k].tmplt = NULL;
+			jobs[k].argc = PER_JOB;
+			jobs[k].argv = argv[(i * 5) % FILES] + j * PER_JOB;
+			k++;
+		}
+	}
+	jobs[k].filename = "update-many-missing.rrd";
+	jobs[k].tmplt = NULL;
+	jobs[k].argc = 1;
+	jobs[k].argv = argv[0];
+	remove(jobs[k].filename);
+
+	if (rrd_update_many(jobs, JOBS, 8, 2, 0, status) != -1)
+		fail("rrd_update_many did not report the missing file",
+		     __LINE__);
+	for (k = 0; k < JOBS - 1; k++) {
+		if (status[k].rc != 0 || status[k].error != NULL) {
+			fprintf(stderr, "job %d: %s\n", k, status[k].error);
+			fail("rrd_update_many", __LINE__);
+		}
+	}
+	if (status[k].rc == 0 || status[k].error == NULL
+	    || strstr(status[k].error, "update-many-missing.rrd") == NULL)
+		fail("status of the missing file", __LINE__);
+	rrd_freemem(status[k].error);
+
+	for (i = 0; i < FILES; i++) {
+		if (!same_file(names[i][0], names[i][1])) {
+			fprintf(stderr, "%s and %s differ\n", names[i][0],
+				names[i][1]);
+			return 1;
+		}
+	}
+	return 0;
+}